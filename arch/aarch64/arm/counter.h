@@ -0,0 +1,28 @@
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <stdint.h>
+
+/* CNTVCT_EL0 / CNTFRQ_EL0, the ARM generic timer virtual count and its
+ * frequency. Both are readable from EL1 without any setup. */
+
+static inline uint64_t read_cntvct(void)
+{
+    uint64_t cnt;
+    asm volatile("isb\n\t"
+                 "mrs %[cnt], cntvct_el0"
+        : [cnt] "=r"(cnt)
+        :
+        : "memory");
+    return cnt;
+}
+
+static inline uint64_t read_cntfrq(void)
+{
+    uint64_t frq;
+    asm volatile("mrs %[frq], cntfrq_el0"
+        : [frq] "=r"(frq));
+    return frq;
+}
+
+#endif /* COUNTER_H */
@@ -8,7 +8,9 @@
 #define SCTLR_EE_LITTLE_ENDIAN (0 << 25)
 #define SCTLR_EOE_LITTLE_ENDIAN (0 << 24)
 #define SCTLR_I_CACHE_DISABLED (0 << 12)
+#define SCTLR_I_CACHE_ENABLED (1 << 12)
 #define SCTLR_D_CACHE_DISABLED (0 << 2)
+#define SCTLR_D_CACHE_ENABLED (1 << 2)
 #define SCTLR_MMU_DISABLED (0 << 0)
 #define SCTLR_MMU_ENABLED (1 << 0)
 
@@ -34,6 +36,8 @@
 
 #define SPSR_MASK_ALL (7 << 6)
 #define SPSR_EL1h (5 << 0)
+#define SPSR_EL0t (0 << 0)
+#define SPSR_MODE_MASK 0xf
 #define SPSR_VALUE (SPSR_MASK_ALL | SPSR_EL1h)
 
 /* CPACR_EL1, Architectural Feature Access Control Register (EL1) Page 2411 of
@@ -45,28 +49,62 @@
 
 #define CPACR_TTA_FPEN_ZEN_ENABLE (CPACR_TTA | CPACR_FPEN(1) | CPACR_ZEN(1))
 
+/* ESR_EL1, Exception Syndrome Register (EL1), see the
+ * AArch64-Reference-Manual. */
+
+#define ESR_ELx_EC_SHIFT 26
+#define ESR_ELx_EC(esr) (((esr) >> ESR_ELx_EC_SHIFT) & 0x3f)
+#define ESR_ELx_EC_MAX 0x3f
+
+#define ESR_ELx_EC_FP_ASIMD 0x07 /* access to SIMD or floating-point */
+#define ESR_ELx_EC_SVC64 0x15 /* svc in AArch64 state */
+#define ESR_ELx_EC_DABT_LOW 0x24 /* data abort from a lower exception level */
+#define ESR_ELx_EC_DABT_CUR 0x25 /* data abort without a change in exception level */
+
+/* data aborts */
+#define ESR_ELx_WNR (1 << 6) /* caused by a write */
+#define ESR_ELx_FSC_TYPE(esr) ((esr) & 0x3c)
+#define ESR_ELx_FSC_LEVEL(esr) ((esr) & 0x3)
+#define ESR_ELx_FSC_FAULT 0x04 /* translation fault */
+#define ESR_ELx_FSC_PERM 0x0c /* permission fault */
+
 /* MAIR_EL1, Memory Attribute Indirection Register (EL1) Page 2609 of
  * AArch64-Reference-Manual. */
 
 #define MT_DEVICE_nGnRnE 0x0
 #define MT_NORMAL_NC 0x1
-#define MT_READONLY 0x2
+#define MT_NORMAL 0x2
 #define MT_DEVICE_nGnRnE_FLAGS 0x00
 #define MT_NORMAL_NC_FLAGS 0x44
-#define MT_READONLY_FLAGS 0xff
-#define MAIR_VALUE (MT_DEVICE_nGnRnE_FLAGS << (8 * MT_DEVICE_nGnRnE)) | (MT_NORMAL_NC_FLAGS << (8 * MT_NORMAL_NC)) | (MT_READONLY_FLAGS) << (8 * MT_READONLY)
+// Normal memory, inner and outer Write-Back Read/Write-Allocate non-transient.
+#define MT_NORMAL_FLAGS 0xff
+#define MAIR_VALUE ((MT_DEVICE_nGnRnE_FLAGS << (8 * MT_DEVICE_nGnRnE)) | (MT_NORMAL_NC_FLAGS << (8 * MT_NORMAL_NC)) | (MT_NORMAL_FLAGS << (8 * MT_NORMAL)))
 
 /* TCR_EL1, Translation Control Register (EL1) Page 2685 of
  * AArch64-Reference-Manual. */
 
-#define TCR_T0SZ (64 - 36)
-#define TCR_PS (0x01 << 16) // 36-bit physical address
+// 48-bit virtual addresses in both halves, 4 levels of 4KB tables each
+#define TCR_T0SZ (64 - 48)
+#define TCR_T1SZ ((64 - 48) << 16)
 #define TCR_TG0_4K (0 << 14)
-#define TCR_IPS_64G (1ull << 32)
+#define TCR_TG1_4K (2ull << 30)
+#define TCR_IPS_64G (1ull << 32) // 36-bit physical address
 #define TCR_SH0_OUTER_SHAREABLE (0x2 << 12)
 #define TCR_SH0_INNER_SHAREABLE (0x3 << 12)
+#define TCR_SH1_INNER_SHAREABLE (0x3 << 28)
+// table walks are Inner and Outer Write-Back Read/Write-Allocate
 #define OUTER_CACHEABLE (0x1 << 10)
 #define INNER_CACHEABLE (0x1 << 8)
-#define TCR_VALUE (TCR_IPS_64G | OUTER_CACHEABLE | INNER_CACHEABLE | TCR_T0SZ | TCR_PS | TCR_TG0_4K | TCR_SH0_INNER_SHAREABLE)
+#define TCR_ORGN1_CACHEABLE (0x1 << 26)
+#define TCR_IRGN1_CACHEABLE (0x1 << 24)
+// 16-bit ASIDs, when ID_AA64MMFR0_EL1 reports them
+#define TCR_AS (1ull << 36)
+#define TCR_TTBR0 (TCR_T0SZ | TCR_TG0_4K | TCR_SH0_INNER_SHAREABLE | OUTER_CACHEABLE | INNER_CACHEABLE)
+#define TCR_TTBR1 (TCR_T1SZ | TCR_TG1_4K | TCR_SH1_INNER_SHAREABLE | TCR_ORGN1_CACHEABLE | TCR_IRGN1_CACHEABLE)
+#define TCR_VALUE (TCR_IPS_64G | TCR_TTBR0 | TCR_TTBR1)
+
+/* ID_AA64MMFR0_EL1, AArch64 Memory Model Feature Register 0 */
+#define ID_AA64MMFR0_ASIDBITS_SHIFT 4
+#define ID_AA64MMFR0_ASIDBITS_16 0x2
 
 #endif /* SYSREGS_H */
@@ -1,18 +1,87 @@
 /**
  * @file delay.c
  * @brief This file contains the implementation for delay functions.
+ *
+ * Delays are measured on the generic timer counter, CNTVCT_EL0, which runs at
+ * the fixed frequency in CNTFRQ_EL0 independent of the CPU clock, the caches
+ * and whether the kernel runs on hardware or in QEMU. Both registers are
+ * usable right after reset, so the delays work before any timer is set up.
  */
 #include <stdint.h>
 
+#include "arm/counter.h"
+#include "delay/delay.h"
+#include "scheduler/scheduler.h"
+#include "time/hrtimer.h"
+
+/**
+ * @brief Converts nanoseconds to counter ticks, rounding up.
+ *
+ * Rounding up makes sure a delay is never shorter than requested.
+ */
+static uint64_t delay_ns_to_ticks(uint64_t ns)
+{
+    uint64_t frq = read_cntfrq();
+
+    return ns / NSEC_PER_SEC * frq + (ns % NSEC_PER_SEC * frq + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+}
+
+static void delay_ticks(uint64_t ticks)
+{
+    uint64_t start = read_cntvct();
+
+    while (read_cntvct() - start < ticks) {
+        asm volatile("yield");
+    }
+}
+
+/**
+ * @brief Busy waits for at least ns nanoseconds.
+ *
+ * The resolution is one counter tick, 1/CNTFRQ_EL0 seconds.
+ *
+ * @param ns Time to wait in nanoseconds.
+ */
+void ndelay(uint64_t ns)
+{
+    delay_ticks(delay_ns_to_ticks(ns));
+}
+
+/**
+ * @brief Busy waits for at least us microseconds.
+ *
+ * @param us Time to wait in microseconds.
+ */
+void udelay(uint64_t us)
+{
+    delay_ticks(delay_ns_to_ticks(us * NSEC_PER_USEC));
+}
+
 /**
- * @brief Delays the execution for a specified amount of time.
+ * @brief Busy waits for at least ms milliseconds.
  *
- * @param count The number of iterations to delay. Higher values result in longer delays.
+ * @param ms Time to wait in milliseconds.
  */
-void delay(int32_t count)
+void mdelay(uint64_t ms)
 {
-    asm volatile("__delay_%=: subs %[count], %[count], #1; bne __delay_%=\n"
-        : "=r"(count)
-        : [count] "0"(count)
-        : "cc");
+    delay_ticks(delay_ns_to_ticks(ms * NSEC_PER_MSEC));
+}
+
+/**
+ * @brief Waits for at least us microseconds, letting other tasks run meanwhile.
+ *
+ * The task stays runnable and calls schedule() until the time is up, so it
+ * does not hold its core for the whole wait. The wait may end later than with
+ * udelay() if other tasks run in between.
+ *
+ * @param us Time to wait in microseconds.
+ */
+void udelay_yield(uint64_t us)
+{
+    uint64_t start = read_cntvct();
+    uint64_t ticks = delay_ns_to_ticks(us * NSEC_PER_USEC);
+
+    while (read_cntvct() - start < ticks) {
+        schedule();
+    }
 }
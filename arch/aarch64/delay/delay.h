@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
-void delay(int32_t count);
+void ndelay(uint64_t ns);
+void udelay(uint64_t us);
+void mdelay(uint64_t ms);
+void udelay_yield(uint64_t us);
 
 #endif // DELAY_H
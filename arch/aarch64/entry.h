@@ -1,7 +1,17 @@
 #ifndef ENTRY_H
 #define ENTRY_H
 
-#define S_FRAME_SIZE 256 // size of all saved registers
+#define S_FRAME_SIZE 288 // size of all saved registers
+
+/* offsets into the exception frame, see struct pt_regs */
+#define S_X0 0
+#define S_X21 168
+#define S_X22 176
+#define S_X30 240
+#define S_SP 248 // SP_EL0 when taken from EL0
+#define S_PC 256 // ELR_EL1
+#define S_PSTATE 264 // SPSR_EL1
+#define S_PMCCNTR 272 // cycle counter at the vector, with CONFIG_PERF
 
 #define SYNC_INVALID_EL1t 0
 #define IRQ_INVALID_EL1t 1
@@ -26,7 +36,27 @@
 
 #ifndef __ASSEMBLER__
 
+/**
+ * @brief Registers saved by kernel_entry, at the stack pointer of the handler.
+ */
+struct pt_regs {
+    unsigned long regs[31];
+    unsigned long sp;
+    unsigned long pc;
+    unsigned long pstate;
+    unsigned long pmccntr;
+    unsigned long unused; /* keeps the frame 16 byte aligned */
+};
+
+_Static_assert(sizeof(struct pt_regs) == S_FRAME_SIZE, "pt_regs does not match the exception frame");
+
+/* the exception was taken from EL0 */
+#define user_mode(regs) (((regs)->pstate & SPSR_MODE_MASK) == SPSR_EL0t)
+
 extern void ret_from_fork();
 
+/* frame a task returns to EL0 with, at the top of its kernel stack */
+#define task_pt_regs(p) ((struct pt_regs*)((p)->stack + THREAD_SIZE) - 1)
+
 #endif
 #endif
@@ -0,0 +1,127 @@
+/**
+ * @file fpsimd.c
+ * @brief Lazy switching of the FP/SIMD registers.
+ *
+ * cpu_switch_to() only switches the general purpose registers. The FP/SIMD
+ * registers are saved when switching away from a task that used them during
+ * its time slice, and access is then disabled in CPACR_EL1. The first FP/SIMD
+ * instruction of the next task traps and loads its registers, unless they are
+ * still live in this core because no other task used FP/SIMD in between.
+ * Tasks that never touch FP/SIMD never pay for a save or a load.
+ *
+ * The registers may be live for the interrupted task in any handler, so the
+ * kernel is built with -mgeneral-regs-only and only fpsimd_asm.S touches them.
+ */
+#include "fpsimd/fpsimd.h"
+#include "arm/sysregs.h"
+#include "mem/cache.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+
+struct fpsimd_cpu {
+    /* task whose registers are in this core, possibly not enabled */
+    struct task_struct* owner;
+    /* FP/SIMD access is enabled, the registers belong to current */
+    int live;
+    struct fpsimd_stats stats;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct fpsimd_cpu fpsimd_cpus[NR_CPUS];
+
+static inline void fpsimd_set_access(int enable)
+{
+    unsigned long cpacr;
+    asm volatile("mrs %[cpacr], cpacr_el1"
+        : [cpacr] "=r"(cpacr));
+    cpacr &= ~CPACR_FPEN(3);
+    if (enable) {
+        cpacr |= CPACR_FPEN(3);
+    }
+    asm volatile("msr cpacr_el1, %[cpacr]\n\t"
+                 "isb"
+        :
+        : [cpacr] "r"(cpacr)
+        : "memory");
+}
+
+/**
+ * @brief Makes the boot code of the calling core the owner of its registers.
+ *
+ * Called once per core after its idle task has been set up.
+ */
+void fpsimd_init_cpu(void)
+{
+    struct fpsimd_cpu* fc = &fpsimd_cpus[smp_processor_id()];
+
+    fpsimd_set_access(1);
+    current->fpsimd_used = 1;
+    current->fpsimd_cpu = smp_processor_id();
+    fc->owner = current;
+    fc->live = 1;
+}
+
+/**
+ * @brief Saves the registers of prev if it used them and disables access.
+ *
+ * Must be called with interrupts disabled right before current is changed,
+ * so no trap can load the registers of prev in between.
+ *
+ * @param prev The task being switched away from.
+ */
+void fpsimd_thread_switch(struct task_struct* prev)
+{
+    struct fpsimd_cpu* fc = &fpsimd_cpus[smp_processor_id()];
+
+    if (!fc->live) {
+        return;
+    }
+    fpsimd_save_state(&prev->fpsimd);
+    fpsimd_set_access(0);
+    fc->live = 0;
+    fc->stats.saves++;
+}
+
+/**
+ * @brief Handles an FP/SIMD access trap of current.
+ *
+ * Enables access and loads the registers of current if this core does not
+ * hold them anymore. A task that never used FP/SIMD starts from zero.
+ */
+void fpsimd_access_trap(void)
+{
+    unsigned int cpu = smp_processor_id();
+    struct fpsimd_cpu* fc = &fpsimd_cpus[cpu];
+    struct task_struct* p = current;
+
+    fpsimd_set_access(1);
+    fc->stats.traps++;
+
+    if (!p->fpsimd_used) {
+        for (int i = 0; i < 32; i++) {
+            p->fpsimd.vregs[i] = 0;
+        }
+        p->fpsimd.fpsr = 0;
+        p->fpsimd.fpcr = 0;
+        p->fpsimd_used = 1;
+        fpsimd_load_state(&p->fpsimd);
+        fc->stats.loads++;
+    } else if (fc->owner != p || p->fpsimd_cpu != cpu) {
+        fpsimd_load_state(&p->fpsimd);
+        fc->stats.loads++;
+    }
+
+    fc->owner = p;
+    p->fpsimd_cpu = cpu;
+    fc->live = 1;
+}
+
+/**
+ * @brief Reports the FP/SIMD switching counters of a core.
+ *
+ * @param cpu The core to report.
+ * @param stats Filled with the counters.
+ */
+void fpsimd_get_stats(unsigned int cpu, struct fpsimd_stats* stats)
+{
+    *stats = fpsimd_cpus[cpu].stats;
+}
@@ -0,0 +1,32 @@
+#ifndef FPSIMD_H
+#define FPSIMD_H
+
+#include <stdint.h>
+
+/**
+ * @brief FP/SIMD registers of a task while they are not live in a core.
+ */
+struct fpsimd_state {
+    __uint128_t vregs[32];
+    uint32_t fpsr;
+    uint32_t fpcr;
+} __attribute__((aligned(16)));
+
+struct fpsimd_stats {
+    unsigned long traps; /* first FP/SIMD use after a switch */
+    unsigned long loads; /* traps that had to load the registers from memory */
+    unsigned long saves; /* switches away from a task that used FP/SIMD */
+};
+
+struct task_struct;
+
+void fpsimd_init_cpu(void);
+void fpsimd_thread_switch(struct task_struct* prev);
+void fpsimd_access_trap(void);
+void fpsimd_get_stats(unsigned int cpu, struct fpsimd_stats* stats);
+
+/* asm */
+extern void fpsimd_save_state(struct fpsimd_state* state);
+extern void fpsimd_load_state(struct fpsimd_state* state);
+
+#endif
@@ -10,12 +10,23 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "arm/sysregs.h"
+#include "entry.h"
+#include "fpsimd/fpsimd.h"
 #include "irq/irq.h"
+#include "log/log.h"
+#include "mem/fault.h"
+#include "perf/perf.h"
 #include "peripherals/bcm2711/bcm2711_lpa.h"
 #include "peripherals/bcm2711/core_ca72.h"
 #include "peripherals/bcm2711/cpu.h"
 #include "peripherals/bcm2711/interrupt_handlers.h"
+#include "peripherals/bcm2711/uart/uart.h"
 #include "printk.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "trace/trace.h"
 
 const char* entry_error_messages[] = {
     "SYNC_INVALID_EL1t",
@@ -39,23 +50,15 @@ const char* entry_error_messages[] = {
     "ERROR_INVALID_EL0_32",
 };
 
-/**
- * @brief Get the current CPU identifier.
- *
- * This function retrieves the identifier of the CPU that is currently
- * executing the code. It is typically used in a multi-core system to
- * determine which CPU is handling the current task or interrupt.
- *
- * @return The identifier of the current CPU as an 8-bit unsigned integer.
- */
-static uint8_t get_current_cpu(void)
-{
-    uint32_t mpidr = 0;
-    asm volatile("mrs     %[mpidr], mpidr_el1"
-        : /* No outputs. */
-        : [mpidr] "r"(mpidr));
-    return mpidr & 0xff;
-}
+/* nesting depth of handle_irq() on every core */
+static unsigned long irq_depth[NR_CPUS];
+
+/* exception frame of the innermost interrupt on every core */
+static struct pt_regs* irq_regs[NR_CPUS];
+
+/* exception entry up to the C handler, timed from the vector */
+static PERF_REGION(perf_irq_entry, "irq_entry");
+static PERF_REGION(perf_svc_entry, "svc_entry");
 
 /**
  * @brief Enables the interrupt requests (IRQs).
@@ -88,6 +91,38 @@ void disable_irqs(void)
     return;
 }
 
+/**
+ * @brief Masks IRQs on this core and returns the previous mask.
+ *
+ * Unlike disable_irqs() this can be nested, the caller restores the previous
+ * state with local_irq_restore().
+ *
+ * @return The previous value of DAIF.
+ */
+unsigned long local_irq_save(void)
+{
+    unsigned long flags;
+    asm volatile("mrs   %[flags], daif\n\t"
+                 "msr   daifset, #2"
+        : [flags] "=r"(flags)
+        :
+        : "memory");
+    return flags;
+}
+
+/**
+ * @brief Restores the IRQ mask saved by local_irq_save().
+ *
+ * @param flags The value returned by local_irq_save().
+ */
+void local_irq_restore(unsigned long flags)
+{
+    asm volatile("msr   daif, %[flags]"
+        :
+        : [flags] "r"(flags)
+        : "memory");
+}
+
 /**
  * @brief Enable the specified IRQ.
  *
@@ -103,7 +138,7 @@ void enable_irq(IRQn_Type irq)
 {
     COMPLETE_MEMORY_READS;
     volatile uint8_t* targets = (volatile uint8_t*)&GIC_DIST->GICD_ITARGETSR;
-    targets[irq] |= 1 << get_current_cpu();
+    targets[irq] |= 1 << smp_processor_id();
     volatile uint32_t* enabled = (volatile uint32_t*)&GIC_DIST->GICD_ISENABLER;
     enabled[irq / 32] = 1 << (irq % 32);
     COMPLETE_MEMORY_READS;
@@ -118,8 +153,25 @@ void enable_irq(IRQn_Type irq)
  */
 void enable_interrupt_controller(void)
 {
-    /* enable system timer irq */
-    enable_irq(TIMER_0_IRQn);
+    /* enable forwarding from the distributor to the cpu interfaces */
+    GIC_DIST->GICD_CTLR_b.ENABLE_GROUP0 = true;
+}
+
+/**
+ * @brief Initializes the GIC CPU interface of the calling core.
+ *
+ * The CPU interface and the SGI/PPI enables are banked per core, so every
+ * core has to run this before it can take interrupts.
+ */
+void gic_cpu_init(void)
+{
+    /* do not mask any priority */
+    GIC_CPU->GICC_PMR = 0xff;
+    GIC_CPU->GICC_CTLR_b.ENABLE_GROUP_0 = true;
+
+    /* inter-processor interrupts */
+    enable_irq(IPI_RESCHEDULE);
+    enable_irq(IPI_PMU);
 }
 
 /**
@@ -127,14 +179,101 @@ void enable_interrupt_controller(void)
  *
  * This function is used to display a message when an invalid entry is detected.
  * It provides information about the type of the invalid entry, the ESR value,
- * and the address where the invalid entry occurred.
+ * and the address where the invalid entry occurred. The core halts afterwards,
+ * so the console is switched to synchronous output first and the kernel log
+ * is dumped after the message.
  * @param type Type of the invalid entry
  * @param esr Exception Syndrome Register value
  * @param address Address where the invalid entry occurred
  */
 void show_invalid_entry_message(int type, unsigned long esr, unsigned long address)
 {
-    printk("%s, ESR: %x, address: %x\r\n", entry_error_messages[type], esr, address);
+    uart_panic();
+    log_panic();
+    printk(KERN_EMERG "%s, ESR: %x, address: %x\r\n", entry_error_messages[type], esr, address);
+    log_dump();
+}
+
+static int do_fpsimd_trap(unsigned long esr, struct pt_regs* regs)
+{
+    (void)esr;
+    (void)regs;
+    fpsimd_access_trap();
+    return 0;
+}
+
+static int do_svc(unsigned long esr, struct pt_regs* regs)
+{
+    (void)esr;
+    perf_account_cycles(&perf_svc_entry, pmu_read_cycles() - regs->pmccntr);
+    return 0;
+}
+
+static int do_data_abort(unsigned long esr, struct pt_regs* regs)
+{
+    unsigned long far;
+    asm volatile("mrs %[far], far_el1"
+        : [far] "=r"(far));
+    return do_page_fault(far, esr, regs);
+}
+
+/* handlers by exception class, they return 0 once the exception is resolved */
+static int (*const sync_handlers[ESR_ELx_EC_MAX + 1])(unsigned long esr, struct pt_regs* regs) = {
+    [ESR_ELx_EC_FP_ASIMD] = do_fpsimd_trap,
+    [ESR_ELx_EC_SVC64] = do_svc,
+    [ESR_ELx_EC_DABT_LOW] = do_data_abort,
+    [ESR_ELx_EC_DABT_CUR] = do_data_abort,
+};
+
+/**
+ * @brief Handles a synchronous exception.
+ *
+ * Dispatches on the exception class in ESR_EL1. FP/SIMD access traps are
+ * part of lazy register switching. An svc from EL1 does nothing, it only
+ * serves to time an exception round trip, system calls from EL0 never get
+ * here. Data aborts on user addresses go to do_page_fault(). Everything
+ * else, and anything a handler cannot resolve, is reported and halts the
+ * core, or kills the task if it came from EL0.
+ *
+ * @param esr Exception Syndrome Register value
+ * @param address Address of the instruction that caused the exception
+ * @param regs The exception frame
+ */
+void handle_sync(unsigned long esr, unsigned long address, struct pt_regs* regs)
+{
+    int (*handler)(unsigned long esr, struct pt_regs* regs) = sync_handlers[ESR_ELx_EC(esr)];
+
+    if (handler && !handler(esr, regs)) {
+        return;
+    }
+
+    if (!user_mode(regs)) {
+        show_invalid_entry_message(SYNC_INVALID_EL1h, esr, address);
+        while (1) { }
+    }
+
+    /* only the task is lost */
+    printk(KERN_ERR "%s in pid %d, ESR: %x, address: %x\r\n", entry_error_messages[SYNC_INVALID_EL0_64], current->pid, esr, address);
+    enable_irqs();
+    do_exit(-1);
+}
+
+/**
+ * @brief Returns how many interrupts the calling core is handling, 0 in task context.
+ */
+unsigned long in_interrupt(void)
+{
+    return irq_depth[smp_processor_id()];
+}
+
+/**
+ * @brief Returns the exception frame of the interrupt the calling core is handling.
+ *
+ * @return The frame, NULL in task context.
+ */
+struct pt_regs* get_irq_regs(void)
+{
+    return irq_regs[smp_processor_id()];
 }
 
 /**
@@ -142,10 +281,19 @@ void show_invalid_entry_message(int type, unsigned long esr, unsigned long addre
  *
  * This function is responsible for processing the interrupt request
  * and performing the necessary actions to handle the interrupt.
+ *
+ * @param regs The exception frame of the interrupted code.
  */
-void handle_irq(void)
+void handle_irq(struct pt_regs* regs)
 {
+    unsigned int cpu = smp_processor_id();
+    struct pt_regs* old_regs = irq_regs[cpu];
+
+    perf_account_cycles(&perf_irq_entry, pmu_read_cycles() - regs->pmccntr);
+
     COMPLETE_MEMORY_READS;
+    irq_depth[cpu]++;
+    irq_regs[cpu] = regs;
 
     while (GIC_CPU->GICC_HPPIR_b.INTERRUPT_ID < INTERRUPT_COUNT) {
         /* Get the interrupt acknowledge register.
@@ -154,7 +302,6 @@ void handle_irq(void)
 
         /* Get id of the current interrupt */
         uint32_t interrupt_id = current_interrupt & ARM_GIC400_CPU_GICC_IAR_INTERRUPT_ID_Msk;
-        printk("irq pending! id: %x\r\n", interrupt_id);
 
         /* check if interrupt is in range */
         if (interrupt_id >= INTERRUPT_COUNT) {
@@ -173,7 +320,9 @@ void handle_irq(void)
         }
 
         COMPLETE_MEMORY_READS;
+        trace_event(TRACE_IRQ_ENTRY, interrupt_id, 0, 0);
         handler();
+        trace_event(TRACE_IRQ_EXIT, interrupt_id, 0, 0);
         COMPLETE_MEMORY_READS;
 
         /* turn off interrupts */
@@ -182,6 +331,11 @@ void handle_irq(void)
         GIC_CPU->GICC_EOIR = current_interrupt;
     }
     COMPLETE_MEMORY_READS;
+    irq_regs[cpu] = old_regs;
+    irq_depth[cpu]--;
+
+    /* the interrupt may have ended the time slice of the current task */
+    preempt_schedule_irq();
 
     return;
 }
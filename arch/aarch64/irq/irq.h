@@ -5,11 +5,19 @@
 #include <stdint.h>
 
 void enable_interrupt_controller(void);
+void gic_cpu_init(void);
 void show_invalid_entry_message(int type, unsigned long esr, unsigned long address);
 
-void handle_irq(void);
+struct pt_regs;
+
+void handle_sync(unsigned long esr, unsigned long address, struct pt_regs* regs);
+void handle_irq(struct pt_regs* regs);
+struct pt_regs* get_irq_regs(void);
+unsigned long in_interrupt(void);
 void enable_irqs(void);
 void disable_irqs(void);
+unsigned long local_irq_save(void);
+void local_irq_restore(unsigned long flags);
 
 void enable_irq(IRQn_Type irq);
 extern void irq_vector_init(void);
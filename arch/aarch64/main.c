@@ -8,13 +8,24 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "bench/bench.h"
 #include "delay/delay.h"
+#include "fpsimd/fpsimd.h"
 #include "irq/irq.h"
+#include "log/log.h"
+#include "mem/mem.h"
+#include "mem/mm.h"
 #include "mem/mmu.h"
-#include "peripherals/bcm2711/timer/timer.h"
+#include "mem/pgtable.h"
+#include "mem/slab.h"
 #include "peripherals/bcm2711/uart/uart.h"
+#include "pmu/pmu.h"
+#include "power/power.h"
 #include "scheduler/fork.h"
 #include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "time/hrtimer.h"
+#include "timer/arch_timer.h"
 #include "printk.h"
 
 #if defined(__cplusplus)
@@ -36,7 +47,7 @@ void process1(char* array)
     printk("Process %s started\n", array);
     while (1) {
         printk("Process %s running\n", array);
-        delay(10);
+        udelay_yield(100000);
     }
 }
 
@@ -62,17 +73,72 @@ void kmain(uint64_t dtb_ptr32, uint64_t x1, uint64_t x2, uint64_t x3)
 void kmain(uint32_t r0, uint32_t r1, uint32_t atags)
 #endif
 {
+    sched_init();
 #ifdef __aarch64__
-    setup_mmu_flat_map();
+    fpsimd_init_cpu();
+    pmu_init_cpu();
+    mmu_init();
 #endif
     uart_init(RP4);
-    set_putc((putc_func_t)uart_putc);
+    log_set_console(uart_putc);
+    set_putc((putc_func_t)log_putc);
+#ifdef CONFIG_BENCH
+    bench_cache("cache_off");
+#endif
+#ifdef __aarch64__
+    mmu_enable_caches();
+#endif
+    mem_init();
+    kmem_cache_init();
+    fork_init();
+#ifdef __aarch64__
+    pgtable_early_done();
+    mm_init();
+#endif
+#ifdef CONFIG_BENCH
+    bench_cache("cache_on");
+    bench_mem();
+    bench_pcp();
+    bench_slab();
+    bench_string();
+    bench_pgtable();
+#endif
     irq_vector_init();
-    timer_init();
+    hrtimer_init();
 
     // enable gic
     enable_irqs();
     enable_interrupt_controller();
+    gic_cpu_init();
+    arch_timer_init_cpu();
+    uart_enable_irq();
+
+    smp_boot_secondaries();
+    log_start_flush();
+#ifdef CONFIG_BENCH
+    bench_smp();
+    bench_sched();
+    bench_fork();
+    bench_mm();
+    bench_cow();
+    bench_fault();
+    bench_syscall();
+    bench_fpsimd();
+    bench_idle();
+    bench_hrtimer();
+    bench_delay();
+    bench_uart();
+    bench_log();
+    bench_trace();
+    bench_perf();
+#endif
+#ifdef CONFIG_KBENCH
+    /* the benchmark image stops QEMU once the results are out */
+    printk("%s done\n", BENCH_TAG);
+    log_flush();
+    uart_flush();
+    system_exit(0);
+#endif
 
     int el = get_el();
     printk("Current exception level: %d\n", el);
@@ -87,40 +153,5 @@ void kmain(uint32_t r0, uint32_t r1, uint32_t atags)
         printk("Failed to create process\n");
     }
 
-    while (1) {
-        schedule();
-    }
-}
-
-/**
- * @brief Function to spin the CPU1.
- *
- * This function is responsible for spinning the CPU1.
- */
-void spin_cpu1(void)
-{
-    while (1)
-        ;
-}
-
-/**
- * @brief Function to spin the CPU2.
- *
- * This function is responsible for spinning the CPU2.
- */
-void spin_cpu2(void)
-{
-    while (1)
-        ;
-}
-
-/**
- * @brief Function to spin the CPU3.
- *
- * This function is responsible for spinning the CPU3.
- */
-void spin_cpu3(void)
-{
-    while (1)
-        ;
+    cpu_idle();
 }
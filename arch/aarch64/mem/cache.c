@@ -0,0 +1,149 @@
+/**
+ * @file cache.c
+ * @brief Cache maintenance operations for the Cortex-A72.
+ *
+ * This file contains the set/way and by-address cache maintenance routines
+ * needed before the caches are enabled and when memory is shared with agents
+ * that do not snoop the caches.
+ */
+#include <stdint.h>
+
+#include "mem/cache.h"
+
+#define CLIDR_LOC(clidr) (((clidr) >> 24) & 0x7)
+#define CLIDR_LOUIS(clidr) (((clidr) >> 21) & 0x7)
+#define CLIDR_CTYPE(clidr, level) (((clidr) >> ((level) * 3)) & 0x7)
+#define CLIDR_CTYPE_DATA 2 /* 2 = data only, 3 = separate, 4 = unified */
+
+#define CCSIDR_LINE_SHIFT(ccsidr) (((ccsidr) & 0x7) + 4)
+#define CCSIDR_WAYS(ccsidr) ((((ccsidr) >> 3) & 0x3ff) + 1)
+#define CCSIDR_SETS(ccsidr) ((((ccsidr) >> 13) & 0x7fff) + 1)
+
+/**
+ * @brief Walks the data cache levels below a limit by set/way.
+ *
+ * @param clean Clean dirty lines before invalidating them (DC CISW instead of DC ISW).
+ * @param local Stop at the Level of Unification Inner Shareable, i.e. only
+ *              touch the caches private to this core.
+ */
+static void dcache_set_way_all(int clean, int local)
+{
+    uint64_t clidr;
+    asm volatile("mrs %[clidr], clidr_el1"
+        : [clidr] "=r"(clidr));
+
+    uint64_t levels = local ? CLIDR_LOUIS(clidr) : CLIDR_LOC(clidr);
+    for (uint64_t level = 0; level < levels; level++) {
+        if (CLIDR_CTYPE(clidr, level) < CLIDR_CTYPE_DATA) {
+            continue;
+        }
+
+        uint64_t ccsidr;
+        asm volatile("msr csselr_el1, %[csselr]\n\t"
+                     "isb\n\t"
+                     "mrs %[ccsidr], ccsidr_el1"
+            : [ccsidr] "=r"(ccsidr)
+            : [csselr] "r"(level << 1));
+
+        uint64_t line_shift = CCSIDR_LINE_SHIFT(ccsidr);
+        uint64_t ways = CCSIDR_WAYS(ccsidr);
+        uint64_t sets = CCSIDR_SETS(ccsidr);
+        /* way index lives in the top bits of the operand */
+        uint64_t way_shift = ways > 1 ? __builtin_clz((uint32_t)(ways - 1)) : 0;
+
+        for (uint64_t way = 0; way < ways; way++) {
+            for (uint64_t set = 0; set < sets; set++) {
+                uint64_t sw = (way << way_shift) | (set << line_shift) | (level << 1);
+                if (clean) {
+                    asm volatile("dc cisw, %[sw]" : : [sw] "r"(sw) : "memory");
+                } else {
+                    asm volatile("dc isw, %[sw]" : : [sw] "r"(sw) : "memory");
+                }
+            }
+        }
+    }
+
+    asm volatile("msr csselr_el1, xzr\n\t"
+                 "dsb sy\n\t"
+                 "isb" ::: "memory");
+}
+
+/**
+ * @brief Invalidates all data cache levels by set/way.
+ *
+ * Must only be used while the data cache is disabled, e.g. before setting
+ * SCTLR_EL1.C for the first time, since dirty lines are discarded.
+ */
+void dcache_invalidate_all(void)
+{
+    dcache_set_way_all(0, 0);
+}
+
+/**
+ * @brief Cleans and invalidates all data cache levels by set/way.
+ */
+void dcache_clean_invalidate_all(void)
+{
+    dcache_set_way_all(1, 0);
+}
+
+/**
+ * @brief Invalidates the data caches private to this core by set/way.
+ *
+ * Used when a secondary core enables its caches while other cores are
+ * already running with the shared levels enabled.
+ */
+void dcache_invalidate_local(void)
+{
+    dcache_set_way_all(0, 1);
+}
+
+/**
+ * @brief Cleans a virtual address range to the Point of Coherency.
+ *
+ * Used to publish data to observers that bypass the caches, such as
+ * secondary cores that have not yet enabled their MMU.
+ *
+ * @param start Start of the range.
+ * @param size Size of the range in bytes.
+ */
+void dcache_clean_range(void* start, size_t size)
+{
+    uint64_t addr = (uint64_t)start & ~(uint64_t)(CACHE_LINE_SIZE - 1);
+    uint64_t end = (uint64_t)start + size;
+
+    for (; addr < end; addr += CACHE_LINE_SIZE) {
+        asm volatile("dc cvac, %[addr]" : : [addr] "r"(addr) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
+
+/**
+ * @brief Cleans and invalidates a virtual address range to the Point of Coherency.
+ *
+ * Afterwards no cache holds a copy of the range, so a core that writes it
+ * with its caches disabled will not later read stale lines.
+ *
+ * @param start Start of the range.
+ * @param size Size of the range in bytes.
+ */
+void dcache_flush_range(void* start, size_t size)
+{
+    uint64_t addr = (uint64_t)start & ~(uint64_t)(CACHE_LINE_SIZE - 1);
+    uint64_t end = (uint64_t)start + size;
+
+    for (; addr < end; addr += CACHE_LINE_SIZE) {
+        asm volatile("dc civac, %[addr]" : : [addr] "r"(addr) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
+
+/**
+ * @brief Invalidates the whole instruction cache to the Point of Unification.
+ */
+void icache_invalidate_all(void)
+{
+    asm volatile("ic iallu\n\t"
+                 "dsb ish\n\t"
+                 "isb" ::: "memory");
+}
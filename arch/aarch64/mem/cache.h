@@ -0,0 +1,15 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h>
+
+#define CACHE_LINE_SIZE 64
+
+void dcache_invalidate_all(void);
+void dcache_clean_invalidate_all(void);
+void dcache_invalidate_local(void);
+void dcache_clean_range(void* start, size_t size);
+void dcache_flush_range(void* start, size_t size);
+void icache_invalidate_all(void);
+
+#endif /* _CACHE_H */
@@ -0,0 +1,160 @@
+/**
+ * @file fault.c
+ * @brief Data aborts on user addresses.
+ *
+ * Ranges reserved with do_mmap() are not backed by memory until they are
+ * used. The first access to a page of one takes a translation fault, which
+ * maps a zeroed page there, so large stacks and heaps only cost the pages
+ * that are actually touched.
+ *
+ * Pages shared by fork_process() are mapped read-only and marked
+ * MM_DESCRIPTOR_COW in both address spaces. The first write to one takes a
+ * permission fault, which gives the writer its own copy of the page, or the
+ * page itself when no other address space maps it any more.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "arm/sysregs.h"
+#include "entry.h"
+#include "lib/string.h"
+#include "mem/fault.h"
+#include "mem/mem.h"
+#include "mem/mm.h"
+#include "mem/mmu.h"
+#include "mem/pgtable.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "sync/spinlock.h"
+
+static struct fault_stats fault_stats[NR_CPUS];
+
+/**
+ * @brief Maps a zeroed page at va in an area, mm->lock must be held.
+ *
+ * @return 0 if the access can be retried, -1 if memory ran out.
+ */
+static int do_anonymous_page(struct mm_struct* mm, struct vm_area_struct* vma, unsigned long va)
+{
+    unsigned long pa;
+
+    /* another core mapped it first */
+    if (pgtable_translate(mm->pgd, va, &pa)) {
+        return 0;
+    }
+
+    unsigned long page = get_zeroed_page();
+    if (!page) {
+        return -1;
+    }
+
+    uint64_t prot = PROT_USER_DATA;
+    if (!(vma->vm_flags & VM_WRITE)) {
+        prot |= MM_DESCRIPTOR_READ_ONLY;
+    }
+    if (map_range(mm->pgd, va, page, PAGE_SIZE, prot)) {
+        free_page(page);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Resolves a write to a copy-on-write page, mm->lock must be held.
+ *
+ * @return 0 if the write can be retried, -1 if the page is not copy-on-write.
+ */
+static int do_wp_page(struct mm_struct* mm, unsigned long va)
+{
+    uint64_t* pte = pgtable_pte(mm->pgd, va);
+    if (!pte || !(*pte & MM_DESCRIPTOR_VALID)) {
+        return -1;
+    }
+
+    uint64_t desc = *pte;
+    if (!(desc & MM_DESCRIPTOR_READ_ONLY)) {
+        /* another core resolved it first, the TLB entry was stale */
+        return 0;
+    }
+    if (!(desc & MM_DESCRIPTOR_COW)) {
+        return -1;
+    }
+
+    unsigned long old = desc & MM_DESCRIPTOR_ADDRESS_MASK;
+    uint64_t attrs = desc & ~MM_DESCRIPTOR_ADDRESS_MASK & ~(MM_DESCRIPTOR_READ_ONLY | MM_DESCRIPTOR_COW);
+
+    if (page_count(old) == 1) {
+        /* nobody else maps it, only the permission changes */
+        *pte = old | attrs;
+        flush_tlb_page(mm, va);
+        return 0;
+    }
+
+    unsigned long page = get_free_page();
+    if (!page) {
+        return -1;
+    }
+    memcpy((void*)page, (void*)old, PAGE_SIZE);
+
+    /* break before make, the output address changes */
+    *pte = 0;
+    flush_tlb_page(mm, va);
+    *pte = page | attrs;
+    asm volatile("dsb ishst\n\t"
+                 "isb" ::: "memory");
+    put_page(old);
+    return 0;
+}
+
+/**
+ * @brief Handles a data abort on a user address.
+ *
+ * Called from handle_sync() with interrupts masked.
+ *
+ * @param far Faulting virtual address, from FAR_EL1.
+ * @param esr Exception Syndrome Register value.
+ * @param regs The exception frame.
+ *
+ * @return 0 if the access can be retried, -1 if the fault is fatal.
+ */
+int do_page_fault(unsigned long far, unsigned long esr, struct pt_regs* regs)
+{
+    struct mm_struct* mm = current->mm;
+    struct fault_stats* stats = &fault_stats[smp_processor_id()];
+    unsigned long va = far & ~(PAGE_SIZE - 1ul);
+    int ret = -1;
+    (void)regs;
+
+    if (far < USER_VA_START || far >= USER_VA_END || mm == &init_mm) {
+        return -1;
+    }
+
+#ifdef CONFIG_BENCH
+    uint64_t start = read_cntvct();
+#endif
+    spin_lock(&mm->lock);
+    if (ESR_ELx_FSC_TYPE(esr) == ESR_ELx_FSC_FAULT) {
+        struct vm_area_struct* vma = find_vma(mm, far);
+
+        if (vma && ((esr & ESR_ELx_WNR) ? vma->vm_flags & VM_WRITE : vma->vm_flags & VM_READ)) {
+            ret = do_anonymous_page(mm, vma, va);
+            stats->minor_faults += !ret;
+        }
+    } else if (ESR_ELx_FSC_TYPE(esr) == ESR_ELx_FSC_PERM && (esr & ESR_ELx_WNR)) {
+        ret = do_wp_page(mm, va);
+        stats->cow_faults += !ret;
+    }
+    spin_unlock(&mm->lock);
+#ifdef CONFIG_BENCH
+    stats->fault_ticks += read_cntvct() - start;
+#endif
+    return ret;
+}
+
+/**
+ * @brief Returns the page fault counters of a core.
+ */
+void fault_get_stats(unsigned int cpu, struct fault_stats* stats)
+{
+    *stats = fault_stats[cpu];
+}
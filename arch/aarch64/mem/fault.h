@@ -0,0 +1,18 @@
+#ifndef _FAULT_H
+#define _FAULT_H
+
+/**
+ * @brief Page fault counters of a single core.
+ */
+struct fault_stats {
+    unsigned long minor_faults; /* zeroed pages mapped on first touch */
+    unsigned long cow_faults; /* writes to copy-on-write pages */
+    unsigned long fault_ticks; /* CNTVCT ticks spent handling both, CONFIG_BENCH only */
+};
+
+struct pt_regs;
+
+int do_page_fault(unsigned long far, unsigned long esr, struct pt_regs* regs);
+void fault_get_stats(unsigned int cpu, struct fault_stats* stats);
+
+#endif /* _FAULT_H */
@@ -4,49 +4,628 @@
  *
  * This file contains functions and data structures for managing memory
  * in the kernel, including paging and memory allocation.
+ *
+ * Physical pages are handed out by a binary buddy allocator. A block of order
+ * n is 2^n pages and is aligned to its own size. Each order keeps its free
+ * blocks in a bitmap with two summary levels on top of it, so finding the
+ * lowest free block of an order only touches three words and allocation and
+ * freeing are O(log n). The bitmaps are kept outside of the pages they track,
+ * which means free pages are never written to and may lie outside of the
+ * memory that is currently mapped.
+ *
+ * Single pages are served from a small per-CPU cache in front of the buddy
+ * allocator. It is refilled and drained in batches, so the common
+ * get_free_page()/free_page() path only touches data owned by the calling
+ * core and takes the global zone lock once per batch.
+ *
+ * Next to the cache every core keeps a pool of pages that its idle task has
+ * already cleared with DC ZVA, so get_zeroed_page() only has to clear a page
+ * itself when the pool ran dry.
+ *
+ * Pages mapped into more than one address space are reference counted. The
+ * counts live in an array taken from the buddy allocator at boot and only
+ * hold the references beyond the first, so a page has one reference when it
+ * is allocated and nothing has to be set up or cleared on the fast paths.
  */
+#include <stdint.h>
+
+#include "irq/irq.h"
+#include "lib/string.h"
+#include "mem/cache.h"
 #include "mem/mem.h"
+#include "perf/perf.h"
+#include "smp/smp.h"
+#include "sync/spinlock.h"
+
+#define BITS_PER_WORD 64
+
+/* upper bounds for the bitmaps of all orders together */
+#define BUDDY_MAP_WORDS (PAGING_PAGES / 32 + 2 * MAX_ORDER)
+#define BUDDY_SUMMARY_WORDS (PAGING_PAGES / 2048 + 2 * MAX_ORDER)
+#define BUDDY_TOP_WORDS (PAGING_PAGES / 131072 + 2 * MAX_ORDER)
+
+/* smallest block holding the reference counts of all pages */
+#define PAGE_REFS_ORDER 7
+_Static_assert(PAGING_PAGES * sizeof(uint16_t) <= (PAGE_SIZE << PAGE_REFS_ORDER), "page reference counts do not fit");
+_Static_assert(PAGING_PAGES * sizeof(uint16_t) > (PAGE_SIZE << (PAGE_REFS_ORDER - 1)), "page reference counts fit a smaller block");
 
 /**
- * @var memory_map
- * @brief An array representing the memory map for paging.
- *
- * This array is used to keep track of the status of each page in memory.
- * Each entry in the array corresponds to a page, and the value indicates
- * the status of that page (e.g., free, allocated).
+ * @brief Free blocks of a single order.
  *
- * @note The size of the array is determined by the PAGING_PAGES macro.
+ * Bit n of map is set when block n is free. Bit n of summary is set when
+ * word n of map is non-zero and bit n of top is set when word n of summary
+ * is non-zero.
  */
-static unsigned short memory_map[PAGING_PAGES] = {
-    0,
+struct free_area {
+    uint64_t* map;
+    uint64_t* summary;
+    uint64_t* top;
+    unsigned long blocks; /* number of whole blocks of this order */
+    unsigned long top_words;
+    unsigned long nr_free;
 };
 
+/**
+ * @brief Per-CPU cache of single free pages.
+ *
+ * Refilled with batch pages when it drops to low and drained by batch pages
+ * when it reaches high.
+ */
+struct per_cpu_pages {
+    unsigned long count;
+    unsigned long low;
+    unsigned long high;
+    unsigned long batch;
+    unsigned long zeroed_count;
+    struct pcp_stats stats;
+    unsigned long pages[PCP_HIGH];
+    unsigned long zeroed[PCP_ZEROED_HIGH];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct free_area free_area[MAX_ORDER];
+static spinlock_t zone_lock = SPINLOCK_INIT;
+static struct per_cpu_pages per_cpu_pages[NR_CPUS];
+
+static uint64_t buddy_map[BUDDY_MAP_WORDS];
+static uint64_t buddy_summary[BUDDY_SUMMARY_WORDS];
+static uint64_t buddy_top[BUDDY_TOP_WORDS];
+
+/* references to each page beyond the first */
+static uint16_t* page_refs;
+
+static PERF_REGION(perf_get_free_page, "get_free_page");
+
+#define WORDS(bits) (((bits) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+#define BIT(n) (1ull << ((n) % BITS_PER_WORD))
+
+static int area_test(struct free_area* area, unsigned long block)
+{
+    return (area->map[block / BITS_PER_WORD] & BIT(block)) != 0;
+}
+
+static void area_set(struct free_area* area, unsigned long block)
+{
+    unsigned long word = block / BITS_PER_WORD;
+    unsigned long summary = word / BITS_PER_WORD;
+
+    if (!area->map[word]) {
+        if (!area->summary[summary]) {
+            area->top[summary / BITS_PER_WORD] |= BIT(summary);
+        }
+        area->summary[summary] |= BIT(word);
+    }
+    area->map[word] |= BIT(block);
+    area->nr_free++;
+}
+
+static void area_clear(struct free_area* area, unsigned long block)
+{
+    unsigned long word = block / BITS_PER_WORD;
+    unsigned long summary = word / BITS_PER_WORD;
+
+    area->map[word] &= ~BIT(block);
+    if (!area->map[word]) {
+        area->summary[summary] &= ~BIT(word);
+        if (!area->summary[summary]) {
+            area->top[summary / BITS_PER_WORD] &= ~BIT(summary);
+        }
+    }
+    area->nr_free--;
+}
+
+/**
+ * @brief Finds the lowest free block of an order.
+ *
+ * @return The block index, the caller has to make sure nr_free is non-zero.
+ */
+static unsigned long area_first(struct free_area* area)
+{
+    unsigned long t = 0;
+    while (!area->top[t]) {
+        t++;
+    }
+    unsigned long summary = t * BITS_PER_WORD + __builtin_ctzll(area->top[t]);
+    unsigned long word = summary * BITS_PER_WORD + __builtin_ctzll(area->summary[summary]);
+    return word * BITS_PER_WORD + __builtin_ctzll(area->map[word]);
+}
+
+/**
+ * @brief Initializes the buddy allocator.
+ *
+ * Lays out the bitmaps of every order and releases all pages between
+ * LOW_MEMORY and HIGH_MEMORY as the largest aligned blocks that fit.
+ */
+void mem_init(void)
+{
+    uint64_t* map = buddy_map;
+    uint64_t* summary = buddy_summary;
+    uint64_t* top = buddy_top;
+
+    for (unsigned int order = 0; order < MAX_ORDER; order++) {
+        struct free_area* area = &free_area[order];
+        unsigned long map_words = WORDS(PAGING_PAGES >> order);
+        unsigned long summary_words = WORDS(map_words);
+
+        area->blocks = PAGING_PAGES >> order;
+        area->top_words = WORDS(summary_words);
+        area->nr_free = 0;
+        area->map = map;
+        area->summary = summary;
+        area->top = top;
+
+        map += map_words;
+        summary += summary_words;
+        top += area->top_words;
+    }
+
+    unsigned long page = 0;
+    while (page < PAGING_PAGES) {
+        unsigned int order = MAX_ORDER - 1;
+        while (order && ((page & ((1ul << order) - 1)) || page + (1ul << order) > PAGING_PAGES)) {
+            order--;
+        }
+        area_set(&free_area[order], page >> order);
+        page += 1ul << order;
+    }
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        per_cpu_pages[cpu].count = 0;
+        per_cpu_pages[cpu].zeroed_count = 0;
+        per_cpu_pages[cpu].low = PCP_LOW;
+        per_cpu_pages[cpu].high = PCP_HIGH;
+        per_cpu_pages[cpu].batch = PCP_BATCH;
+    }
+
+    page_refs = (uint16_t*)alloc_pages(PAGE_REFS_ORDER);
+    memset(page_refs, 0, PAGE_SIZE << PAGE_REFS_ORDER);
+}
+
+/**
+ * @brief Takes 2^order pages from the buddy allocator, zone_lock must be held.
+ *
+ * Takes the lowest free block of the smallest order that is large enough and
+ * splits it down, returning the unused halves to the lower orders.
+ */
+static unsigned long buddy_alloc(unsigned int order)
+{
+    unsigned int current_order = order;
+
+    while (current_order < MAX_ORDER && !free_area[current_order].nr_free) {
+        current_order++;
+    }
+    if (current_order >= MAX_ORDER) {
+        return 0;
+    }
+
+    unsigned long block = area_first(&free_area[current_order]);
+    area_clear(&free_area[current_order], block);
+
+    while (current_order > order) {
+        current_order--;
+        block <<= 1;
+        area_set(&free_area[current_order], block + 1);
+    }
+
+    return LOW_MEMORY + ((block << order) << PAGE_SHIFT);
+}
+
+/**
+ * @brief Returns 2^order pages to the buddy allocator, zone_lock must be held.
+ *
+ * The block is merged with its buddy for as long as the buddy is free.
+ */
+static void buddy_free(unsigned long p, unsigned int order)
+{
+    unsigned long block = ((p - LOW_MEMORY) >> PAGE_SHIFT) >> order;
+
+    while (order < MAX_ORDER - 1) {
+        struct free_area* area = &free_area[order];
+        unsigned long buddy = block ^ 1;
+
+        if (buddy >= area->blocks || !area_test(area, buddy)) {
+            break;
+        }
+        area_clear(area, buddy);
+        block >>= 1;
+        order++;
+    }
+    area_set(&free_area[order], block);
+}
+
+/**
+ * @brief Allocates 2^order physically contiguous pages.
+ *
+ * @param order Order of the block.
+ * @return The address of the first page, or 0 if no block is available.
+ */
+unsigned long alloc_pages(unsigned int order)
+{
+    unsigned long flags = spin_lock_irqsave(&zone_lock);
+    unsigned long p = buddy_alloc(order);
+    spin_unlock_irqrestore(&zone_lock, flags);
+    return p;
+}
+
+/**
+ * @brief Frees 2^order pages allocated with alloc_pages().
+ *
+ * @param p The address returned by alloc_pages().
+ * @param order The order that was passed to alloc_pages().
+ */
+void free_pages(unsigned long p, unsigned int order)
+{
+    unsigned long flags = spin_lock_irqsave(&zone_lock);
+    buddy_free(p, order);
+    spin_unlock_irqrestore(&zone_lock, flags);
+}
+
+/**
+ * @brief Reports the number of free blocks of every order.
+ *
+ * @param stats Filled with the current allocator state.
+ */
+void mem_get_stats(struct mem_stats* stats)
+{
+    unsigned long flags = spin_lock_irqsave(&zone_lock);
+    stats->free_pages = 0;
+    for (unsigned int order = 0; order < MAX_ORDER; order++) {
+        stats->nr_free[order] = free_area[order].nr_free;
+        stats->free_pages += free_area[order].nr_free << order;
+    }
+    spin_unlock_irqrestore(&zone_lock, flags);
+
+    stats->cached_pages = 0;
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        stats->cached_pages += per_cpu_pages[cpu].count + per_cpu_pages[cpu].zeroed_count;
+    }
+}
+
+/**
+ * @brief Tells whether a page lies in a free buddy block of any order, zone_lock must be held.
+ */
+static int buddy_page_free(unsigned long page)
+{
+    for (unsigned int order = 0; order < MAX_ORDER; order++) {
+        unsigned long block = page >> order;
+        if (block < free_area[order].blocks && area_test(&free_area[order], block)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks the free bitmaps of one order, zone_lock must be held.
+ *
+ * @return The number of broken invariants found.
+ */
+static unsigned long area_check(unsigned int order)
+{
+    struct free_area* area = &free_area[order];
+    unsigned long map_words = WORDS(area->blocks);
+    unsigned long summary_words = WORDS(map_words);
+    unsigned long errors = 0, nr_free = 0;
+
+    for (unsigned long w = 0; w < map_words; w++) {
+        uint64_t bits = area->map[w];
+
+        /* summary bits mirror the map words */
+        if (!!bits != !!(area->summary[w / BITS_PER_WORD] & BIT(w))) {
+            errors++;
+        }
+        nr_free += __builtin_popcountll(bits);
+
+        while (bits) {
+            unsigned long block = w * BITS_PER_WORD + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            if (block >= area->blocks) {
+                errors++;
+                continue;
+            }
+            /* a free buddy should have been merged */
+            if (order < MAX_ORDER - 1 && (block ^ 1) < area->blocks && area_test(area, block ^ 1)) {
+                errors += block & 1;
+            }
+            /* a page must not be free in two orders at once */
+            for (unsigned int up = order + 1; up < MAX_ORDER; up++) {
+                unsigned long parent = block >> (up - order);
+                if (parent < free_area[up].blocks && area_test(&free_area[up], parent)) {
+                    errors++;
+                }
+            }
+        }
+    }
+    for (unsigned long w = 0; w < summary_words; w++) {
+        if (!!area->summary[w] != !!(area->top[w / BITS_PER_WORD] & BIT(w))) {
+            errors++;
+        }
+    }
+    if (nr_free != area->nr_free) {
+        errors++;
+    }
+    return errors;
+}
+
+/**
+ * @brief Checks the invariants of the page allocator.
+ *
+ * Walks the bitmaps of every order: the counters and summary levels agree
+ * with the maps, no two free buddies are left unmerged, no page is free in
+ * two orders, no page in a per-CPU cache or zeroed pool is also free in the
+ * buddy allocator and the pages in the zeroed pools are still zero. Takes a
+ * while, meant for stress tests.
+ *
+ * @return The number of broken invariants found, 0 if the allocator is sound.
+ */
+unsigned long mem_check(void)
+{
+    unsigned long errors = 0;
+    unsigned long flags = spin_lock_irqsave(&zone_lock);
+
+    for (unsigned int order = 0; order < MAX_ORDER; order++) {
+        errors += area_check(order);
+    }
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct per_cpu_pages* pcp = &per_cpu_pages[cpu];
+        for (unsigned long i = 0; i < pcp->count; i++) {
+            if (buddy_page_free((pcp->pages[i] - LOW_MEMORY) >> PAGE_SHIFT)) {
+                errors++;
+            }
+        }
+        for (unsigned long i = 0; i < pcp->zeroed_count; i++) {
+            const uint64_t* words = (const uint64_t*)pcp->zeroed[i];
+
+            if (buddy_page_free((pcp->zeroed[i] - LOW_MEMORY) >> PAGE_SHIFT)) {
+                errors++;
+            }
+            for (unsigned long w = 0; w < PAGE_SIZE / sizeof(*words); w++) {
+                if (words[w]) {
+                    errors++;
+                    break;
+                }
+            }
+        }
+    }
+    spin_unlock_irqrestore(&zone_lock, flags);
+    return errors;
+}
+
+/**
+ * @brief Reports the page cache counters of a core.
+ *
+ * @param cpu The core to report.
+ * @param stats Filled with the counters.
+ */
+void mem_get_pcp_stats(unsigned int cpu, struct pcp_stats* stats)
+{
+    *stats = per_cpu_pages[cpu].stats;
+}
+
+/**
+ * @brief Moves a batch of pages from the buddy allocator to a per-CPU cache.
+ */
+static void pcp_refill(struct per_cpu_pages* pcp)
+{
+    spin_lock(&zone_lock);
+    while (pcp->count < pcp->low + pcp->batch) {
+        unsigned long p = buddy_alloc(0);
+        if (!p) {
+            break;
+        }
+        pcp->pages[pcp->count++] = p;
+    }
+    spin_unlock(&zone_lock);
+    pcp->stats.refills++;
+}
+
+/**
+ * @brief Moves a batch of pages from a per-CPU cache back to the buddy allocator.
+ */
+static void pcp_drain(struct per_cpu_pages* pcp)
+{
+    spin_lock(&zone_lock);
+    for (unsigned long i = 0; i < pcp->batch && pcp->count; i++) {
+        buddy_free(pcp->pages[--pcp->count], 0);
+    }
+    spin_unlock(&zone_lock);
+    pcp->stats.drains++;
+}
+
 /**
  * @brief Retrieves a free memory page.
  *
  * This function searches for and returns an available free memory page.
+ * The page is taken from the cache of the current core, which is refilled
+ * from the buddy allocator when it runs low.
  *
  * @return The address of the free memory page, or 0 if no free page is available.
  */
 unsigned long get_free_page()
 {
-    for (unsigned int i = 0; i < PAGING_PAGES; i++) {
-        if (memory_map[i] == 0) {
-            memory_map[i] = 1;
-            return LOW_MEMORY + i * PAGE_SIZE;
+    struct pmu_sample start;
+    perf_start(&start);
+
+    unsigned long flags = local_irq_save();
+    struct per_cpu_pages* pcp = &per_cpu_pages[smp_processor_id()];
+
+    if (pcp->count > pcp->low) {
+        pcp->stats.hits++;
+    } else {
+        pcp->stats.misses++;
+        pcp_refill(pcp);
+    }
+
+    unsigned long p = 0;
+    if (pcp->count) {
+        p = pcp->pages[--pcp->count];
+    }
+    local_irq_restore(flags);
+
+    perf_stop(&perf_get_free_page, &start);
+    return p;
+}
+
+/**
+ * @brief Retrieves a free memory page filled with zeros.
+ *
+ * The page comes from the zeroed pool of the current core if it has one,
+ * otherwise a free page is cleared here.
+ *
+ * @return The address of the page, or 0 if no free page is available.
+ */
+unsigned long get_zeroed_page(void)
+{
+    unsigned long p = 0;
+    unsigned long flags = local_irq_save();
+    struct per_cpu_pages* pcp = &per_cpu_pages[smp_processor_id()];
+
+    if (pcp->zeroed_count) {
+        p = pcp->zeroed[--pcp->zeroed_count];
+        pcp->stats.zeroed_hits++;
+    } else {
+        pcp->stats.zeroed_misses++;
+    }
+    local_irq_restore(flags);
+
+    if (!p) {
+        p = get_free_page();
+        if (p) {
+            clear_page((void*)p);
         }
     }
-    return 0;
+    return p;
+}
+
+/**
+ * @brief Zeroes one page into the zeroed pool of the current core.
+ *
+ * Called from the idle loop. The page is cleared with interrupts enabled,
+ * so a single call never holds up a task that became ready for long.
+ *
+ * @return 1 if a page was added, 0 if the pool is full or memory ran out.
+ */
+int mem_refill_zeroed(void)
+{
+    if (per_cpu_pages[smp_processor_id()].zeroed_count >= PCP_ZEROED_HIGH) {
+        return 0;
+    }
+
+    unsigned long p = get_free_page();
+    if (!p) {
+        return 0;
+    }
+    clear_page((void*)p);
+
+    unsigned long flags = local_irq_save();
+    struct per_cpu_pages* pcp = &per_cpu_pages[smp_processor_id()];
+    int added = pcp->zeroed_count < PCP_ZEROED_HIGH;
+
+    if (added) {
+        pcp->zeroed[pcp->zeroed_count++] = p;
+        pcp->stats.zeroed_refills++;
+    }
+    local_irq_restore(flags);
+
+    if (!added) {
+        free_page(p);
+    }
+    return added;
 }
 
 /**
  * @brief Frees a memory page.
  *
- * This function releases the memory page at the given address.
+ * This function releases the memory page at the given address to the cache
+ * of the current core, which is drained to the buddy allocator when full.
  *
  * @param p The address of the memory page to be freed.
  */
 void free_page(unsigned long p)
 {
-    memory_map[(p - LOW_MEMORY) / PAGE_SIZE] = 0;
+    unsigned long flags = local_irq_save();
+    struct per_cpu_pages* pcp = &per_cpu_pages[smp_processor_id()];
+
+    if (pcp->count >= pcp->high) {
+        pcp_drain(pcp);
+    }
+    pcp->pages[pcp->count++] = p;
+    local_irq_restore(flags);
+}
+
+static inline uint16_t* page_ref(unsigned long p)
+{
+    return &page_refs[(p - LOW_MEMORY) >> PAGE_SHIFT];
+}
+
+/**
+ * @brief Takes another reference to a page.
+ *
+ * Pages of the kernel image, which user text is mapped from, are not
+ * counted and never freed.
+ *
+ * @param p The address of the page, from get_free_page() or get_zeroed_page().
+ */
+void get_page(unsigned long p)
+{
+    if (p < LOW_MEMORY) {
+        return;
+    }
+    __atomic_add_fetch(page_ref(p), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Drops a reference to a page, frees it with the last one.
+ *
+ * @param p The address of the page.
+ */
+void put_page(unsigned long p)
+{
+    if (p < LOW_MEMORY) {
+        return;
+    }
+    uint16_t* ref = page_ref(p);
+    uint16_t refs = __atomic_load_n(ref, __ATOMIC_ACQUIRE);
+
+    /* the last reference is not counted, nobody else can take one */
+    while (refs) {
+        if (__atomic_compare_exchange_n(ref, &refs, refs - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+    }
+    free_page(p);
+}
+
+/**
+ * @brief Returns the number of references to a page.
+ *
+ * Pages of the kernel image are not counted and always reported as shared,
+ * so do_wp_page() copies them instead of making them writable.
+ */
+unsigned int page_count(unsigned long p)
+{
+    if (p < LOW_MEMORY) {
+        return 2;
+    }
+    return __atomic_load_n(page_ref(p), __ATOMIC_ACQUIRE) + 1;
 }
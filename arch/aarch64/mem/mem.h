@@ -8,14 +8,61 @@
 #define PAGE_SIZE (1 << PAGE_SHIFT)
 #define SECTION_SIZE (1 << SECTION_SHIFT)
 
+/* raspi4b in low peripheral mode, only the first GB of RAM is mapped, see mmu.c */
+#define RAM_END 0x40000000
+/* the last 16MB of it are shared with the GPU, which does not snoop the ARM caches */
+#define GPU_MEMORY_START (RAM_END - 16 * 1024 * 1024)
+
 #define LOW_MEMORY (2 * SECTION_SIZE)
-/* hardcoded for raspi4b */
-#define HIGH_MEMORY 0xFE000000
+/* the page allocator manages the mapped RAM up to the GPU memory */
+#define HIGH_MEMORY GPU_MEMORY_START
 
 #define PAGING_MEMORY (HIGH_MEMORY - LOW_MEMORY)
 #define PAGING_PAGES (PAGING_MEMORY / PAGE_SIZE)
 
+/* buddy allocator, blocks of 2^0 .. 2^(MAX_ORDER - 1) pages */
+#define MAX_ORDER 11
+
+/* per-CPU single page cache watermarks */
+#define PCP_LOW 0
+#define PCP_HIGH 64
+#define PCP_BATCH 16
+/* per-CPU pool of pages zeroed ahead of time by the idle task */
+#define PCP_ZEROED_HIGH 32
+
+#ifndef __ASSEMBLER__
+
+struct mem_stats {
+    unsigned long free_pages; /* free pages in the buddy allocator */
+    unsigned long cached_pages; /* free pages held in per-CPU caches and zeroed pools */
+    unsigned long nr_free[MAX_ORDER]; /* free blocks per order */
+};
+
+struct pcp_stats {
+    unsigned long hits; /* get_free_page() served from the cache */
+    unsigned long misses; /* get_free_page() that had to refill first */
+    unsigned long refills;
+    unsigned long drains;
+    unsigned long zeroed_hits; /* get_zeroed_page() served from the zeroed pool */
+    unsigned long zeroed_misses; /* get_zeroed_page() that had to clear a page */
+    unsigned long zeroed_refills; /* pages zeroed into the pool by the idle task */
+};
+
+void mem_init(void);
+unsigned long alloc_pages(unsigned int order);
+void free_pages(unsigned long p, unsigned int order);
+void mem_get_stats(struct mem_stats* stats);
+void mem_get_pcp_stats(unsigned int cpu, struct pcp_stats* stats);
+unsigned long mem_check(void);
+
 void free_page(unsigned long p);
 unsigned long get_free_page();
+unsigned long get_zeroed_page(void);
+int mem_refill_zeroed(void);
+void clear_page(void* page);
+void get_page(unsigned long p);
+void put_page(unsigned long p);
+unsigned int page_count(unsigned long p);
 
+#endif /* __ASSEMBLER__ */
 #endif
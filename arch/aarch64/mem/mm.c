@@ -0,0 +1,542 @@
+/**
+ * @file mm.c
+ * @brief Address spaces and ASID allocation.
+ *
+ * Every address space has its own TTBR0 root, whose first entry is the
+ * kernel identity map shared with all others. Switching address spaces only
+ * writes TTBR0: its user entries are not global and are tagged with the
+ * ASID of the address space, so the TLB entries of other address spaces stay
+ * valid and no flush is needed.
+ *
+ * ASIDs are 16 bits wide when the core supports it, 8 otherwise, ASID 0 is
+ * init_mm's. An address space keeps its ASID until all of them are used up.
+ * Then the generation, kept in the bits above the ASID, is bumped, the map
+ * of used ASIDs is cleared except for the ones that are running and every
+ * core flushes its TLB before it switches to an address space again. An
+ * address space of an older generation gets a new ASID the next time it is
+ * switched to. Switches within the current generation take no lock.
+ */
+#include <stdint.h>
+
+#include "mem/mem.h"
+#include "mem/mm.h"
+#include "mem/mmu.h"
+#include "mem/pgtable.h"
+#include "mem/slab.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "sync/spinlock.h"
+
+#define ASID_MAX_BITS 16
+#define BITS_PER_WORD 64
+
+struct mm_struct init_mm = {
+    .users = 1,
+    .lock = SPINLOCK_INIT,
+    .mmap = LIST_HEAD_INIT(init_mm.mmap),
+};
+
+static struct kmem_cache* mm_cache;
+static struct kmem_cache* vma_cache;
+
+static unsigned int asid_bits;
+static uint64_t asid_generation;
+static uint64_t asid_map[(1ul << ASID_MAX_BITS) / BITS_PER_WORD];
+static unsigned long asid_next = 1;
+static spinlock_t asid_lock = SPINLOCK_INIT;
+
+/* ASID each core runs, 0 while a rollover takes it away */
+static uint64_t active_asids[NR_CPUS];
+/* ASIDs that stayed in use over the last rollover */
+static uint64_t reserved_asids[NR_CPUS];
+/* cores that must flush their TLB before the next switch */
+static unsigned long tlb_flush_pending;
+
+static int asids_disabled;
+
+#define NUM_ASIDS (1ul << asid_bits)
+#define ASID_FIRST_GENERATION NUM_ASIDS
+#define asid_index(id) ((id) & (NUM_ASIDS - 1))
+
+static inline void cpu_switch_mm(uint64_t* pgd, uint64_t asid)
+{
+    uint64_t ttbr0 = (uint64_t)pgd | MM_TTBR_CNP | (asid << 48);
+    asm volatile("msr ttbr0_el1, %[ttbr0]\n\t"
+                 "isb"
+        :
+        : [ttbr0] "r"(ttbr0)
+        : "memory");
+}
+
+static inline void local_flush_tlb_all(void)
+{
+    asm volatile("dsb nshst\n\t"
+                 "tlbi vmalle1\n\t"
+                 "dsb nsh\n\t"
+                 "isb" ::: "memory");
+}
+
+static inline int generation_current(uint64_t id)
+{
+    return !((id ^ __atomic_load_n(&asid_generation, __ATOMIC_RELAXED)) >> asid_bits);
+}
+
+/**
+ * @brief Creates the mm_struct cache and sets up the ASID allocator.
+ *
+ * Must be called after kmem_cache_init() and mmu_init().
+ */
+void mm_init(void)
+{
+    mm_cache = kmem_cache_create("mm_struct", sizeof(struct mm_struct), SLAB_HWCACHE_ALIGN);
+    vma_cache = kmem_cache_create("vm_area_struct", sizeof(struct vm_area_struct), 0);
+    asid_bits = mmu_asid_bits();
+    asid_generation = ASID_FIRST_GENERATION;
+    init_mm.pgd = idmap_pgd;
+}
+
+static unsigned long asid_find_free(unsigned long from)
+{
+    for (unsigned long i = from; i < NUM_ASIDS;) {
+        uint64_t free = ~asid_map[i / BITS_PER_WORD] >> (i % BITS_PER_WORD);
+
+        if (free) {
+            return i + __builtin_ctzll(free);
+        }
+        i = (i / BITS_PER_WORD + 1) * BITS_PER_WORD;
+    }
+    return NUM_ASIDS;
+}
+
+static inline void asid_set(unsigned long index)
+{
+    asid_map[index / BITS_PER_WORD] |= 1ull << (index % BITS_PER_WORD);
+}
+
+/**
+ * @brief Starts a new generation, asid_lock must be held.
+ *
+ * The ASIDs running on the cores stay reserved, so their address spaces keep
+ * them, everything else is given up and every core flushes its TLB.
+ */
+static void flush_context(void)
+{
+    for (unsigned long i = 0; i < NUM_ASIDS / BITS_PER_WORD; i++) {
+        asid_map[i] = 0;
+    }
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        uint64_t id = __atomic_exchange_n(&active_asids[cpu], 0, __ATOMIC_RELAXED);
+        /* a core that did not switch since the last rollover still runs its reserved ASID */
+        if (!id) {
+            id = reserved_asids[cpu];
+        }
+        asid_set(asid_index(id));
+        reserved_asids[cpu] = id;
+    }
+    __atomic_store_n(&tlb_flush_pending, (1ul << NR_CPUS) - 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Moves a reserved ASID to the new generation, asid_lock must be held.
+ */
+static int update_reserved_asid(uint64_t id, uint64_t new_id)
+{
+    int hit = 0;
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (reserved_asids[cpu] == id) {
+            reserved_asids[cpu] = new_id;
+            hit = 1;
+        }
+    }
+    return hit;
+}
+
+/**
+ * @brief Returns an ASID of the current generation for mm, asid_lock must be held.
+ */
+static uint64_t new_context(struct mm_struct* mm)
+{
+    uint64_t id = mm->context_id;
+    uint64_t generation = __atomic_load_n(&asid_generation, __ATOMIC_RELAXED);
+
+    if (id) {
+        uint64_t new_id = generation | asid_index(id);
+        unsigned long index = asid_index(id);
+
+        /* still running somewhere since the rollover */
+        if (update_reserved_asid(id, new_id)) {
+            return new_id;
+        }
+        /* keep the old ASID if nobody took it in this generation */
+        if (!(asid_map[index / BITS_PER_WORD] & (1ull << (index % BITS_PER_WORD)))) {
+            asid_set(index);
+            return new_id;
+        }
+    }
+
+    unsigned long index = asid_find_free(asid_next);
+    if (index == NUM_ASIDS) {
+        generation = __atomic_add_fetch(&asid_generation, ASID_FIRST_GENERATION, __ATOMIC_RELAXED);
+        flush_context();
+        index = asid_find_free(1);
+    }
+    asid_set(index);
+    asid_next = index;
+    return generation | index;
+}
+
+/**
+ * @brief Loads an address space on the calling core.
+ *
+ * Must be called with preemption disabled. Takes a new ASID first if the one
+ * of mm is from an older generation.
+ */
+void switch_mm(struct mm_struct* mm)
+{
+    if (mm == &init_mm || asids_disabled) {
+        /* ASID 0, shared by everything when ASIDs are off */
+        cpu_switch_mm(mm->pgd, 0);
+        if (asids_disabled) {
+            local_flush_tlb_all();
+        }
+        return;
+    }
+
+    unsigned int cpu = smp_processor_id();
+    uint64_t id = __atomic_load_n(&mm->context_id, __ATOMIC_RELAXED);
+    uint64_t active = __atomic_load_n(&active_asids[cpu], __ATOMIC_RELAXED);
+
+    /* a rollover clears active_asids first, then the exchange fails */
+    if (!active || !generation_current(id) || !__atomic_compare_exchange_n(&active_asids[cpu], &active, id, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        unsigned long flags = spin_lock_irqsave(&asid_lock);
+
+        id = mm->context_id;
+        if (!generation_current(id)) {
+            id = new_context(mm);
+            __atomic_store_n(&mm->context_id, id, __ATOMIC_RELAXED);
+        }
+        if (__atomic_load_n(&tlb_flush_pending, __ATOMIC_ACQUIRE) & (1ul << cpu)) {
+            __atomic_and_fetch(&tlb_flush_pending, ~(1ul << cpu), __ATOMIC_RELAXED);
+            local_flush_tlb_all();
+        }
+        __atomic_store_n(&active_asids[cpu], id, __ATOMIC_RELAXED);
+        spin_unlock_irqrestore(&asid_lock, flags);
+    }
+
+    cpu_switch_mm(mm->pgd, asid_index(id));
+}
+
+/**
+ * @brief Turns ASIDs on or off, for benchmarks.
+ *
+ * Without them every address space runs with ASID 0 and each switch flushes
+ * the TLB of the core. The TLBs of all cores are flushed when switching
+ * modes, so no entry tagged in one mode is hit in the other.
+ *
+ * @param enable 0 to turn ASIDs off.
+ */
+void mm_use_asids(int enable)
+{
+    asids_disabled = !enable;
+    flush_tlb_all();
+}
+
+/**
+ * @brief Creates an empty address space.
+ *
+ * @return The address space with one user, or 0 if no memory is left.
+ */
+struct mm_struct* mm_alloc(void)
+{
+    struct mm_struct* mm = kmem_cache_alloc(mm_cache);
+    if (!mm) {
+        return 0;
+    }
+
+    mm->pgd = pgd_alloc();
+    if (!mm->pgd) {
+        kmem_cache_free(mm_cache, mm);
+        return 0;
+    }
+    mm->context_id = 0;
+    mm->users = 1;
+    mm->lock = (spinlock_t)SPINLOCK_INIT;
+    list_init(&mm->mmap);
+    return mm;
+}
+
+static void free_vmas(struct mm_struct* mm)
+{
+    struct list_head *pos, *n;
+
+    list_for_each_safe(pos, n, &mm->mmap)
+    {
+        list_del(pos);
+        kmem_cache_free(vma_cache, list_entry(pos, struct vm_area_struct, list));
+    }
+}
+
+/**
+ * @brief Copies the areas of oldmm to mm, oldmm->lock must be held.
+ */
+static int dup_vmas(struct mm_struct* mm, struct mm_struct* oldmm)
+{
+    struct list_head* pos;
+
+    list_for_each(pos, &oldmm->mmap)
+    {
+        struct vm_area_struct* vma = kmem_cache_alloc(vma_cache);
+        if (!vma) {
+            return -1;
+        }
+        *vma = *list_entry(pos, struct vm_area_struct, list);
+        list_add_tail(&vma->list, &mm->mmap);
+    }
+    return 0;
+}
+
+/**
+ * @brief Creates a copy-on-write copy of an address space.
+ *
+ * The pages of oldmm are shared read-only, whichever address space writes
+ * to one first gets its own copy in do_page_fault().
+ *
+ * @param oldmm The address space to copy, its user half must only map pages.
+ *
+ * @return The new address space with one user, or 0 on failure.
+ */
+struct mm_struct* dup_mm(struct mm_struct* oldmm)
+{
+    struct mm_struct* mm = mm_alloc();
+    if (!mm) {
+        return 0;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&oldmm->lock);
+    int ret = dup_vmas(mm, oldmm) || pgd_copy_cow(mm->pgd, oldmm->pgd);
+    /* the pages of oldmm that became read-only may still be writable in a TLB */
+    flush_tlb_mm(oldmm);
+    spin_unlock_irqrestore(&oldmm->lock, flags);
+
+    if (ret) {
+        mm_put(mm);
+        return 0;
+    }
+    return mm;
+}
+
+/**
+ * @brief Returns the area addr lies in, mm->lock must be held.
+ *
+ * @return The area, or 0 if addr is not in any.
+ */
+struct vm_area_struct* find_vma(struct mm_struct* mm, unsigned long addr)
+{
+    struct list_head* pos;
+
+    list_for_each(pos, &mm->mmap)
+    {
+        struct vm_area_struct* vma = list_entry(pos, struct vm_area_struct, list);
+
+        if (addr < vma->vm_start) {
+            break;
+        }
+        if (addr < vma->vm_end) {
+            return vma;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reserves a range of user addresses, backed by zeroed pages on first touch.
+ *
+ * Nothing is allocated or mapped here, do_page_fault() maps a zeroed page
+ * the first time a page of the range is accessed.
+ *
+ * @param mm The address space.
+ * @param addr First address, page aligned, or 0 to take the lowest free range.
+ * @param len Size of the range, rounded up to whole pages.
+ * @param flags VM_READ, VM_WRITE and VM_EXEC.
+ *
+ * @return The first address of the range, 0 if it overlaps another one or
+ *         does not fit.
+ */
+unsigned long do_mmap(struct mm_struct* mm, unsigned long addr, unsigned long len, unsigned long flags)
+{
+    struct list_head* pos;
+
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1ul);
+    if (!len || (addr & (PAGE_SIZE - 1)) || len > USER_VA_END - USER_VA_START) {
+        return 0;
+    }
+
+    struct vm_area_struct* vma = kmem_cache_alloc(vma_cache);
+    if (!vma) {
+        return 0;
+    }
+
+    unsigned long irq_flags = spin_lock_irqsave(&mm->lock);
+    unsigned long start = addr ? addr : USER_VA_START;
+
+    /* areas are sorted, the new one goes before the first one above it */
+    list_for_each(pos, &mm->mmap)
+    {
+        struct vm_area_struct* next = list_entry(pos, struct vm_area_struct, list);
+
+        if (start + len <= next->vm_start) {
+            break;
+        }
+        if (start < next->vm_end) {
+            if (addr) {
+                break;
+            }
+            start = next->vm_end;
+        }
+    }
+    if (start < USER_VA_START || start > USER_VA_END - len
+        || (pos != &mm->mmap && start + len > list_entry(pos, struct vm_area_struct, list)->vm_start)) {
+        spin_unlock_irqrestore(&mm->lock, irq_flags);
+        kmem_cache_free(vma_cache, vma);
+        return 0;
+    }
+
+    vma->vm_start = start;
+    vma->vm_end = start + len;
+    vma->vm_flags = flags;
+    list_add_tail(&vma->list, pos);
+    spin_unlock_irqrestore(&mm->lock, irq_flags);
+    return start;
+}
+
+/**
+ * @brief Checks that a range of user addresses may be accessed.
+ *
+ * The kernel reads and writes user memory on the same tables as the task,
+ * pages that are not backed yet fault in like they would for the task.
+ *
+ * @param flags VM_READ and/or VM_WRITE, every area of the range must allow them.
+ *
+ * @return 1 if the range lies in areas of mm, 0 if any of it does not.
+ */
+int access_ok(struct mm_struct* mm, unsigned long addr, unsigned long len, unsigned long flags)
+{
+    unsigned long end = addr + len;
+    int ok = 1;
+
+    if (addr < USER_VA_START || end < addr || end > USER_VA_END) {
+        return 0;
+    }
+
+    unsigned long irq_flags = spin_lock_irqsave(&mm->lock);
+    /* the areas are sorted, a gap between them ends the range */
+    while (addr < end) {
+        struct vm_area_struct* vma = find_vma(mm, addr);
+
+        if (!vma || (vma->vm_flags & flags) != flags) {
+            ok = 0;
+            break;
+        }
+        addr = vma->vm_end;
+    }
+    spin_unlock_irqrestore(&mm->lock, irq_flags);
+    return ok;
+}
+
+/**
+ * @brief Maps the user text of the kernel image at USER_TEXT_START.
+ *
+ * The pages stay part of the image, every address space maps the same ones
+ * read-only, see user_text_addr().
+ *
+ * @return 0 on success, -1 if the range is taken or memory ran out.
+ */
+int mm_map_user_text(struct mm_struct* mm)
+{
+    unsigned long size = (unsigned long)__user_end - (unsigned long)__user_start;
+
+    if (do_mmap(mm, USER_TEXT_START, size, VM_READ | VM_EXEC) != USER_TEXT_START) {
+        return -1;
+    }
+
+    unsigned long irq_flags = spin_lock_irqsave(&mm->lock);
+    int ret = map_range(mm->pgd, USER_TEXT_START, (unsigned long)__user_start, size, PROT_USER_EXEC);
+    spin_unlock_irqrestore(&mm->lock, irq_flags);
+    return ret;
+}
+
+static inline uint64_t mm_asid(struct mm_struct* mm)
+{
+    return asids_disabled ? 0 : asid_index(__atomic_load_n(&mm->context_id, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief Invalidates the TLB entries of an address space on every core.
+ */
+void flush_tlb_mm(struct mm_struct* mm)
+{
+    asm volatile("dsb ishst\n\t"
+                 "tlbi aside1is, %[asid]\n\t"
+                 "dsb ish\n\t"
+                 "isb"
+        :
+        : [asid] "r"(mm_asid(mm) << 48)
+        : "memory");
+}
+
+/**
+ * @brief Invalidates the TLB entries of a single page of an address space on every core.
+ */
+void flush_tlb_page(struct mm_struct* mm, unsigned long va)
+{
+    asm volatile("dsb ishst\n\t"
+                 "tlbi vae1is, %[page]\n\t"
+                 "dsb ish\n\t"
+                 "isb"
+        :
+        : [page] "r"((mm_asid(mm) << 48) | ((va >> PAGE_SHIFT) & ((1ul << 44) - 1)))
+        : "memory");
+}
+
+/**
+ * @brief Takes a reference to an address space.
+ */
+void mm_get(struct mm_struct* mm)
+{
+    __atomic_add_fetch(&mm->users, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Drops a reference to an address space, frees it with the last one.
+ *
+ * Its ASID is not handed out again before the next rollover, which flushes
+ * the TLBs, so stale entries of it are never hit.
+ */
+void mm_put(struct mm_struct* mm)
+{
+    if (__atomic_sub_fetch(&mm->users, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    pgd_free(mm->pgd);
+    free_vmas(mm);
+    kmem_cache_free(mm_cache, mm);
+}
+
+/**
+ * @brief Makes mm the address space of the current task.
+ *
+ * @param mm The address space, the task takes its own reference.
+ */
+void mm_attach(struct mm_struct* mm)
+{
+    struct mm_struct* old = current->mm;
+
+    mm_get(mm);
+    preempt_disable();
+    current->mm = mm;
+    switch_mm(mm);
+    preempt_enable();
+    mm_put(old);
+}
@@ -0,0 +1,63 @@
+#ifndef _MM_H
+#define _MM_H
+
+#include <stdint.h>
+
+#include "lib/list.h"
+#include "sync/spinlock.h"
+
+/* vm_area_struct flags */
+#define VM_READ (1 << 0)
+#define VM_WRITE (1 << 1)
+#define VM_EXEC (1 << 2)
+
+/* code that runs in EL0, linked into .text.user of the kernel image */
+extern char __user_start[];
+extern char __user_end[];
+
+/* user address of a symbol in .text.user, once mm_map_user_text() mapped it */
+#define user_text_addr(sym) (USER_TEXT_START + ((unsigned long)(sym) - (unsigned long)__user_start))
+
+/**
+ * @brief A range of user addresses reserved by do_mmap().
+ *
+ * Pages are only allocated and mapped when the range is first touched.
+ */
+struct vm_area_struct {
+    unsigned long vm_start;
+    unsigned long vm_end; /* first address after the area */
+    unsigned long vm_flags;
+    struct list_head list; /* in mm->mmap, sorted by address */
+};
+
+/**
+ * @brief Address space of a task.
+ *
+ * Kernel threads share init_mm, which only has the kernel identity map.
+ */
+struct mm_struct {
+    uint64_t* pgd; /* TTBR0 root */
+    uint64_t context_id; /* ASID generation | ASID, 0 until first switched to */
+    long users;
+    spinlock_t lock; /* serializes changes to the tables and the areas */
+    struct list_head mmap; /* vm_area_structs */
+};
+
+extern struct mm_struct init_mm;
+
+void mm_init(void);
+struct mm_struct* mm_alloc(void);
+void mm_get(struct mm_struct* mm);
+void mm_put(struct mm_struct* mm);
+struct mm_struct* dup_mm(struct mm_struct* oldmm);
+unsigned long do_mmap(struct mm_struct* mm, unsigned long addr, unsigned long len, unsigned long flags);
+struct vm_area_struct* find_vma(struct mm_struct* mm, unsigned long addr);
+int access_ok(struct mm_struct* mm, unsigned long addr, unsigned long len, unsigned long flags);
+int mm_map_user_text(struct mm_struct* mm);
+void flush_tlb_mm(struct mm_struct* mm);
+void flush_tlb_page(struct mm_struct* mm, unsigned long va);
+void mm_attach(struct mm_struct* mm);
+void switch_mm(struct mm_struct* mm);
+void mm_use_asids(int enable);
+
+#endif /* _MM_H */
@@ -4,64 +4,60 @@
  *
  * This file contains the implementation of the Memory Management Unit (MMU)
  * functionalities for the kernel.
+ *
+ * Both halves of the address space use four levels of 4KB tables, see
+ * mem/pgtable.h. The kernel runs on an identity map in the first level 0
+ * entry of TTBR0: the image is linked at its load address and the
+ * peripheral headers use physical addresses. The rest of TTBR0 is left to
+ * per-process address spaces, which share that first entry.
+ *
+ * TTBR1 maps RAM and peripherals linearly at PAGE_OFFSET as well, but
+ * nothing runs from it or accesses kernel data through it yet, so this is
+ * not a higher half kernel.
  */
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include "mem/cache.h"
 #include "mem/mem.h"
 #include "mem/mmu.h"
+#include "mem/pgtable.h"
 #include "mmio/mmio.h"
 #include "peripherals/bcm2711/cpu.h"
 
-#ifdef __aarch64__
-#define BCM_VERSION 2711
-// Each entry is a gig.
-uint64_t level_1_table[512] __attribute__((aligned(4096)));
+#define PERIPHERALS_START 0xFC000000ul
+#define PERIPHERALS_END 0x100000000ul
 
-// First gig is stack, code, rodata then data, bss, ram and then GPU.
-uint64_t level_2[512] __attribute__((aligned(4096)));
+extern char __text_start[];
+extern char __text_end[];
 
-#if BCM_VERSION == 2711
-// Third gig has peripherals
-uint64_t level_2_peripherals[512] __attribute__((aligned(4096)));
-#endif
-#else
-// Each entry is a megabyte
-uint32_t level_1_table[1024] __attribute__((aligned(4096)));
-#endif
+uint64_t* kernel_pgd;
+uint64_t* idmap_pgd;
 
 /**
- * @brief Sets up a flat memory map for the Memory Management Unit (MMU).
- *
- * This function configures the MMU to use a flat memory mapping, where virtual
- * addresses map directly to physical addresses.
- *
- * @note This function assumes strict alignment requirements.
+ * @brief Returns the width of the ASIDs the core supports, 8 or 16 bits.
  */
-STRICT_ALIGN void setup_mmu_flat_map(void)
+STRICT_ALIGN unsigned int mmu_asid_bits(void)
 {
-    // Each entry is 2MB or 0x20_0000
-    // First two MB
-    level_2[0] = 0x0000000000000000 | MM_DESCRIPTOR_MAIR_INDEX(MT_READONLY) | MM_DESCRIPTOR_INNER_SHAREABLE | MM_DESCRIPTOR_ACCESS_FLAG | MM_DESCRIPTOR_BLOCK | MM_DESCRIPTOR_VALID;
-    for (uint64_t i = 1; i < 512 - 8; i++) {
-        level_2[i] = (0x0000000000000000 + (i << 21)) | MM_DESCRIPTOR_EXECUTE_NEVER | MM_DESCRIPTOR_MAIR_INDEX(MT_READONLY) | MM_DESCRIPTOR_INNER_SHAREABLE | MM_DESCRIPTOR_ACCESS_FLAG | MM_DESCRIPTOR_BLOCK | MM_DESCRIPTOR_VALID;
-    }
-    // Last 16 MB are shared with the GPU.
-    for (uint64_t i = 512 - 8; i < 512; i++) {
-        level_2[i] = (0x0000000000000000 + (i << 21)) | MM_DESCRIPTOR_EXECUTE_NEVER | MM_DESCRIPTOR_MAIR_INDEX(MT_READONLY) | MM_DESCRIPTOR_INNER_SHAREABLE | MM_DESCRIPTOR_ACCESS_FLAG | MM_DESCRIPTOR_BLOCK | MM_DESCRIPTOR_VALID;
-    }
-    level_1_table[0] = ((uint64_t)level_2) | MM_DESCRIPTOR_TABLE | MM_DESCRIPTOR_VALID;
-
-    // Set peripherals to register access.
-    for (uint64_t i = 480; i < 512; i++) {
-        level_2_peripherals[i] = (0x00000000c0000000 + (i << 21)) | MM_DESCRIPTOR_EXECUTE_NEVER | MM_DESCRIPTOR_MAIR_INDEX(MT_DEVICE_nGnRnE) | MM_DESCRIPTOR_ACCESS_FLAG | MM_DESCRIPTOR_BLOCK | MM_DESCRIPTOR_VALID;
-    }
-    level_1_table[3] = ((uint64_t)level_2_peripherals) | MM_DESCRIPTOR_TABLE | MM_DESCRIPTOR_VALID;
+    uint64_t mmfr0;
+    asm volatile("mrs %[mmfr0], id_aa64mmfr0_el1"
+        : [mmfr0] "=r"(mmfr0));
+    return ((mmfr0 >> ID_AA64MMFR0_ASIDBITS_SHIFT) & 0xf) == ID_AA64MMFR0_ASIDBITS_16 ? 16 : 8;
+}
 
+/**
+ * @brief Loads the translation registers and turns on the MMU of this core.
+ *
+ * Uses the tables built by mmu_init(), so secondary cores can enable the
+ * same mapping.
+ */
+STRICT_ALIGN static void mmu_enable(void)
+{
     uint64_t mair = MAIR_VALUE;
-    uint64_t tcr = TCR_VALUE;
-    uint64_t ttbr0 = ((uint64_t)level_1_table) | MM_TTBR_CNP;
+    uint64_t tcr = TCR_VALUE | (mmu_asid_bits() == 16 ? TCR_AS : 0);
+    uint64_t ttbr0 = ((uint64_t)idmap_pgd) | MM_TTBR_CNP;
+    uint64_t ttbr1 = ((uint64_t)kernel_pgd) | MM_TTBR_CNP;
     uint64_t sctlr = 0;
     asm volatile(
         // The ISB forces these changes to be seen before any other registers are changed
@@ -70,8 +66,9 @@ STRICT_ALIGN void setup_mmu_flat_map(void)
         "TLBI VMALLE1\n\t"
         // Set MAIR
         "MSR MAIR_EL1, %[mair]\n\t"
-        // Set TTBR0
+        // Set TTBR0 and TTBR1
         "MSR TTBR0_EL1, %[ttbr0]\n\t"
+        "MSR TTBR1_EL1, %[ttbr1]\n\t"
         // Set TCR
         "MSR TCR_EL1, %[tcr]\n\t"
         // The ISB forces these changes to be seen before the MMU is enabled.
@@ -85,9 +82,103 @@ STRICT_ALIGN void setup_mmu_flat_map(void)
         "MSR SCTLR_EL1, %[sctlr]\n\t"
         // The ISB forces these changes to be seen by the next instruction
         "ISB\n\t"
-        : /* No outputs. */
+        : [sctlr] "+r"(sctlr)
         : [mair] "r"(mair),
         [tcr] "r"(tcr),
         [ttbr0] "r"(ttbr0),
-        [sctlr] "r"(sctlr));
+        [ttbr1] "r"(ttbr1)
+        : "memory");
+}
+
+/**
+ * @brief Maps RAM and peripherals at their physical address plus offset.
+ *
+ * @param pgd Level 0 table to fill.
+ * @param offset Added to the physical addresses.
+ * @param text Map the kernel text read-only and executable at EL1, in pages.
+ */
+STRICT_ALIGN static void map_physical(uint64_t* pgd, unsigned long offset, bool text)
+{
+    unsigned long text_start = text ? (unsigned long)__text_start : 0;
+    unsigned long text_end = text ? (unsigned long)__text_end : 0;
+
+    /* the page aligned text splits the first block, map_range() uses pages around it */
+    if (text) {
+        map_range(pgd, offset, 0, text_start, PROT_KERNEL);
+        map_range(pgd, offset + text_start, text_start, text_end - text_start, PROT_KERNEL_TEXT);
+    }
+    map_range(pgd, offset + text_end, text_end, GPU_MEMORY_START - text_end, PROT_KERNEL);
+    map_range(pgd, offset + GPU_MEMORY_START, GPU_MEMORY_START, RAM_END - GPU_MEMORY_START, PROT_KERNEL_NC);
+    map_range(pgd, offset + PERIPHERALS_START, PERIPHERALS_START, PERIPHERALS_END - PERIPHERALS_START, PROT_DEVICE);
+}
+
+/**
+ * @brief Builds the kernel translation tables and enables the MMU.
+ *
+ * RAM is mapped as Normal Write-Back memory and peripherals as
+ * Device-nGnRnE, but the caches are left disabled until mmu_enable_caches()
+ * is called. Only the kernel text is executable, from the identity map, and
+ * it is read-only. Everything else, rodata, data, BSS and the stacks
+ * included, is writable and never executable.
+ *
+ * @note This function assumes strict alignment requirements.
+ */
+STRICT_ALIGN void mmu_init(void)
+{
+    idmap_pgd = pgtable_alloc();
+    kernel_pgd = pgtable_alloc();
+    map_physical(idmap_pgd, 0, true);
+    map_physical(kernel_pgd, PAGE_OFFSET, false);
+
+    mmu_enable();
+}
+
+/**
+ * @brief Enables the data and instruction caches.
+ *
+ * The caches come out of reset in an unknown state, so every data cache level
+ * is invalidated by set/way and the instruction cache is invalidated before
+ * SCTLR_EL1.C and SCTLR_EL1.I are set. Must be called with the MMU enabled,
+ * otherwise all data accesses are treated as Device memory.
+ */
+void mmu_enable_caches(void)
+{
+    dcache_invalidate_all();
+    icache_invalidate_all();
+
+    uint64_t sctlr = 0;
+    asm volatile(
+        "MRS %[sctlr], SCTLR_EL1\n\t"
+        "ORR %[sctlr], %[sctlr], %[cache_bits]\n\t"
+        "dsb ish\n\t"
+        "MSR SCTLR_EL1, %[sctlr]\n\t"
+        "ISB\n\t"
+        : [sctlr] "+r"(sctlr)
+        : [cache_bits] "r"((uint64_t)(SCTLR_D_CACHE_ENABLED | SCTLR_I_CACHE_ENABLED))
+        : "memory");
+}
+
+/**
+ * @brief Enables the MMU and caches on a secondary core.
+ *
+ * Only the caches private to this core are invalidated, the shared L2 already
+ * holds live data of the cores that are running.
+ */
+void mmu_enable_secondary(void)
+{
+    mmu_enable();
+
+    dcache_invalidate_local();
+    icache_invalidate_all();
+
+    uint64_t sctlr = 0;
+    asm volatile(
+        "MRS %[sctlr], SCTLR_EL1\n\t"
+        "ORR %[sctlr], %[sctlr], %[cache_bits]\n\t"
+        "dsb ish\n\t"
+        "MSR SCTLR_EL1, %[sctlr]\n\t"
+        "ISB\n\t"
+        : [sctlr] "+r"(sctlr)
+        : [cache_bits] "r"((uint64_t)(SCTLR_D_CACHE_ENABLED | SCTLR_I_CACHE_ENABLED))
+        : "memory");
 }
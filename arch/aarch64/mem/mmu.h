@@ -14,24 +14,10 @@
  *            n    MAIR
  *   DEVICE_nGnRnE    000    00000000
  *   NORMAL_NC        001    01000100
+ *   NORMAL           010    11111111
+ *
+ * MAIR_EL1 and TCR_EL1 values live in arm/sysregs.h.
  */
-#define MT_DEVICE_nGnRnE 0x0
-#define MT_NORMAL_NC 0x1
-#define MT_READONLY 0x2
-#define MT_DEVICE_nGnRnE_FLAGS 0x00
-#define MT_NORMAL_NC_FLAGS 0x44
-#define MT_READONLY_FLAGS 0xff
-#define MAIR_VALUE (MT_DEVICE_nGnRnE_FLAGS << (8 * MT_DEVICE_nGnRnE)) | (MT_NORMAL_NC_FLAGS << (8 * MT_NORMAL_NC)) | (MT_READONLY_FLAGS) << (8 * MT_READONLY)
-
-#define TCR_T0SZ (64 - 36)
-#define TCR_PS (0x01 << 16) // 36-bit physical address
-#define TCR_TG0_4K (0 << 14)
-#define TCR_IPS_64G (1ull << 32)
-#define TCR_SH0_OUTER_SHAREABLE (0x2 << 12)
-#define TCR_SH0_INNER_SHAREABLE (0x3 << 12)
-#define OUTER_CACHEABLE (0x1 << 10)
-#define INNER_CACHEABLE (0x1 << 8)
-#define TCR_VALUE (TCR_IPS_64G | OUTER_CACHEABLE | INNER_CACHEABLE | TCR_T0SZ | TCR_PS | TCR_TG0_4K | TCR_SH0_INNER_SHAREABLE)
 
 #define ENTRY_TYPE_TABLE_DESCRIPTOR 0x11
 #define ENTRY_TYPE_BLOCK_ENTRY 0x01
@@ -42,15 +28,26 @@
 
 #define MM_DESCRIPTOR_BLOCK (0x0 << 1)
 #define MM_DESCRIPTOR_TABLE (0x1 << 1)
+// Level 3 entries use the table encoding for pages
+#define MM_DESCRIPTOR_PAGE (0x1 << 1)
+
+// Output address of a table, block or page descriptor
+#define MM_DESCRIPTOR_ADDRESS_MASK (0x0000fffffffff000ull)
 
 // Block attributes
-#define MM_DESCRIPTOR_EXECUTE_NEVER (0x1ull << 54)
+#define MM_DESCRIPTOR_EXECUTE_NEVER (0x1ull << 54) // UXN, never executable at EL0
+#define MM_DESCRIPTOR_PRIVILEGED_EXECUTE_NEVER (0x1ull << 53) // PXN
 #define MM_DESCRIPTOR_CONTIGUOUS (0x1ull << 52)
+#define MM_DESCRIPTOR_NOT_GLOBAL (0x1ull << 11)
 #define MM_DESCRIPTOR_ACCESS_FLAG (0x1ull << 10)
+#define MM_DESCRIPTOR_USER (0x1ull << 6) // AP[1], accessible from EL0
+#define MM_DESCRIPTOR_READ_ONLY (0x1ull << 7) // AP[2]
+// Bits 58:55 are ignored by the hardware and left to software
+#define MM_DESCRIPTOR_COW (0x1ull << 55) // read-only until copied on the first write
 
 #define MM_DESCRIPTOR_NON_SHAREABLE (0x00ull << 8)
-#define MM_DESCRIPTOR_OUTER_SHAREABLE (0x10ull << 8)
-#define MM_DESCRIPTOR_INNER_SHAREABLE (0x11ull << 8)
+#define MM_DESCRIPTOR_OUTER_SHAREABLE (0x2ull << 8)
+#define MM_DESCRIPTOR_INNER_SHAREABLE (0x3ull << 8)
 
 #define MM_DESCRIPTOR_MAIR_INDEX(index) (index << 2)
 
@@ -101,7 +98,17 @@
 
 #endif
 
-void setup_mmu_flat_map(void);
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+
+/* the linear map in TTBR1 and the identity map the kernel runs on in TTBR0 */
+extern uint64_t* kernel_pgd;
+extern uint64_t* idmap_pgd;
+
 void mmu_init(void);
+void mmu_enable_caches(void);
+void mmu_enable_secondary(void);
+unsigned int mmu_asid_bits(void);
+#endif /* __ASSEMBLER__ */
 
 #endif /* _MMU_H */
@@ -0,0 +1,489 @@
+/**
+ * @file pgtable.c
+ * @brief Translation table management.
+ *
+ * map_range() uses 1GB blocks at level 1 and 2MB blocks at level 2 wherever
+ * the virtual address, the physical address and the size left allow it and
+ * 4KB pages at level 3 elsewhere, so a range takes as few TLB entries as
+ * possible. unmap_range() splits blocks that are only partly unmapped and
+ * frees the tables it empties once no TLB can still walk them.
+ *
+ * Descriptors hold physical addresses and tables are reached through the
+ * identity map, see mmu.c. The kernel tables are built with the MMU off,
+ * before the page allocator is up, so until mem_init() has run tables come
+ * from a small static pool, and from get_zeroed_page() after that. The pool
+ * is only used on the boot core, tables taken from it are never put back.
+ *
+ * Callers serialize changes to the same tables.
+ */
+#include <stdint.h>
+
+#include "mem/mem.h"
+#include "mem/mmu.h"
+#include "mem/pgtable.h"
+#include "peripherals/bcm2711/cpu.h"
+
+/* enough for the kernel maps built by mmu_init() */
+#define EARLY_TABLES 16
+
+/* above this many pages unmap_range() flushes the whole TLB */
+#define TLBI_MAX_PAGES 64
+
+/* tables unlinked by unmap_range() wait here for the TLB invalidation */
+#define FREE_BATCH 32
+
+struct free_batch {
+    unsigned int count;
+    uint64_t* tables[FREE_BATCH];
+};
+
+static uint64_t early_tables[EARLY_TABLES][PTRS_PER_TABLE] __attribute__((aligned(PAGE_SIZE)));
+/* early_tables handed out so far */
+static unsigned int early_tables_used;
+/* set once the page allocator is up, the pool is closed from then on */
+static int early_tables_done;
+
+static inline unsigned int level_shift(int level)
+{
+    return PAGE_SHIFT + (3 - level) * TABLE_SHIFT;
+}
+
+static inline uint64_t* table_of(uint64_t desc)
+{
+    return (uint64_t*)(desc & MM_DESCRIPTOR_ADDRESS_MASK);
+}
+
+/**
+ * @brief Returns the last address of the entry va lies in or end, whichever is lower.
+ *
+ * Compares end - 1 so that a range reaching the top of the address space,
+ * where end wraps to 0, is handled as well.
+ */
+static inline unsigned long entry_end(unsigned long va, unsigned long end, unsigned long size)
+{
+    unsigned long next = (va & ~(size - 1)) + size;
+    return next - 1 < end - 1 ? next : end;
+}
+
+/**
+ * @brief Allocates a zeroed translation table.
+ *
+ * @return The table, or 0 if no memory is left.
+ */
+STRICT_ALIGN uint64_t* pgtable_alloc(void)
+{
+    if (!early_tables_done) {
+        return early_tables_used < EARLY_TABLES ? early_tables[early_tables_used++] : 0;
+    }
+    return (uint64_t*)get_zeroed_page();
+}
+
+/**
+ * @brief Frees a translation table, all of its entries must be invalid.
+ *
+ * Tables of the early pool are left unused, the pool is boot only.
+ */
+void pgtable_free(uint64_t* table)
+{
+    unsigned long offset = (unsigned long)table - (unsigned long)early_tables;
+
+    if (offset >= sizeof(early_tables)) {
+        free_page((unsigned long)table);
+    }
+}
+
+/**
+ * @brief Takes further tables from the page allocator, called once mem_init() has run.
+ */
+void pgtable_early_done(void)
+{
+    early_tables_done = 1;
+}
+
+/**
+ * @brief Allocates the TTBR0 root of a new address space.
+ *
+ * The first entry is shared with idmap_pgd, so the kernel keeps running on
+ * its identity map, the user half is empty.
+ *
+ * @return The table, or 0 if no memory is left.
+ */
+uint64_t* pgd_alloc(void)
+{
+    uint64_t* pgd = (uint64_t*)get_zeroed_page();
+
+    if (pgd) {
+        pgd[0] = idmap_pgd[0];
+    }
+    return pgd;
+}
+
+static void free_tables(uint64_t* table, int level)
+{
+    for (unsigned int i = 0; i < PTRS_PER_TABLE; i++) {
+        uint64_t desc = table[i];
+
+        if (!(desc & MM_DESCRIPTOR_VALID)) {
+            continue;
+        }
+        if (level == 3) {
+            put_page(desc & MM_DESCRIPTOR_ADDRESS_MASK);
+        } else if (desc & MM_DESCRIPTOR_TABLE) {
+            free_tables(table_of(desc), level + 1);
+        }
+        table[i] = 0;
+    }
+    pgtable_free(table);
+}
+
+/**
+ * @brief Frees the TTBR0 root of an address space and the tables below it.
+ *
+ * Every page still mapped in its user half loses a reference, blocks are
+ * left alone. Nothing may run on it any more, no TLB entries are
+ * invalidated: its ASID is not used again before the TLBs are flushed.
+ */
+void pgd_free(uint64_t* pgd)
+{
+    for (unsigned int i = 1; i < PTRS_PER_TABLE; i++) {
+        if (pgd[i] & MM_DESCRIPTOR_VALID) {
+            free_tables(table_of(pgd[i]), 1);
+        }
+    }
+    free_page((unsigned long)pgd);
+}
+
+static int copy_level(uint64_t* dst, uint64_t* src, int level)
+{
+    for (unsigned int i = 0; i < PTRS_PER_TABLE; i++) {
+        uint64_t desc = src[i];
+
+        if (!(desc & MM_DESCRIPTOR_VALID)) {
+            continue;
+        }
+        if (level == 3) {
+            /* both share the page until one of them writes to it */
+            if (!(desc & MM_DESCRIPTOR_READ_ONLY)) {
+                desc |= MM_DESCRIPTOR_READ_ONLY | MM_DESCRIPTOR_COW;
+                src[i] = desc;
+            }
+            get_page(desc & MM_DESCRIPTOR_ADDRESS_MASK);
+            dst[i] = desc;
+        } else if (desc & MM_DESCRIPTOR_TABLE) {
+            uint64_t* sub = pgtable_alloc();
+            if (!sub) {
+                return -1;
+            }
+            dst[i] = (uint64_t)sub | MM_DESCRIPTOR_TABLE | MM_DESCRIPTOR_VALID;
+            if (copy_level(sub, table_of(desc), level + 1)) {
+                return -1;
+            }
+        } else {
+            /* blocks are not reference counted */
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Shares the user half of an address space with a new one, copy on write.
+ *
+ * The tables are copied, the pages are not: writable pages become read-only
+ * in both and are marked MM_DESCRIPTOR_COW, every page gets another
+ * reference. The user half must only hold pages. The caller flushes the TLB
+ * entries of src that were made read-only.
+ *
+ * @param dst Root of the new address space, from pgd_alloc().
+ * @param src Root of the address space to copy.
+ *
+ * @return 0 on success, -1 if memory ran out or src maps a block. What was
+ *         copied so far stays in dst and is freed with it.
+ */
+int pgd_copy_cow(uint64_t* dst, uint64_t* src)
+{
+    for (unsigned int i = 1; i < PTRS_PER_TABLE; i++) {
+        if (!(src[i] & MM_DESCRIPTOR_VALID)) {
+            continue;
+        }
+        uint64_t* sub = pgtable_alloc();
+        if (!sub) {
+            return -1;
+        }
+        dst[i] = (uint64_t)sub | MM_DESCRIPTOR_TABLE | MM_DESCRIPTOR_VALID;
+        if (copy_level(sub, table_of(src[i]), 1)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the level 3 entry of a virtual address.
+ *
+ * @return The entry, which may be invalid, or 0 if va is mapped by a block
+ *         or no level 3 table covers it.
+ */
+uint64_t* pgtable_pte(uint64_t* pgd, unsigned long va)
+{
+    uint64_t* table = pgd;
+
+    for (int level = 0; level < 3; level++) {
+        uint64_t desc = table[(va >> level_shift(level)) & (PTRS_PER_TABLE - 1)];
+
+        if ((desc & (MM_DESCRIPTOR_TABLE | MM_DESCRIPTOR_VALID)) != (MM_DESCRIPTOR_TABLE | MM_DESCRIPTOR_VALID)) {
+            return 0;
+        }
+        table = table_of(desc);
+    }
+    return &table[(va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1)];
+}
+
+/**
+ * @brief Invalidates all TLB entries of every core.
+ */
+void flush_tlb_all(void)
+{
+    asm volatile("dsb ishst\n\t"
+                 "tlbi vmalle1is\n\t"
+                 "dsb ish\n\t"
+                 "isb" ::: "memory");
+}
+
+/**
+ * @brief Invalidates the TLB entries of a range for all ASIDs on every core.
+ *
+ * Large ranges flush the whole TLB instead of one page at a time.
+ *
+ * @param start First address of the range, page aligned.
+ * @param end Address after the range.
+ */
+void flush_tlb_range(unsigned long start, unsigned long end)
+{
+    if ((end - start) >> PAGE_SHIFT > TLBI_MAX_PAGES) {
+        flush_tlb_all();
+        return;
+    }
+
+    asm volatile("dsb ishst" ::: "memory");
+    for (unsigned long va = start; va != end; va += PAGE_SIZE) {
+        /* VA[55:12] */
+        asm volatile("tlbi vaae1is, %[page]"
+            :
+            : [page] "r"((va >> PAGE_SHIFT) & ((1ul << 44) - 1))
+            : "memory");
+    }
+    asm volatile("dsb ish\n\t"
+                 "isb" ::: "memory");
+}
+
+STRICT_ALIGN static int map_level(uint64_t* table, int level, unsigned long va, unsigned long end, unsigned long pa, uint64_t prot)
+{
+    unsigned long size = 1ul << level_shift(level);
+
+    do {
+        uint64_t* entry = &table[(va >> level_shift(level)) & (PTRS_PER_TABLE - 1)];
+        unsigned long next = entry_end(va, end, size);
+
+        if (level == 3) {
+            if (*entry & MM_DESCRIPTOR_VALID) {
+                return -1;
+            }
+            *entry = pa | prot | MM_DESCRIPTOR_PAGE | MM_DESCRIPTOR_VALID;
+        } else if (level > 0 && next - va == size && !(pa & (size - 1)) && !(*entry & MM_DESCRIPTOR_VALID)) {
+            *entry = pa | prot | MM_DESCRIPTOR_BLOCK | MM_DESCRIPTOR_VALID;
+        } else {
+            if (!(*entry & MM_DESCRIPTOR_VALID)) {
+                uint64_t* sub = pgtable_alloc();
+                if (!sub) {
+                    return -1;
+                }
+                *entry = (uint64_t)sub | MM_DESCRIPTOR_TABLE | MM_DESCRIPTOR_VALID;
+            } else if (!(*entry & MM_DESCRIPTOR_TABLE)) {
+                /* already mapped by a block */
+                return -1;
+            }
+            if (map_level(table_of(*entry), level + 1, va, next, pa, prot)) {
+                return -1;
+            }
+        }
+        pa += next - va;
+        va = next;
+    } while (va != end);
+
+    return 0;
+}
+
+/**
+ * @brief Maps a range of physical memory.
+ *
+ * Blocks are used wherever va and pa are equally aligned to the block size
+ * and the range covers the whole block. The range must not be mapped yet,
+ * if it is or memory runs out parts of it may be left mapped.
+ *
+ * @param pgd Level 0 table of the address space.
+ * @param va First virtual address, page aligned.
+ * @param pa First physical address, page aligned.
+ * @param size Size of the range, a multiple of PAGE_SIZE.
+ * @param prot Descriptor attributes, one of the PROT_* values.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+STRICT_ALIGN int map_range(uint64_t* pgd, unsigned long va, unsigned long pa, unsigned long size, uint64_t prot)
+{
+    if (!size || ((va | pa | size) & (PAGE_SIZE - 1))) {
+        return -1;
+    }
+
+    int ret = map_level(pgd, 0, va, va + size, pa, prot);
+    /* make the entries visible to the table walks of every core */
+    asm volatile("dsb ishst\n\t"
+                 "isb" ::: "memory");
+    return ret;
+}
+
+/**
+ * @brief Queues a table to be freed after the next TLB invalidation.
+ */
+static void free_batch_add(struct free_batch* batch, uint64_t* table)
+{
+    if (batch->count == FREE_BATCH) {
+        flush_tlb_all();
+        for (unsigned int i = 0; i < batch->count; i++) {
+            pgtable_free(batch->tables[i]);
+        }
+        batch->count = 0;
+    }
+    batch->tables[batch->count++] = table;
+}
+
+static int table_empty(const uint64_t* table)
+{
+    for (unsigned int i = 0; i < PTRS_PER_TABLE; i++) {
+        if (table[i] & MM_DESCRIPTOR_VALID) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Replaces a block by a table of the next level mapping the same memory.
+ */
+static int split_block(uint64_t* entry, int level, unsigned long va)
+{
+    uint64_t* sub = pgtable_alloc();
+    if (!sub) {
+        return -1;
+    }
+
+    uint64_t desc = *entry;
+    unsigned long block = va & ~((1ul << level_shift(level)) - 1);
+    uint64_t attrs = desc & ~MM_DESCRIPTOR_ADDRESS_MASK & ~(uint64_t)(MM_DESCRIPTOR_TABLE | MM_DESCRIPTOR_VALID);
+    unsigned long pa = desc & MM_DESCRIPTOR_ADDRESS_MASK;
+    unsigned long size = 1ul << level_shift(level + 1);
+    uint64_t type = level + 1 == 3 ? MM_DESCRIPTOR_PAGE : MM_DESCRIPTOR_BLOCK;
+
+    for (unsigned int i = 0; i < PTRS_PER_TABLE; i++) {
+        sub[i] = (pa + i * size) | attrs | type | MM_DESCRIPTOR_VALID;
+    }
+
+    /* break before make, the block is unmapped until the table is in place */
+    *entry = 0;
+    flush_tlb_range(block, block + PAGE_SIZE);
+    *entry = (uint64_t)sub | MM_DESCRIPTOR_TABLE | MM_DESCRIPTOR_VALID;
+    return 0;
+}
+
+static int unmap_level(uint64_t* table, int level, unsigned long va, unsigned long end, struct free_batch* batch)
+{
+    unsigned long size = 1ul << level_shift(level);
+
+    do {
+        uint64_t* entry = &table[(va >> level_shift(level)) & (PTRS_PER_TABLE - 1)];
+        unsigned long next = entry_end(va, end, size);
+
+        if (*entry & MM_DESCRIPTOR_VALID) {
+            int leaf = level == 3 || !(*entry & MM_DESCRIPTOR_TABLE);
+
+            if (leaf && next - va == size) {
+                *entry = 0;
+            } else {
+                if (leaf && split_block(entry, level, va)) {
+                    return -1;
+                }
+                uint64_t* sub = table_of(*entry);
+                if (unmap_level(sub, level + 1, va, next, batch)) {
+                    return -1;
+                }
+                if (table_empty(sub)) {
+                    *entry = 0;
+                    free_batch_add(batch, sub);
+                }
+            }
+        }
+        va = next;
+    } while (va != end);
+
+    return 0;
+}
+
+/**
+ * @brief Removes the mappings of a range.
+ *
+ * Blocks that lie partly in the range are split first. Splitting briefly
+ * unmaps the whole block, so the rest of it must not be in use by other
+ * cores meanwhile. Tables left empty are freed.
+ *
+ * @param pgd Level 0 table of the address space.
+ * @param va First virtual address, page aligned.
+ * @param size Size of the range, a multiple of PAGE_SIZE.
+ *
+ * @return 0 on success, -1 if a block could not be split.
+ */
+int unmap_range(uint64_t* pgd, unsigned long va, unsigned long size)
+{
+    struct free_batch batch;
+
+    if (!size || ((va | size) & (PAGE_SIZE - 1))) {
+        return -1;
+    }
+
+    batch.count = 0;
+    int ret = unmap_level(pgd, 0, va, va + size, &batch);
+
+    flush_tlb_range(va, va + size);
+    for (unsigned int i = 0; i < batch.count; i++) {
+        pgtable_free(batch.tables[i]);
+    }
+    return ret;
+}
+
+/**
+ * @brief Looks up the physical address a virtual address is mapped to.
+ *
+ * @param pgd Level 0 table of the address space.
+ * @param va The virtual address.
+ * @param pa Set to the physical address if va is mapped.
+ *
+ * @return The size of the page or block va lies in, 0 if it is not mapped.
+ */
+unsigned long pgtable_translate(uint64_t* pgd, unsigned long va, unsigned long* pa)
+{
+    uint64_t* table = pgd;
+
+    for (int level = 0; level <= 3; level++) {
+        uint64_t desc = table[(va >> level_shift(level)) & (PTRS_PER_TABLE - 1)];
+
+        if (!(desc & MM_DESCRIPTOR_VALID)) {
+            return 0;
+        }
+        if (level == 3 || !(desc & MM_DESCRIPTOR_TABLE)) {
+            unsigned long mask = (1ul << level_shift(level)) - 1;
+            *pa = (desc & MM_DESCRIPTOR_ADDRESS_MASK & ~mask) | (va & mask);
+            return mask + 1;
+        }
+        table = table_of(desc);
+    }
+    return 0;
+}
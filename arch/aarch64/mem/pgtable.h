@@ -0,0 +1,64 @@
+#ifndef _PGTABLE_H
+#define _PGTABLE_H
+
+#include <stdint.h>
+
+#include "arm/sysregs.h"
+#include "mem/mem.h"
+#include "mem/mmu.h"
+
+/*
+ * 4KB granule, 48-bit virtual addresses and four levels of tables in both
+ * halves of the address space:
+ *
+ *   47:39 level 0 index, 512GB per entry, tables only
+ *   38:30 level 1 index, 1GB blocks
+ *   29:21 level 2 index, 2MB blocks
+ *   20:12 level 3 index, 4KB pages
+ */
+#define VA_BITS 48
+#define PTRS_PER_TABLE (1 << TABLE_SHIFT)
+#define PGD_SHIFT (PAGE_SHIFT + 3 * TABLE_SHIFT)
+#define PUD_SHIFT (PAGE_SHIFT + 2 * TABLE_SHIFT)
+#define PMD_SHIFT (PAGE_SHIFT + TABLE_SHIFT)
+
+#define PUD_SIZE (1ul << PUD_SHIFT)
+#define PMD_SIZE (1ul << PMD_SHIFT)
+
+/* TTBR1 half, physical memory is mapped linearly from here, the kernel does not run from it yet */
+#define PAGE_OFFSET 0xffff000000000000ul
+
+/*
+ * TTBR0 half. The first level 0 entry holds the identity map the kernel
+ * runs on, it is shared by every TTBR0 table and only accessible from EL1.
+ * The rest is left to per-process address spaces.
+ */
+#define USER_VA_START (1ul << PGD_SHIFT)
+#define USER_VA_END (1ul << VA_BITS)
+/* mm_map_user_text() maps the user text here */
+#define USER_TEXT_START USER_VA_START
+
+/* attributes for map_range() */
+#define PROT_KERNEL_COMMON (MM_DESCRIPTOR_ACCESS_FLAG | MM_DESCRIPTOR_EXECUTE_NEVER)
+#define PROT_KERNEL_EXEC (PROT_KERNEL_COMMON | MM_DESCRIPTOR_MAIR_INDEX(MT_NORMAL) | MM_DESCRIPTOR_INNER_SHAREABLE)
+#define PROT_KERNEL (PROT_KERNEL_EXEC | MM_DESCRIPTOR_PRIVILEGED_EXECUTE_NEVER)
+#define PROT_KERNEL_TEXT (PROT_KERNEL_EXEC | MM_DESCRIPTOR_READ_ONLY)
+#define PROT_KERNEL_NC (PROT_KERNEL_COMMON | MM_DESCRIPTOR_PRIVILEGED_EXECUTE_NEVER | MM_DESCRIPTOR_MAIR_INDEX(MT_NORMAL_NC) | MM_DESCRIPTOR_INNER_SHAREABLE)
+#define PROT_USER_DATA (MM_DESCRIPTOR_ACCESS_FLAG | MM_DESCRIPTOR_EXECUTE_NEVER | MM_DESCRIPTOR_PRIVILEGED_EXECUTE_NEVER | MM_DESCRIPTOR_MAIR_INDEX(MT_NORMAL) | MM_DESCRIPTOR_INNER_SHAREABLE | MM_DESCRIPTOR_NOT_GLOBAL | MM_DESCRIPTOR_USER)
+#define PROT_USER_EXEC (MM_DESCRIPTOR_ACCESS_FLAG | MM_DESCRIPTOR_PRIVILEGED_EXECUTE_NEVER | MM_DESCRIPTOR_MAIR_INDEX(MT_NORMAL) | MM_DESCRIPTOR_INNER_SHAREABLE | MM_DESCRIPTOR_NOT_GLOBAL | MM_DESCRIPTOR_USER | MM_DESCRIPTOR_READ_ONLY)
+#define PROT_DEVICE (PROT_KERNEL_COMMON | MM_DESCRIPTOR_PRIVILEGED_EXECUTE_NEVER | MM_DESCRIPTOR_MAIR_INDEX(MT_DEVICE_nGnRnE))
+
+uint64_t* pgtable_alloc(void);
+void pgtable_free(uint64_t* table);
+void pgtable_early_done(void);
+uint64_t* pgd_alloc(void);
+void pgd_free(uint64_t* pgd);
+int pgd_copy_cow(uint64_t* dst, uint64_t* src);
+uint64_t* pgtable_pte(uint64_t* pgd, unsigned long va);
+int map_range(uint64_t* pgd, unsigned long va, unsigned long pa, unsigned long size, uint64_t prot);
+int unmap_range(uint64_t* pgd, unsigned long va, unsigned long size);
+unsigned long pgtable_translate(uint64_t* pgd, unsigned long va, unsigned long* pa);
+void flush_tlb_all(void);
+void flush_tlb_range(unsigned long start, unsigned long end);
+
+#endif /* _PGTABLE_H */
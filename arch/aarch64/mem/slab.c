@@ -0,0 +1,298 @@
+/**
+ * @file slab.c
+ * @brief Slab allocator for small kernel objects.
+ *
+ * A cache hands out objects of one size. Objects are carved out of slabs,
+ * blocks of 2^order pages taken from the buddy allocator, with a struct slab
+ * header in the first cache line. Since slabs are aligned to their own size
+ * the owning slab of an object is found by masking its address.
+ *
+ * Every core keeps a magazine of recently freed objects per cache, so the
+ * common alloc/free path neither takes the cache lock nor touches slab
+ * headers shared with other cores.
+ */
+#include <stdint.h>
+
+#include "irq/irq.h"
+#include "mem/mem.h"
+#include "mem/slab.h"
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((unsigned long)(a) - 1))
+
+/* minimum number of objects a slab should hold before trying a larger order */
+#define SLAB_MIN_OBJECTS 8
+
+/* kmalloc() slabs all use SLAB_MAX_ORDER, so kfree() can find the slab
+ * header of an object without knowing its size class */
+#define SLAB_KMALLOC (1u << 31)
+
+struct slab {
+    struct kmem_cache* cache;
+    struct list_head list;
+    void* freelist; /* free objects, linked through their first word */
+    unsigned long inuse;
+};
+
+static struct kmem_cache cache_cache;
+static struct kmem_cache kmalloc_caches[KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1];
+
+static const char* kmalloc_names[] = {
+    "kmalloc-64",
+    "kmalloc-128",
+    "kmalloc-256",
+    "kmalloc-512",
+    "kmalloc-1024",
+    "kmalloc-2048",
+    "kmalloc-4096",
+};
+
+static unsigned long slab_bytes(struct kmem_cache* cache)
+{
+    return (unsigned long)PAGE_SIZE << cache->order;
+}
+
+static struct slab* obj_to_slab(struct kmem_cache* cache, void* obj)
+{
+    return (struct slab*)((unsigned long)obj & ~(slab_bytes(cache) - 1));
+}
+
+/**
+ * @brief Fills in the layout of a cache.
+ */
+static void kmem_cache_setup(struct kmem_cache* cache, const char* name, size_t size, unsigned int flags)
+{
+    unsigned long align = (flags & SLAB_HWCACHE_ALIGN) ? CACHE_LINE_SIZE : sizeof(void*);
+
+    if (size < sizeof(void*)) {
+        size = sizeof(void*);
+    }
+
+    cache->name = name;
+    cache->object_size = size;
+    cache->size = ALIGN_UP(size, align);
+    cache->offset = ALIGN_UP(sizeof(struct slab), align);
+
+    cache->order = (flags & SLAB_KMALLOC) ? SLAB_MAX_ORDER : 0;
+    while (cache->order < SLAB_MAX_ORDER
+        && (slab_bytes(cache) - cache->offset) / cache->size < SLAB_MIN_OBJECTS) {
+        cache->order++;
+    }
+    cache->objects_per_slab = (slab_bytes(cache) - cache->offset) / cache->size;
+
+    cache->lock = (spinlock_t)SPINLOCK_INIT;
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    cache->empty_slabs = 0;
+    cache->nr_slabs = 0;
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        cache->magazine[cpu].count = 0;
+    }
+}
+
+/**
+ * @brief Allocates a new slab and links all of its objects into the freelist.
+ *
+ * Called with the cache lock held.
+ */
+static struct slab* slab_grow(struct kmem_cache* cache)
+{
+    unsigned long addr = alloc_pages(cache->order);
+    if (!addr) {
+        return NULL;
+    }
+
+    struct slab* slab = (struct slab*)addr;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->freelist = NULL;
+
+    for (long i = cache->objects_per_slab - 1; i >= 0; i--) {
+        void** obj = (void**)(addr + cache->offset + i * cache->size);
+        *obj = slab->freelist;
+        slab->freelist = obj;
+    }
+
+    list_add(&slab->list, &cache->partial);
+    cache->empty_slabs++;
+    cache->nr_slabs++;
+    return slab;
+}
+
+/**
+ * @brief Takes one object from the slabs of a cache, cache lock held.
+ */
+static void* slab_take(struct kmem_cache* cache)
+{
+    struct slab* slab;
+
+    if (list_empty(&cache->partial)) {
+        slab = slab_grow(cache);
+        if (!slab) {
+            return NULL;
+        }
+    } else {
+        slab = list_first_entry(&cache->partial, struct slab, list);
+    }
+
+    void** obj = slab->freelist;
+    slab->freelist = *obj;
+    if (slab->inuse++ == 0) {
+        cache->empty_slabs--;
+    }
+    if (!slab->freelist) {
+        list_move(&slab->list, &cache->full);
+    }
+    return obj;
+}
+
+/**
+ * @brief Returns one object to its slab, cache lock held.
+ *
+ * Keeps at most one completely free slab per cache, any further empty slab
+ * goes back to the page allocator.
+ */
+static void slab_put(struct kmem_cache* cache, void* obj)
+{
+    struct slab* slab = obj_to_slab(cache, obj);
+
+    if (!slab->freelist) {
+        list_move(&slab->list, &cache->partial);
+    }
+    *(void**)obj = slab->freelist;
+    slab->freelist = obj;
+
+    if (--slab->inuse == 0) {
+        if (cache->empty_slabs) {
+            list_del(&slab->list);
+            cache->nr_slabs--;
+            free_pages((unsigned long)slab, cache->order);
+        } else {
+            cache->empty_slabs++;
+        }
+    }
+}
+
+/**
+ * @brief Initializes the slab allocator and the kmalloc() size classes.
+ *
+ * Must be called after mem_init().
+ */
+void kmem_cache_init(void)
+{
+    kmem_cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), SLAB_HWCACHE_ALIGN);
+
+    for (unsigned int shift = KMALLOC_MIN_SHIFT; shift <= KMALLOC_MAX_SHIFT; shift++) {
+        kmem_cache_setup(&kmalloc_caches[shift - KMALLOC_MIN_SHIFT],
+            kmalloc_names[shift - KMALLOC_MIN_SHIFT], 1ul << shift, SLAB_HWCACHE_ALIGN | SLAB_KMALLOC);
+    }
+}
+
+/**
+ * @brief Creates a named cache of equally sized objects.
+ *
+ * @param name Name of the cache, must stay valid for the lifetime of the cache.
+ * @param size Size of one object in bytes.
+ * @param flags SLAB_HWCACHE_ALIGN to start every object on its own cache line.
+ * @return The new cache, or NULL if out of memory.
+ */
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, unsigned int flags)
+{
+    struct kmem_cache* cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) {
+        return NULL;
+    }
+    kmem_cache_setup(cache, name, size, flags);
+    return cache;
+}
+
+/**
+ * @brief Allocates an object from a cache.
+ *
+ * Objects come from the magazine of the current core. An empty magazine is
+ * refilled with half of its capacity under the cache lock.
+ *
+ * @param cache The cache to allocate from.
+ * @return The object, or NULL if out of memory.
+ */
+void* kmem_cache_alloc(struct kmem_cache* cache)
+{
+    unsigned long flags = local_irq_save();
+    struct kmem_magazine* mag = &cache->magazine[smp_processor_id()];
+
+    if (!mag->count) {
+        spin_lock(&cache->lock);
+        while (mag->count < SLAB_MAGAZINE_SIZE / 2) {
+            void* obj = slab_take(cache);
+            if (!obj) {
+                break;
+            }
+            mag->objects[mag->count++] = obj;
+        }
+        spin_unlock(&cache->lock);
+    }
+
+    void* obj = NULL;
+    if (mag->count) {
+        obj = mag->objects[--mag->count];
+    }
+    local_irq_restore(flags);
+    return obj;
+}
+
+/**
+ * @brief Returns an object to its cache.
+ *
+ * A full magazine is flushed by half of its capacity under the cache lock.
+ *
+ * @param cache The cache the object was allocated from.
+ * @param obj The object.
+ */
+void kmem_cache_free(struct kmem_cache* cache, void* obj)
+{
+    unsigned long flags = local_irq_save();
+    struct kmem_magazine* mag = &cache->magazine[smp_processor_id()];
+
+    if (mag->count == SLAB_MAGAZINE_SIZE) {
+        spin_lock(&cache->lock);
+        while (mag->count > SLAB_MAGAZINE_SIZE / 2) {
+            slab_put(cache, mag->objects[--mag->count]);
+        }
+        spin_unlock(&cache->lock);
+    }
+    mag->objects[mag->count++] = obj;
+    local_irq_restore(flags);
+}
+
+/**
+ * @brief Allocates memory from the smallest size class that fits.
+ *
+ * @param size Number of bytes, at most KMALLOC_MAX_SIZE. Larger buffers have
+ *             to come from alloc_pages().
+ * @return Cache line aligned memory, or NULL.
+ */
+void* kmalloc(size_t size)
+{
+    if (size > KMALLOC_MAX_SIZE) {
+        return NULL;
+    }
+
+    unsigned int shift = KMALLOC_MIN_SHIFT;
+    while ((1ul << shift) < size) {
+        shift++;
+    }
+    return kmem_cache_alloc(&kmalloc_caches[shift - KMALLOC_MIN_SHIFT]);
+}
+
+/**
+ * @brief Frees memory allocated with kmalloc().
+ *
+ * @param obj The memory, NULL is ignored.
+ */
+void kfree(void* obj)
+{
+    if (!obj) {
+        return;
+    }
+    struct slab* slab = (struct slab*)((unsigned long)obj & ~(((unsigned long)PAGE_SIZE << SLAB_MAX_ORDER) - 1));
+    kmem_cache_free(slab->cache, obj);
+}
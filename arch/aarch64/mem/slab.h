@@ -0,0 +1,54 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <stddef.h>
+
+#include "lib/list.h"
+#include "mem/cache.h"
+#include "smp/smp.h"
+#include "sync/spinlock.h"
+
+/* kmem_cache_create() flags */
+#define SLAB_HWCACHE_ALIGN (1 << 0) /* align objects to CACHE_LINE_SIZE */
+
+/* objects held per core before going back to the slabs */
+#define SLAB_MAGAZINE_SIZE 16
+/* largest slab is 2^SLAB_MAX_ORDER pages */
+#define SLAB_MAX_ORDER 3
+
+/* kmalloc() size classes are powers of two from 64 bytes to 4 KiB */
+#define KMALLOC_MIN_SHIFT 6
+#define KMALLOC_MAX_SHIFT 12
+#define KMALLOC_MAX_SIZE (1 << KMALLOC_MAX_SHIFT)
+
+struct kmem_magazine {
+    unsigned long count;
+    void* objects[SLAB_MAGAZINE_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct kmem_cache {
+    const char* name;
+    unsigned long object_size; /* size requested by the user */
+    unsigned long size; /* object stride inside a slab */
+    unsigned long offset; /* offset of the first object in a slab */
+    unsigned int order; /* pages per slab as a buddy order */
+    unsigned int objects_per_slab;
+
+    spinlock_t lock;
+    struct list_head partial; /* slabs with at least one free object */
+    struct list_head full;
+    unsigned long empty_slabs; /* completely free slabs kept on partial */
+    unsigned long nr_slabs;
+
+    struct kmem_magazine magazine[NR_CPUS];
+};
+
+void kmem_cache_init(void);
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, unsigned int flags);
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+
+void* kmalloc(size_t size);
+void kfree(void* obj);
+
+#endif /* _SLAB_H */
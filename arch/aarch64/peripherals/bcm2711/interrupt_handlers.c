@@ -12,10 +12,37 @@
 
 #include "bcm2711_lpa.h"
 #include "cpu.h"
-#include "timer/timer.h"
+#include "peripherals/bcm2711/uart/uart.h"
+#include "pmu/pmu.h"
+#include "smp/smp.h"
+#include "timer/arch_timer.h"
 
 #define BCM_VERSION 2711
 
+// 1: Software generated interrupt 1, wakes an idle core to look for work
+__attribute__((weak)) void SGI1_IRQHandler(void)
+{
+    handle_ipi(IPI_RESCHEDULE);
+}
+
+// 2: Software generated interrupt 2, another core changed the PMU setup
+__attribute__((weak)) void SGI2_IRQHandler(void)
+{
+    handle_ipi(IPI_PMU);
+}
+
+// 27: Private peripheral interrupt, EL1 virtual timer of the core
+__attribute__((weak)) void CNTV_IRQHandler(void)
+{
+    handle_arch_timer_irq();
+}
+
+// 48-51: Shared peripheral interrupts of the PMUs of cores 0-3, counter overflow
+__attribute__((weak)) void PMU_IRQHandler(void)
+{
+    handle_pmu_irq();
+}
+
 // This catches non-interrupt exceptions that are similar to Cortex-M hard faults.
 __attribute__((weak)) void HardFault_IRQHandler(void)
 {
@@ -85,7 +112,7 @@ __attribute__((weak)) void BSC7_IRQHandler(void)
 }
 __attribute__((weak)) void UART0_IRQHandler(void)
 {
-    while (true) { }
+    uart_handle_irq();
 }
 __attribute__((weak)) void UART1_IRQHandler(void)
 {
@@ -254,10 +281,10 @@ __attribute__((weak)) void SWI7_IRQHandler(void)
 }
 #endif
 
-// 96: Timer 0
+// 96: Timer 0, used by the GPU firmware
 __attribute__((weak)) void TIMER_0_IRQHandler(void)
 {
-    handle_timer_irq();
+    while (true) { }
 }
 
 // 97: Timer 1
@@ -809,8 +836,8 @@ void* interrupt_handlers[72] = {
 #else
 void* interrupt_handlers[160] = {
     NULL, // 0
-    NULL, // 1
-    NULL, // 2
+    SGI1_IRQHandler, // 1
+    SGI2_IRQHandler, // 2
     NULL, // 3
     NULL, // 4
     NULL, // 5
@@ -835,7 +862,7 @@ void* interrupt_handlers[160] = {
     NULL, // 24
     NULL, // 25
     NULL, // 26
-    NULL, // 27
+    CNTV_IRQHandler, // 27
     NULL, // 28
     NULL, // 29
     NULL, // 30
@@ -856,10 +883,10 @@ void* interrupt_handlers[160] = {
     NULL, // 45
     NULL, // 46
     NULL, // 47
-    NULL, // 48
-    NULL, // 49
-    NULL, // 50
-    NULL, // 51
+    PMU_IRQHandler, // 48
+    PMU_IRQHandler, // 49
+    PMU_IRQHandler, // 50
+    PMU_IRQHandler, // 51
     NULL, // 52
     NULL, // 53
     NULL, // 54
@@ -5,42 +5,28 @@
  * This file contains the implementation of the timer peripheral driver
  * for the BCM2711. It provides functions to configure and use the
  * timer hardware.
+ *
+ * Timer events are driven by the per-core ARM generic timer, see
+ * time/hrtimer.c. The free running 1 MHz system timer is only read.
  */
 #include "peripherals/bcm2711/timer/timer.h"
 #include "peripherals/bcm2711/bcm2711_lpa.h"
-#include "scheduler/scheduler.h"
-#include "printk.h"
 #include <stdint.h>
 
-const unsigned int interval = 200000;
-unsigned int current_time = 0;
-SYSTMR_Type timer;
-
 /**
- * @brief Initializes the timer peripheral for the BCM2711.
+ * @brief Returns the system timer counter in microseconds.
  *
- * This function sets up the necessary configurations to initialize the timer
- * peripheral on the BCM2711. It ensures that the timer is ready for use and
- * properly configured according to the requirements of the system.
+ * The counter is split into two registers, CHI is read again to catch a
+ * carry out of CLO in between.
  */
-void timer_init(void)
+uint64_t timer_now(void)
 {
-    current_time = timer.CLO;
-    current_time += interval;
-    timer.C1 = current_time;
-}
+    uint32_t hi, lo;
 
-/**
- * @brief Handles the timer interrupt request (IRQ).
- *
- * This function is called when a timer interrupt occurs. It processes the
- * interrupt and performs the necessary actions to handle the timer event.
- */
-void handle_timer_irq(void)
-{
-    current_time += interval;
-    timer.C1 = current_time;
-    timer.CS = timer.CS_b.M1;
-    printk("timer interrupt\n");
-    timer_tick();
+    do {
+        hi = SYSTMR->CHI;
+        lo = SYSTMR->CLO;
+    } while (hi != SYSTMR->CHI);
+
+    return ((uint64_t)hi << 32) | lo;
 }
@@ -1,7 +1,8 @@
 #ifndef TIMER_H
 #define TIMER_H
 
-void timer_init(void);
-void handle_timer_irq(void);
+#include <stdint.h>
+
+uint64_t timer_now(void);
 
 #endif
@@ -6,55 +6,125 @@
  * peripheral. It provides the necessary functions to initialize and
  * communicate using the UART interface.
  *
+ * Output is queued in a ring buffer and moved to the 32 byte TX FIFO of the
+ * PL011 by its TX interrupt, so uart_putc() never waits for the line. Any
+ * core may add to the ring without a lock: a writer reserves a slot by
+ * advancing head with a compare-and-swap and marks the slot full once the
+ * byte is in it. Only one core at a time moves bytes to the FIFO, the one
+ * that holds tx_lock, and it stops at the first slot that is not full yet.
+ * Until uart_enable_irq() is called, and again after uart_panic(), every
+ * byte is written synchronously.
+ *
+ * Received bytes are moved from the RX FIFO to an RX ring by the RX and RX
+ * timeout interrupts. Readers sleep on a wait queue until the ring has data.
+ * uart_read_line() adds a line discipline on top: it echoes what is typed,
+ * handles backspace and returns complete lines.
+ *
  * @note From https://wiki.osdev.org/Raspberry_Pi_Bare_Bones
  */
 #include <stddef.h>
 #include <stdint.h>
 
 #include "delay/delay.h"
+#include "irq/irq.h"
 #include "mmio/mmio.h"
+#include "peripherals/bcm2711/uart/uart.h"
+#include "scheduler/scheduler.h"
+#include "scheduler/wait.h"
+#include "sync/spinlock.h"
 
 enum {
     // The offsets for reach register.
-    GPIO_BASE = 0x200000,
+    GPIO_OFFSET = 0x200000,
 
     // Controls actuation of pull up/down to ALL GPIO pins.
-    GPPUD = (GPIO_BASE + 0x94),
+    GPPUD = (GPIO_OFFSET + 0x94),
 
     // Controls actuation of pull up/down for specific GPIO pin.
-    GPPUDCLK0 = (GPIO_BASE + 0x98),
+    GPPUDCLK0 = (GPIO_OFFSET + 0x98),
 
     // The base address for UART.
-    UART0_BASE = (GPIO_BASE + 0x1000), // for raspi4 0xFE201000, raspi2 & 3
+    UART0_OFFSET = (GPIO_OFFSET + 0x1000), // for raspi4 0xFE201000, raspi2 & 3
                                        // 0x3F201000, and 0x20201000 for raspi1
 
     // The offsets for reach register for the UART.
-    UART0_DR = (UART0_BASE + 0x00),
-    UART0_RSRECR = (UART0_BASE + 0x04),
-    UART0_FR = (UART0_BASE + 0x18),
-    UART0_ILPR = (UART0_BASE + 0x20),
-    UART0_IBRD = (UART0_BASE + 0x24),
-    UART0_FBRD = (UART0_BASE + 0x28),
-    UART0_LCRH = (UART0_BASE + 0x2C),
-    UART0_CR = (UART0_BASE + 0x30),
-    UART0_IFLS = (UART0_BASE + 0x34),
-    UART0_IMSC = (UART0_BASE + 0x38),
-    UART0_RIS = (UART0_BASE + 0x3C),
-    UART0_MIS = (UART0_BASE + 0x40),
-    UART0_ICR = (UART0_BASE + 0x44),
-    UART0_DMACR = (UART0_BASE + 0x48),
-    UART0_ITCR = (UART0_BASE + 0x80),
-    UART0_ITIP = (UART0_BASE + 0x84),
-    UART0_ITOP = (UART0_BASE + 0x88),
-    UART0_TDR = (UART0_BASE + 0x8C),
+    UART0_DR = (UART0_OFFSET + 0x00),
+    UART0_RSRECR = (UART0_OFFSET + 0x04),
+    UART0_FR = (UART0_OFFSET + 0x18),
+    UART0_ILPR = (UART0_OFFSET + 0x20),
+    UART0_IBRD = (UART0_OFFSET + 0x24),
+    UART0_FBRD = (UART0_OFFSET + 0x28),
+    UART0_LCRH = (UART0_OFFSET + 0x2C),
+    UART0_CR = (UART0_OFFSET + 0x30),
+    UART0_IFLS = (UART0_OFFSET + 0x34),
+    UART0_IMSC = (UART0_OFFSET + 0x38),
+    UART0_RIS = (UART0_OFFSET + 0x3C),
+    UART0_MIS = (UART0_OFFSET + 0x40),
+    UART0_ICR = (UART0_OFFSET + 0x44),
+    UART0_DMACR = (UART0_OFFSET + 0x48),
+    UART0_ITCR = (UART0_OFFSET + 0x80),
+    UART0_ITIP = (UART0_OFFSET + 0x84),
+    UART0_ITOP = (UART0_OFFSET + 0x88),
+    UART0_TDR = (UART0_OFFSET + 0x8C),
 
     // The offsets for Mailbox registers
-    MBOX_BASE = 0xB880,
-    MBOX_READ = (MBOX_BASE + 0x00),
-    MBOX_STATUS = (MBOX_BASE + 0x18),
-    MBOX_WRITE = (MBOX_BASE + 0x20)
+    MBOX_OFFSET = 0xB880,
+    MBOX_READ = (MBOX_OFFSET + 0x00),
+    MBOX_STATUS = (MBOX_OFFSET + 0x18),
+    MBOX_WRITE = (MBOX_OFFSET + 0x20)
 };
 
+// UART0_DR error bits of a received byte.
+#define UART_DR_OE (1 << 11)
+#define UART_DR_ERRORS (0xf << 8)
+
+// UART0_FR bits.
+#define UART_FR_BUSY (1 << 3)
+#define UART_FR_RXFE (1 << 4)
+#define UART_FR_TXFF (1 << 5)
+#define UART_FR_TXFE (1 << 7)
+
+// UART0_CR bits.
+#define UART_CR_UARTEN (1 << 0)
+#define UART_CR_LBE (1 << 7)
+
+// UART0_IMSC, UART0_MIS and UART0_ICR bits.
+#define UART_INT_RX (1 << 4)
+#define UART_INT_TX (1 << 5)
+#define UART_INT_RT (1 << 6)
+
+// UART0_IFLS: TX interrupt when the FIFO drains to 1/8 full, RX when it fills to 1/2.
+#define UART_IFLS_TX_1_8 (0 << 0)
+#define UART_IFLS_RX_1_2 (2 << 3)
+
+// UART0_LCRH: FIFOs enabled, 8 bit words.
+#define UART_LCRH_8N1_FIFO ((1 << 4) | (1 << 5) | (1 << 6))
+
+// PL011 reference clock set through the mailbox in uart_init().
+#define UART_CLOCK 3000000
+
+#define UART_TX_SLOT_FULL 0x100
+
+/*
+ * Each slot holds a byte with UART_TX_SLOT_FULL set once it was written, the
+ * consumer clears the slot when the byte went to the FIFO. head and tail only
+ * ever grow and are taken modulo UART_TX_RING_SIZE.
+ */
+static volatile uint16_t tx_ring[UART_TX_RING_SIZE];
+static unsigned long tx_head;
+static unsigned long tx_tail;
+static spinlock_t tx_lock = SPINLOCK_INIT;
+static volatile int tx_sync = 1;
+static int irq_enabled;
+static struct uart_stats uart_stats;
+
+/* received bytes, the lock is taken by the interrupt and by readers */
+static uint8_t rx_ring[UART_RX_RING_SIZE];
+static unsigned long rx_head;
+static unsigned long rx_tail;
+static spinlock_t rx_lock = SPINLOCK_INIT;
+static struct wait_queue_head rx_wait = WAIT_QUEUE_HEAD_INIT(rx_wait);
+
 // A Mailbox message with set clock rate of PL011 to 3MHz tag
 // starting from Raspberry Pi 3, the SoC is changed to BCM2837 and PL011 clock (UART0) is not fixed any more
 volatile unsigned int __attribute__((aligned(16))) mbox[9] = {
@@ -78,13 +148,13 @@ void uart_init(int raspi)
     mmio_write(UART0_CR, 0x00000000);
     // Setup the GPIO pin 14 && 15.
 
-    // Disable pull up/down for all GPIO pins & delay for 150 cycles.
+    // Disable pull up/down for all GPIO pins & wait at least 150 cycles.
     mmio_write(GPPUD, 0x00000000);
-    delay(150);
+    udelay(1);
 
-    // Disable pull up/down for pin 14,15 & delay for 150 cycles.
+    // Disable pull up/down for pin 14,15 & wait at least 150 cycles.
     mmio_write(GPPUDCLK0, (1 << 14) | (1 << 15));
-    delay(150);
+    udelay(1);
 
     // Write 0 to GPPUDCLK0 to make it take effect.
     mmio_write(GPPUDCLK0, 0x00000000);
@@ -117,28 +187,344 @@ void uart_init(int raspi)
     mmio_write(UART0_FBRD, 40);
 
     // Enable FIFO & 8 bit data transmission (1 stop bit, no parity).
-    mmio_write(UART0_LCRH, (1 << 4) | (1 << 5) | (1 << 6));
+    mmio_write(UART0_LCRH, UART_LCRH_8N1_FIFO);
 
-    // Mask all interrupts.
-    mmio_write(UART0_IMSC, (1 << 1) | (1 << 4) | (1 << 5) | (1 << 6) | (1 << 7) | (1 << 8) | (1 << 9) | (1 << 10));
+    // Mask all interrupts, uart_enable_irq() unmasks the ones in use.
+    mmio_write(UART0_IMSC, 0);
+    mmio_write(UART0_IFLS, UART_IFLS_TX_1_8 | UART_IFLS_RX_1_2);
 
     // Enable UART0, receive & transfer part of UART.
     mmio_write(UART0_CR, (1 << 0) | (1 << 8) | (1 << 9));
 }
 
+/**
+ * @brief Writes a character to the TX FIFO, waiting for space.
+ */
+static void uart_putc_sync(unsigned char c)
+{
+    while (mmio_read(UART0_FR) & UART_FR_TXFF) {
+    }
+    mmio_write(UART0_DR, c);
+}
+
+/**
+ * @brief Moves bytes from the ring to the TX FIFO until either is exhausted.
+ *
+ * Does nothing if another core is already doing it. Runs with interrupts
+ * masked so an interrupt on this core cannot wait for a ring that only this
+ * core could drain.
+ */
+static void uart_tx_kick(void)
+{
+    unsigned long flags = local_irq_save();
+
+    while (spin_trylock(&tx_lock)) {
+        unsigned long tail = tx_tail;
+        while (!(mmio_read(UART0_FR) & UART_FR_TXFF)) {
+            uint16_t slot = __atomic_load_n(&tx_ring[tail % UART_TX_RING_SIZE], __ATOMIC_ACQUIRE);
+            if (!(slot & UART_TX_SLOT_FULL)) {
+                break;
+            }
+            mmio_write(UART0_DR, slot & 0xff);
+            tx_ring[tail % UART_TX_RING_SIZE] = 0;
+            tail++;
+        }
+        __atomic_store_n(&tx_tail, tail, __ATOMIC_RELEASE);
+        spin_unlock(&tx_lock);
+
+        /* a byte written while the lock was held has to be picked up here */
+        uint16_t next = __atomic_load_n(&tx_ring[tail % UART_TX_RING_SIZE], __ATOMIC_ACQUIRE);
+        if (!(next & UART_TX_SLOT_FULL) || (mmio_read(UART0_FR) & UART_FR_TXFF)) {
+            break;
+        }
+    }
+
+    local_irq_restore(flags);
+}
+
 /**
  * @brief Sends a character via UART.
  *
- * This function transmits a single character over the UART interface.
+ * The character is queued and this function returns without waiting for
+ * the line. Only if the ring is full it moves bytes to the FIFO itself
+ * until there is room again.
  *
  * @param c The character to be sent.
  */
 void uart_putc(unsigned char c)
 {
-    // Wait for UART to become ready to transmit.
-    while (mmio_read(UART0_FR) & (1 << 5)) {
+    if (tx_sync) {
+        uart_putc_sync(c);
+        return;
     }
-    mmio_write(UART0_DR, c);
+
+    /* no interrupt may come between reserving a slot and filling it, or a
+     * writer in the interrupt could wait for that slot with a full ring */
+    unsigned long flags = local_irq_save();
+    unsigned long head = __atomic_load_n(&tx_head, __ATOMIC_RELAXED);
+    while (1) {
+        if (head - __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE) >= UART_TX_RING_SIZE) {
+            __atomic_add_fetch(&uart_stats.tx_overflows, 1, __ATOMIC_RELAXED);
+            uart_tx_kick();
+            head = __atomic_load_n(&tx_head, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&tx_head, &head, head + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    __atomic_store_n(&tx_ring[head % UART_TX_RING_SIZE], UART_TX_SLOT_FULL | c, __ATOMIC_RELEASE);
+    local_irq_restore(flags);
+    __atomic_add_fetch(&uart_stats.tx_bytes, 1, __ATOMIC_RELAXED);
+
+    uart_tx_kick();
+}
+
+/**
+ * @brief Moves everything in the RX FIFO to the RX ring and wakes readers.
+ */
+static void uart_rx_drain(void)
+{
+    int received = 0;
+
+    unsigned long flags = spin_lock_irqsave(&rx_lock);
+    while (!(mmio_read(UART0_FR) & UART_FR_RXFE)) {
+        uint32_t data = mmio_read(UART0_DR);
+        if (data & UART_DR_OE) {
+            /* the FIFO was full, bytes before this one were lost */
+            uart_stats.rx_overruns++;
+        }
+        if (data & UART_DR_ERRORS & ~UART_DR_OE) {
+            uart_stats.rx_errors++;
+            continue;
+        }
+        if (rx_head - rx_tail >= UART_RX_RING_SIZE) {
+            uart_stats.rx_dropped++;
+            continue;
+        }
+        rx_ring[rx_head++ % UART_RX_RING_SIZE] = data & 0xff;
+        uart_stats.rx_bytes++;
+        received = 1;
+    }
+    spin_unlock_irqrestore(&rx_lock, flags);
+
+    if (received) {
+        wake_up(&rx_wait);
+    }
+}
+
+/**
+ * @brief Handles the PL011 interrupt.
+ *
+ * Refills the TX FIFO from the TX ring and empties the RX FIFO into the RX
+ * ring.
+ */
+void uart_handle_irq(void)
+{
+    uint32_t status = mmio_read(UART0_MIS);
+
+    if (status & (UART_INT_RX | UART_INT_RT)) {
+        /* RX clears itself once the FIFO is below the level, RT has to be cleared */
+        mmio_write(UART0_ICR, UART_INT_RX | UART_INT_RT);
+        uart_stats.rx_irqs++;
+        uart_rx_drain();
+    }
+
+    if (status & UART_INT_TX) {
+        /* clear before refilling, so draining past the level again raises it again */
+        mmio_write(UART0_ICR, UART_INT_TX);
+        uart_stats.tx_irqs++;
+        uart_tx_kick();
+    }
+}
+
+/**
+ * @brief Switches the UART from synchronous output and polled input to interrupts.
+ *
+ * Must be called on the core that is to take the UART interrupt, after the
+ * interrupt controller is set up.
+ */
+void uart_enable_irq(void)
+{
+    mmio_write(UART0_ICR, UART_INT_TX | UART_INT_RX | UART_INT_RT);
+    mmio_write(UART0_IMSC, mmio_read(UART0_IMSC) | UART_INT_TX | UART_INT_RX | UART_INT_RT);
+    enable_irq(UART_IRQn);
+    irq_enabled = 1;
+    tx_sync = 0;
+}
+
+/**
+ * @brief Waits until everything queued so far has been written to the FIFO.
+ */
+void uart_flush(void)
+{
+    unsigned long head = __atomic_load_n(&tx_head, __ATOMIC_ACQUIRE);
+
+    while ((long)(head - __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE)) > 0) {
+        uart_tx_kick();
+    }
+    while (!(mmio_read(UART0_FR) & UART_FR_TXFE)) {
+    }
+}
+
+/**
+ * @brief Selects synchronous output or the TX interrupt.
+ *
+ * Only has an effect after uart_enable_irq(), output queued so far is
+ * flushed before switching.
+ *
+ * @param sync Non-zero to write every byte synchronously.
+ */
+void uart_set_sync(int sync)
+{
+    if (!irq_enabled) {
+        return;
+    }
+    uart_flush();
+    tx_sync = sync;
+}
+
+/**
+ * @brief Switches to synchronous output for good, for fatal errors.
+ *
+ * Whatever is queued is written out first, polling the FIFO, so it can be
+ * used with interrupts masked and from any core. Writers that are halfway
+ * through adding a byte on another core may lose that byte.
+ */
+void uart_panic(void)
+{
+    tx_sync = 1;
+    irq_enabled = 0;
+
+    unsigned long tail = __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE);
+    unsigned long head = __atomic_load_n(&tx_head, __ATOMIC_ACQUIRE);
+    for (; tail != head; tail++) {
+        uint16_t slot = tx_ring[tail % UART_TX_RING_SIZE];
+        if (slot & UART_TX_SLOT_FULL) {
+            uart_putc_sync(slot & 0xff);
+        }
+    }
+    __atomic_store_n(&tx_tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Reports the transmit counters.
+ *
+ * @param stats Filled with the counters.
+ */
+void uart_get_stats(struct uart_stats* stats)
+{
+    *stats = uart_stats;
+}
+
+/**
+ * @brief Takes up to size bytes from the RX ring.
+ *
+ * @return The number of bytes taken.
+ */
+static size_t uart_rx_take(uint8_t* buf, size_t size)
+{
+    size_t n = 0;
+
+    unsigned long flags = spin_lock_irqsave(&rx_lock);
+    while (n < size && rx_tail != rx_head) {
+        buf[n++] = rx_ring[rx_tail++ % UART_RX_RING_SIZE];
+    }
+    spin_unlock_irqrestore(&rx_lock, flags);
+    return n;
+}
+
+/**
+ * @brief Discards everything received and not read yet.
+ */
+void uart_flush_input(void)
+{
+    unsigned long flags = spin_lock_irqsave(&rx_lock);
+    while (!(mmio_read(UART0_FR) & UART_FR_RXFE)) {
+        mmio_read(UART0_DR);
+    }
+    rx_tail = rx_head;
+    spin_unlock_irqrestore(&rx_lock, flags);
+}
+
+/**
+ * @brief Reads received bytes, sleeping until there is at least one.
+ *
+ * Before uart_enable_irq() the RX FIFO is polled. The idle task of a core
+ * cannot sleep, it waits in the idle loop instead.
+ *
+ * @param buf Buffer for the bytes.
+ * @param size Size of the buffer, must not be 0.
+ * @return The number of bytes read, between 1 and size.
+ */
+size_t uart_read(void* buf, size_t size)
+{
+    struct wait_queue_entry wait;
+    size_t n;
+
+    if (!irq_enabled) {
+        while (mmio_read(UART0_FR) & UART_FR_RXFE) {
+        }
+        *(uint8_t*)buf = mmio_read(UART0_DR);
+        return 1;
+    }
+
+    if (is_idle_task(current)) {
+        while (!(n = uart_rx_take(buf, size))) {
+            cpu_idle_enter();
+        }
+        return n;
+    }
+
+    init_wait_entry(&wait);
+    while (1) {
+        prepare_to_wait(&rx_wait, &wait, TASK_INTERRUPTIBLE);
+        n = uart_rx_take(buf, size);
+        if (n) {
+            break;
+        }
+        schedule();
+    }
+    finish_wait(&rx_wait, &wait);
+    return n;
+}
+
+/**
+ * @brief Reads a line of input with echo and line editing.
+ *
+ * Carriage returns are taken as the end of the line, backspace and delete
+ * remove the last character. The line is returned with a trailing newline
+ * and null terminated. A line longer than the buffer is returned in parts.
+ *
+ * @param buf Buffer for the line.
+ * @param size Size of the buffer, at least 2.
+ * @return Length of the line including the newline.
+ */
+size_t uart_read_line(char* buf, size_t size)
+{
+    size_t len = 0;
+
+    while (len + 1 < size) {
+        unsigned char c;
+        uart_read(&c, 1);
+
+        if (c == '\r' || c == '\n') {
+            uart_puts("\r\n");
+            buf[len++] = '\n';
+            break;
+        }
+        if (c == '\b' || c == 0x7f) {
+            if (len) {
+                len--;
+                uart_puts("\b \b");
+            }
+            continue;
+        }
+        uart_putc(c);
+        buf[len++] = c;
+    }
+    buf[len] = '\0';
+    return len;
 }
 
 /**
@@ -150,10 +536,50 @@ void uart_putc(unsigned char c)
  */
 unsigned char uart_getc()
 {
-    // Wait for UART to have received something.
-    while (mmio_read(UART0_FR) & (1 << 4)) {
+    unsigned char c;
+    uart_read(&c, 1);
+    return c;
+}
+
+/**
+ * @brief Sets the baud rate.
+ *
+ * Waits for pending output first, the UART is disabled while the divisor
+ * changes.
+ *
+ * @param baud Baud rate, at most UART_CLOCK / 16.
+ */
+void uart_set_baud(unsigned int baud)
+{
+    /* divisor in 1/64ths, rounded to the nearest */
+    unsigned int divisor = (4 * UART_CLOCK + baud / 2) / baud;
+
+    uart_flush();
+    while (mmio_read(UART0_FR) & UART_FR_BUSY) {
     }
-    return mmio_read(UART0_DR);
+
+    uint32_t cr = mmio_read(UART0_CR);
+    mmio_write(UART0_CR, cr & ~UART_CR_UARTEN);
+    mmio_write(UART0_IBRD, divisor >> 6);
+    mmio_write(UART0_FBRD, divisor & 0x3f);
+    // The divisor only takes effect with a write to LCRH.
+    mmio_write(UART0_LCRH, UART_LCRH_8N1_FIFO);
+    mmio_write(UART0_CR, cr);
+}
+
+/**
+ * @brief Routes the output of the UART to its own input instead of the line.
+ *
+ * @param enable Non-zero to loop back, 0 to use the line again.
+ */
+void uart_set_loopback(int enable)
+{
+    uart_flush();
+    while (mmio_read(UART0_FR) & UART_FR_BUSY) {
+    }
+
+    uint32_t cr = mmio_read(UART0_CR);
+    mmio_write(UART0_CR, enable ? cr | UART_CR_LBE : cr & ~UART_CR_LBE);
 }
 
 /**
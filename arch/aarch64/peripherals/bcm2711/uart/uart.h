@@ -3,9 +3,37 @@
 
 #include <stddef.h>
 
+/* bytes queued for transmission, a power of two */
+#define UART_TX_RING_SIZE 16384
+
+/* bytes received and not read yet, a power of two */
+#define UART_RX_RING_SIZE 4096
+
+struct uart_stats {
+    unsigned long tx_bytes;
+    unsigned long tx_irqs;
+    unsigned long tx_overflows; /* times a writer found the ring full */
+    unsigned long rx_bytes;
+    unsigned long rx_irqs;
+    unsigned long rx_overruns; /* the RX FIFO was full and lost bytes */
+    unsigned long rx_dropped; /* bytes lost because the RX ring was full */
+    unsigned long rx_errors; /* bytes with framing, parity or break errors */
+};
+
 void uart_init(int raspi);
+void uart_enable_irq(void);
+void uart_handle_irq(void);
 void uart_putc(unsigned char c);
 unsigned char uart_getc();
+size_t uart_read(void* buf, size_t size);
+size_t uart_read_line(char* buf, size_t size);
+void uart_flush_input(void);
+void uart_set_baud(unsigned int baud);
+void uart_set_loopback(int enable);
 void uart_puts(const char* str);
+void uart_flush(void);
+void uart_set_sync(int sync);
+void uart_panic(void);
+void uart_get_stats(struct uart_stats* stats);
 
 #endif
@@ -0,0 +1,243 @@
+/**
+ * @file pmu.c
+ * @brief Cortex-A72 performance monitors.
+ *
+ * Every core runs its cycle counter and PMU_COUNTERS event counters from
+ * boot on, so perf regions only have to read them. The events are the same
+ * on all cores, pmu_set_event() reprograms the other cores with an IPI.
+ *
+ * Sampling uses the last event counter of the core, counting cycles, so the
+ * cycle counter keeps running undisturbed. Its overflow interrupt records the
+ * interrupted PC with perf_sample() and reloads the counter.
+ */
+#include <stdint.h>
+
+#include "entry.h"
+#include "irq/irq.h"
+#include "perf/perf.h"
+#include "pmu/pmu.h"
+#include "smp/smp.h"
+
+static unsigned int pmu_events[PMU_COUNTERS] = {
+    PMU_EVENT_L1D_CACHE_REFILL,
+    PMU_EVENT_L2D_CACHE_REFILL,
+    PMU_EVENT_BR_MIS_PRED,
+    PMU_EVENT_INST_RETIRED,
+};
+
+/* cycles between two samples, 0 while not sampling */
+static volatile uint32_t pmu_sample_period;
+
+static const struct {
+    unsigned int event;
+    const char* name;
+} pmu_event_names[] = {
+    { PMU_EVENT_L1D_CACHE_REFILL, "l1d_refill" },
+    { PMU_EVENT_INST_RETIRED, "inst_retired" },
+    { PMU_EVENT_BR_MIS_PRED, "br_mis_pred" },
+    { PMU_EVENT_CPU_CYCLES, "cpu_cycles" },
+    { PMU_EVENT_L2D_CACHE_REFILL, "l2d_refill" },
+};
+
+static inline uint64_t pmu_read_pmcr(void)
+{
+    uint64_t pmcr;
+    asm volatile("mrs %[pmcr], pmcr_el0"
+        : [pmcr] "=r"(pmcr));
+    return pmcr;
+}
+
+/**
+ * @brief Returns the event counter used for sampling, or -1 if there is none left.
+ */
+static int pmu_sample_counter(void)
+{
+    unsigned int n = PMCR_N(pmu_read_pmcr());
+    return n > PMU_COUNTERS ? (int)n - 1 : -1;
+}
+
+static void pmu_write_evtype(unsigned int counter, unsigned int event)
+{
+    /* count at EL1 and EL0 */
+    asm volatile("msr pmselr_el0, %[counter]\n\t"
+                 "isb\n\t"
+                 "msr pmxevtyper_el0, %[event]"
+        :
+        : [counter] "r"((uint64_t)counter), [event] "r"((uint64_t)(event & 0xffff))
+        : "memory");
+}
+
+static void pmu_write_evcntr(unsigned int counter, uint32_t value)
+{
+    asm volatile("msr pmselr_el0, %[counter]\n\t"
+                 "isb\n\t"
+                 "msr pmxevcntr_el0, %[value]"
+        :
+        : [counter] "r"((uint64_t)counter), [value] "r"((uint64_t)value)
+        : "memory");
+}
+
+/**
+ * @brief Starts the counters of the calling core.
+ *
+ * Called once per core during boot, before its interrupts are enabled.
+ * Benchmarks running in EL0 may read the cycle counter, nothing else.
+ */
+void pmu_init_cpu(void)
+{
+    uint64_t enable = PMU_CYCLE_COUNTER_BIT | ((1ul << PMU_COUNTERS) - 1);
+
+    asm volatile("msr pmintenclr_el1, %[all]\n\t"
+                 "msr pmcntenclr_el0, %[all]\n\t"
+                 "msr pmovsclr_el0, %[all]\n\t"
+                 "msr pmccfiltr_el0, xzr"
+        :
+        : [all] "r"(~0ul)
+        : "memory");
+    for (unsigned int i = 0; i < PMU_COUNTERS; i++) {
+        pmu_write_evtype(i, pmu_events[i]);
+    }
+    asm volatile("msr pmcr_el0, %[pmcr]\n\t"
+                 "msr pmcntenset_el0, %[enable]\n\t"
+                 "isb"
+        :
+        : [pmcr] "r"((uint64_t)(PMCR_E | PMCR_P | PMCR_C | PMCR_LC)), [enable] "r"(enable)
+        : "memory");
+#ifdef CONFIG_BENCH
+    asm volatile("msr pmuserenr_el0, %[cr]"
+        :
+        : [cr] "r"((uint64_t)PMUSERENR_CR));
+#endif
+}
+
+/**
+ * @brief Selects the event an event counter counts on all cores.
+ *
+ * The calling core is reprogrammed at once, the others when they take the
+ * IPI.
+ *
+ * @param counter Event counter, below PMU_COUNTERS.
+ * @param event Architectural or Cortex-A72 event number.
+ */
+void pmu_set_event(unsigned int counter, unsigned int event)
+{
+    if (counter >= PMU_COUNTERS) {
+        return;
+    }
+    pmu_events[counter] = event;
+    pmu_sync_cpu();
+    smp_send_ipi(smp_online_mask() & ~(1ul << smp_processor_id()), IPI_PMU);
+}
+
+/**
+ * @brief Returns the event an event counter counts.
+ */
+unsigned int pmu_get_event(unsigned int counter)
+{
+    return counter < PMU_COUNTERS ? pmu_events[counter] : 0;
+}
+
+/**
+ * @brief Returns a printable name of an event, NULL for unknown events.
+ */
+const char* pmu_event_name(unsigned int event)
+{
+    for (unsigned int i = 0; i < sizeof(pmu_event_names) / sizeof(pmu_event_names[0]); i++) {
+        if (pmu_event_names[i].event == event) {
+            return pmu_event_names[i].name;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts sampling the PC on all cores.
+ *
+ * @param period Cycles between two samples.
+ * @return 0 on success, -1 if the PMU has no spare counter for sampling.
+ */
+int pmu_start_sampling(uint32_t period)
+{
+    if (!period || pmu_sample_counter() < 0) {
+        return -1;
+    }
+    pmu_sample_period = period;
+    pmu_sync_cpu();
+    smp_send_ipi(smp_online_mask() & ~(1ul << smp_processor_id()), IPI_PMU);
+    return 0;
+}
+
+/**
+ * @brief Stops sampling on all cores.
+ */
+void pmu_stop_sampling(void)
+{
+    pmu_sample_period = 0;
+    pmu_sync_cpu();
+    smp_send_ipi(smp_online_mask() & ~(1ul << smp_processor_id()), IPI_PMU);
+}
+
+/**
+ * @brief Programs the events and the sampling state of the calling core.
+ *
+ * Runs on the IPI_PMU interrupt after another core changed them.
+ */
+void pmu_sync_cpu(void)
+{
+    unsigned long flags = local_irq_save();
+    int counter = pmu_sample_counter();
+    uint32_t period = pmu_sample_period;
+
+    for (unsigned int i = 0; i < PMU_COUNTERS; i++) {
+        pmu_write_evtype(i, pmu_events[i]);
+    }
+
+    if (counter >= 0) {
+        uint64_t bit = 1ul << counter;
+
+        asm volatile("msr pmintenclr_el1, %[bit]\n\t"
+                     "msr pmcntenclr_el0, %[bit]\n\t"
+                     "msr pmovsclr_el0, %[bit]"
+            :
+            : [bit] "r"(bit)
+            : "memory");
+        if (period) {
+            pmu_write_evtype(counter, PMU_EVENT_CPU_CYCLES);
+            pmu_write_evcntr(counter, -period);
+            asm volatile("msr pmintenset_el1, %[bit]\n\t"
+                         "msr pmcntenset_el0, %[bit]\n\t"
+                         "isb"
+                :
+                : [bit] "r"(bit)
+                : "memory");
+            enable_irq((IRQn_Type)(PMU_IRQ_BASE + smp_processor_id()));
+        }
+    }
+    local_irq_restore(flags);
+}
+
+/**
+ * @brief Handles the overflow interrupt of the PMU of the calling core.
+ */
+void handle_pmu_irq(void)
+{
+    int counter = pmu_sample_counter();
+    uint64_t overflow;
+
+    asm volatile("mrs %[ovs], pmovsclr_el0\n\t"
+                 "msr pmovsclr_el0, %[ovs]"
+        : [ovs] "=&r"(overflow)
+        :
+        : "memory");
+
+    if (counter < 0 || !(overflow & (1ul << counter))) {
+        return;
+    }
+    /* count the cycles to the next sample from here */
+    pmu_write_evcntr(counter, -pmu_sample_period);
+
+    struct pt_regs* regs = get_irq_regs();
+    if (regs) {
+        perf_sample(regs->pc);
+    }
+}
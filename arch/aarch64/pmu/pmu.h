@@ -0,0 +1,87 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include <stdint.h>
+
+/* event counters read by pmu_read(), the first counters of the core */
+#define PMU_COUNTERS 4
+
+/* shared peripheral interrupt of the PMU of core 0, the others follow */
+#define PMU_IRQ_BASE 48
+
+/* PMCR_EL0 */
+#define PMCR_E (1 << 0) /* enable all counters */
+#define PMCR_P (1 << 1) /* reset the event counters */
+#define PMCR_C (1 << 2) /* reset the cycle counter */
+#define PMCR_LC (1 << 6) /* 64-bit cycle counter overflow */
+#define PMCR_N(pmcr) (((pmcr) >> 11) & 0x1f)
+
+/* bit of the cycle counter in PMCNTENSET_EL0, PMINTENSET_EL1 and PMOVSCLR_EL0 */
+#define PMU_CYCLE_COUNTER_BIT (1ul << 31)
+
+/* PMUSERENR_EL0 */
+#define PMUSERENR_CR (1 << 2) /* EL0 may read the cycle counter */
+
+/* common architectural events, all supported by the Cortex-A72 */
+#define PMU_EVENT_L1D_CACHE_REFILL 0x03
+#define PMU_EVENT_INST_RETIRED 0x08
+#define PMU_EVENT_BR_MIS_PRED 0x10
+#define PMU_EVENT_CPU_CYCLES 0x11
+#define PMU_EVENT_L2D_CACHE_REFILL 0x17
+
+/**
+ * @brief Counter values of the calling core, see pmu_read().
+ */
+struct pmu_sample {
+    uint64_t cycles;
+    uint32_t events[PMU_COUNTERS];
+};
+
+/**
+ * @brief Reads the cycle counter of the calling core.
+ */
+static inline uint64_t pmu_read_cycles(void)
+{
+    uint64_t cycles;
+    asm volatile("isb\n\t"
+                 "mrs %[cycles], pmccntr_el0"
+        : [cycles] "=r"(cycles)
+        :
+        : "memory");
+    return cycles;
+}
+
+/**
+ * @brief Reads the cycle counter and the event counters of the calling core.
+ *
+ * The event counters are 32 bits wide, differences have to be taken modulo
+ * 2^32.
+ */
+static inline void pmu_read(struct pmu_sample* sample)
+{
+    uint64_t e0, e1, e2, e3;
+    asm volatile("isb\n\t"
+                 "mrs %[cycles], pmccntr_el0\n\t"
+                 "mrs %[e0], pmevcntr0_el0\n\t"
+                 "mrs %[e1], pmevcntr1_el0\n\t"
+                 "mrs %[e2], pmevcntr2_el0\n\t"
+                 "mrs %[e3], pmevcntr3_el0"
+        : [cycles] "=r"(sample->cycles), [e0] "=r"(e0), [e1] "=r"(e1), [e2] "=r"(e2), [e3] "=r"(e3)
+        :
+        : "memory");
+    sample->events[0] = e0;
+    sample->events[1] = e1;
+    sample->events[2] = e2;
+    sample->events[3] = e3;
+}
+
+void pmu_init_cpu(void);
+void pmu_set_event(unsigned int counter, unsigned int event);
+unsigned int pmu_get_event(unsigned int counter);
+const char* pmu_event_name(unsigned int event);
+int pmu_start_sampling(uint32_t period);
+void pmu_stop_sampling(void);
+void pmu_sync_cpu(void);
+void handle_pmu_irq(void);
+
+#endif
@@ -0,0 +1,38 @@
+/**
+ * @file power.c
+ * @brief Stopping the machine.
+ *
+ * The raspi4b has no PSCI firmware, so the kernel can only be stopped from
+ * the outside: with CONFIG_SEMIHOSTING a QEMU started with -semihosting
+ * exits with the given code. Semihosting traps on hardware without a
+ * debugger attached, so it is only built into images meant for QEMU.
+ */
+#include <stdint.h>
+
+#include "irq/irq.h"
+#include "power/power.h"
+
+/**
+ * @brief Stops the machine, or parks the calling core if that is not possible.
+ *
+ * @param code Exit code passed to the host.
+ */
+void system_exit(int code)
+{
+#ifdef CONFIG_SEMIHOSTING
+    uint64_t block[2] = { ADP_STOPPED_APPLICATION_EXIT, (uint64_t)code };
+
+    asm volatile("mov x0, %[op]\n\t"
+                 "mov x1, %[block]\n\t"
+                 "hlt #0xf000"
+        :
+        : [op] "r"((uint64_t)SEMIHOSTING_SYS_EXIT), [block] "r"(block)
+        : "x0", "x1", "memory");
+#else
+    (void)code;
+#endif
+    disable_irqs();
+    while (1) {
+        asm volatile("wfi");
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef POWER_H
+#define POWER_H
+
+/* semihosting operation and exit reason, see the Arm semihosting specification */
+#define SEMIHOSTING_SYS_EXIT 0x18
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026
+
+void system_exit(int code) __attribute__((noreturn));
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * @file smp.c
+ * @brief Secondary core bring-up and inter-processor interrupts.
+ *
+ * Secondary cores either enter _start together with the primary core or are
+ * parked by the firmware on the spin table. In both cases they wait until the
+ * primary releases them, then drop to EL1 through the same path as the primary
+ * core, switch to their own boot stack and call secondary_kmain().
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "fpsimd/fpsimd.h"
+#include "irq/irq.h"
+#include "mem/cache.h"
+#include "mem/mmu.h"
+#include "peripherals/bcm2711/bcm2711_lpa.h"
+#include "peripherals/bcm2711/cpu.h"
+#include "pmu/pmu.h"
+#include "printk.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "timer/arch_timer.h"
+
+/* how long to wait for the secondary cores to come up */
+#define SMP_BOOT_TIMEOUT_MS 1000
+
+extern void _start(void);
+
+/* used by boot.S, see CPU_STACK_SIZE */
+unsigned char cpu_stacks[NR_CPUS][CPU_STACK_SIZE] __attribute__((aligned(16)));
+
+/* read by secondary cores with their MMU off, long before BSS is cleared */
+volatile unsigned long secondary_release[NR_CPUS] __attribute__((section(".data"))) = { 0 };
+
+static volatile unsigned long cpu_online = 1;
+
+/* IPIs taken by every core */
+static volatile unsigned long ipi_count[NR_CPUS];
+
+/**
+ * @brief Releases the secondary cores and waits for them to come online.
+ *
+ * Must be called after the scheduler, the allocators and the MMU tables have
+ * been set up, since secondary cores start using them right away.
+ */
+void smp_boot_secondaries(void)
+{
+    volatile unsigned long* spin_table = (volatile unsigned long*)SPIN_TABLE_BASE;
+
+    for (unsigned int cpu = 1; cpu < NR_CPUS; cpu++) {
+        /* the core writes its stack with caches off, drop any stale lines */
+        dcache_flush_range(cpu_stacks[cpu], CPU_STACK_SIZE);
+        secondary_release[cpu] = 1;
+        spin_table[cpu] = (unsigned long)&_start;
+    }
+    dcache_clean_range((void*)secondary_release, sizeof(secondary_release));
+    dcache_clean_range((void*)spin_table, NR_CPUS * sizeof(unsigned long));
+    asm volatile("sev");
+
+    uint64_t deadline = read_cntvct() + read_cntfrq() * SMP_BOOT_TIMEOUT_MS / 1000;
+    while (cpu_online != (1ul << NR_CPUS) - 1 && read_cntvct() < deadline) {
+    }
+
+    printk("%d cores online\n", smp_num_online());
+}
+
+/**
+ * @brief C entry point of the secondary cores.
+ *
+ * Called from boot.S on the boot stack of the core, with the MMU still off.
+ *
+ * @param cpu Number of this core.
+ */
+void secondary_kmain(unsigned long cpu)
+{
+    mmu_enable_secondary();
+    irq_vector_init();
+    sched_init_secondary(cpu);
+    fpsimd_init_cpu();
+    pmu_init_cpu();
+    gic_cpu_init();
+    arch_timer_init_cpu();
+
+    __atomic_or_fetch(&cpu_online, 1ul << cpu, __ATOMIC_RELEASE);
+
+    enable_irqs();
+    cpu_idle();
+}
+
+/**
+ * @brief Returns a bitmask of the cores that are running.
+ */
+unsigned long smp_online_mask(void)
+{
+    return __atomic_load_n(&cpu_online, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Returns the number of cores that are running.
+ */
+unsigned int smp_num_online(void)
+{
+    return __builtin_popcountl(smp_online_mask());
+}
+
+/**
+ * @brief Sends a software generated interrupt to a set of cores.
+ *
+ * @param cpu_mask Bitmask of the target cores.
+ * @param ipi The SGI number, one of the IPI_* values.
+ */
+void smp_send_ipi(unsigned long cpu_mask, unsigned int ipi)
+{
+    /* make stores visible before the target takes the interrupt */
+    asm volatile("dsb ish" ::: "memory");
+    GIC_DIST->GICD_SGIR = ((cpu_mask & 0xff) << 16) | (ipi & 0xf);
+}
+
+/**
+ * @brief Handles an inter-processor interrupt.
+ *
+ * IPI_RESCHEDULE needs no work here, taking the interrupt already woke the
+ * core from cpu_idle(). IPI_PMU reprograms the performance monitors.
+ *
+ * @param ipi The SGI number, one of the IPI_* values.
+ */
+void handle_ipi(unsigned int ipi)
+{
+    ipi_count[smp_processor_id()]++;
+    if (ipi == IPI_PMU) {
+        pmu_sync_cpu();
+    }
+}
+
+/**
+ * @brief Returns the number of IPIs the calling core has taken.
+ */
+unsigned long smp_ipi_count(void)
+{
+    return ipi_count[smp_processor_id()];
+}
@@ -0,0 +1,52 @@
+#ifndef SMP_H
+#define SMP_H
+
+/* raspi4b has four Cortex-A72 cores */
+#define NR_CPUS 4
+
+/* boot stack of each secondary core */
+#define CPU_STACK_SIZE 16384
+
+/* spin table the firmware parks secondary cores on, one entry per core */
+#define SPIN_TABLE_BASE 0xd8
+
+/* software generated interrupts used between cores */
+#define IPI_RESCHEDULE 1
+#define IPI_PMU 2
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+/**
+ * @brief Returns the number of the core executing this code.
+ *
+ * Aff0 of MPIDR_EL1 is the core number within the cluster.
+ */
+static inline unsigned int smp_processor_id(void)
+{
+    uint64_t mpidr;
+    asm volatile("mrs %[mpidr], mpidr_el1"
+        : [mpidr] "=r"(mpidr));
+    return mpidr & 0xff;
+}
+
+/**
+ * @brief Sleeps until an interrupt is pending, also when it is masked.
+ */
+static inline void cpu_wfi(void)
+{
+    asm volatile("dsb sy\n\t"
+                 "wfi");
+}
+
+void smp_boot_secondaries(void);
+void secondary_kmain(unsigned long cpu);
+unsigned long smp_online_mask(void);
+unsigned int smp_num_online(void);
+void smp_send_ipi(unsigned long cpu_mask, unsigned int ipi);
+void handle_ipi(unsigned int ipi);
+unsigned long smp_ipi_count(void);
+
+#endif /* __ASSEMBLER__ */
+#endif
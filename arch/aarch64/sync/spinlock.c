@@ -0,0 +1,73 @@
+/**
+ * @file spinlock.c
+ * @brief Spinlocks for data shared between cores.
+ *
+ * The exclusive load/store pairs generated for the atomics only work on
+ * memory that is mapped Normal cacheable, so locks must not be taken before
+ * mmu_enable_caches() on real hardware.
+ */
+#include "sync/spinlock.h"
+#include "irq/irq.h"
+
+/**
+ * @brief Acquires a spinlock.
+ *
+ * Spins on a plain load while the lock is held, so that waiting cores do not
+ * keep stealing the cache line from the owner.
+ *
+ * @param lock The lock to acquire.
+ */
+void spin_lock(spinlock_t* lock)
+{
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) {
+            asm volatile("yield");
+        }
+    }
+}
+
+/**
+ * @brief Releases a spinlock.
+ *
+ * @param lock The lock to release.
+ */
+void spin_unlock(spinlock_t* lock)
+{
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Tries to acquire a spinlock without waiting.
+ *
+ * @param lock The lock to acquire.
+ * @return 1 if the lock was acquired, 0 if it is held by someone else.
+ */
+int spin_trylock(spinlock_t* lock)
+{
+    return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Masks IRQs on this core and acquires a spinlock.
+ *
+ * @param lock The lock to acquire.
+ * @return The previous interrupt mask, to be passed to spin_unlock_irqrestore().
+ */
+unsigned long spin_lock_irqsave(spinlock_t* lock)
+{
+    unsigned long flags = local_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+/**
+ * @brief Releases a spinlock and restores the interrupt mask.
+ *
+ * @param lock The lock to release.
+ * @param flags The value returned by spin_lock_irqsave().
+ */
+void spin_unlock_irqrestore(spinlock_t* lock, unsigned long flags)
+{
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
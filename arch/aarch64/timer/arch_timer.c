@@ -0,0 +1,63 @@
+/**
+ * @file arch_timer.c
+ * @brief Per-core ARM generic timer used as clock event device.
+ *
+ * Every core programs its own EL1 virtual timer with the absolute CNTVCT
+ * value of its next hrtimer, so timer events never need the shared BCM2711
+ * system timer or an IPI.
+ */
+#include <stdint.h>
+
+#include "irq/irq.h"
+#include "time/hrtimer.h"
+#include "timer/arch_timer.h"
+
+/**
+ * @brief Sets up the virtual timer of the calling core.
+ *
+ * The timer stays masked until the first hrtimer is queued. Must be called
+ * after gic_cpu_init() since the PPI enable is banked per core.
+ */
+void arch_timer_init_cpu(void)
+{
+    arch_timer_stop();
+    enable_irq((IRQn_Type)ARCH_TIMER_VIRT_IRQ);
+}
+
+/**
+ * @brief Fires the timer interrupt of the calling core at an absolute time.
+ *
+ * @param cval CNTVCT_EL0 value to fire at, a value in the past fires at once.
+ */
+void arch_timer_set_next(uint64_t cval)
+{
+    asm volatile("msr cntv_cval_el0, %[cval]\n\t"
+                 "msr cntv_ctl_el0, %[ctl]\n\t"
+                 "isb"
+        :
+        : [cval] "r"(cval), [ctl] "r"((uint64_t)CNTV_CTL_ENABLE)
+        : "memory");
+}
+
+/**
+ * @brief Masks the timer interrupt of the calling core.
+ */
+void arch_timer_stop(void)
+{
+    asm volatile("msr cntv_ctl_el0, %[ctl]\n\t"
+                 "isb"
+        :
+        : [ctl] "r"((uint64_t)(CNTV_CTL_ENABLE | CNTV_CTL_IMASK))
+        : "memory");
+}
+
+/**
+ * @brief Handles the virtual timer interrupt.
+ *
+ * The interrupt is level triggered, hrtimer_interrupt() either moves the
+ * compare value into the future or masks the timer before the EOI.
+ */
+void handle_arch_timer_irq(void)
+{
+    hrtimer_interrupt();
+}
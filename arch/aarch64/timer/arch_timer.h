@@ -0,0 +1,19 @@
+#ifndef ARCH_TIMER_H
+#define ARCH_TIMER_H
+
+#include <stdint.h>
+
+/* PPI of the EL1 virtual timer, banked per core */
+#define ARCH_TIMER_VIRT_IRQ 27
+
+/* CNTV_CTL_EL0 */
+#define CNTV_CTL_ENABLE (1 << 0)
+#define CNTV_CTL_IMASK (1 << 1)
+#define CNTV_CTL_ISTATUS (1 << 2)
+
+void arch_timer_init_cpu(void);
+void arch_timer_set_next(uint64_t cval);
+void arch_timer_stop(void);
+void handle_arch_timer_irq(void);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef USER_H
+#define USER_H
+
+/*
+ * Offsets into the page the user programs get in x0, where they take their
+ * parameters from and leave their results, see struct user_data.
+ */
+#define USER_DATA_ITERATIONS 0
+#define USER_DATA_CYCLES 8
+#define USER_DATA_PID 16
+#define USER_DATA_WRITE 24
+#define USER_DATA_MMAP 32
+#define USER_DATA_MMAP_READ 40
+#define USER_DATA_BAD_SYSCALL 48
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+struct user_data {
+    uint64_t iterations; /* in, system calls to time */
+    uint64_t cycles; /* PMCCNTR_EL0 cycles the system calls took */
+    int64_t pid; /* result of the last getpid */
+    int64_t write; /* results of user_smoke */
+    int64_t mmap;
+    int64_t mmap_read; /* word read back from the mapped page */
+    int64_t bad_syscall; /* result of a number past NR_SYSCALLS */
+};
+
+_Static_assert(__builtin_offsetof(struct user_data, bad_syscall) == USER_DATA_BAD_SYSCALL, "user_data does not match user.S");
+
+/* entry points in .text.user, see user_text_addr() */
+extern char user_null_syscall[];
+extern char user_smoke[];
+
+#endif
+#endif
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Run the benchmark kernel under QEMU and compare it with a baseline.
+
+Build the image with `xmake build kbench`. The kernel prints its results as
+
+    BENCH <suite> <name> <value> <unit>
+
+and stops QEMU through semihosting after a final "BENCH done" line.
+
+Results are compared with the baseline JSON by unit: times (ps, ns, cycles,
+ticks, mticks) must not grow and rates (anything per second) must not drop
+by more than the threshold. Other units are only shown. The exit code is 1
+if a result regressed or the run did not finish, so the script can gate CI.
+Use --update to store the results of the run as the new baseline.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+LOWER_IS_BETTER = {"ps", "ns", "cycles", "ticks", "mticks"}
+
+DEFAULT_BASELINE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "kbench_baseline.json")
+
+
+def run_qemu(args):
+    cmd = [
+        args.qemu, "-M", "raspi4b", "-smp", "4",
+        "-kernel", args.kernel,
+        "-display", "none", "-monitor", "none",
+        "-serial", "stdio",
+        "-semihosting",
+    ]
+    try:
+        proc = subprocess.run(cmd, capture_output=True, text=True, errors="replace", timeout=args.timeout)
+    except subprocess.TimeoutExpired as e:
+        out = e.stdout.decode(errors="replace") if isinstance(e.stdout, bytes) else (e.stdout or "")
+        return out, None
+    return proc.stdout, proc.returncode
+
+
+def parse(log):
+    results = {}
+    done = False
+    for line in log.splitlines():
+        pos = line.find("BENCH ")
+        if pos < 0:
+            continue
+        fields = line[pos:].split()
+        if fields[1:] == ["done"]:
+            done = True
+            continue
+        if len(fields) < 4:
+            continue
+        try:
+            value = int(fields[3])
+        except ValueError:
+            continue
+        unit = fields[4] if len(fields) > 4 else ""
+        results["%s/%s" % (fields[1], fields[2])] = {"value": value, "unit": unit}
+    return results, done
+
+
+def direction(unit):
+    if unit in LOWER_IS_BETTER:
+        return -1
+    if unit.endswith("/s"):
+        return 1
+    return 0
+
+
+def compare(baseline, results, threshold):
+    regressions = 0
+    for key in sorted(set(baseline) | set(results)):
+        old = baseline.get(key)
+        new = results.get(key)
+        if old is None:
+            print("%-50s %14s -> %14d %s (new)" % (key, "", new["value"], new["unit"]))
+            continue
+        if new is None:
+            print("%-50s %14d -> %14s %s (missing)" % (key, old["value"], "", old["unit"]))
+            continue
+
+        change = (new["value"] - old["value"]) * 100.0 / old["value"] if old["value"] else 0.0
+        sign = direction(new["unit"])
+        mark = ""
+        if sign and -sign * change > threshold:
+            mark = " REGRESSION"
+            regressions += 1
+        elif sign and sign * change > threshold:
+            mark = " improved"
+        print("%-50s %14d -> %14d %s %+.1f%%%s" % (key, old["value"], new["value"], new["unit"], change, mark))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--kernel", default="build/linux/aarch64/release/kbench.elf", help="benchmark kernel image")
+    parser.add_argument("--qemu", default="qemu-system-aarch64", help="QEMU binary")
+    parser.add_argument("--log", help="compare this UART log instead of running QEMU")
+    parser.add_argument("--save-log", help="write the UART output of the run here")
+    parser.add_argument("--baseline", default=DEFAULT_BASELINE, help="baseline JSON")
+    parser.add_argument("--threshold", type=float, default=10.0, help="allowed change in percent")
+    parser.add_argument("--timeout", type=int, default=600, help="seconds before the run is given up on")
+    parser.add_argument("--update", action="store_true", help="store the results as the new baseline")
+    args = parser.parse_args()
+
+    if args.log:
+        with open(args.log, errors="replace") as f:
+            log = f.read()
+        code = 0
+    else:
+        log, code = run_qemu(args)
+        if args.save_log:
+            with open(args.save_log, "w") as f:
+                f.write(log)
+
+    results, done = parse(log)
+    if not done or code != 0:
+        sys.stderr.write("kbench: run did not finish (exit code %s), %d results\n" % (code, len(results)))
+        return 1
+
+    if args.update:
+        with open(args.baseline, "w") as f:
+            json.dump(results, f, indent=1, sort_keys=True)
+            f.write("\n")
+        print("stored %d results in %s" % (len(results), args.baseline))
+        return 0
+
+    if not os.path.exists(args.baseline):
+        sys.stderr.write("kbench: no baseline at %s, run with --update first\n" % args.baseline)
+        return 1
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+
+    regressions = compare(baseline, results, args.threshold)
+    print("%d results, %d regressions over %.0f%%" % (len(results), regressions, args.threshold))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
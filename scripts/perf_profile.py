@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Turn the PC samples of a kernel UART log into a flat profile.
+
+The kernel prints its sample buffers with perf_sample_dump() as
+
+    PERF_SAMPLE <cpu> <hex pc>
+    PERF_SAMPLE_LOST <cpu> <count>
+
+Pass the captured UART log and the kernel ELF the log was taken with, other
+lines are ignored. PCs are mapped to functions with the symbol table printed
+by nm, use --nm to pick the one of the cross toolchain.
+"""
+
+import argparse
+import bisect
+import collections
+import subprocess
+import sys
+
+
+def parse_log(lines):
+    samples = []
+    lost = 0
+    for line in lines:
+        pos = line.find("PERF_SAMPLE")
+        if pos < 0:
+            continue
+        fields = line[pos:].split()
+        if len(fields) != 3:
+            continue
+        try:
+            if fields[0] == "PERF_SAMPLE":
+                samples.append((int(fields[1]), int(fields[2], 16)))
+            elif fields[0] == "PERF_SAMPLE_LOST":
+                lost += int(fields[2])
+        except ValueError:
+            continue
+    return samples, lost
+
+
+def load_symbols(nm, elf):
+    out = subprocess.run([nm, "-n", elf], check=True, capture_output=True, text=True).stdout
+    addrs = []
+    names = []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) != 3 or fields[1] not in "tTwW":
+            continue
+        addrs.append(int(fields[0], 16))
+        names.append(fields[2])
+    return addrs, names
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="UART log with PERF_SAMPLE lines, - for stdin")
+    parser.add_argument("elf", help="kernel ELF, e.g. kernel8.elf")
+    parser.add_argument("--nm", default="aarch64-none-elf-nm", help="nm of the cross toolchain")
+    parser.add_argument("--cpu", type=int, help="only count samples of this core")
+    parser.add_argument("-n", "--lines", type=int, default=30, help="functions to print")
+    args = parser.parse_args()
+
+    with (sys.stdin if args.input == "-" else open(args.input, errors="replace")) as f:
+        samples, lost = parse_log(f)
+    if args.cpu is not None:
+        samples = [s for s in samples if s[0] == args.cpu]
+    if not samples:
+        parser.error("no PERF_SAMPLE lines in the input")
+    addrs, names = load_symbols(args.nm, args.elf)
+
+    counts = collections.Counter()
+    for _, pc in samples:
+        i = bisect.bisect_right(addrs, pc) - 1
+        counts[names[i] if i >= 0 else "0x%x" % pc] += 1
+
+    total = len(samples)
+    print("%d samples, %d lost" % (total, lost))
+    print("%8s %7s  %s" % ("samples", "percent", "function"))
+    for name, count in counts.most_common(args.lines):
+        print("%8d %6.2f%%  %s" % (count, 100.0 * count / total, name))
+
+
+if __name__ == "__main__":
+    main()
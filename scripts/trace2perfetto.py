@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""Convert a kernel trace dump to Chrome/Perfetto trace JSON.
+
+The kernel prints its trace buffers with trace_dump() as
+
+    TRACE_FREQ <hex of the little-endian counter frequency>
+    TRACE <hex of a little-endian struct trace_entry>
+    ...
+
+Pass the captured UART log, other lines are ignored. A raw binary file of
+struct trace_entry records, e.g. dumped with gdb, works with --binary and
+--freq. Open the output in https://ui.perfetto.dev or chrome://tracing.
+
+Every core gets a process with a "tasks" thread showing which task ran when
+and an "irqs" thread showing interrupt handlers. Wakeups are drawn as flows
+to the switch that ran the woken task. Context switch and interrupt latency
+statistics are printed to stderr.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+ENTRY = struct.Struct("<QHHIQQ")
+
+SCHED_SWITCH = 1
+SCHED_WAKEUP = 2
+IRQ_ENTRY = 3
+IRQ_EXIT = 4
+TASK_NEW = 5
+TASK_EXIT = 6
+
+IRQ_NAMES = {
+    1: "ipi reschedule",
+    27: "arch timer",
+    153: "uart",
+}
+
+TID_TASKS = 0
+TID_IRQS = 1
+
+
+def parse_log(lines):
+    freq = None
+    records = []
+    for line in lines:
+        line = line.strip()
+        pos = line.find("TRACE")
+        if pos < 0:
+            continue
+        fields = line[pos:].split()
+        if len(fields) != 2:
+            continue
+        try:
+            data = bytes.fromhex(fields[1])
+        except ValueError:
+            continue
+        if fields[0] == "TRACE_FREQ" and len(data) == 8:
+            freq = struct.unpack("<Q", data)[0]
+        elif fields[0] == "TRACE" and len(data) == ENTRY.size:
+            records.append(ENTRY.unpack(data))
+    return freq, records
+
+
+def parse_binary(data):
+    count = len(data) // ENTRY.size
+    return [ENTRY.unpack_from(data, i * ENTRY.size) for i in range(count)]
+
+
+def task_name(pid):
+    return "idle" if pid == 0 else "pid %d" % pid
+
+
+class Converter:
+    def __init__(self, freq):
+        self.freq = freq
+        self.events = []
+        self.start = None
+        self.running = {}  # cpu -> (pid, start ts)
+        self.irqs = {}  # cpu -> stack of (irq, start ts)
+        self.wakeups = {}  # pid -> (flow id, ts)
+        self.flow_id = 0
+        self.wakeup_latency = []
+        self.irq_duration = []
+        self.switches = 0
+
+    def us(self, ts):
+        return (ts - self.start) * 1e6 / self.freq
+
+    def add(self, **event):
+        self.events.append(event)
+
+    def slice(self, cpu, tid, name, begin, end, args=None):
+        event = dict(name=name, ph="X", pid=cpu, tid=tid, ts=self.us(begin), dur=self.us(end) - self.us(begin))
+        if args:
+            event["args"] = args
+        self.add(**event)
+
+    def instant(self, cpu, name, ts, args):
+        self.add(name=name, ph="i", s="t", pid=cpu, tid=TID_TASKS, ts=self.us(ts), args=args)
+
+    def metadata(self, cpus):
+        for cpu in sorted(cpus):
+            self.add(name="process_name", ph="M", pid=cpu, args={"name": "CPU %d" % cpu})
+            self.add(name="process_sort_index", ph="M", pid=cpu, args={"sort_index": cpu})
+            self.add(name="thread_name", ph="M", pid=cpu, tid=TID_TASKS, args={"name": "tasks"})
+            self.add(name="thread_name", ph="M", pid=cpu, tid=TID_IRQS, args={"name": "irqs"})
+
+    def record(self, ts, event, cpu, arg0, arg1, arg2):
+        if cpu not in self.running:
+            self.running[cpu] = (None, ts)
+
+        if event == SCHED_SWITCH:
+            prev, since = self.running[cpu]
+            name = task_name(arg0 if prev is None else prev)
+            self.slice(cpu, TID_TASKS, name, since, ts, {"state": arg2})
+            self.running[cpu] = (arg1, ts)
+            self.switches += 1
+            wakeup = self.wakeups.pop(arg1, None)
+            if wakeup:
+                flow, woken = wakeup
+                self.wakeup_latency.append(self.us(ts) - self.us(woken))
+                self.add(name="wakeup", cat="sched", ph="f", bp="e", id=flow, pid=cpu, tid=TID_TASKS, ts=self.us(ts))
+        elif event == SCHED_WAKEUP:
+            self.flow_id += 1
+            self.wakeups[arg0] = (self.flow_id, ts)
+            self.instant(cpu, "wakeup " + task_name(arg0), ts, {"pid": arg0, "target_cpu": arg1})
+            self.add(name="wakeup", cat="sched", ph="s", id=self.flow_id, pid=cpu, tid=TID_TASKS, ts=self.us(ts))
+        elif event == IRQ_ENTRY:
+            self.irqs.setdefault(cpu, []).append((arg0, ts))
+        elif event == IRQ_EXIT:
+            stack = self.irqs.get(cpu)
+            if stack and stack[-1][0] == arg0:
+                irq, since = stack.pop()
+                self.irq_duration.append(self.us(ts) - self.us(since))
+                self.slice(cpu, TID_IRQS, IRQ_NAMES.get(irq, "irq %d" % irq), since, ts, {"irq": irq})
+        elif event == TASK_NEW:
+            self.instant(cpu, "fork " + task_name(arg0), ts, {"pid": arg0, "parent": arg1})
+        elif event == TASK_EXIT:
+            self.instant(cpu, "exit " + task_name(arg0), ts, {"pid": arg0, "code": arg1})
+
+    def convert(self, records):
+        records = sorted(records, key=lambda r: r[0])
+        if not records:
+            return {"traceEvents": []}
+        self.start = records[0][0]
+        cpus = set()
+        for ts, event, cpu, arg0, arg1, arg2 in records:
+            cpus.add(cpu)
+            self.record(ts, event, cpu, arg0, arg1, arg2)
+
+        end = records[-1][0]
+        for cpu, (pid, since) in self.running.items():
+            if pid is not None:
+                self.slice(cpu, TID_TASKS, task_name(pid), since, end)
+        self.metadata(cpus)
+        return {"traceEvents": self.events, "displayTimeUnit": "ns"}
+
+    def summary(self, out):
+        def stats(name, values):
+            if values:
+                out.write("%s: n=%d avg=%.2fus max=%.2fus\n" % (name, len(values), sum(values) / len(values), max(values)))
+
+        out.write("context switches: %d\n" % self.switches)
+        stats("wakeup latency", self.wakeup_latency)
+        stats("irq handler time", self.irq_duration)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="UART log with TRACE lines, - for stdin")
+    parser.add_argument("-o", "--output", default="-", help="trace JSON, - for stdout")
+    parser.add_argument("--binary", action="store_true", help="input is raw struct trace_entry records")
+    parser.add_argument("--freq", type=int, help="counter frequency in Hz, overrides TRACE_FREQ")
+    args = parser.parse_args()
+
+    freq = None
+    if args.binary:
+        with open(args.input, "rb") as f:
+            records = parse_binary(f.read())
+    else:
+        with (sys.stdin if args.input == "-" else open(args.input, errors="replace")) as f:
+            freq, records = parse_log(f)
+    freq = args.freq or freq
+    if not freq:
+        parser.error("no TRACE_FREQ line in the input, pass --freq")
+
+    converter = Converter(freq)
+    trace = converter.convert(records)
+    with (sys.stdout if args.output == "-" else open(args.output, "w")) as f:
+        json.dump(trace, f)
+    converter.summary(sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,111 @@
+/**
+ * @file bench.c
+ * @brief Common helpers for the boot-time benchmarks.
+ *
+ * Benchmarks are only run when the kernel is built with CONFIG_BENCH. Time is
+ * measured with the ARM generic timer virtual counter.
+ */
+#include "bench/bench.h"
+#include "arm/counter.h"
+#include "printk.h"
+
+static uint32_t bench_seed = 0x2545f491;
+
+/**
+ * @brief Prints a benchmark result in the machine-parseable format.
+ *
+ * The value is converted to decimal here so that 64-bit results do not
+ * depend on the length modifiers supported by printk.
+ *
+ * @param suite Benchmark suite, e.g. "cache".
+ * @param name Name of the measured quantity.
+ * @param value Measured value.
+ * @param unit Unit of the value.
+ */
+void bench_report(const char* suite, const char* name, uint64_t value, const char* unit)
+{
+    char buf[21];
+    int i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value && i > 0);
+
+    printk("%s %s %s %s %s\n", BENCH_TAG, suite, name, &buf[i], unit);
+}
+
+/**
+ * @brief Builds a result name with a numeric suffix, e.g. "switches_per_s_64".
+ *
+ * @param buf Receives the name.
+ * @param size Size of buf.
+ * @param name Name without the suffix.
+ * @param n Number appended after an underscore.
+ */
+void bench_name(char* buf, size_t size, const char* name, uint64_t n)
+{
+    char digits[21];
+    size_t nd = 0;
+    size_t i = 0;
+
+    do {
+        digits[nd++] = '0' + (n % 10);
+        n /= 10;
+    } while (n);
+
+    while (*name && i + 1 < size) {
+        buf[i++] = *name++;
+    }
+    if (i + 1 < size) {
+        buf[i++] = '_';
+    }
+    while (nd && i + 1 < size) {
+        buf[i++] = digits[--nd];
+    }
+    buf[i] = '\0';
+}
+
+/**
+ * @brief Converts generic timer ticks to nanoseconds.
+ *
+ * @param ticks Number of CNTVCT_EL0 ticks.
+ * @return The duration in nanoseconds.
+ */
+uint64_t bench_ticks_to_ns(uint64_t ticks)
+{
+    uint64_t frq = read_cntfrq();
+    if (!frq) {
+        return 0;
+    }
+    return ticks / frq * 1000000000ull + (ticks % frq) * 1000000000ull / frq;
+}
+
+/**
+ * @brief Computes how many events happened per second.
+ *
+ * @param count Number of events.
+ * @param ticks Number of CNTVCT_EL0 ticks the events took.
+ * @return Events per second.
+ */
+uint64_t bench_per_second(uint64_t count, uint64_t ticks)
+{
+    if (!ticks) {
+        return 0;
+    }
+    return count * read_cntfrq() / ticks;
+}
+
+/**
+ * @brief Returns a pseudo random number (xorshift32).
+ *
+ * The sequence is deterministic so that runs can be compared.
+ */
+uint32_t bench_random(void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
@@ -0,0 +1,42 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Every result is printed as a single line:
+ *   BENCH <suite> <name> <value> <unit>
+ * so it can be grepped out of the UART log.
+ */
+#define BENCH_TAG "BENCH"
+
+void bench_report(const char* suite, const char* name, uint64_t value, const char* unit);
+void bench_name(char* buf, size_t size, const char* name, uint64_t n);
+uint64_t bench_ticks_to_ns(uint64_t ticks);
+uint64_t bench_per_second(uint64_t count, uint64_t ticks);
+uint32_t bench_random(void);
+
+void bench_cache(const char* label);
+void bench_mem(void);
+void bench_pcp(void);
+void bench_slab(void);
+void bench_smp(void);
+void bench_sched(void);
+void bench_fork(void);
+void bench_fpsimd(void);
+void bench_idle(void);
+void bench_hrtimer(void);
+void bench_delay(void);
+void bench_uart(void);
+void bench_log(void);
+void bench_trace(void);
+void bench_perf(void);
+void bench_string(void);
+void bench_pgtable(void);
+void bench_mm(void);
+void bench_cow(void);
+void bench_fault(void);
+void bench_syscall(void);
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * @file bench_cache.c
+ * @brief memcpy and printk throughput benchmark.
+ *
+ * Run once before and once after mmu_enable_caches() to show the effect of
+ * the data and instruction caches.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "printk.h"
+
+#define BENCH_COPY_SIZE (64 * 1024)
+#define BENCH_COPY_ROUNDS 16
+#define BENCH_PRINTK_LINES 32
+
+static uint64_t bench_src[BENCH_COPY_SIZE / sizeof(uint64_t)] __attribute__((aligned(64)));
+static uint64_t bench_dst[BENCH_COPY_SIZE / sizeof(uint64_t)] __attribute__((aligned(64)));
+
+/**
+ * @brief Copies a buffer one doubleword at a time.
+ */
+static void bench_copy(uint64_t* dst, const uint64_t* src, uint64_t words)
+{
+    for (uint64_t i = 0; i < words; i++) {
+        dst[i] = src[i];
+    }
+}
+
+/**
+ * @brief Measures memcpy and printk throughput with the current cache setup.
+ *
+ * @param label Suite name the results are reported under, e.g. "cache_off".
+ */
+void bench_cache(const char* label)
+{
+    const uint64_t words = BENCH_COPY_SIZE / sizeof(uint64_t);
+    for (uint64_t i = 0; i < words; i++) {
+        bench_src[i] = i;
+    }
+
+    uint64_t start = read_cntvct();
+    for (int round = 0; round < BENCH_COPY_ROUNDS; round++) {
+        bench_copy(bench_dst, bench_src, words);
+    }
+    uint64_t ticks = read_cntvct() - start;
+    bench_report(label, "memcpy", bench_per_second((uint64_t)BENCH_COPY_SIZE * BENCH_COPY_ROUNDS, ticks) / 1024, "KiB/s");
+
+    /* sizeof() counts the NUL, which stands in for the newline */
+    static const char line_text[] = "...............................................................";
+    start = read_cntvct();
+    for (int line = 0; line < BENCH_PRINTK_LINES; line++) {
+        printk("%s\n", line_text);
+    }
+    ticks = read_cntvct() - start;
+    bench_report(label, "printk", bench_per_second(sizeof(line_text) * BENCH_PRINTK_LINES, ticks), "B/s");
+}
@@ -0,0 +1,192 @@
+/**
+ * @file bench_cow.c
+ * @brief Copy-on-write fork against copying the address space up front.
+ *
+ * The primary idle task switches to an address space with 1MB, 16MB or
+ * 128MB of pages and forks. fork_process() only copies the tables, the
+ * eager variant copies every page before it creates the child. Each child
+ * writes one word of every page, which for copy-on-write means a fault and
+ * a copy per page. The report has the time the parent spent in the fork,
+ * the average ns of a child write fault and pages lost over the run.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "lib/string.h"
+#include "mem/mem.h"
+#include "mem/mm.h"
+#include "mem/pgtable.h"
+#include "scheduler/fork.h"
+#include "scheduler/pid.h"
+#include "scheduler/scheduler.h"
+
+static const unsigned long bench_cow_sizes_mb[] = { 1, 16, 128 };
+
+static unsigned long bench_cow_nr_pages;
+static volatile uint64_t bench_cow_child_ticks;
+static volatile unsigned long bench_cow_done;
+
+static unsigned long bench_cow_free_pages(void)
+{
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    return stats.free_pages + stats.cached_pages;
+}
+
+/**
+ * @brief Child task, writes to every page, switching to mm first if it is given.
+ */
+static void bench_cow_child(unsigned long mm)
+{
+    volatile uint64_t* ws = (volatile uint64_t*)USER_VA_START;
+
+    if (mm) {
+        mm_attach((struct mm_struct*)mm);
+    }
+
+    uint64_t start = read_cntvct();
+    for (unsigned long page = 0; page < bench_cow_nr_pages; page++) {
+        ws[page * (PAGE_SIZE / sizeof(uint64_t))]++;
+    }
+    bench_cow_child_ticks = read_cntvct() - start;
+
+    __atomic_store_n(&bench_cow_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Maps nr_pages pages with their index written to them at USER_VA_START.
+ *
+ * @return 0 on success, -1 if memory ran out.
+ */
+static int bench_cow_populate(struct mm_struct* mm, unsigned long nr_pages)
+{
+    for (unsigned long i = 0; i < nr_pages; i++) {
+        unsigned long page = get_free_page();
+
+        if (!page) {
+            return -1;
+        }
+        *(uint64_t*)page = i;
+        if (map_range(mm->pgd, USER_VA_START + i * PAGE_SIZE, page, PAGE_SIZE, PROT_USER_DATA)) {
+            free_page(page);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Creates a copy of the current address space with all pages copied.
+ */
+static struct mm_struct* bench_cow_copy_eager(unsigned long nr_pages)
+{
+    struct mm_struct* mm = mm_alloc();
+    if (!mm) {
+        return 0;
+    }
+
+    for (unsigned long i = 0; i < nr_pages; i++) {
+        unsigned long va = USER_VA_START + i * PAGE_SIZE;
+        unsigned long pa;
+        unsigned long page = get_free_page();
+
+        if (!page || !pgtable_translate(current->mm->pgd, va, &pa)) {
+            if (page) {
+                free_page(page);
+            }
+            mm_put(mm);
+            return 0;
+        }
+        memcpy((void*)page, (void*)pa, PAGE_SIZE);
+        if (map_range(mm->pgd, va, page, PAGE_SIZE, PROT_USER_DATA)) {
+            free_page(page);
+            mm_put(mm);
+            return 0;
+        }
+    }
+    return mm;
+}
+
+static void bench_cow_wait(void)
+{
+    while (!__atomic_load_n(&bench_cow_done, __ATOMIC_ACQUIRE)) {
+        cpu_idle_enter();
+    }
+    bench_cow_done = 0;
+}
+
+/**
+ * @brief Forks a parent of size_mb both ways and reports the results.
+ */
+static void bench_cow_run(unsigned long size_mb)
+{
+    char name[32];
+    struct mm_struct* parent = mm_alloc();
+
+    bench_cow_nr_pages = size_mb * (1024 * 1024 / PAGE_SIZE);
+    if (!parent || bench_cow_populate(parent, bench_cow_nr_pages)) {
+        bench_report("cow", "alloc_failed", size_mb, "MB");
+        if (parent) {
+            mm_put(parent);
+        }
+        return;
+    }
+    mm_attach(parent);
+    mm_put(parent);
+
+    uint64_t start = read_cntvct();
+    int ret = fork_process((unsigned long)&bench_cow_child, 0);
+    uint64_t cow_ticks = read_cntvct() - start;
+    if (ret) {
+        bench_report("cow", "fork_failed", size_mb, "MB");
+    } else {
+        bench_cow_wait();
+        bench_name(name, sizeof(name), "cow_fork_mb", size_mb);
+        bench_report("cow", name, bench_ticks_to_ns(cow_ticks), "ns");
+        bench_name(name, sizeof(name), "cow_fault_mb", size_mb);
+        bench_report("cow", name, bench_ticks_to_ns(bench_cow_child_ticks) / bench_cow_nr_pages, "ns");
+    }
+
+    start = read_cntvct();
+    struct mm_struct* copy = bench_cow_copy_eager(bench_cow_nr_pages);
+    ret = !copy || copy_process((unsigned long)&bench_cow_child, (unsigned long)copy);
+    uint64_t eager_ticks = read_cntvct() - start;
+    if (ret) {
+        bench_report("cow", "eager_failed", size_mb, "MB");
+    } else {
+        bench_cow_wait();
+        bench_name(name, sizeof(name), "eager_fork_mb", size_mb);
+        bench_report("cow", name, bench_ticks_to_ns(eager_ticks), "ns");
+        bench_name(name, sizeof(name), "eager_write_mb", size_mb);
+        bench_report("cow", name, bench_ticks_to_ns(bench_cow_child_ticks) / bench_cow_nr_pages, "ns");
+    }
+    if (copy) {
+        mm_put(copy);
+    }
+
+    /* frees the parent and its pages */
+    mm_attach(&init_mm);
+}
+
+/**
+ * @brief Runs the copy-on-write fork benchmark.
+ *
+ * Must be called on the primary core after mm_init(), with the scheduler running.
+ */
+void bench_cow(void)
+{
+    unsigned long base = nr_tasks();
+    unsigned long free_start = bench_cow_free_pages();
+
+    for (unsigned int i = 0; i < sizeof(bench_cow_sizes_mb) / sizeof(bench_cow_sizes_mb[0]); i++) {
+        bench_cow_run(bench_cow_sizes_mb[i]);
+    }
+
+    /* the children hold on to their address spaces until they are reaped */
+    while (nr_tasks() > base) {
+        cpu_idle_enter();
+    }
+    unsigned long free_end = bench_cow_free_pages();
+    bench_report("cow", "leaked_pages", free_start > free_end ? free_start - free_end : 0, "pages");
+}
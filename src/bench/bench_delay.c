@@ -0,0 +1,87 @@
+/**
+ * @file bench_delay.c
+ * @brief Accuracy of the counter based delays.
+ *
+ * Every delay from 100ns to 10ms is requested a few times and timed on the
+ * counter. The report has the average and worst overshoot per requested
+ * delay, and how often a delay returned early, which must never happen.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "delay/delay.h"
+#include "time/hrtimer.h"
+
+#define BENCH_DELAY_ROUNDS 16
+
+static const uint64_t bench_delay_ns[] = { 100, 1000, 10000, 100000, 1000000, 10000000 };
+
+/**
+ * @brief A delay function and the names its results are reported under.
+ */
+struct bench_delay_case {
+    void (*fn)(uint64_t);
+    uint64_t unit_ns; /* nanoseconds per unit of the argument of fn */
+    const char* avg_name;
+    const char* max_name;
+    const char* early_name;
+};
+
+static const struct bench_delay_case bench_delay_cases[] = {
+    { ndelay, 1, "ndelay_avg_error", "ndelay_max_error", "ndelay_early" },
+    { udelay, NSEC_PER_USEC, "udelay_avg_error", "udelay_max_error", "udelay_early" },
+    { mdelay, NSEC_PER_MSEC, "mdelay_avg_error", "mdelay_max_error", "mdelay_early" },
+    { udelay_yield, NSEC_PER_USEC, "udelay_yield_avg_error", "udelay_yield_max_error", "udelay_yield_early" },
+};
+
+/**
+ * @brief Times one delay function for every requested delay it can express.
+ */
+static void bench_delay_run(const struct bench_delay_case* c)
+{
+    char name[48];
+
+    for (unsigned int i = 0; i < sizeof(bench_delay_ns) / sizeof(bench_delay_ns[0]); i++) {
+        uint64_t requested = bench_delay_ns[i];
+        uint64_t sum = 0, max = 0;
+        unsigned long early = 0;
+
+        if (requested < c->unit_ns) {
+            continue;
+        }
+        for (int round = 0; round < BENCH_DELAY_ROUNDS; round++) {
+            uint64_t start = read_cntvct();
+            c->fn(requested / c->unit_ns);
+            uint64_t actual = bench_ticks_to_ns(read_cntvct() - start);
+
+            if (actual < requested) {
+                early++;
+                continue;
+            }
+            sum += actual - requested;
+            if (actual - requested > max) {
+                max = actual - requested;
+            }
+        }
+
+        bench_name(name, sizeof(name), c->avg_name, requested);
+        bench_report("delay", name, sum / BENCH_DELAY_ROUNDS, "ns");
+        bench_name(name, sizeof(name), c->max_name, requested);
+        bench_report("delay", name, max, "ns");
+        bench_name(name, sizeof(name), c->early_name, requested);
+        bench_report("delay", name, early, "count");
+    }
+}
+
+/**
+ * @brief Runs the delay accuracy self-test.
+ *
+ * Names end in the requested delay in nanoseconds.
+ */
+void bench_delay(void)
+{
+    for (unsigned int i = 0; i < sizeof(bench_delay_cases) / sizeof(bench_delay_cases[0]); i++) {
+        bench_delay_run(&bench_delay_cases[i]);
+    }
+}
@@ -0,0 +1,133 @@
+/**
+ * @file bench_fault.c
+ * @brief Demand paging of reserved ranges.
+ *
+ * The primary idle task switches to an address space with a 64MB heap and
+ * an 8MB stack reserved by do_mmap(). Reserving takes no pages. Part of the
+ * heap is then written to and part of it read, one word per page, so every
+ * access takes a minor fault that maps a zeroed page. The report has the
+ * minor faults, the average time do_page_fault() took and the time per
+ * access including the exception, next to the time per access once the
+ * pages are mapped. Only the top pages of the stack are touched, the pages
+ * it takes, tables included, show that the rest stays unbacked.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "mem/fault.h"
+#include "mem/mem.h"
+#include "mem/mm.h"
+#include "mem/pgtable.h"
+#include "smp/smp.h"
+
+#define BENCH_FAULT_HEAP (64ul * 1024 * 1024)
+#define BENCH_FAULT_STACK (8ul * 1024 * 1024)
+/* pages of the heap written and read */
+#define BENCH_FAULT_PAGES 4096
+#define BENCH_FAULT_STACK_PAGES 4
+
+#define BENCH_FAULT_WORDS_PER_PAGE (PAGE_SIZE / sizeof(uint64_t))
+
+static unsigned long bench_fault_free_pages(void)
+{
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    return stats.free_pages + stats.cached_pages;
+}
+
+static void bench_fault_sample(struct fault_stats* total)
+{
+    struct fault_stats stats;
+
+    *total = (struct fault_stats) { 0 };
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        fault_get_stats(cpu, &stats);
+        total->minor_faults += stats.minor_faults;
+        total->cow_faults += stats.cow_faults;
+        total->fault_ticks += stats.fault_ticks;
+    }
+}
+
+/**
+ * @brief Reports the faults taken since before and the ns per page of ticks.
+ */
+static void bench_fault_report(const char* faults, const char* fault_ns, const char* access_ns, struct fault_stats* before, uint64_t ticks)
+{
+    struct fault_stats after;
+    bench_fault_sample(&after);
+
+    unsigned long minor = after.minor_faults - before->minor_faults;
+    bench_report("fault", faults, minor, "count");
+    bench_report("fault", fault_ns, minor ? bench_ticks_to_ns(after.fault_ticks - before->fault_ticks) / minor : 0, "ns");
+    bench_report("fault", access_ns, bench_ticks_to_ns(ticks) / BENCH_FAULT_PAGES, "ns");
+}
+
+/**
+ * @brief Runs the demand paging benchmark.
+ *
+ * Must be called on the primary core after mm_init().
+ */
+void bench_fault(void)
+{
+    unsigned long free_start = bench_fault_free_pages();
+    struct fault_stats before;
+
+    struct mm_struct* mm = mm_alloc();
+    if (!mm) {
+        bench_report("fault", "alloc_failed", 1, "count");
+        return;
+    }
+    mm_attach(mm);
+    mm_put(mm);
+
+    unsigned long free_mm = bench_fault_free_pages();
+    unsigned long heap = do_mmap(mm, 0, BENCH_FAULT_HEAP, VM_READ | VM_WRITE);
+    unsigned long stack = do_mmap(mm, 0, BENCH_FAULT_STACK, VM_READ | VM_WRITE);
+    if (!heap || !stack) {
+        bench_report("fault", "mmap_failed", 1, "count");
+        mm_attach(&init_mm);
+        return;
+    }
+    unsigned long free_reserved = bench_fault_free_pages();
+    bench_report("fault", "reserve_pages", free_mm > free_reserved ? free_mm - free_reserved : 0, "pages");
+
+    volatile uint64_t* words = (volatile uint64_t*)heap;
+
+    bench_fault_sample(&before);
+    uint64_t start = read_cntvct();
+    for (unsigned long page = 0; page < BENCH_FAULT_PAGES; page++) {
+        words[page * BENCH_FAULT_WORDS_PER_PAGE] = page;
+    }
+    bench_fault_report("write_faults", "write_fault", "write_first", &before, read_cntvct() - start);
+
+    bench_fault_sample(&before);
+    start = read_cntvct();
+    for (unsigned long page = 0; page < BENCH_FAULT_PAGES; page++) {
+        words[page * BENCH_FAULT_WORDS_PER_PAGE] += 1;
+    }
+    bench_fault_report("rewrite_faults", "rewrite_fault", "write_mapped", &before, read_cntvct() - start);
+
+    uint64_t sum = 0;
+    bench_fault_sample(&before);
+    start = read_cntvct();
+    for (unsigned long page = BENCH_FAULT_PAGES; page < 2 * BENCH_FAULT_PAGES; page++) {
+        sum += words[page * BENCH_FAULT_WORDS_PER_PAGE];
+    }
+    bench_fault_report("read_faults", "read_fault", "read_first", &before, read_cntvct() - start);
+    bench_report("fault", "read_not_zero", sum, "count");
+
+    /* the stack grows down from the end of its range */
+    unsigned long free_stack = bench_fault_free_pages();
+    for (unsigned long page = 1; page <= BENCH_FAULT_STACK_PAGES; page++) {
+        *(volatile uint64_t*)(stack + BENCH_FAULT_STACK - page * PAGE_SIZE) = page;
+    }
+    unsigned long free_touched = bench_fault_free_pages();
+    bench_report("fault", "stack_pages", free_stack > free_touched ? free_stack - free_touched : 0, "pages");
+
+    /* frees the address space and its pages */
+    mm_attach(&init_mm);
+
+    unsigned long free_end = bench_fault_free_pages();
+    bench_report("fault", "leaked_pages", free_start > free_end ? free_start - free_end : 0, "pages");
+}
@@ -0,0 +1,133 @@
+/**
+ * @file bench_fork.c
+ * @brief Fork/exit churn benchmark.
+ *
+ * Creates and reaps short-lived tasks in batches and checks that the memory
+ * they used comes back once they are reaped. Every fork takes a zeroed page
+ * for the stack, the hit rate of the zeroed page pools over the run is
+ * reported together with what a hit saves over clearing the page at fork.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "mem/mem.h"
+#include "scheduler/fork.h"
+#include "scheduler/pid.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+
+#define BENCH_FORK_TASKS 100000
+#define BENCH_FORK_BATCH 64
+
+/**
+ * @brief Worker task, returns right away and is reaped.
+ */
+static void bench_fork_worker(unsigned long arg)
+{
+    (void)arg;
+}
+
+static unsigned long bench_fork_free_pages(void)
+{
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    return stats.free_pages + stats.cached_pages;
+}
+
+/**
+ * @brief Sums the zeroed pool hits and misses of all cores.
+ */
+static void bench_fork_zeroed(unsigned long* hits, unsigned long* misses)
+{
+    struct pcp_stats stats;
+
+    *hits = 0;
+    *misses = 0;
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        mem_get_pcp_stats(cpu, &stats);
+        *hits += stats.zeroed_hits;
+        *misses += stats.zeroed_misses;
+    }
+}
+
+/**
+ * @brief Reports the average ns of get_zeroed_page() with a full and an empty pool.
+ */
+static void bench_fork_zeroed_latency(void)
+{
+    static unsigned long pages[2 * PCP_ZEROED_HIGH];
+    unsigned int n = 0;
+
+    while (mem_refill_zeroed()) { }
+
+    /* the first PCP_ZEROED_HIGH come from the pool, the rest are cleared */
+    uint64_t start = read_cntvct();
+    for (; n < PCP_ZEROED_HIGH; n++) {
+        pages[n] = get_zeroed_page();
+    }
+    uint64_t hit = read_cntvct() - start;
+
+    start = read_cntvct();
+    for (; n < 2 * PCP_ZEROED_HIGH; n++) {
+        pages[n] = get_zeroed_page();
+    }
+    uint64_t miss = read_cntvct() - start;
+
+    for (n = 0; n < 2 * PCP_ZEROED_HIGH; n++) {
+        if (pages[n]) {
+            free_page(pages[n]);
+        }
+    }
+
+    uint64_t hit_ns = bench_ticks_to_ns(hit) / PCP_ZEROED_HIGH;
+    uint64_t miss_ns = bench_ticks_to_ns(miss) / PCP_ZEROED_HIGH;
+    bench_report("fork", "zeroed_hit", hit_ns, "ns");
+    bench_report("fork", "zeroed_miss", miss_ns, "ns");
+    bench_report("fork", "zeroed_saved_per_fork", miss_ns > hit_ns ? miss_ns - hit_ns : 0, "ns");
+}
+
+/**
+ * @brief Runs the fork/exit churn benchmark.
+ */
+void bench_fork(void)
+{
+    unsigned long base = nr_tasks();
+    unsigned long free_start = bench_fork_free_pages();
+    unsigned long reclaimed = 0;
+    unsigned long created = 0;
+    unsigned long hits_start, misses_start, hits, misses;
+
+    bench_fork_zeroed(&hits_start, &misses_start);
+    uint64_t start = read_cntvct();
+    while (created < BENCH_FORK_TASKS) {
+        for (int i = 0; i < BENCH_FORK_BATCH; i++) {
+            if (copy_process((unsigned long)&bench_fork_worker, 0)) {
+                bench_report("fork", "fork_failed", created, "tasks");
+                return;
+            }
+            created++;
+        }
+        unsigned long free_forked = bench_fork_free_pages();
+
+        /* zero pages while waiting, like the idle loop does */
+        while (nr_tasks() > base) {
+            schedule();
+            mem_refill_zeroed();
+        }
+        reclaimed += bench_fork_free_pages() - free_forked;
+    }
+    uint64_t ticks = read_cntvct() - start;
+
+    unsigned long free_end = bench_fork_free_pages();
+    bench_fork_zeroed(&hits, &misses);
+    hits -= hits_start;
+    misses -= misses_start;
+
+    bench_report("fork", "tasks_per_s", bench_per_second(created, ticks), "tasks/s");
+    bench_report("fork", "reclaimed", reclaimed * (PAGE_SIZE / 1024), "KiB");
+    bench_report("fork", "leaked_pages", free_start > free_end ? free_start - free_end : 0, "pages");
+    bench_report("fork", "zeroed_hit_rate", hits + misses ? 1000 * hits / (hits + misses) : 0, "permille");
+
+    bench_fork_zeroed_latency();
+}
@@ -0,0 +1,192 @@
+/**
+ * @file bench_fpsimd.c
+ * @brief Context switch cost with lazy FP/SIMD switching.
+ *
+ * Two tasks yield to each other on the primary core, once with integer code
+ * only and once while keeping values in the callee-saved FP registers d8-d15
+ * across every switch. The integer run must not cause any FP/SIMD save or
+ * load, the FP run must get back exactly the values it put in.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "fpsimd/fpsimd.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+
+#define BENCH_FPSIMD_ROUNDS 10000
+
+static volatile unsigned long bench_fpsimd_done;
+static volatile unsigned long bench_fpsimd_errors;
+
+/**
+ * @brief Fills d8-d15 from pattern, yields and checks them afterwards.
+ *
+ * Everything happens in one asm block so the compiler cannot use the
+ * registers in between.
+ *
+ * @return Non-zero if any register came back changed.
+ */
+static uint64_t bench_fpsimd_yield_check(uint64_t pattern)
+{
+    uint64_t bad;
+
+    asm volatile("mov x19, %[pattern]\n\t"
+                 "fmov d8, x19\n\t"
+                 "add x9, x19, #1\n\t"
+                 "fmov d9, x9\n\t"
+                 "add x9, x19, #2\n\t"
+                 "fmov d10, x9\n\t"
+                 "add x9, x19, #3\n\t"
+                 "fmov d11, x9\n\t"
+                 "add x9, x19, #4\n\t"
+                 "fmov d12, x9\n\t"
+                 "add x9, x19, #5\n\t"
+                 "fmov d13, x9\n\t"
+                 "add x9, x19, #6\n\t"
+                 "fmov d14, x9\n\t"
+                 "add x9, x19, #7\n\t"
+                 "fmov d15, x9\n\t"
+                 "bl schedule\n\t"
+                 "fmov x20, d8\n\t"
+                 "eor x20, x20, x19\n\t"
+                 "add x9, x19, #1\n\t"
+                 "fmov x10, d9\n\t"
+                 "eor x9, x9, x10\n\t"
+                 "orr x20, x20, x9\n\t"
+                 "add x9, x19, #2\n\t"
+                 "fmov x10, d10\n\t"
+                 "eor x9, x9, x10\n\t"
+                 "orr x20, x20, x9\n\t"
+                 "add x9, x19, #3\n\t"
+                 "fmov x10, d11\n\t"
+                 "eor x9, x9, x10\n\t"
+                 "orr x20, x20, x9\n\t"
+                 "add x9, x19, #4\n\t"
+                 "fmov x10, d12\n\t"
+                 "eor x9, x9, x10\n\t"
+                 "orr x20, x20, x9\n\t"
+                 "add x9, x19, #5\n\t"
+                 "fmov x10, d13\n\t"
+                 "eor x9, x9, x10\n\t"
+                 "orr x20, x20, x9\n\t"
+                 "add x9, x19, #6\n\t"
+                 "fmov x10, d14\n\t"
+                 "eor x9, x9, x10\n\t"
+                 "orr x20, x20, x9\n\t"
+                 "add x9, x19, #7\n\t"
+                 "fmov x10, d15\n\t"
+                 "eor x9, x9, x10\n\t"
+                 "orr x20, x20, x9\n\t"
+                 "mov %[bad], x20"
+        : [bad] "=&r"(bad)
+        : [pattern] "r"(pattern)
+        : "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10",
+        "x11", "x12", "x13", "x14", "x15", "x16", "x17", "x18", "x19", "x20",
+        "x30", "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "v8", "v9",
+        "v10", "v11", "v12", "v13", "v14", "v15", "v16", "v17", "v18", "v19",
+        "v20", "v21", "v22", "v23", "v24", "v25", "v26", "v27", "v28", "v29",
+        "v30", "v31", "cc", "memory");
+
+    return bad;
+}
+
+/**
+ * @brief Worker task that only uses general purpose registers.
+ */
+static void bench_fpsimd_int_worker(unsigned long arg)
+{
+    (void)arg;
+    for (int i = 0; i < BENCH_FPSIMD_ROUNDS; i++) {
+        schedule();
+    }
+    __atomic_add_fetch(&bench_fpsimd_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Worker task that keeps its own values in d8-d15 across switches.
+ */
+static void bench_fpsimd_fp_worker(unsigned long arg)
+{
+    for (int i = 0; i < BENCH_FPSIMD_ROUNDS; i++) {
+        if (bench_fpsimd_yield_check((arg << 32) | i)) {
+            __atomic_add_fetch(&bench_fpsimd_errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_add_fetch(&bench_fpsimd_done, 1, __ATOMIC_RELEASE);
+}
+
+static void bench_fpsimd_sample(struct fpsimd_stats* total)
+{
+    struct fpsimd_stats stats;
+
+    *total = (struct fpsimd_stats) { 0 };
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        fpsimd_get_stats(cpu, &stats);
+        total->traps += stats.traps;
+        total->loads += stats.loads;
+        total->saves += stats.saves;
+    }
+}
+
+/**
+ * @brief Runs two workers against each other on the primary core.
+ *
+ * @param worker The task function.
+ * @param delta Receives how the FP/SIMD counters changed during the run.
+ * @return CNTVCT ticks per context switch, in thousandths.
+ */
+static uint64_t bench_fpsimd_run(void (*worker)(unsigned long), struct fpsimd_stats* delta)
+{
+    struct fpsimd_stats before, after;
+
+    bench_fpsimd_done = 0;
+    bench_fpsimd_sample(&before);
+
+    uint64_t start = read_cntvct();
+    for (unsigned long i = 1; i <= 2; i++) {
+        if (copy_process((unsigned long)worker, i)) {
+            bench_report("fpsimd", "fork_failed", i, "tasks");
+            return 0;
+        }
+    }
+    while (__atomic_load_n(&bench_fpsimd_done, __ATOMIC_ACQUIRE) < 2) {
+        schedule();
+    }
+    uint64_t ticks = read_cntvct() - start;
+    bench_fpsimd_sample(&after);
+
+    delta->traps = after.traps - before.traps;
+    delta->loads = after.loads - before.loads;
+    delta->saves = after.saves - before.saves;
+    return 1000 * ticks / (2 * BENCH_FPSIMD_ROUNDS);
+}
+
+/**
+ * @brief Runs the FP/SIMD context switch benchmark.
+ *
+ * Must be called after smp_boot_secondaries().
+ */
+void bench_fpsimd(void)
+{
+    struct fpsimd_stats delta;
+    uint64_t mticks;
+
+    sched_set_cpu_mask(1);
+
+    mticks = bench_fpsimd_run(bench_fpsimd_int_worker, &delta);
+    bench_report("fpsimd", "int_switch_mticks", mticks, "mticks");
+    bench_report("fpsimd", "int_saves", delta.saves, "count");
+    bench_report("fpsimd", "int_loads", delta.loads, "count");
+
+    bench_fpsimd_errors = 0;
+    mticks = bench_fpsimd_run(bench_fpsimd_fp_worker, &delta);
+    bench_report("fpsimd", "fp_switch_mticks", mticks, "mticks");
+    bench_report("fpsimd", "fp_saves", delta.saves, "count");
+    bench_report("fpsimd", "fp_loads", delta.loads, "count");
+    bench_report("fpsimd", "fp_corruptions", bench_fpsimd_errors, "count");
+
+    sched_set_cpu_mask(~0ul);
+}
@@ -0,0 +1,149 @@
+/**
+ * @file bench_hrtimer.c
+ * @brief High resolution timer benchmark.
+ *
+ * Measures the cost of queueing and cancelling timers on a loaded base, the
+ * cost of running expired timers in the interrupt and how late a sleeping
+ * task is woken up.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "time/hrtimer.h"
+
+#define BENCH_HRTIMER_TIMERS 2048
+#define BENCH_HRTIMER_SLEEPS 200
+#define BENCH_HRTIMER_SLEEP_NS NSEC_PER_MSEC
+
+static struct hrtimer bench_timers[BENCH_HRTIMER_TIMERS];
+static volatile unsigned long bench_hrtimer_fired;
+static volatile unsigned long bench_hrtimer_done;
+static uint64_t bench_latency_min, bench_latency_max, bench_latency_sum;
+
+static enum hrtimer_restart bench_hrtimer_callback(struct hrtimer* timer)
+{
+    (void)timer;
+    bench_hrtimer_fired++;
+    return HRTIMER_NORESTART;
+}
+
+/**
+ * @brief Queues and cancels timers with random expiries far in the future.
+ */
+static void bench_hrtimer_insert_cancel(void)
+{
+    uint64_t now = read_cntvct();
+    uint64_t far = ns_to_ticks(NSEC_PER_SEC);
+
+    for (int i = 0; i < BENCH_HRTIMER_TIMERS; i++) {
+        hrtimer_setup(&bench_timers[i], bench_hrtimer_callback, 0);
+    }
+
+    uint64_t start = read_cntvct();
+    for (int i = 0; i < BENCH_HRTIMER_TIMERS; i++) {
+        hrtimer_start(&bench_timers[i], now + far + bench_random() % far);
+    }
+    uint64_t insert_ticks = read_cntvct() - start;
+
+    start = read_cntvct();
+    for (int i = 0; i < BENCH_HRTIMER_TIMERS; i++) {
+        timer_cancel(&bench_timers[i]);
+    }
+    uint64_t cancel_ticks = read_cntvct() - start;
+
+    bench_report("hrtimer", "insert_mticks", 1000 * insert_ticks / BENCH_HRTIMER_TIMERS, "mticks");
+    bench_report("hrtimer", "cancel_mticks", 1000 * cancel_ticks / BENCH_HRTIMER_TIMERS, "mticks");
+}
+
+/**
+ * @brief Lets timers with random expiries within a millisecond run out.
+ */
+static void bench_hrtimer_expire(void)
+{
+    struct hrtimer_stats before, after;
+    uint64_t window = ns_to_ticks(NSEC_PER_MSEC);
+    unsigned int cpu = smp_processor_id();
+
+    bench_hrtimer_fired = 0;
+    hrtimer_get_stats(cpu, &before);
+    uint64_t now = read_cntvct();
+    for (int i = 0; i < BENCH_HRTIMER_TIMERS; i++) {
+        hrtimer_start(&bench_timers[i], now + window + bench_random() % window);
+    }
+    while (bench_hrtimer_fired < BENCH_HRTIMER_TIMERS) {
+        cpu_idle_enter();
+    }
+    hrtimer_get_stats(cpu, &after);
+
+    unsigned long expired = after.expired - before.expired;
+    bench_report("hrtimer", "expire_mticks", 1000 * (after.expire_ticks - before.expire_ticks) / expired, "mticks");
+    bench_report("hrtimer", "expire_interrupts", after.interrupts - before.interrupts, "count");
+}
+
+/**
+ * @brief Worker task, sleeps repeatedly and records how late it woke up.
+ */
+static void bench_hrtimer_sleeper(unsigned long arg)
+{
+    (void)arg;
+    uint64_t sleep = ns_to_ticks(BENCH_HRTIMER_SLEEP_NS);
+
+    for (int i = 0; i < BENCH_HRTIMER_SLEEPS; i++) {
+        uint64_t target = read_cntvct() + sleep;
+        sleep_ns(BENCH_HRTIMER_SLEEP_NS);
+        uint64_t now = read_cntvct();
+        uint64_t latency = now > target ? now - target : 0;
+
+        if (latency < bench_latency_min) {
+            bench_latency_min = latency;
+        }
+        if (latency > bench_latency_max) {
+            bench_latency_max = latency;
+        }
+        bench_latency_sum += latency;
+    }
+    __atomic_store_n(&bench_hrtimer_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Measures the wakeup latency of a task sleeping for a millisecond.
+ */
+static void bench_hrtimer_latency(void)
+{
+    bench_latency_min = ~0ull;
+    bench_latency_max = 0;
+    bench_latency_sum = 0;
+    bench_hrtimer_done = 0;
+
+    if (copy_process((unsigned long)&bench_hrtimer_sleeper, 0)) {
+        bench_report("hrtimer", "fork_failed", 1, "tasks");
+        return;
+    }
+    while (!__atomic_load_n(&bench_hrtimer_done, __ATOMIC_ACQUIRE)) {
+        cpu_idle_enter();
+    }
+
+    bench_report("hrtimer", "wakeup_latency_min", bench_ticks_to_ns(bench_latency_min), "ns");
+    bench_report("hrtimer", "wakeup_latency_avg", bench_ticks_to_ns(bench_latency_sum / BENCH_HRTIMER_SLEEPS), "ns");
+    bench_report("hrtimer", "wakeup_latency_max", bench_ticks_to_ns(bench_latency_max), "ns");
+}
+
+/**
+ * @brief Runs the high resolution timer benchmark on the primary core.
+ *
+ * Must be called from the idle task of the primary core after hrtimer_init().
+ */
+void bench_hrtimer(void)
+{
+    sched_set_cpu_mask(1);
+
+    bench_hrtimer_insert_cancel();
+    bench_hrtimer_expire();
+    bench_hrtimer_latency();
+
+    sched_set_cpu_mask(~0ul);
+}
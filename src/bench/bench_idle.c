@@ -0,0 +1,52 @@
+/**
+ * @file bench_idle.c
+ * @brief Idle residency and wakeup rate with the dynamic tick.
+ *
+ * The primary core sleeps in its idle loop for a fixed time with no tasks
+ * in the system, woken only by a single hrtimer. Every core reports
+ * the share of that time it spent in WFI and how often it woke up.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "time/hrtimer.h"
+
+#define BENCH_IDLE_NS NSEC_PER_SEC
+
+/**
+ * @brief Runs the idle benchmark.
+ *
+ * Must be called after smp_boot_secondaries() and hrtimer_init().
+ */
+void bench_idle(void)
+{
+    struct sched_stats before[NR_CPUS], after[NR_CPUS];
+    struct hrtimer_stats timer_before[NR_CPUS], timer_after[NR_CPUS];
+    char name[32];
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        sched_get_stats(cpu, &before[cpu]);
+        hrtimer_get_stats(cpu, &timer_before[cpu]);
+    }
+
+    uint64_t start = read_cntvct();
+    sleep_ns(BENCH_IDLE_NS);
+    uint64_t ticks = read_cntvct() - start;
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        sched_get_stats(cpu, &after[cpu]);
+        hrtimer_get_stats(cpu, &timer_after[cpu]);
+    }
+
+    for (unsigned int cpu = 0; cpu < smp_num_online(); cpu++) {
+        bench_name(name, sizeof(name), "timer_irqs_per_s_cpu", cpu);
+        bench_report("idle", name, bench_per_second(timer_after[cpu].interrupts - timer_before[cpu].interrupts, ticks), "irqs/s");
+        bench_name(name, sizeof(name), "residency_cpu", cpu);
+        bench_report("idle", name, 100 * (after[cpu].idle_ticks - before[cpu].idle_ticks) / ticks, "%");
+        bench_name(name, sizeof(name), "wakeups_per_s_cpu", cpu);
+        bench_report("idle", name, bench_per_second(after[cpu].wakeups - before[cpu].wakeups, ticks), "wakeups/s");
+    }
+}
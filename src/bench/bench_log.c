@@ -0,0 +1,44 @@
+/**
+ * @file bench_log.c
+ * @brief Cost of printk into the per-CPU log.
+ *
+ * Logs debug lines, which are kept in the log but not printed, so the time
+ * measured is only formatting and storing the line.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "log/log.h"
+#include "smp/smp.h"
+#include "printk.h"
+
+#define BENCH_LOG_LINES 256
+
+/**
+ * @brief Runs the logging benchmark on the calling core.
+ */
+void bench_log(void)
+{
+    struct log_stats before, after;
+    unsigned int cpu = smp_processor_id();
+    uint64_t max = 0;
+
+    log_get_stats(cpu, &before);
+    uint64_t start = read_cntvct();
+    for (int i = 0; i < BENCH_LOG_LINES; i++) {
+        uint64_t line_start = read_cntvct();
+        printk(KERN_DEBUG "bench log: line %d of %d\n", i, BENCH_LOG_LINES);
+        uint64_t ticks = read_cntvct() - line_start;
+        if (ticks > max) {
+            max = ticks;
+        }
+    }
+    uint64_t ticks = read_cntvct() - start;
+    log_get_stats(cpu, &after);
+
+    bench_report("log", "printk_avg", bench_ticks_to_ns(ticks / BENCH_LOG_LINES), "ns");
+    bench_report("log", "printk_max", bench_ticks_to_ns(max), "ns");
+    bench_report("log", "records", after.records - before.records, "count");
+    bench_report("log", "overwritten", after.overwritten - before.overwritten, "count");
+}
@@ -0,0 +1,171 @@
+/**
+ * @file bench_mem.c
+ * @brief Page allocator stress benchmark.
+ *
+ * Randomly allocates and frees blocks of random orders, then reports the
+ * allocation rate and how fragmented the free memory is. A second pass
+ * exercises the per-CPU single page caches. Both passes end with
+ * mem_check() and the blocks held at the end of the random sequence are
+ * checked for overlaps, so every run doubles as a fuzz test of the
+ * allocator; any non-zero violation count is a bug.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "mem/mem.h"
+#include "smp/smp.h"
+
+#define BENCH_MEM_SLOTS 512
+#define BENCH_MEM_OPS 100000
+#define BENCH_MEM_MAX_ORDER 6
+#define BENCH_PCP_ROUNDS 20000
+#define BENCH_PCP_BURST 8
+
+static struct {
+    unsigned long addr;
+    unsigned int order;
+} bench_mem_slots[BENCH_MEM_SLOTS];
+
+/**
+ * @brief Percentage of free pages that are not part of a largest-order block.
+ */
+static uint64_t bench_mem_fragmentation(void)
+{
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    if (!stats.free_pages) {
+        return 0;
+    }
+    uint64_t largest = stats.nr_free[MAX_ORDER - 1] << (MAX_ORDER - 1);
+    return 100 * (stats.free_pages - largest) / stats.free_pages;
+}
+
+/**
+ * @brief Counts pairs of held blocks that share pages.
+ */
+static uint64_t bench_mem_overlaps(void)
+{
+    uint64_t overlaps = 0;
+
+    for (int i = 0; i < BENCH_MEM_SLOTS; i++) {
+        unsigned long a = bench_mem_slots[i].addr;
+        unsigned long a_end = a + ((unsigned long)PAGE_SIZE << bench_mem_slots[i].order);
+
+        if (!a) {
+            continue;
+        }
+        for (int j = i + 1; j < BENCH_MEM_SLOTS; j++) {
+            unsigned long b = bench_mem_slots[j].addr;
+            unsigned long b_end = b + ((unsigned long)PAGE_SIZE << bench_mem_slots[j].order);
+
+            if (b && a < b_end && b < a_end) {
+                overlaps++;
+            }
+        }
+    }
+    return overlaps;
+}
+
+/**
+ * @brief Runs the page allocator stress benchmark.
+ */
+void bench_mem(void)
+{
+    struct mem_stats before, after;
+    uint64_t alloc_ticks = 0, free_ticks = 0;
+    uint64_t allocs = 0, frees = 0, failed = 0;
+
+    mem_get_stats(&before);
+
+    for (int op = 0; op < BENCH_MEM_OPS; op++) {
+        uint32_t r = bench_random();
+        unsigned int slot = r % BENCH_MEM_SLOTS;
+
+        if (bench_mem_slots[slot].addr) {
+            uint64_t start = read_cntvct();
+            free_pages(bench_mem_slots[slot].addr, bench_mem_slots[slot].order);
+            free_ticks += read_cntvct() - start;
+            bench_mem_slots[slot].addr = 0;
+            frees++;
+        } else {
+            /* order n is picked with probability 1 / 2^(n + 1) */
+            unsigned int order = __builtin_ctz((r >> 16) | (1u << BENCH_MEM_MAX_ORDER));
+            uint64_t start = read_cntvct();
+            unsigned long addr = alloc_pages(order);
+            alloc_ticks += read_cntvct() - start;
+            if (!addr) {
+                failed++;
+                continue;
+            }
+            bench_mem_slots[slot].addr = addr;
+            bench_mem_slots[slot].order = order;
+            allocs++;
+        }
+    }
+
+    bench_report("mem", "allocs_per_sec", bench_per_second(allocs, alloc_ticks), "ops/s");
+    bench_report("mem", "frees_per_sec", bench_per_second(frees, free_ticks), "ops/s");
+    bench_report("mem", "failed_allocs", failed, "count");
+    bench_report("mem", "fragmentation", bench_mem_fragmentation(), "%");
+    bench_report("mem", "overlapping_blocks", bench_mem_overlaps(), "count");
+    uint64_t violations = mem_check();
+
+    for (int slot = 0; slot < BENCH_MEM_SLOTS; slot++) {
+        if (bench_mem_slots[slot].addr) {
+            free_pages(bench_mem_slots[slot].addr, bench_mem_slots[slot].order);
+            bench_mem_slots[slot].addr = 0;
+        }
+    }
+
+    mem_get_stats(&after);
+    bench_report("mem", "leaked_pages", before.free_pages - after.free_pages, "pages");
+    bench_report("mem", "invariant_violations", violations + mem_check(), "count");
+}
+
+/**
+ * @brief Runs the per-CPU page cache benchmark.
+ *
+ * Allocates and frees short bursts of single pages, like repeated
+ * copy_process() calls, and reports the cache hit rate and refill frequency.
+ */
+void bench_pcp(void)
+{
+    unsigned long pages[BENCH_PCP_BURST];
+    struct pcp_stats before, after;
+    uint64_t get_ticks = 0, put_ticks = 0, gets = 0;
+    unsigned int cpu = smp_processor_id();
+
+    mem_get_pcp_stats(cpu, &before);
+
+    for (int round = 0; round < BENCH_PCP_ROUNDS; round++) {
+        unsigned int burst = 1 + bench_random() % BENCH_PCP_BURST;
+
+        uint64_t start = read_cntvct();
+        for (unsigned int i = 0; i < burst; i++) {
+            pages[i] = get_free_page();
+        }
+        get_ticks += read_cntvct() - start;
+
+        start = read_cntvct();
+        for (unsigned int i = 0; i < burst; i++) {
+            if (pages[i]) {
+                free_page(pages[i]);
+            }
+        }
+        put_ticks += read_cntvct() - start;
+        gets += burst;
+    }
+
+    mem_get_pcp_stats(cpu, &after);
+    uint64_t hits = after.hits - before.hits;
+    uint64_t misses = after.misses - before.misses;
+    uint64_t refills = after.refills - before.refills;
+
+    bench_report("pcp", "get_free_page", bench_ticks_to_ns(get_ticks) / gets, "ns");
+    bench_report("pcp", "free_page", bench_ticks_to_ns(put_ticks) / gets, "ns");
+    bench_report("pcp", "hit_rate", hits + misses ? 1000 * hits / (hits + misses) : 0, "permille");
+    bench_report("pcp", "refills_per_1000", 1000 * refills / gets, "count");
+    bench_report("pcp", "drains", after.drains - before.drains, "count");
+    bench_report("pcp", "invariant_violations", mem_check(), "count");
+}
@@ -0,0 +1,144 @@
+/**
+ * @file bench_mm.c
+ * @brief Context switches between address spaces, with and without ASIDs.
+ *
+ * Two tasks with an address space each take turns on the primary core. On
+ * every turn a task writes one word of every page of its working set and
+ * yields to the other. With ASIDs the TLB entries of both working sets stay
+ * valid across the switches, without them every switch flushes the TLB and
+ * the task walks the tables again for each page. The report has the average
+ * ns per switch, the touches of the working set included.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "mem/mem.h"
+#include "mem/mm.h"
+#include "mem/pgtable.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+
+#define BENCH_MM_ROUNDS 20000
+#define BENCH_MM_TASKS 2
+#define BENCH_MM_MAX_PAGES 256
+
+static const unsigned long bench_mm_pages[] = { 16, BENCH_MM_MAX_PAGES };
+
+static struct mm_struct* bench_mm_spaces[BENCH_MM_TASKS];
+static unsigned long bench_mm_nr_pages;
+static volatile unsigned long bench_mm_done;
+
+/**
+ * @brief Worker task, switches to its address space and takes turns touching it.
+ */
+static void bench_mm_worker(unsigned long slot)
+{
+    volatile uint64_t* ws = (volatile uint64_t*)USER_VA_START;
+
+    mm_attach(bench_mm_spaces[slot]);
+    for (int round = 0; round < BENCH_MM_ROUNDS; round++) {
+        for (unsigned long page = 0; page < bench_mm_nr_pages; page++) {
+            ws[page * (PAGE_SIZE / sizeof(uint64_t))]++;
+        }
+        schedule();
+    }
+
+    __atomic_add_fetch(&bench_mm_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Creates an address space with nr_pages zeroed pages mapped at USER_VA_START.
+ *
+ * @return The address space, or 0 if no memory is left.
+ */
+static struct mm_struct* bench_mm_create(unsigned long* pages, unsigned long nr_pages)
+{
+    struct mm_struct* mm = mm_alloc();
+    if (!mm) {
+        return 0;
+    }
+
+    for (unsigned long i = 0; i < nr_pages; i++) {
+        pages[i] = get_zeroed_page();
+        if (!pages[i] || map_range(mm->pgd, USER_VA_START + i * PAGE_SIZE, pages[i], PAGE_SIZE, PROT_USER_DATA)) {
+            bench_report("mm", "map_failed", 1, "count");
+        }
+    }
+    return mm;
+}
+
+static void bench_mm_destroy(struct mm_struct* mm, unsigned long* pages, unsigned long nr_pages)
+{
+    unmap_range(mm->pgd, USER_VA_START, nr_pages * PAGE_SIZE);
+    for (unsigned long i = 0; i < nr_pages; i++) {
+        if (pages[i]) {
+            free_page(pages[i]);
+        }
+    }
+    mm_put(mm);
+}
+
+/**
+ * @brief Runs the workers once, returns the average ns per switch.
+ */
+static uint64_t bench_mm_run(void)
+{
+    bench_mm_done = 0;
+
+    uint64_t start = read_cntvct();
+    for (unsigned long i = 0; i < BENCH_MM_TASKS; i++) {
+        if (copy_process((unsigned long)&bench_mm_worker, i)) {
+            bench_report("mm", "fork_failed", 1, "count");
+            return 0;
+        }
+    }
+    /* the idle task only runs once both workers are done */
+    while (__atomic_load_n(&bench_mm_done, __ATOMIC_ACQUIRE) < BENCH_MM_TASKS) {
+        cpu_idle_enter();
+    }
+    uint64_t ticks = read_cntvct() - start;
+
+    return bench_ticks_to_ns(ticks) / (BENCH_MM_TASKS * BENCH_MM_ROUNDS);
+}
+
+/**
+ * @brief Runs the address space switch benchmark.
+ *
+ * Must be called after mm_init(), with the scheduler running.
+ */
+void bench_mm(void)
+{
+    static unsigned long pages[BENCH_MM_TASKS][BENCH_MM_MAX_PAGES];
+    char name[32];
+
+    sched_set_cpu_mask(1);
+    for (unsigned int n = 0; n < sizeof(bench_mm_pages) / sizeof(bench_mm_pages[0]); n++) {
+        bench_mm_nr_pages = bench_mm_pages[n];
+        for (unsigned int i = 0; i < BENCH_MM_TASKS; i++) {
+            bench_mm_spaces[i] = bench_mm_create(pages[i], bench_mm_nr_pages);
+            if (!bench_mm_spaces[i]) {
+                bench_report("mm", "alloc_failed", 1, "count");
+                while (i--) {
+                    bench_mm_destroy(bench_mm_spaces[i], pages[i], bench_mm_nr_pages);
+                }
+                sched_set_cpu_mask(~0ul);
+                return;
+            }
+        }
+
+        mm_use_asids(1);
+        bench_name(name, sizeof(name), "asid_switch_pages", bench_mm_nr_pages);
+        bench_report("mm", name, bench_mm_run(), "ns");
+
+        mm_use_asids(0);
+        bench_name(name, sizeof(name), "flush_switch_pages", bench_mm_nr_pages);
+        bench_report("mm", name, bench_mm_run(), "ns");
+        mm_use_asids(1);
+
+        for (unsigned int i = 0; i < BENCH_MM_TASKS; i++) {
+            bench_mm_destroy(bench_mm_spaces[i], pages[i], bench_mm_nr_pages);
+        }
+    }
+    sched_set_cpu_mask(~0ul);
+}
@@ -0,0 +1,179 @@
+/**
+ * @file bench_perf.c
+ * @brief Exception round trips, perf regions and a sample profile.
+ *
+ * Times a no-op svc and an IPI the core sends to itself on the cycle
+ * counter, the latter includes the GIC. With CONFIG_PERF the entry half is
+ * measured from the vector, the rest is the return through kernel_exit.
+ * The regions instrumented in the kernel are reported and dumped with their
+ * histograms, and a short busy loop is profiled by PMU sampling and its PCs
+ * dumped over UART for scripts/perf_profile.py.
+ */
+#include <stdint.h>
+
+#include "bench/bench.h"
+#include "delay/delay.h"
+#include "mem/mem.h"
+#include "peripherals/bcm2711/uart/uart.h"
+#include "perf/perf.h"
+#include "pmu/pmu.h"
+#include "smp/smp.h"
+
+#define BENCH_PERF_CALLS 10000
+#define BENCH_PERF_PAGES 1000
+#define BENCH_PERF_IPIS 1000
+/* about 15 samples per millisecond at 1.5GHz */
+#define BENCH_PERF_SAMPLE_PERIOD 100000
+#define BENCH_PERF_SAMPLE_MS 100
+
+/**
+ * @brief Returns the average cycles of an svc from EL1 and back.
+ */
+static uint64_t bench_perf_svc(void)
+{
+    uint64_t start = pmu_read_cycles();
+    for (int i = 0; i < BENCH_PERF_CALLS; i++) {
+        asm volatile("svc #0" ::: "memory");
+    }
+    return (pmu_read_cycles() - start) / BENCH_PERF_CALLS;
+}
+
+/**
+ * @brief Returns the average cycles from sending an IPI to the calling core
+ * until its handler returned.
+ */
+static uint64_t bench_perf_self_ipi(void)
+{
+    uint64_t sum = 0;
+
+    for (int i = 0; i < BENCH_PERF_IPIS; i++) {
+        unsigned long taken = smp_ipi_count();
+        uint64_t start = pmu_read_cycles();
+
+        smp_send_ipi(1ul << smp_processor_id(), IPI_RESCHEDULE);
+        while (smp_ipi_count() == taken) { }
+        sum += pmu_read_cycles() - start;
+    }
+    return sum / BENCH_PERF_IPIS;
+}
+
+#ifdef CONFIG_PERF
+static PERF_REGION(bench_perf_markers, "perf_markers");
+
+static const char* const bench_perf_regions[] = {
+    "perf_markers",
+    "irq_entry",
+    "svc_entry",
+    "cpu_switch_to",
+    "get_free_page",
+};
+
+/**
+ * @brief Reports the average cycles and events per 1000 calls of a region.
+ */
+static void bench_perf_report_region(const char* region_name)
+{
+    struct perf_region* region = perf_find(region_name);
+    struct perf_stats stats;
+    char name[48];
+
+    if (!region) {
+        return;
+    }
+    perf_read(region, &stats);
+    if (!stats.count) {
+        return;
+    }
+    bench_report("perf", region->name, stats.cycles / stats.count, "cycles");
+    for (unsigned int i = 0; i < PMU_COUNTERS; i++) {
+        const char* event = pmu_event_name(pmu_get_event(i));
+        unsigned int n = 0;
+
+        if (!event) {
+            continue;
+        }
+        /* <region>_<event>, e.g. get_free_page_l1d_refill */
+        for (const char* s = region->name; *s && n + 1 < sizeof(name); s++) {
+            name[n++] = *s;
+        }
+        if (n + 1 < sizeof(name)) {
+            name[n++] = '_';
+        }
+        for (const char* s = event; *s && n + 1 < sizeof(name); s++) {
+            name[n++] = *s;
+        }
+        name[n] = '\0';
+        bench_report("perf", name, 1000 * stats.events[i] / stats.count, "per_1000_calls");
+    }
+}
+
+/**
+ * @brief Measures the regions, reports them and dumps their histograms.
+ */
+static void bench_perf_regions_run(uint64_t round_trip)
+{
+    struct pmu_sample start;
+    struct perf_stats entry;
+
+    for (int i = 0; i < BENCH_PERF_CALLS; i++) {
+        perf_start(&start);
+        perf_stop(&bench_perf_markers, &start);
+    }
+    for (int i = 0; i < BENCH_PERF_PAGES; i++) {
+        unsigned long page = get_free_page();
+        if (page) {
+            free_page(page);
+        }
+    }
+
+    for (unsigned int i = 0; i < sizeof(bench_perf_regions) / sizeof(bench_perf_regions[0]); i++) {
+        bench_perf_report_region(bench_perf_regions[i]);
+    }
+
+    /* what is left of the round trip is mostly kernel_exit and the eret */
+    struct perf_region* svc = perf_find("svc_entry");
+    if (svc) {
+        perf_read(svc, &entry);
+        if (entry.count && round_trip > entry.cycles / entry.count) {
+            bench_report("perf", "svc_exit", round_trip - entry.cycles / entry.count, "cycles");
+        }
+    }
+
+    perf_dump(uart_putc);
+    uart_flush();
+}
+#endif
+
+/**
+ * @brief Profiles a busy loop on the calling core with PMU sampling.
+ */
+static void bench_perf_sample_run(void)
+{
+    if (perf_sample_start(BENCH_PERF_SAMPLE_PERIOD)) {
+        bench_report("perf", "sampling_unsupported", 1, "count");
+        return;
+    }
+    mdelay(BENCH_PERF_SAMPLE_MS);
+    perf_sample_stop();
+
+    bench_report("perf", "samples", perf_sample_count(), "count");
+    perf_sample_dump(uart_putc);
+    uart_flush();
+}
+
+/**
+ * @brief Runs the profiling benchmark.
+ *
+ * Must be called from the idle task of the primary core.
+ */
+void bench_perf(void)
+{
+    uint64_t round_trip = bench_perf_svc();
+    bench_report("perf", "svc_round_trip", round_trip, "cycles");
+    bench_report("perf", "irq_round_trip", bench_perf_self_ipi(), "cycles");
+
+#ifdef CONFIG_PERF
+    bench_perf_regions_run(round_trip);
+#endif
+    bench_perf_sample_run();
+}
@@ -0,0 +1,129 @@
+/**
+ * @file bench_pgtable.c
+ * @brief Block against page mappings under random access.
+ *
+ * The same 256MB of RAM is mapped twice in the TTBR1 half, once aligned so
+ * map_range() uses 2MB blocks and once a page off, which leaves it 4KB
+ * pages only. Random words are read through each. The block mapping needs
+ * 128 TLB entries, the page mapping 65536, far more than the TLB holds, so
+ * most of its reads walk the tables. Every mapping is checked with
+ * pgtable_translate() and the time to map and unmap it is reported too.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "mem/mem.h"
+#include "mem/mmu.h"
+#include "mem/pgtable.h"
+
+#define BENCH_PGTABLE_SIZE (256ul * 1024 * 1024)
+/* RAM from 0 is mapped, it is only read */
+#define BENCH_PGTABLE_PA 0ul
+#define BENCH_PGTABLE_VA (PAGE_OFFSET + (1ul << 40))
+#define BENCH_PGTABLE_READS 1000000
+
+static unsigned long bench_pgtable_free_pages(void)
+{
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    return stats.free_pages + stats.cached_pages;
+}
+
+/**
+ * @brief Checks a mapping against the physical range.
+ *
+ * @return The number of pages and blocks it is made of, 0 if it is wrong.
+ */
+static unsigned long bench_pgtable_entries(unsigned long va)
+{
+    unsigned long entries = 0;
+
+    for (unsigned long offset = 0; offset < BENCH_PGTABLE_SIZE;) {
+        unsigned long pa;
+        unsigned long size = pgtable_translate(kernel_pgd, va + offset, &pa);
+
+        if (!size || pa != BENCH_PGTABLE_PA + offset) {
+            return 0;
+        }
+        entries++;
+        offset += size;
+    }
+    return entries;
+}
+
+/**
+ * @brief Reports a result as <label>_<what>, e.g. pages_random_read.
+ */
+static void bench_pgtable_report(const char* label, const char* what, uint64_t value, const char* unit)
+{
+    char name[48];
+    unsigned int n = 0;
+
+    for (const char* s = label; *s && n + 1 < sizeof(name); s++) {
+        name[n++] = *s;
+    }
+    if (n + 1 < sizeof(name)) {
+        name[n++] = '_';
+    }
+    for (const char* s = what; *s && n + 1 < sizeof(name); s++) {
+        name[n++] = *s;
+    }
+    name[n] = '\0';
+    bench_report("pgtable", name, value, unit);
+}
+
+/**
+ * @brief Maps the range at va, reads through it and unmaps it again.
+ */
+static void bench_pgtable_run(const char* label, unsigned long va)
+{
+    unsigned long free_start = bench_pgtable_free_pages();
+
+    uint64_t start = read_cntvct();
+    int ret = map_range(kernel_pgd, va, BENCH_PGTABLE_PA, BENCH_PGTABLE_SIZE, PROT_KERNEL);
+    uint64_t map_ticks = read_cntvct() - start;
+
+    if (ret) {
+        bench_pgtable_report(label, "map_failed", 1, "count");
+        unmap_range(kernel_pgd, va, BENCH_PGTABLE_SIZE);
+        return;
+    }
+    bench_pgtable_report(label, "entries", bench_pgtable_entries(va), "count");
+
+    volatile uint64_t* words = (volatile uint64_t*)va;
+    uint64_t sum = 0;
+    start = read_cntvct();
+    for (int i = 0; i < BENCH_PGTABLE_READS; i++) {
+        sum += words[((uint64_t)bench_random() * (BENCH_PGTABLE_SIZE / 8)) >> 32];
+    }
+    uint64_t read_ticks = read_cntvct() - start;
+    (void)sum;
+
+    start = read_cntvct();
+    ret = unmap_range(kernel_pgd, va, BENCH_PGTABLE_SIZE);
+    uint64_t unmap_ticks = read_cntvct() - start;
+
+    unsigned long free_end = bench_pgtable_free_pages();
+
+    bench_pgtable_report(label, "random_read", bench_ticks_to_ns(read_ticks) * 1000 / BENCH_PGTABLE_READS, "ps");
+    bench_pgtable_report(label, "map", bench_ticks_to_ns(map_ticks), "ns");
+    bench_pgtable_report(label, "unmap", bench_ticks_to_ns(unmap_ticks), "ns");
+    bench_pgtable_report(label, "leaked_pages", free_start > free_end ? free_start - free_end : 0, "pages");
+    if (ret) {
+        bench_pgtable_report(label, "unmap_failed", 1, "count");
+    }
+}
+
+/**
+ * @brief Runs the block against page mapping benchmark.
+ *
+ * Must be called after mem_init().
+ */
+void bench_pgtable(void)
+{
+    /* 2MB aligned like the physical range, all blocks */
+    bench_pgtable_run("blocks", BENCH_PGTABLE_VA);
+    /* one page off, no block fits */
+    bench_pgtable_run("pages", BENCH_PGTABLE_VA + PUD_SIZE + PAGE_SIZE);
+}
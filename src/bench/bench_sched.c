@@ -0,0 +1,178 @@
+/**
+ * @file bench_sched.c
+ * @brief Scheduler pick-next latency and context switch rate benchmark.
+ *
+ * A number of tasks yield to each other in a loop for a fixed time on all
+ * online cores. The scheduler counters of all cores are sampled before and
+ * after, which gives the context switches per second, the average time of a
+ * scheduling decision and how many tasks were migrated by work stealing.
+ *
+ * Fairness is checked with CPU-bound tasks that never yield, first all on
+ * the primary core and then on all cores. Tasks of the same priority must
+ * get about the same share of the time, the report has the smallest share
+ * relative to the largest and the number of tasks that never ran.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+
+#define BENCH_SCHED_MS 200
+
+#define BENCH_SCHED_FAIR_MS 500
+#define BENCH_SCHED_FAIR_MAX 16
+
+static const unsigned long bench_sched_tasks[] = { 8, 64, 1000 };
+static const unsigned long bench_sched_fair_tasks[] = { 4, BENCH_SCHED_FAIR_MAX };
+
+static volatile unsigned long bench_sched_progress[BENCH_SCHED_FAIR_MAX];
+
+static volatile uint64_t bench_sched_deadline;
+static volatile unsigned long bench_sched_done;
+
+/**
+ * @brief Worker task, yields until the deadline and exits.
+ */
+static void bench_sched_worker(unsigned long arg)
+{
+    (void)arg;
+    while (read_cntvct() < bench_sched_deadline) {
+        schedule();
+    }
+
+    __atomic_add_fetch(&bench_sched_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief CPU-bound worker task, counts its progress until the deadline.
+ */
+static void bench_sched_spinner(unsigned long slot)
+{
+    while (read_cntvct() < bench_sched_deadline) {
+        bench_sched_progress[slot]++;
+    }
+
+    __atomic_add_fetch(&bench_sched_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Sums up the scheduler counters of all cores.
+ */
+static void bench_sched_sample(struct sched_stats* total)
+{
+    struct sched_stats stats;
+
+    *total = (struct sched_stats) { 0 };
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        sched_get_stats(cpu, &stats);
+        total->switches += stats.switches;
+        total->picks += stats.picks;
+        total->pick_ticks += stats.pick_ticks;
+        total->steal_attempts += stats.steal_attempts;
+        total->steal_failures += stats.steal_failures;
+        total->migrations += stats.migrations;
+    }
+}
+
+/**
+ * @brief Runs one round of the benchmark with a given number of tasks.
+ */
+static void bench_sched_run(unsigned long nr_tasks)
+{
+    struct sched_stats before, after;
+    char name[32];
+
+    bench_sched_deadline = ~0ull;
+    bench_sched_done = 0;
+    for (unsigned long i = 0; i < nr_tasks; i++) {
+        if (copy_process((unsigned long)&bench_sched_worker, i)) {
+            bench_report("sched", "fork_failed", nr_tasks, "tasks");
+            nr_tasks = i;
+            break;
+        }
+    }
+
+    bench_sched_sample(&before);
+    uint64_t start = read_cntvct();
+    bench_sched_deadline = start + read_cntfrq() * BENCH_SCHED_MS / 1000;
+
+    while (__atomic_load_n(&bench_sched_done, __ATOMIC_ACQUIRE) < nr_tasks) {
+        schedule();
+    }
+    uint64_t ticks = read_cntvct() - start;
+    bench_sched_sample(&after);
+
+    unsigned long picks = after.picks - before.picks;
+    bench_name(name, sizeof(name), "switches_per_s", nr_tasks);
+    bench_report("sched", name, bench_per_second(after.switches - before.switches, ticks), "switches/s");
+    bench_name(name, sizeof(name), "pick_mticks", nr_tasks);
+    bench_report("sched", name, picks ? 1000 * (after.pick_ticks - before.pick_ticks) / picks : 0, "mticks");
+    bench_name(name, sizeof(name), "migrations", nr_tasks);
+    bench_report("sched", name, after.migrations - before.migrations, "count");
+    bench_name(name, sizeof(name), "steal_failures", nr_tasks);
+    bench_report("sched", name, after.steal_failures - before.steal_failures, "count");
+}
+
+/**
+ * @brief Runs CPU-bound tasks on a set of cores and reports how evenly they progressed.
+ */
+static void bench_sched_fair_run(unsigned long nr_tasks, unsigned long cpu_mask, const char* share_name, const char* starved_name)
+{
+    char name[48];
+
+    sched_set_cpu_mask(cpu_mask);
+    bench_sched_deadline = read_cntvct() + read_cntfrq() * BENCH_SCHED_FAIR_MS / 1000;
+    bench_sched_done = 0;
+    for (unsigned long i = 0; i < nr_tasks; i++) {
+        bench_sched_progress[i] = 0;
+        if (copy_process((unsigned long)&bench_sched_spinner, i)) {
+            bench_report("sched", "fork_failed", nr_tasks, "tasks");
+            nr_tasks = i;
+            break;
+        }
+    }
+    while (__atomic_load_n(&bench_sched_done, __ATOMIC_ACQUIRE) < nr_tasks) {
+        cpu_idle_enter();
+    }
+    sched_set_cpu_mask(~0ul);
+
+    unsigned long min = ~0ul, max = 0, starved = 0;
+    for (unsigned long i = 0; i < nr_tasks; i++) {
+        unsigned long progress = bench_sched_progress[i];
+        if (progress < min) {
+            min = progress;
+        }
+        if (progress > max) {
+            max = progress;
+        }
+        starved += !progress;
+    }
+
+    bench_name(name, sizeof(name), share_name, nr_tasks);
+    bench_report("sched", name, max ? 1000 * min / max : 0, "permille");
+    bench_name(name, sizeof(name), starved_name, nr_tasks);
+    bench_report("sched", name, starved, "count");
+}
+
+/**
+ * @brief Runs the scheduler benchmark with 8, 64 and 1000 runnable tasks,
+ * then the fairness check.
+ *
+ * Must be called after smp_boot_secondaries().
+ */
+void bench_sched(void)
+{
+    bench_report("sched", "cntfrq", read_cntfrq(), "Hz");
+
+    for (unsigned int i = 0; i < sizeof(bench_sched_tasks) / sizeof(bench_sched_tasks[0]); i++) {
+        bench_sched_run(bench_sched_tasks[i]);
+    }
+
+    for (unsigned int i = 0; i < sizeof(bench_sched_fair_tasks) / sizeof(bench_sched_fair_tasks[0]); i++) {
+        bench_sched_fair_run(bench_sched_fair_tasks[i], 1, "fair_min_share_cpu0", "fair_starved_cpu0");
+        bench_sched_fair_run(bench_sched_fair_tasks[i], ~0ul, "fair_min_share_all", "fair_starved_all");
+    }
+}
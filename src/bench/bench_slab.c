@@ -0,0 +1,68 @@
+/**
+ * @file bench_slab.c
+ * @brief Slab allocator latency benchmark.
+ *
+ * Latencies are reported in CNTVCT_EL0 ticks per operation, next to the
+ * counter frequency needed to convert them to time.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "mem/slab.h"
+
+#define BENCH_SLAB_ROUNDS 10000
+#define BENCH_SLAB_BATCH 256
+#define BENCH_SLAB_OBJECT_SIZE 200
+
+static void* bench_slab_objects[BENCH_SLAB_BATCH];
+
+/**
+ * @brief Runs the slab allocator benchmark.
+ *
+ * The hot case allocates and immediately frees one object, which stays in
+ * the per-CPU magazine. The batch case holds many objects at once, so the
+ * magazine is refilled from and flushed to the slabs.
+ */
+void bench_slab(void)
+{
+    struct kmem_cache* cache = kmem_cache_create("bench", BENCH_SLAB_OBJECT_SIZE, SLAB_HWCACHE_ALIGN);
+    if (!cache) {
+        bench_report("slab", "create_failed", 1, "count");
+        return;
+    }
+
+    bench_report("slab", "cntfrq", read_cntfrq(), "Hz");
+
+    uint64_t start = read_cntvct();
+    for (int round = 0; round < BENCH_SLAB_ROUNDS; round++) {
+        kmem_cache_free(cache, kmem_cache_alloc(cache));
+    }
+    uint64_t ticks = read_cntvct() - start;
+    bench_report("slab", "hot_alloc_free", 1000 * ticks / BENCH_SLAB_ROUNDS, "mticks");
+
+    uint64_t alloc_ticks = 0, free_ticks = 0;
+    for (int round = 0; round < BENCH_SLAB_ROUNDS / BENCH_SLAB_BATCH; round++) {
+        start = read_cntvct();
+        for (int i = 0; i < BENCH_SLAB_BATCH; i++) {
+            bench_slab_objects[i] = kmem_cache_alloc(cache);
+        }
+        alloc_ticks += read_cntvct() - start;
+
+        start = read_cntvct();
+        for (int i = 0; i < BENCH_SLAB_BATCH; i++) {
+            kmem_cache_free(cache, bench_slab_objects[i]);
+        }
+        free_ticks += read_cntvct() - start;
+    }
+    uint64_t ops = (BENCH_SLAB_ROUNDS / BENCH_SLAB_BATCH) * BENCH_SLAB_BATCH;
+    bench_report("slab", "batch_alloc", 1000 * alloc_ticks / ops, "mticks");
+    bench_report("slab", "batch_free", 1000 * free_ticks / ops, "mticks");
+
+    start = read_cntvct();
+    for (int round = 0; round < BENCH_SLAB_ROUNDS; round++) {
+        kfree(kmalloc(64 << (round % 7)));
+    }
+    ticks = read_cntvct() - start;
+    bench_report("slab", "kmalloc_kfree", 1000 * ticks / BENCH_SLAB_ROUNDS, "mticks");
+}
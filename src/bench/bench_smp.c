@@ -0,0 +1,70 @@
+/**
+ * @file bench_smp.c
+ * @brief Multi-core scheduler throughput benchmark.
+ *
+ * The same set of CPU-bound tasks is run with one to NR_CPUS cores allowed
+ * to schedule them, so the results show how throughput scales with cores.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+
+#define BENCH_SMP_TASKS 8
+#define BENCH_SMP_WORK 200000
+
+static volatile unsigned long bench_smp_done;
+
+/**
+ * @brief Worker task, spins through a fixed amount of work and exits.
+ */
+static void bench_smp_worker(unsigned long seed)
+{
+    volatile uint32_t x = seed | 1;
+    for (int i = 0; i < BENCH_SMP_WORK; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+
+    __atomic_add_fetch(&bench_smp_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Runs the multi-core scheduler benchmark.
+ *
+ * Must be called after smp_boot_secondaries().
+ */
+void bench_smp(void)
+{
+    unsigned int online = smp_num_online();
+    bench_report("smp", "cores_online", online, "count");
+
+    for (unsigned int cpus = 1; cpus <= online; cpus++) {
+        char name[32];
+        bench_name(name, sizeof(name), "tasks_per_s_cpus", cpus);
+
+        sched_set_cpu_mask((1ul << cpus) - 1);
+        bench_smp_done = 0;
+
+        uint64_t start = read_cntvct();
+        for (unsigned long i = 0; i < BENCH_SMP_TASKS; i++) {
+            if (copy_process((unsigned long)&bench_smp_worker, i + 1)) {
+                bench_report("smp", "fork_failed", 1, "count");
+                sched_set_cpu_mask(~0ul);
+                return;
+            }
+        }
+        while (__atomic_load_n(&bench_smp_done, __ATOMIC_ACQUIRE) < BENCH_SMP_TASKS) {
+            schedule();
+        }
+        uint64_t ticks = read_cntvct() - start;
+
+        bench_report("smp", name, bench_per_second(BENCH_SMP_TASKS, ticks), "tasks/s");
+    }
+
+    sched_set_cpu_mask(~0ul);
+}
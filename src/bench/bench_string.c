@@ -0,0 +1,175 @@
+/**
+ * @file bench_string.c
+ * @brief memcpy and memset throughput against plain loops.
+ *
+ * Every size from 16 bytes to 2MiB is copied and filled often enough to move
+ * BENCH_STRING_BYTES, with a byte loop, a 64-bit word loop and the routines
+ * of lib/string.h. The latter also run with the destination one byte off and,
+ * for memset, with zero, which takes DC ZVA from 256 bytes on. clear_page is
+ * reported on its own.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "lib/string.h"
+#include "mem/mem.h"
+
+/* the loops below must stay loops, not become calls or vector code */
+#pragma GCC optimize("no-tree-loop-distribute-patterns", "no-tree-vectorize")
+
+/* 4MiB per buffer, room for 2MiB plus an offset */
+#define BENCH_STRING_ORDER 10
+#define BENCH_STRING_BYTES (8 * 1024 * 1024)
+#define BENCH_STRING_PAGES 1024
+
+enum bench_string_kind {
+    BENCH_STRING_BYTE,
+    BENCH_STRING_WORD,
+    BENCH_STRING_LIB,
+};
+
+static const size_t bench_string_sizes[] = {
+    16, 64, 256, 1024, 4096, 16384, 65536, 262144, 2 * 1024 * 1024
+};
+
+static uint8_t* bench_string_src;
+static uint8_t* bench_string_dst;
+
+static void bench_string_copy_bytes(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = src[i];
+    }
+}
+
+/* aligned buffers and a multiple of 8 bytes only */
+static void bench_string_copy_words(uint8_t* dst, const uint8_t* src, size_t n)
+{
+    uint64_t* d = (uint64_t*)dst;
+    const uint64_t* s = (const uint64_t*)src;
+
+    for (size_t i = 0; i < n / 8; i++) {
+        d[i] = s[i];
+    }
+}
+
+static void bench_string_set_bytes(uint8_t* dst, int c, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = c;
+    }
+}
+
+/* aligned buffer and a multiple of 8 bytes only */
+static void bench_string_set_words(uint8_t* dst, int c, size_t n)
+{
+    uint64_t* d = (uint64_t*)dst;
+    uint64_t v = (uint8_t)c * 0x0101010101010101ull;
+
+    for (size_t i = 0; i < n / 8; i++) {
+        d[i] = v;
+    }
+}
+
+/**
+ * @brief Copies or fills a size until BENCH_STRING_BYTES moved, reports KiB/s.
+ *
+ * A fill with c < 0 stores the round number, otherwise c.
+ */
+static void bench_string_run(const char* name, enum bench_string_kind kind, size_t size, size_t offset, int fill, int c)
+{
+    char buf[48];
+    uint64_t rounds = BENCH_STRING_BYTES / size;
+    uint8_t* dst = bench_string_dst + offset;
+
+    uint64_t start = read_cntvct();
+    for (uint64_t i = 0; i < rounds; i++) {
+        int v = c < 0 ? (int)i | 1 : c;
+
+        switch (kind) {
+        case BENCH_STRING_BYTE:
+            if (fill) {
+                bench_string_set_bytes(dst, v, size);
+            } else {
+                bench_string_copy_bytes(dst, bench_string_src, size);
+            }
+            break;
+        case BENCH_STRING_WORD:
+            if (fill) {
+                bench_string_set_words(dst, v, size);
+            } else {
+                bench_string_copy_words(dst, bench_string_src, size);
+            }
+            break;
+        case BENCH_STRING_LIB:
+            if (fill) {
+                memset(dst, v, size);
+            } else {
+                memcpy(dst, bench_string_src, size);
+            }
+            break;
+        }
+        /* keep the calls from being merged or dropped */
+        asm volatile("" ::: "memory");
+    }
+    uint64_t ticks = read_cntvct() - start;
+
+    bench_name(buf, sizeof(buf), name, size);
+    bench_report("string", buf, bench_per_second(rounds * size, ticks) / 1024, "KiB/s");
+}
+
+/**
+ * @brief Reports the rate of clear_page over the destination buffer.
+ */
+static void bench_string_clear_page(void)
+{
+    unsigned long pages = (PAGE_SIZE << BENCH_STRING_ORDER) / PAGE_SIZE;
+
+    uint64_t start = read_cntvct();
+    for (int i = 0; i < BENCH_STRING_PAGES; i++) {
+        clear_page(bench_string_dst + (i % pages) * PAGE_SIZE);
+    }
+    uint64_t ticks = read_cntvct() - start;
+
+    bench_report("string", "clear_page", bench_per_second(BENCH_STRING_PAGES, ticks), "pages/s");
+}
+
+/**
+ * @brief Runs the memcpy and memset benchmark.
+ */
+void bench_string(void)
+{
+    bench_string_src = (uint8_t*)alloc_pages(BENCH_STRING_ORDER);
+    bench_string_dst = (uint8_t*)alloc_pages(BENCH_STRING_ORDER);
+    if (!bench_string_src || !bench_string_dst) {
+        bench_report("string", "no_memory", 1, "count");
+        goto out;
+    }
+    for (size_t i = 0; i < (PAGE_SIZE << BENCH_STRING_ORDER); i++) {
+        bench_string_src[i] = i;
+    }
+
+    for (unsigned int i = 0; i < sizeof(bench_string_sizes) / sizeof(bench_string_sizes[0]); i++) {
+        size_t size = bench_string_sizes[i];
+
+        bench_string_run("memcpy_byte", BENCH_STRING_BYTE, size, 0, 0, 0);
+        bench_string_run("memcpy_word", BENCH_STRING_WORD, size, 0, 0, 0);
+        bench_string_run("memcpy", BENCH_STRING_LIB, size, 0, 0, 0);
+        bench_string_run("memcpy_unaligned", BENCH_STRING_LIB, size, 1, 0, 0);
+        bench_string_run("memset_byte", BENCH_STRING_BYTE, size, 0, 1, -1);
+        bench_string_run("memset_word", BENCH_STRING_WORD, size, 0, 1, -1);
+        bench_string_run("memset", BENCH_STRING_LIB, size, 0, 1, -1);
+        bench_string_run("memset_unaligned", BENCH_STRING_LIB, size, 1, 1, -1);
+        bench_string_run("memset_zero", BENCH_STRING_LIB, size, 0, 1, 0);
+    }
+    bench_string_clear_page();
+
+out:
+    if (bench_string_src) {
+        free_pages((unsigned long)bench_string_src, BENCH_STRING_ORDER);
+    }
+    if (bench_string_dst) {
+        free_pages((unsigned long)bench_string_dst, BENCH_STRING_ORDER);
+    }
+}
@@ -0,0 +1,123 @@
+/**
+ * @file bench_syscall.c
+ * @brief Null system call round trips from EL0.
+ *
+ * A task running in EL0 makes getpid calls back to back and times them
+ * with the cycle counter, so the result covers the exception, the dispatch
+ * through sys_call_table and the fast return of el0_svc. Next to it is an
+ * svc from EL1, which saves and restores the whole frame and goes through
+ * handle_sync(). A second task makes every system call once and leaves the
+ * results in its data page. The tasks are kept on the primary core, the
+ * counter is per core.
+ */
+#include <stdint.h>
+
+#include "bench/bench.h"
+#include "mem/mem.h"
+#include "mem/mm.h"
+#include "mem/pgtable.h"
+#include "pmu/pmu.h"
+#include "scheduler/fork.h"
+#include "scheduler/pid.h"
+#include "scheduler/scheduler.h"
+#include "syscall/syscall.h"
+#include "user/user.h"
+
+#define BENCH_SYSCALL_ITERATIONS 100000
+#define BENCH_SYSCALL_STACK (64ul * 1024)
+
+static unsigned long bench_syscall_free_pages(void)
+{
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    return stats.free_pages + stats.cached_pages;
+}
+
+/**
+ * @brief Runs a user program to completion.
+ *
+ * The program gets the user text, a stack and a data page, which is
+ * returned through data and stays valid until the address space is put.
+ *
+ * @return The address space, 0 if the task could not be created.
+ */
+static struct mm_struct* bench_syscall_run(char* prog, struct user_data** data)
+{
+    unsigned long base = nr_tasks();
+    struct mm_struct* mm = mm_alloc();
+    if (!mm) {
+        return 0;
+    }
+
+    unsigned long page = get_zeroed_page();
+    unsigned long data_va = do_mmap(mm, 0, PAGE_SIZE, VM_READ | VM_WRITE);
+    unsigned long stack = do_mmap(mm, 0, BENCH_SYSCALL_STACK, VM_READ | VM_WRITE);
+    /* the text goes first, do_mmap() hands out the lowest free range */
+    if (!page || mm_map_user_text(mm) || !data_va || !stack
+        || map_range(mm->pgd, data_va, page, PAGE_SIZE, PROT_USER_DATA)) {
+        if (page) {
+            free_page(page);
+        }
+        mm_put(mm);
+        return 0;
+    }
+
+    /* mapped up front, the kernel reads it after the task is gone */
+    *data = (struct user_data*)page;
+    (*data)->iterations = BENCH_SYSCALL_ITERATIONS;
+
+    if (copy_user_process(mm, user_text_addr(prog), stack + BENCH_SYSCALL_STACK, data_va)) {
+        mm_put(mm);
+        return 0;
+    }
+    while (nr_tasks() > base) {
+        cpu_idle_enter();
+    }
+    return mm;
+}
+
+/**
+ * @brief Runs the system call benchmark.
+ *
+ * Must be called on the primary core after mm_init(), with the scheduler running.
+ */
+void bench_syscall(void)
+{
+    unsigned long free_start = bench_syscall_free_pages();
+    struct user_data* data;
+
+    sched_set_cpu_mask(1);
+
+    struct mm_struct* mm = bench_syscall_run(user_null_syscall, &data);
+    if (!mm) {
+        bench_report("syscall", "user_failed", 1, "count");
+        sched_set_cpu_mask(~0ul);
+        return;
+    }
+    bench_report("syscall", "null_syscall", data->cycles / BENCH_SYSCALL_ITERATIONS, "cycles");
+    bench_report("syscall", "null_errors", data->pid <= 0, "count");
+    mm_put(mm);
+
+    uint64_t start = pmu_read_cycles();
+    for (int i = 0; i < BENCH_SYSCALL_ITERATIONS; i++) {
+        asm volatile("svc #0" ::: "memory");
+    }
+    bench_report("syscall", "el1_svc", (pmu_read_cycles() - start) / BENCH_SYSCALL_ITERATIONS, "cycles");
+
+    mm = bench_syscall_run(user_smoke, &data);
+    if (!mm) {
+        bench_report("syscall", "smoke_failed", 1, "count");
+        sched_set_cpu_mask(~0ul);
+        return;
+    }
+    /* see user_smoke for the expected results */
+    unsigned long errors = (data->write != 16) + (data->mmap == SYSCALL_ERROR) + (data->mmap_read != 0x5a)
+        + (data->bad_syscall != SYSCALL_ERROR) + (data->pid <= 0);
+    bench_report("syscall", "smoke_errors", errors, "count");
+    mm_put(mm);
+
+    sched_set_cpu_mask(~0ul);
+
+    unsigned long free_end = bench_syscall_free_pages();
+    bench_report("syscall", "leaked_pages", free_start > free_end ? free_start - free_end : 0, "pages");
+}
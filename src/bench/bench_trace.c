@@ -0,0 +1,77 @@
+/**
+ * @file bench_trace.c
+ * @brief Tracepoint overhead and a sample trace.
+ *
+ * Times a tracepoint while tracing is stopped and while it records, then
+ * traces a few tasks that sleep and yield on all cores and dumps the
+ * buffers over UART for scripts/trace2perfetto.py.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "peripherals/bcm2711/uart/uart.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "time/hrtimer.h"
+#include "trace/trace.h"
+
+#define BENCH_TRACE_CALLS 100000
+#define BENCH_TRACE_TASKS 8
+#define BENCH_TRACE_ROUNDS 50
+
+static volatile unsigned long bench_trace_done;
+
+/**
+ * @brief Worker task, alternates short sleeps with yields.
+ */
+static void bench_trace_worker(unsigned long arg)
+{
+    for (int i = 0; i < BENCH_TRACE_ROUNDS; i++) {
+        sleep_ns((arg + 1) * 50 * NSEC_PER_USEC);
+        schedule();
+    }
+    __atomic_add_fetch(&bench_trace_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Returns the cost of one tracepoint in thousandths of a tick.
+ */
+static uint64_t bench_trace_cost(void)
+{
+    uint64_t start = read_cntvct();
+    for (int i = 0; i < BENCH_TRACE_CALLS; i++) {
+        trace_event(TRACE_IRQ_ENTRY, i, 0, 0);
+    }
+    return 1000 * (read_cntvct() - start) / BENCH_TRACE_CALLS;
+}
+
+/**
+ * @brief Runs the tracing benchmark, only with CONFIG_TRACE.
+ */
+void bench_trace(void)
+{
+#ifdef CONFIG_TRACE
+    trace_stop();
+    bench_report("trace", "disabled_mticks", bench_trace_cost(), "mticks");
+    trace_start();
+    bench_report("trace", "enabled_mticks", bench_trace_cost(), "mticks");
+
+    unsigned long tasks = 0;
+    bench_trace_done = 0;
+    trace_start();
+    for (; tasks < BENCH_TRACE_TASKS; tasks++) {
+        if (copy_process((unsigned long)&bench_trace_worker, tasks)) {
+            bench_report("trace", "fork_failed", tasks, "tasks");
+            break;
+        }
+    }
+    while (__atomic_load_n(&bench_trace_done, __ATOMIC_ACQUIRE) < tasks) {
+        cpu_idle_enter();
+    }
+    trace_stop();
+
+    trace_dump(uart_putc);
+    uart_flush();
+#endif
+}
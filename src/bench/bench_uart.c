@@ -0,0 +1,169 @@
+/**
+ * @file bench_uart.c
+ * @brief Cost of console output in interrupt context.
+ *
+ * A periodic hrtimer writes a line from its callback, once with synchronous
+ * UART output and once through the TX ring. The time the callback spends
+ * writing is time the interrupt is not handled.
+ *
+ * The receive path is tested with the UART in loopback: a task reads a
+ * numbered byte stream with uart_read() while the primary core writes it,
+ * at 115200 baud and at the highest rate of the 3MHz UART clock. Every byte
+ * lost on the way shows up as a sequence error.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "bench/bench.h"
+#include "peripherals/bcm2711/uart/uart.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "time/hrtimer.h"
+
+#define BENCH_UART_LINES 32
+#define BENCH_UART_PERIOD_NS (10 * NSEC_PER_MSEC)
+#define BENCH_UART_RX_BYTES 16384
+
+static volatile unsigned long bench_uart_lines;
+static uint64_t bench_uart_sum, bench_uart_max;
+static volatile unsigned long bench_uart_rx_done;
+static unsigned long bench_uart_rx_errors;
+
+static enum hrtimer_restart bench_uart_callback(struct hrtimer* timer)
+{
+    uint64_t start = read_cntvct();
+    uart_puts("bench uart: a line written from the timer interrupt\n");
+    uint64_t ticks = read_cntvct() - start;
+
+    bench_uart_sum += ticks;
+    if (ticks > bench_uart_max) {
+        bench_uart_max = ticks;
+    }
+    if (++bench_uart_lines == BENCH_UART_LINES) {
+        return HRTIMER_NORESTART;
+    }
+    hrtimer_forward(timer, BENCH_UART_PERIOD_NS);
+    return HRTIMER_RESTART;
+}
+
+/**
+ * @brief Prints the lines from the timer interrupt and reports the cost.
+ */
+static void bench_uart_run(const char* avg_name, const char* max_name)
+{
+    struct hrtimer timer;
+
+    bench_uart_lines = 0;
+    bench_uart_sum = 0;
+    bench_uart_max = 0;
+
+    hrtimer_setup(&timer, bench_uart_callback, 0);
+    if (timer_add(&timer, BENCH_UART_PERIOD_NS)) {
+        return;
+    }
+    while (bench_uart_lines < BENCH_UART_LINES) {
+        cpu_idle_enter();
+    }
+    uart_flush();
+
+    bench_report("uart", avg_name, bench_ticks_to_ns(bench_uart_sum / BENCH_UART_LINES), "ns");
+    bench_report("uart", max_name, bench_ticks_to_ns(bench_uart_max), "ns");
+}
+
+/**
+ * @brief Reader task, reads the byte stream and checks its sequence.
+ */
+static void bench_uart_reader(unsigned long arg)
+{
+    (void)arg;
+    uint8_t buf[64];
+    unsigned long received = 0;
+    uint8_t expected = 0;
+
+    bench_uart_rx_errors = 0;
+    while (received < BENCH_UART_RX_BYTES) {
+        size_t n = uart_read(buf, sizeof(buf));
+        for (size_t i = 0; i < n; i++) {
+            if (buf[i] != expected) {
+                bench_uart_rx_errors++;
+            }
+            expected = buf[i] + 1;
+        }
+        received += n;
+    }
+    __atomic_store_n(&bench_uart_rx_done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Loops a byte stream through the UART at one baud rate.
+ */
+static void bench_uart_rx_run(unsigned int baud, const char* rate_name, const char* error_name, const char* lost_name)
+{
+    struct uart_stats before, after;
+
+    bench_uart_rx_done = 0;
+    if (copy_process((unsigned long)&bench_uart_reader, 0)) {
+        bench_report("uart", "fork_failed", 1, "tasks");
+        return;
+    }
+
+    uart_set_baud(baud);
+    uart_set_loopback(1);
+    uart_flush_input();
+    uart_get_stats(&before);
+
+    /* ten bits per byte, twice that before the stream is given up on */
+    uint64_t start = read_cntvct();
+    uint64_t deadline = start + 2 * ns_to_ticks(BENCH_UART_RX_BYTES * 10 * (NSEC_PER_SEC / baud));
+    unsigned long sent = 0;
+    while (sent < BENCH_UART_RX_BYTES) {
+        uart_putc(sent++ & 0xff);
+        /* let the reader run if it shares this core */
+        if (!(sent % 256)) {
+            schedule();
+        }
+    }
+    while (!__atomic_load_n(&bench_uart_rx_done, __ATOMIC_ACQUIRE)) {
+        /* bytes were lost, pad the stream so the reader finishes */
+        if (read_cntvct() > deadline) {
+            uart_putc(sent++ & 0xff);
+        }
+        cpu_idle_enter();
+    }
+    uint64_t ticks = read_cntvct() - start;
+
+    uart_get_stats(&after);
+    uart_set_loopback(0);
+    uart_flush_input();
+    uart_set_baud(115200);
+
+    bench_report("uart", rate_name, bench_per_second(BENCH_UART_RX_BYTES, ticks), "bytes/s");
+    bench_report("uart", error_name, bench_uart_rx_errors, "count");
+    bench_report("uart", lost_name, (after.rx_overruns - before.rx_overruns) + (after.rx_dropped - before.rx_dropped), "count");
+}
+
+/**
+ * @brief Runs the console output and input benchmark.
+ *
+ * Must be called from the idle task of the primary core after
+ * uart_enable_irq().
+ */
+void bench_uart(void)
+{
+    struct uart_stats before, after;
+
+    uart_set_sync(1);
+    bench_uart_run("irq_puts_sync_avg", "irq_puts_sync_max");
+    uart_set_sync(0);
+
+    uart_get_stats(&before);
+    bench_uart_run("irq_puts_ring_avg", "irq_puts_ring_max");
+    uart_get_stats(&after);
+
+    bench_report("uart", "ring_bytes", after.tx_bytes - before.tx_bytes, "bytes");
+    bench_report("uart", "ring_tx_irqs", after.tx_irqs - before.tx_irqs, "count");
+    bench_report("uart", "ring_overflows", after.tx_overflows - before.tx_overflows, "count");
+
+    bench_uart_rx_run(115200, "rx_bytes_per_s_115200", "rx_sequence_errors_115200", "rx_lost_115200");
+    bench_uart_rx_run(187500, "rx_bytes_per_s_187500", "rx_sequence_errors_187500", "rx_lost_187500");
+}
@@ -0,0 +1,82 @@
+#ifndef _LIST_H
+#define _LIST_H
+
+#include <stddef.h>
+
+/**
+ * @brief Intrusive circular doubly linked list.
+ *
+ * Embed a struct list_head in the element and use list_entry() to get back
+ * to the element from its node.
+ */
+struct list_head {
+    struct list_head* next;
+    struct list_head* prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+
+#define list_entry(ptr, type, member) \
+    ((type*)((char*)(ptr) - offsetof(type, member)))
+
+#define list_first_entry(head, type, member) \
+    list_entry((head)->next, type, member)
+
+#define list_for_each(pos, head) \
+    for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#define list_for_each_safe(pos, n, head) \
+    for (pos = (head)->next, n = pos->next; pos != (head); pos = n, n = pos->next)
+
+static inline void list_init(struct list_head* head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static inline int list_empty(const struct list_head* head)
+{
+    return head->next == head;
+}
+
+static inline void list_insert(struct list_head* node, struct list_head* prev, struct list_head* next)
+{
+    next->prev = node;
+    node->next = next;
+    node->prev = prev;
+    prev->next = node;
+}
+
+/* insert after head, i.e. at the front */
+static inline void list_add(struct list_head* node, struct list_head* head)
+{
+    list_insert(node, head, head->next);
+}
+
+/* insert before head, i.e. at the back */
+static inline void list_add_tail(struct list_head* node, struct list_head* head)
+{
+    list_insert(node, head->prev, head);
+}
+
+static inline void list_del(struct list_head* node)
+{
+    node->next->prev = node->prev;
+    node->prev->next = node->next;
+    node->next = node;
+    node->prev = node;
+}
+
+static inline void list_move(struct list_head* node, struct list_head* head)
+{
+    list_del(node);
+    list_add(node, head);
+}
+
+static inline void list_move_tail(struct list_head* node, struct list_head* head)
+{
+    list_del(node);
+    list_add_tail(node, head);
+}
+
+#endif
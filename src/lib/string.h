@@ -0,0 +1,16 @@
+#ifndef _STRING_H
+#define _STRING_H
+
+#include <stddef.h>
+
+/*
+ * Implemented in arch/aarch64/lib/string.S. The compiler emits calls to
+ * these for structure copies and initialisations even in a freestanding
+ * build.
+ */
+void* memcpy(void* dst, const void* src, size_t n);
+void* memmove(void* dst, const void* src, size_t n);
+void* memset(void* s, int c, size_t n);
+int memcmp(const void* a, const void* b, size_t n);
+
+#endif
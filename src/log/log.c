@@ -0,0 +1,460 @@
+/**
+ * @file log.c
+ * @brief Per-CPU kernel log with deferred console output.
+ *
+ * printk() formats into log_putc(), which collects a line in a buffer of the
+ * calling core and, at the newline, stores it as a record with a CNTVCT
+ * timestamp and a log level in the log of that core. Storing a line only
+ * touches memory of the core, no lock is taken and nothing waits for the
+ * UART. A flush task prints the records on the console afterwards, merged
+ * by timestamp across all cores.
+ *
+ * Every core is the only writer of its log, so writers need no lock. When the
+ * log is full the oldest records are overwritten. Readers, the flush task and
+ * log_dump(), never stop a writer: they copy a record and then check that the
+ * writer has not reclaimed it in the meantime.
+ *
+ * Until log_start_flush() and again after log_panic() every line is printed
+ * right away by the core that logged it.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "irq/irq.h"
+#include "log/log.h"
+#include "mem/cache.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "sync/spinlock.h"
+
+/* task context plus nested interrupts, deeper nesting shares the last line */
+#define LOG_CONTEXTS 4
+
+/**
+ * @brief Header of a record in the log, followed by the text.
+ */
+struct log_record {
+    uint64_t ts; /* CNTVCT_EL0 when the line was started */
+    uint16_t len; /* length of the text */
+    uint8_t level;
+    uint8_t cpu;
+    uint32_t reserved;
+};
+
+#define LOG_ALIGN(n) (((n) + 7) & ~7ul)
+#define LOG_RECORD_SIZE(len) (sizeof(struct log_record) + LOG_ALIGN(len))
+
+/**
+ * @brief A line that is still being written.
+ */
+struct log_line {
+    uint64_t ts;
+    unsigned int len;
+    unsigned int level; /* level + 1, 0 if the line has none */
+    int soh; /* the last character was KERN_SOH, the level follows */
+    char text[LOG_LINE_MAX];
+};
+
+/**
+ * @brief The log of one core.
+ *
+ * head, first and console are byte positions that only ever grow and are
+ * taken modulo LOG_BUF_SIZE. Records between first and head are valid.
+ */
+struct log_buf {
+    unsigned long head; /* where the next record goes */
+    unsigned long first; /* oldest record still in the log */
+    unsigned long console; /* next record for the console, flush side only */
+    struct log_stats stats;
+    struct log_line lines[LOG_CONTEXTS];
+    uint8_t data[LOG_BUF_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct log_buf log_bufs[NR_CPUS];
+static void (*console_putc)(unsigned char c);
+static spinlock_t console_lock = SPINLOCK_INIT;
+static volatile int log_sync = 1;
+static struct task_struct* flush_task;
+static int flush_sleeping;
+
+/**
+ * @brief Sets where log lines are printed, usually uart_putc.
+ */
+void log_set_console(void (*putc)(unsigned char c))
+{
+    console_putc = putc;
+}
+
+static void log_copy_in(struct log_buf* log, unsigned long pos, const void* src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        log->data[(pos + i) % LOG_BUF_SIZE] = ((const uint8_t*)src)[i];
+    }
+}
+
+static void log_copy_out(struct log_buf* log, unsigned long pos, void* dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        ((uint8_t*)dst)[i] = log->data[(pos + i) % LOG_BUF_SIZE];
+    }
+}
+
+/**
+ * @brief Reads the record at pos.
+ *
+ * @return 1 if the record was read, 0 if it was overwritten while reading.
+ */
+static int log_read(struct log_buf* log, unsigned long pos, struct log_record* record, char* text)
+{
+    log_copy_out(log, pos, record, sizeof(*record));
+    if (record->len > LOG_LINE_MAX) {
+        record->len = LOG_LINE_MAX;
+    }
+    log_copy_out(log, pos + sizeof(*record), text, record->len);
+
+    /* pairs with the fence in log_store() */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&log->first, __ATOMIC_RELAXED) <= pos;
+}
+
+/**
+ * @brief Stores a finished line in the log of the calling core, interrupts masked.
+ */
+static void log_store(struct log_buf* log, struct log_line* line, unsigned int cpu)
+{
+    struct log_record record = {
+        .ts = line->ts,
+        .len = line->len,
+        .level = line->level ? line->level - 1 : LOGLEVEL_DEFAULT,
+        .cpu = cpu,
+    };
+    unsigned long size = LOG_RECORD_SIZE(line->len);
+    unsigned long first = log->first;
+
+    while (log->head + size - first > LOG_BUF_SIZE) {
+        struct log_record old;
+        log_copy_out(log, first, &old, sizeof(old));
+        if (first >= __atomic_load_n(&log->console, __ATOMIC_RELAXED)) {
+            log->stats.overwritten++;
+        }
+        first += LOG_RECORD_SIZE(old.len);
+    }
+    if (first != log->first) {
+        __atomic_store_n(&log->first, first, __ATOMIC_RELAXED);
+        /* readers must see the new first before the data is overwritten */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+    log_copy_in(log, log->head, &record, sizeof(record));
+    log_copy_in(log, log->head + sizeof(record), line->text, line->len);
+    __atomic_store_n(&log->head, log->head + size, __ATOMIC_RELEASE);
+    log->stats.records++;
+
+    line->len = 0;
+    line->level = 0;
+}
+
+/**
+ * @brief Wakes the flush task if it is waiting for lines.
+ */
+static void log_wake_flush(void)
+{
+    /* pairs with the fence in log_flush_task() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&flush_sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&flush_sleeping, 0, __ATOMIC_ACQUIRE)) {
+        wake_up_process(flush_task);
+    }
+}
+
+/**
+ * @brief Adds a character to the log, meant to be installed with set_putc().
+ *
+ * Every core and every interrupt nesting level collects its own line, so
+ * lines from interrupts do not end up in the middle of the line they
+ * interrupted. Must not be called with a run queue lock held, it may wake
+ * the flush task.
+ *
+ * @param c The character.
+ */
+void log_putc(unsigned char c)
+{
+    unsigned long flags = local_irq_save();
+    unsigned int cpu = smp_processor_id();
+    struct log_buf* log = &log_bufs[cpu];
+    unsigned long depth = in_interrupt();
+    struct log_line* line = &log->lines[depth < LOG_CONTEXTS ? depth : LOG_CONTEXTS - 1];
+    int stored = 0;
+
+    if (line->soh) {
+        line->soh = 0;
+        if (c >= '0' && c <= '7') {
+            line->level = c - '0' + 1;
+            local_irq_restore(flags);
+            return;
+        }
+    } else if (c == KERN_SOH[0] && !line->len) {
+        line->soh = 1;
+        local_irq_restore(flags);
+        return;
+    }
+
+    if (!line->len) {
+        line->ts = read_cntvct();
+    }
+    if (c == '\n') {
+        log_store(log, line, cpu);
+        stored = 1;
+    } else if (c != '\r') {
+        line->text[line->len++] = c;
+        if (line->len == LOG_LINE_MAX) {
+            log_store(log, line, cpu);
+            stored = 1;
+        }
+    }
+    local_irq_restore(flags);
+
+    if (!stored) {
+        return;
+    }
+    if (log_sync) {
+        log_flush();
+    } else {
+        log_wake_flush();
+    }
+}
+
+static void log_put_number(unsigned long value, int width, char pad)
+{
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (width-- > n) {
+        console_putc(pad);
+    }
+    while (n) {
+        console_putc(digits[--n]);
+    }
+}
+
+/**
+ * @brief Prints a record as "[seconds.microseconds] text".
+ *
+ * @param level Non-zero to print the level in front as well, as dmesg -r does.
+ */
+static void log_print(struct log_record* record, const char* text, int level)
+{
+    uint64_t frq = read_cntfrq();
+    uint64_t us = 0;
+
+    if (frq) {
+        us = record->ts / frq * 1000000 + record->ts % frq * 1000000 / frq;
+    }
+    if (level) {
+        console_putc('<');
+        log_put_number(record->level, 0, '0');
+        console_putc('>');
+    }
+    console_putc('[');
+    log_put_number(us / 1000000, 5, ' ');
+    console_putc('.');
+    log_put_number(us % 1000000, 6, '0');
+    console_putc(']');
+    console_putc(' ');
+    for (unsigned int i = 0; i < record->len; i++) {
+        console_putc(text[i]);
+    }
+    console_putc('\n');
+}
+
+/**
+ * @brief Finds the oldest record after the cursors of all cores.
+ *
+ * Cursors behind the oldest record of their core are moved up to it.
+ *
+ * @return The core whose cursor points at the record, -1 if there is none.
+ */
+static int log_next(unsigned long* cursor, struct log_record* record, char* text)
+{
+    int best = -1;
+    struct log_record candidate;
+    char scratch[LOG_LINE_MAX];
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct log_buf* log = &log_bufs[cpu];
+
+        while (1) {
+            unsigned long first = __atomic_load_n(&log->first, __ATOMIC_ACQUIRE);
+            if (cursor[cpu] < first) {
+                cursor[cpu] = first;
+            }
+            if (cursor[cpu] >= __atomic_load_n(&log->head, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            if (!log_read(log, cursor[cpu], &candidate, scratch)) {
+                continue;
+            }
+            if (best < 0 || candidate.ts < record->ts) {
+                best = cpu;
+                *record = candidate;
+                for (unsigned int i = 0; i < candidate.len; i++) {
+                    text[i] = scratch[i];
+                }
+            }
+            break;
+        }
+    }
+    return best;
+}
+
+/*
+ * Before log_start_flush() only the boot core prints and the caches may still
+ * be off, where exclusive loads and stores do not work, so the console lock
+ * is only taken once the flush task runs.
+ */
+static unsigned long console_lock_irqsave(void)
+{
+    if (log_sync) {
+        return local_irq_save();
+    }
+    return spin_lock_irqsave(&console_lock);
+}
+
+static void console_unlock_irqrestore(unsigned long flags)
+{
+    if (log_sync) {
+        local_irq_restore(flags);
+        return;
+    }
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+/**
+ * @brief Prints every record that has not been on the console yet.
+ */
+void log_flush(void)
+{
+    struct log_record record;
+    char text[LOG_LINE_MAX];
+    unsigned long cursor[NR_CPUS];
+
+    if (!console_putc) {
+        return;
+    }
+
+    while (1) {
+        unsigned long flags = console_lock_irqsave();
+        for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+            cursor[cpu] = log_bufs[cpu].console;
+        }
+        int cpu = log_next(cursor, &record, text);
+        if (cpu < 0) {
+            console_unlock_irqrestore(flags);
+            break;
+        }
+        if (record.level < LOGLEVEL_CONSOLE) {
+            log_print(&record, text, 0);
+        }
+        __atomic_store_n(&log_bufs[cpu].console, cursor[cpu] + LOG_RECORD_SIZE(record.len), __ATOMIC_RELAXED);
+        console_unlock_irqrestore(flags);
+    }
+}
+
+/**
+ * @brief Prints the whole log of all cores with levels, like dmesg -r.
+ *
+ * Does not change what the flush task still has to print.
+ */
+void log_dump(void)
+{
+    struct log_record record;
+    char text[LOG_LINE_MAX];
+    unsigned long cursor[NR_CPUS] = { 0 };
+
+    if (!console_putc) {
+        return;
+    }
+
+    unsigned long flags = console_lock_irqsave();
+    int cpu;
+    while ((cpu = log_next(cursor, &record, text)) >= 0) {
+        log_print(&record, text, 1);
+        cursor[cpu] += LOG_RECORD_SIZE(record.len);
+    }
+    console_unlock_irqrestore(flags);
+}
+
+static int log_pending(void)
+{
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (__atomic_load_n(&log_bufs[cpu].console, __ATOMIC_RELAXED) < __atomic_load_n(&log_bufs[cpu].head, __ATOMIC_ACQUIRE)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Task that prints new records and sleeps while there are none.
+ */
+static void log_flush_task(unsigned long arg)
+{
+    (void)arg;
+    __atomic_store_n(&flush_task, current, __ATOMIC_RELEASE);
+
+    while (1) {
+        log_flush();
+
+        current->state = TASK_INTERRUPTIBLE;
+        __atomic_store_n(&flush_sleeping, 1, __ATOMIC_RELAXED);
+        /* pairs with the fence in log_wake_flush() */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (log_pending() || log_sync) {
+            __atomic_store_n(&flush_sleeping, 0, __ATOMIC_RELAXED);
+            current->state = TASK_RUNNING;
+            continue;
+        }
+        schedule();
+    }
+}
+
+/**
+ * @brief Starts the flush task, lines are printed asynchronously from now on.
+ *
+ * Must be called once the scheduler runs.
+ */
+void log_start_flush(void)
+{
+    if (copy_process((unsigned long)&log_flush_task, 0)) {
+        return;
+    }
+    log_sync = 0;
+}
+
+/**
+ * @brief Switches back to printing every line right away, for fatal errors.
+ *
+ * Prints what is still pending first. The console lock is not taken from
+ * now on, the core that held it may be the one that failed.
+ */
+void log_panic(void)
+{
+    log_sync = 1;
+    log_flush();
+}
+
+/**
+ * @brief Reports the logging counters of a core.
+ *
+ * @param cpu The core to report.
+ * @param stats Filled with the counters.
+ */
+void log_get_stats(unsigned int cpu, struct log_stats* stats)
+{
+    *stats = log_bufs[cpu].stats;
+}
@@ -0,0 +1,45 @@
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <stdint.h>
+
+/*
+ * Log levels, put in front of a printk format like KERN_ERR "message\n".
+ * Lines without a level are logged at LOGLEVEL_DEFAULT.
+ */
+#define KERN_SOH "\001"
+#define KERN_EMERG KERN_SOH "0"
+#define KERN_ALERT KERN_SOH "1"
+#define KERN_CRIT KERN_SOH "2"
+#define KERN_ERR KERN_SOH "3"
+#define KERN_WARNING KERN_SOH "4"
+#define KERN_NOTICE KERN_SOH "5"
+#define KERN_INFO KERN_SOH "6"
+#define KERN_DEBUG KERN_SOH "7"
+
+#define LOGLEVEL_DEFAULT 6
+/* lines at this level and above are only kept for log_dump() */
+#define LOGLEVEL_CONSOLE 7
+
+/* bytes of log kept per core, a power of two */
+#define LOG_BUF_SIZE 16384
+/* longest line, longer ones are split */
+#define LOG_LINE_MAX 256
+
+/**
+ * @brief Logging counters of a single core.
+ */
+struct log_stats {
+    unsigned long records; /* lines logged */
+    unsigned long overwritten; /* lines lost before they reached the console */
+};
+
+void log_set_console(void (*putc)(unsigned char c));
+void log_putc(unsigned char c);
+void log_start_flush(void);
+void log_flush(void);
+void log_dump(void);
+void log_panic(void);
+void log_get_stats(unsigned int cpu, struct log_stats* stats);
+
+#endif
@@ -0,0 +1,365 @@
+/**
+ * @file perf.c
+ * @brief Cycle and event counts of kernel code regions, PC sampling.
+ *
+ * A region is measured between perf_start() and perf_stop() with the PMU
+ * counters of the calling core. Every core adds its measurements to its own
+ * stats of the region, so markers never share cache lines between cores.
+ * Regions register themselves on their first measurement and perf_dump()
+ * prints the sum over all cores with a log2 histogram of the cycles.
+ *
+ * Sampling records the PC interrupted by the PMU overflow interrupt in a
+ * buffer of the core. perf_sample_dump() prints the PCs for
+ * scripts/perf_profile.py, which turns them into a flat profile.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "irq/irq.h"
+#include "perf/perf.h"
+#include "pmu/pmu.h"
+#include "smp/smp.h"
+
+struct perf_sample_buf {
+    unsigned long count; /* samples taken, only the first PERF_SAMPLES are kept */
+    uint64_t pcs[PERF_SAMPLES];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* regions measured so far, newest first */
+static struct perf_region* perf_regions;
+
+static struct perf_sample_buf perf_sample_bufs[NR_CPUS];
+
+#ifdef CONFIG_PERF
+/**
+ * @brief Adds a region to perf_regions the first time it is measured.
+ */
+static void perf_register(struct perf_region* region)
+{
+    if (__atomic_exchange_n(&region->registered, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    struct perf_region* head = __atomic_load_n(&perf_regions, __ATOMIC_RELAXED);
+    do {
+        region->next = head;
+    } while (!__atomic_compare_exchange_n(&perf_regions, &head, region, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static unsigned int perf_bucket(uint64_t cycles)
+{
+    unsigned int bucket = cycles ? 63 - __builtin_clzl(cycles) : 0;
+    return bucket < PERF_HIST_BUCKETS ? bucket : PERF_HIST_BUCKETS - 1;
+}
+
+/**
+ * @brief Adds a measurement to the stats of the calling core.
+ *
+ * Use perf_stop() or perf_account_cycles().
+ */
+void __perf_account(struct perf_region* region, const struct pmu_sample* delta)
+{
+    if (__builtin_expect(!region->registered, 0)) {
+        perf_register(region);
+    }
+
+    unsigned long flags = local_irq_save();
+    struct perf_stats* stats = &region->stats[smp_processor_id()];
+
+    if (!stats->count || delta->cycles < stats->min) {
+        stats->min = delta->cycles;
+    }
+    if (delta->cycles > stats->max) {
+        stats->max = delta->cycles;
+    }
+    stats->count++;
+    stats->cycles += delta->cycles;
+    for (unsigned int i = 0; i < PMU_COUNTERS; i++) {
+        stats->events[i] += delta->events[i];
+    }
+    stats->hist[perf_bucket(delta->cycles)]++;
+    local_irq_restore(flags);
+}
+
+/**
+ * @brief Ends a measurement started with perf_start(), use perf_stop().
+ */
+void __perf_stop(struct perf_region* region, const struct pmu_sample* start)
+{
+    struct pmu_sample delta;
+
+    pmu_read(&delta);
+    delta.cycles -= start->cycles;
+    for (unsigned int i = 0; i < PMU_COUNTERS; i++) {
+        delta.events[i] -= start->events[i];
+    }
+    __perf_account(region, &delta);
+}
+#endif
+
+/**
+ * @brief Looks up a measured region by name.
+ *
+ * @return The region, NULL if no region of that name was measured yet.
+ */
+struct perf_region* perf_find(const char* name)
+{
+    for (struct perf_region* r = __atomic_load_n(&perf_regions, __ATOMIC_ACQUIRE); r; r = r->next) {
+        const char *a = r->name, *b = name;
+        while (*a && *a == *b) {
+            a++;
+            b++;
+        }
+        if (*a == *b) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Sums up the stats of a region over all cores.
+ */
+void perf_read(struct perf_region* region, struct perf_stats* stats)
+{
+    *stats = (struct perf_stats) { 0 };
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        const struct perf_stats* s = &region->stats[cpu];
+
+        if (!s->count) {
+            continue;
+        }
+        if (!stats->count || s->min < stats->min) {
+            stats->min = s->min;
+        }
+        if (s->max > stats->max) {
+            stats->max = s->max;
+        }
+        stats->count += s->count;
+        stats->cycles += s->cycles;
+        for (unsigned int i = 0; i < PMU_COUNTERS; i++) {
+            stats->events[i] += s->events[i];
+        }
+        for (unsigned int i = 0; i < PERF_HIST_BUCKETS; i++) {
+            stats->hist[i] += s->hist[i];
+        }
+    }
+}
+
+/**
+ * @brief Clears the stats of all regions.
+ *
+ * Measurements that run at the same time may be lost or half cleared.
+ */
+void perf_reset(void)
+{
+    for (struct perf_region* r = __atomic_load_n(&perf_regions, __ATOMIC_ACQUIRE); r; r = r->next) {
+        for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+            unsigned long flags = local_irq_save();
+            r->stats[cpu] = (struct perf_stats) { 0 };
+            local_irq_restore(flags);
+        }
+    }
+}
+
+static void perf_put_string(void (*putc)(unsigned char c), const char* s)
+{
+    while (*s) {
+        putc(*s++);
+    }
+}
+
+static void perf_put_dec(void (*putc)(unsigned char c), uint64_t value)
+{
+    char buf[21];
+    int i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value && i > 0);
+    perf_put_string(putc, &buf[i]);
+}
+
+static void perf_put_hex(void (*putc)(unsigned char c), uint64_t value)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        putc(digits[(value >> shift) & 0xf]);
+    }
+}
+
+static void perf_put_event(void (*putc)(unsigned char c), unsigned int event)
+{
+    const char* name = pmu_event_name(event);
+
+    if (name) {
+        perf_put_string(putc, name);
+    } else {
+        perf_put_string(putc, "event_");
+        perf_put_dec(putc, event);
+    }
+}
+
+/**
+ * @brief Prints the stats of one region.
+ */
+static void perf_dump_region(void (*putc)(unsigned char c), struct perf_region* region)
+{
+    struct perf_stats stats;
+
+    perf_read(region, &stats);
+    if (!stats.count) {
+        return;
+    }
+
+    perf_put_string(putc, "PERF ");
+    perf_put_string(putc, region->name);
+    perf_put_string(putc, " count ");
+    perf_put_dec(putc, stats.count);
+    perf_put_string(putc, " cycles avg ");
+    perf_put_dec(putc, stats.cycles / stats.count);
+    perf_put_string(putc, " min ");
+    perf_put_dec(putc, stats.min);
+    perf_put_string(putc, " max ");
+    perf_put_dec(putc, stats.max);
+    putc('\n');
+
+    /* region markers that only know the cycles leave the events at 0 */
+    for (unsigned int i = 0; i < PMU_COUNTERS; i++) {
+        if (!stats.events[i]) {
+            continue;
+        }
+        perf_put_string(putc, "PERF ");
+        perf_put_string(putc, region->name);
+        putc(' ');
+        perf_put_event(putc, pmu_get_event(i));
+        perf_put_string(putc, " total ");
+        perf_put_dec(putc, stats.events[i]);
+        perf_put_string(putc, " per 1000 calls ");
+        perf_put_dec(putc, 1000 * stats.events[i] / stats.count);
+        putc('\n');
+    }
+
+    for (unsigned int i = 0; i < PERF_HIST_BUCKETS; i++) {
+        if (!stats.hist[i]) {
+            continue;
+        }
+        perf_put_string(putc, "PERF ");
+        perf_put_string(putc, region->name);
+        perf_put_string(putc, " hist ");
+        perf_put_dec(putc, i ? 1ul << i : 0);
+        putc('-');
+        if (i == PERF_HIST_BUCKETS - 1) {
+            putc('*');
+        } else {
+            perf_put_dec(putc, (1ul << (i + 1)) - 1);
+        }
+        putc(' ');
+        perf_put_dec(putc, stats.hist[i]);
+        putc(' ');
+        /* a bar of up to 40 characters, relative to all measurements */
+        for (unsigned long n = 40 * stats.hist[i] / stats.count; n; n--) {
+            putc('#');
+        }
+        putc('\n');
+    }
+}
+
+/**
+ * @brief Prints the stats of all measured regions.
+ *
+ * For every region a "PERF <region> count ..." summary line, a line per
+ * event counter and a line per non-empty histogram bucket.
+ *
+ * @param putc Where to print, usually uart_putc.
+ */
+void perf_dump(void (*putc)(unsigned char c))
+{
+    for (struct perf_region* r = __atomic_load_n(&perf_regions, __ATOMIC_ACQUIRE); r; r = r->next) {
+        perf_dump_region(putc, r);
+    }
+}
+
+/**
+ * @brief Clears the sample buffers and starts sampling on all cores.
+ *
+ * @param period Cycles between two samples.
+ * @return 0 on success, -1 if the PMU cannot sample.
+ */
+int perf_sample_start(uint32_t period)
+{
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        perf_sample_bufs[cpu].count = 0;
+    }
+    return pmu_start_sampling(period);
+}
+
+/**
+ * @brief Stops sampling, the buffers keep their contents.
+ */
+void perf_sample_stop(void)
+{
+    pmu_stop_sampling();
+}
+
+/**
+ * @brief Records a sample, called from the PMU overflow interrupt.
+ *
+ * @param pc The interrupted PC.
+ */
+void perf_sample(uint64_t pc)
+{
+    struct perf_sample_buf* buf = &perf_sample_bufs[smp_processor_id()];
+
+    if (buf->count < PERF_SAMPLES) {
+        buf->pcs[buf->count] = pc;
+    }
+    buf->count++;
+}
+
+/**
+ * @brief Returns the number of samples taken on all cores, kept or not.
+ */
+unsigned long perf_sample_count(void)
+{
+    unsigned long count = 0;
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        count += perf_sample_bufs[cpu].count;
+    }
+    return count;
+}
+
+/**
+ * @brief Prints the samples of all cores, sampling must be stopped.
+ *
+ * Prints a "PERF_SAMPLE <cpu> <hex pc>" line per kept sample and a
+ * "PERF_SAMPLE_LOST <cpu> <count>" line for cores whose buffer overflowed.
+ *
+ * @param putc Where to print, usually uart_putc.
+ */
+void perf_sample_dump(void (*putc)(unsigned char c))
+{
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct perf_sample_buf* buf = &perf_sample_bufs[cpu];
+        unsigned long kept = buf->count < PERF_SAMPLES ? buf->count : PERF_SAMPLES;
+
+        for (unsigned long i = 0; i < kept; i++) {
+            perf_put_string(putc, "PERF_SAMPLE ");
+            perf_put_dec(putc, cpu);
+            putc(' ');
+            perf_put_hex(putc, buf->pcs[i]);
+            putc('\n');
+        }
+        if (buf->count > kept) {
+            perf_put_string(putc, "PERF_SAMPLE_LOST ");
+            perf_put_dec(putc, cpu);
+            putc(' ');
+            perf_put_dec(putc, buf->count - kept);
+            putc('\n');
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef _PERF_H
+#define _PERF_H
+
+#include <stdint.h>
+
+#include "mem/cache.h"
+#include "pmu/pmu.h"
+#include "smp/smp.h"
+
+/* log2 buckets of the cycle histograms, the last one takes everything above */
+#define PERF_HIST_BUCKETS 32
+
+/* PCs kept per core while sampling */
+#define PERF_SAMPLES 4096
+
+/**
+ * @brief Measurements of a region, of one core or summed up.
+ */
+struct perf_stats {
+    unsigned long count;
+    uint64_t cycles; /* sum */
+    uint64_t min;
+    uint64_t max;
+    uint64_t events[PMU_COUNTERS]; /* sums */
+    unsigned long hist[PERF_HIST_BUCKETS]; /* bucket i counts cycles in [2^i, 2^(i+1)) */
+};
+
+/**
+ * @brief A measured piece of code, define with PERF_REGION().
+ */
+struct perf_region {
+    const char* name;
+    struct perf_region* next;
+    int registered;
+    struct perf_stats stats[NR_CPUS] __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+#define PERF_REGION(var, region_name) struct perf_region var __attribute__((unused)) = { .name = (region_name) }
+
+#ifdef CONFIG_PERF
+void __perf_stop(struct perf_region* region, const struct pmu_sample* start);
+void __perf_account(struct perf_region* region, const struct pmu_sample* delta);
+
+/*
+ * Markers around the measured code:
+ *   struct pmu_sample start;
+ *   perf_start(&start);
+ *   ...
+ *   perf_stop(&region, &start);
+ * Without CONFIG_PERF they compile to nothing.
+ */
+#define perf_start(start) pmu_read(start)
+#define perf_stop(region, start) __perf_stop((region), (start))
+
+/* adds a measurement of which only the cycles are known */
+#define perf_account_cycles(region, n)                              \
+    do {                                                            \
+        struct pmu_sample __delta = { .cycles = (n) };              \
+        __perf_account((region), &__delta);                         \
+    } while (0)
+#else
+#define perf_start(start) \
+    do {                  \
+        (void)(start);    \
+    } while (0)
+#define perf_stop(region, start) \
+    do {                         \
+        (void)(region);          \
+        (void)(start);           \
+    } while (0)
+#define perf_account_cycles(region, n) \
+    do {                               \
+        (void)(region);                \
+        (void)sizeof(n);               \
+    } while (0)
+#endif
+
+struct perf_region* perf_find(const char* name);
+void perf_read(struct perf_region* region, struct perf_stats* stats);
+void perf_reset(void);
+void perf_dump(void (*putc)(unsigned char c));
+
+int perf_sample_start(uint32_t period);
+void perf_sample_stop(void);
+void perf_sample(uint64_t pc);
+unsigned long perf_sample_count(void);
+void perf_sample_dump(void (*putc)(unsigned char c));
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * @file exit.c
+ * @brief Task exit and reaping.
+ *
+ * A task that exits becomes a zombie and schedules away. Its stack cannot be
+ * freed while it is still running on it, so the core that switched away from
+ * it reaps it right after cpu_switch_to() returned on the next task.
+ */
+#include "scheduler/fork.h"
+#include "scheduler/pid.h"
+#include "scheduler/scheduler.h"
+#include "trace/trace.h"
+
+/**
+ * @brief Terminates the current task.
+ *
+ * Also called when the function passed to copy_process() returns.
+ *
+ * @param code Exit code of the task.
+ */
+void do_exit(long code)
+{
+    preempt_disable();
+    trace_event(TRACE_TASK_EXIT, current->pid, code, 0);
+    current->exit_code = code;
+    current->state = TASK_ZOMBIE;
+    schedule();
+
+    /* a zombie is never picked again */
+    while (1) { }
+}
+
+/**
+ * @brief Reaps a zombie task.
+ *
+ * Releases its pid, stack page and task structure.
+ *
+ * @param p The zombie, its core must have switched away from it.
+ */
+void release_task(struct task_struct* p)
+{
+    free_pid(p->pid);
+    free_task(p);
+}
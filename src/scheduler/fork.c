@@ -1,24 +1,62 @@
 #include "scheduler/fork.h"
+#include "arm/sysregs.h"
 #include "entry.h"
+#include "lib/string.h"
 #include "mem/mem.h"
+#include "mem/mm.h"
+#include "mem/slab.h"
+#include "scheduler/pid.h"
 #include "scheduler/scheduler.h"
+#include "trace/trace.h"
+
+static struct kmem_cache* task_cache;
 
 /**
- * @brief Create a new process
+ * @brief Creates the object cache task structures are allocated from.
  *
- * @param fn Function to run
- * @param arg Argument to pass to the function
+ * Must be called after kmem_cache_init() and before the first copy_process().
+ */
+void fork_init(void)
+{
+    task_cache = kmem_cache_create("task_struct", sizeof(struct task_struct), SLAB_HWCACHE_ALIGN);
+}
+
+/**
+ * @brief Creates a task running fn(arg) in mm, or returning to EL0 with regs.
+ *
+ * @param mm Address space of the task, the caller's reference to it is
+ *           handed over to the task or dropped on failure.
+ * @param regs User registers of the task, NULL for a kernel thread.
  *
  * @return int 0 if successful, 1 if not
  */
-int copy_process(unsigned long fn, unsigned long arg)
+static int copy_task(unsigned long fn, unsigned long arg, struct mm_struct* mm, struct pt_regs* regs)
 {
     preempt_disable();
 
     struct task_struct* p;
 
-    p = (struct task_struct*)get_free_page();
+    p = kmem_cache_alloc(task_cache);
     if (!p) {
+        preempt_enable();
+        mm_put(mm);
+        return 1;
+    }
+    memset(p, 0, sizeof(*p));
+
+    p->stack = get_zeroed_page();
+    if (!p->stack) {
+        kmem_cache_free(task_cache, p);
+        preempt_enable();
+        mm_put(mm);
+        return 1;
+    }
+
+    if (alloc_pid(p) < 0) {
+        free_page(p->stack);
+        kmem_cache_free(task_cache, p);
+        preempt_enable();
+        mm_put(mm);
         return 1;
     }
 
@@ -26,14 +64,97 @@ int copy_process(unsigned long fn, unsigned long arg)
     p->state = TASK_RUNNING;
     p->counter = p->prio;
     p->preempt_count = 1;
+    p->fpsimd_cpu = -1;
+    p->mm = mm;
 
-    p->cpu_context.x19 = fn;
-    p->cpu_context.x20 = arg;
     p->cpu_context.pc = (unsigned long)ret_from_fork;
-    p->cpu_context.sp = (unsigned long)p + THREAD_SIZE;
+    if (regs) {
+        /* ret_from_fork leaves through the frame at the top of the stack */
+        *task_pt_regs(p) = *regs;
+        p->cpu_context.sp = (unsigned long)task_pt_regs(p);
+    } else {
+        p->cpu_context.x19 = fn;
+        p->cpu_context.x20 = arg;
+        p->cpu_context.sp = p->stack + THREAD_SIZE;
+    }
 
-    int pid = task_count++;
-    task[pid] = p;
+    trace_event(TRACE_TASK_NEW, p->pid, current->pid, 0);
+    wake_up_new_task(p);
     preempt_enable();
     return 0;
 }
+
+/**
+ * @brief Create a new process
+ *
+ * The task shares the address space of the caller.
+ *
+ * @param fn Function to run
+ * @param arg Argument to pass to the function
+ *
+ * @return int 0 if successful, 1 if not
+ */
+int copy_process(unsigned long fn, unsigned long arg)
+{
+    mm_get(current->mm);
+    return copy_task(fn, arg, current->mm, NULL);
+}
+
+/**
+ * @brief Create a new process with a copy of the caller's address space
+ *
+ * The pages are shared copy-on-write, see dup_mm(). Like copy_process()
+ * the child starts in fn(arg), in EL1.
+ *
+ * @param fn Function to run
+ * @param arg Argument to pass to the function
+ *
+ * @return int 0 if successful, 1 if not
+ */
+int fork_process(unsigned long fn, unsigned long arg)
+{
+    struct mm_struct* mm = dup_mm(current->mm);
+    if (!mm) {
+        return 1;
+    }
+    return copy_task(fn, arg, mm, NULL);
+}
+
+/**
+ * @brief Create a process running in EL0
+ *
+ * The task starts at pc with x0 = arg and SP_EL0 = sp, with every other
+ * register zeroed. It only leaves EL0 through exceptions and system calls.
+ *
+ * @param mm Address space of the task, with pc and the stack mapped in it.
+ *           The task takes its own reference.
+ * @param pc User address of the first instruction.
+ * @param sp User stack pointer, 16 byte aligned.
+ * @param arg Value of x0.
+ *
+ * @return int 0 if successful, 1 if not
+ */
+int copy_user_process(struct mm_struct* mm, unsigned long pc, unsigned long sp, unsigned long arg)
+{
+    struct pt_regs regs = { 0 };
+
+    regs.regs[0] = arg;
+    regs.sp = sp;
+    regs.pc = pc;
+    regs.pstate = SPSR_EL0t;
+
+    mm_get(mm);
+    return copy_task(0, 0, mm, &regs);
+}
+
+/**
+ * @brief Frees the stack and the task structure of a task and drops its address space.
+ *
+ * @param p The task, it must not be running or queued anywhere.
+ */
+void free_task(struct task_struct* p)
+{
+    mm_put(p->mm);
+    free_page(p->stack);
+    kmem_cache_free(task_cache, p);
+}
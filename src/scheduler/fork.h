@@ -1,6 +1,15 @@
 #ifndef _FORK_H
 #define _FORK_H
 
+void fork_init(void);
+struct mm_struct;
+struct task_struct;
+
 int copy_process(unsigned long fn, unsigned long arg);
+int fork_process(unsigned long fn, unsigned long arg);
+int copy_user_process(struct mm_struct* mm, unsigned long pc, unsigned long sp, unsigned long arg);
+void free_task(struct task_struct* p);
+void do_exit(long code);
+void release_task(struct task_struct* p);
 
 #endif
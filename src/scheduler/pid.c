@@ -0,0 +1,133 @@
+/**
+ * @file pid.c
+ * @brief Process id allocation and lookup.
+ *
+ * Free pids are tracked in a bitmap and handed out next-fit, so a pid is not
+ * reused right after its task exited. The pid to task mapping is a two level
+ * table whose second level pages are only allocated once a pid in their range
+ * is used, which keeps lookups O(1) without reserving memory for PID_MAX
+ * tasks up front.
+ */
+#include <stdint.h>
+
+#include "irq/irq.h"
+#include "mem/mem.h"
+#include "scheduler/pid.h"
+#include "scheduler/scheduler.h"
+#include "sync/spinlock.h"
+
+#define BITS_PER_WORD 64
+#define PIDMAP_WORDS (PID_MAX / BITS_PER_WORD)
+#define PIDS_PER_PAGE (PAGE_SIZE / sizeof(struct task_struct*))
+#define PID_TABLE_PAGES (PID_MAX / PIDS_PER_PAGE)
+
+/* bit n is set when pid n is in use, pid 0 is never handed out */
+static uint64_t pidmap[PIDMAP_WORDS] = { 1 };
+static struct task_struct** pid_table[PID_TABLE_PAGES];
+static long last_pid;
+static unsigned long nr_pids;
+static spinlock_t pid_lock = SPINLOCK_INIT;
+
+/**
+ * @brief Finds a clear bit in the pid bitmap, starting after last_pid.
+ *
+ * @return The pid, or -1 if all are in use.
+ */
+static long pidmap_find(void)
+{
+    unsigned long start = (last_pid + 1) % PID_MAX;
+    unsigned long word = start / BITS_PER_WORD;
+    /* ignore the bits below start in the first word */
+    uint64_t used = pidmap[word] | ((1ull << (start % BITS_PER_WORD)) - 1);
+
+    for (unsigned long i = 0; i <= PIDMAP_WORDS; i++) {
+        if (~used) {
+            return word * BITS_PER_WORD + __builtin_ctzll(~used);
+        }
+        word = (word + 1) % PIDMAP_WORDS;
+        used = pidmap[word];
+    }
+    return -1;
+}
+
+/**
+ * @brief Assigns a free pid to a task and registers it for lookup.
+ *
+ * @param p The new task.
+ * @return The pid, or -1 if no pid or no memory for the table is left.
+ */
+long alloc_pid(struct task_struct* p)
+{
+    unsigned long flags = spin_lock_irqsave(&pid_lock);
+    long pid = pidmap_find();
+    if (pid < 0) {
+        spin_unlock_irqrestore(&pid_lock, flags);
+        return -1;
+    }
+
+    struct task_struct*** slot = &pid_table[pid / PIDS_PER_PAGE];
+    if (!*slot) {
+        struct task_struct** page = (struct task_struct**)get_zeroed_page();
+        if (!page) {
+            spin_unlock_irqrestore(&pid_lock, flags);
+            return -1;
+        }
+        *slot = page;
+    }
+
+    pidmap[pid / BITS_PER_WORD] |= 1ull << (pid % BITS_PER_WORD);
+    (*slot)[pid % PIDS_PER_PAGE] = p;
+    last_pid = pid;
+    nr_pids++;
+    p->pid = pid;
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return pid;
+}
+
+/**
+ * @brief Releases a pid allocated with alloc_pid().
+ *
+ * @param pid The pid to release.
+ */
+void free_pid(long pid)
+{
+    if (pid <= 0 || pid >= PID_MAX) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&pid_lock);
+    pid_table[pid / PIDS_PER_PAGE][pid % PIDS_PER_PAGE] = 0;
+    pidmap[pid / BITS_PER_WORD] &= ~(1ull << (pid % BITS_PER_WORD));
+    nr_pids--;
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+/**
+ * @brief Looks up a live task by its pid.
+ *
+ * @param pid The pid to look up.
+ * @return The task, or NULL if no task has this pid.
+ */
+struct task_struct* find_task_by_pid(long pid)
+{
+    struct task_struct* p = 0;
+
+    if (pid <= 0 || pid >= PID_MAX) {
+        return 0;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&pid_lock);
+    if (pid_table[pid / PIDS_PER_PAGE]) {
+        p = pid_table[pid / PIDS_PER_PAGE][pid % PIDS_PER_PAGE];
+    }
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return p;
+}
+
+/**
+ * @brief Returns the number of tasks that hold a pid, without the idle tasks.
+ */
+unsigned long nr_tasks(void)
+{
+    return __atomic_load_n(&nr_pids, __ATOMIC_RELAXED);
+}
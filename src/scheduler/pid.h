@@ -0,0 +1,14 @@
+#ifndef _PID_H
+#define _PID_H
+
+/* highest pid + 1, pid 0 belongs to the idle tasks */
+#define PID_MAX 32768
+
+struct task_struct;
+
+long alloc_pid(struct task_struct* p);
+void free_pid(long pid);
+struct task_struct* find_task_by_pid(long pid);
+unsigned long nr_tasks(void);
+
+#endif
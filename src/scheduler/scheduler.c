@@ -4,22 +4,428 @@
  *
  * This file contains the implementation of the scheduler functions
  * which are responsible for managing task scheduling in the kernel.
+ *
+ * Every core has its own run queue with one list per priority level and a
+ * bitmap of the non-empty levels, so picking the next task is O(1) no matter
+ * how many tasks are runnable. A task is round-robined within its level and
+ * refills its time slice from prio when it is put back. Cores only take the
+ * lock of their own queue, except when they run dry and steal a task from the
+ * busiest other core.
  */
-#include "scheduler/scheduler.h"
+#include <stdint.h>
+
+#include "arm/counter.h"
 #include "irq/irq.h"
+#include "mem/cache.h"
+#include "mem/mem.h"
+#include "mem/mm.h"
+#include "perf/perf.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "sync/spinlock.h"
+#include "time/hrtimer.h"
+#include "trace/trace.h"
 
-static struct task_struct init_task = {
-    .cpu_context = { 0 },
-    .state = TASK_RUNNING,
-    .counter = 0,
-    .prio = 1,
-    .preempt_count = 1,
-};
-struct task_struct* current = &init_task;
-struct task_struct* task[TASK_COUNT] = {
-    &init_task,
+/**
+ * @brief Run queue of a single core.
+ *
+ * The task running on the core is not on its queue.
+ */
+struct rq {
+    spinlock_t lock;
+    unsigned long nr_running;
+    uint64_t bitmap; /* bit n is set when queue[n] is not empty */
+    struct list_head queue[SCHED_NR_PRIO];
+    struct task_struct* idle;
+    struct task_struct* curr; /* task running on the core */
+    struct hrtimer tick; /* only queued while the core is busy */
+    int tick_running;
+    int need_resched; /* set by the tick, acted on when the interrupt returns */
+    struct pmu_sample switch_start; /* counters before cpu_switch_to() */
+    struct sched_stats stats;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* The task that booted each core. It runs whenever there is nothing else to
+ * run on its core and is never picked by another core. */
+static struct task_struct idle_task[NR_CPUS] = {
+    [0 ... NR_CPUS - 1] = {
+        .cpu_context = { 0 },
+        .state = TASK_RUNNING,
+        .counter = 0,
+        .prio = 1,
+        .preempt_count = 1,
+        .on_cpu = 1,
+        .mm = &init_mm,
+    },
 };
-int task_count = 1;
+
+static struct rq runqueues[NR_CPUS];
+
+static PERF_REGION(perf_switch, "cpu_switch_to");
+
+/* cores allowed to run tasks other than their idle task */
+static volatile unsigned long sched_cpu_mask = ~0ul;
+
+static unsigned int task_level(struct task_struct* p)
+{
+    if (p->prio < 0) {
+        return 0;
+    }
+    if (p->prio >= SCHED_NR_PRIO) {
+        return SCHED_NR_PRIO - 1;
+    }
+    return p->prio;
+}
+
+/**
+ * @brief Appends a task to a run queue, rq->lock must be held.
+ */
+static void enqueue_task(struct rq* rq, struct task_struct* p)
+{
+    unsigned int level = task_level(p);
+
+    list_add_tail(&p->run_list, &rq->queue[level]);
+    p->on_rq = 1;
+    rq->bitmap |= 1ull << level;
+    rq->nr_running++;
+}
+
+/**
+ * @brief Removes a task from a run queue, rq->lock must be held.
+ */
+static void dequeue_task(struct rq* rq, struct task_struct* p)
+{
+    unsigned int level = task_level(p);
+
+    list_del(&p->run_list);
+    if (list_empty(&rq->queue[level])) {
+        rq->bitmap &= ~(1ull << level);
+    }
+    rq->nr_running--;
+}
+
+/**
+ * @brief Takes the first task of the highest non-empty level, rq->lock must be held.
+ *
+ * @return The task, or NULL if the queue is empty.
+ */
+static struct task_struct* pick_next_task(struct rq* rq)
+{
+    if (!rq->bitmap) {
+        return NULL;
+    }
+
+    unsigned int level = 63 - __builtin_clzll(rq->bitmap);
+    struct task_struct* p = list_first_entry(&rq->queue[level], struct task_struct, run_list);
+    dequeue_task(rq, p);
+    return p;
+}
+
+/**
+ * @brief Takes a waiting task from the busiest other core.
+ *
+ * Tasks whose registers are still being saved by their old core are skipped.
+ * Only the lock of the victim is taken, so no lock ordering is needed.
+ *
+ * @param this_rq Run queue of the calling core, which has to be empty.
+ * @return The task, or NULL if no other core has work to give away.
+ */
+static struct task_struct* steal_task(struct rq* this_rq)
+{
+    struct rq* busiest = NULL;
+    unsigned long max = 0;
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        unsigned long nr = __atomic_load_n(&runqueues[cpu].nr_running, __ATOMIC_RELAXED);
+        if (&runqueues[cpu] != this_rq && nr > max) {
+            max = nr;
+            busiest = &runqueues[cpu];
+        }
+    }
+    if (!busiest) {
+        return NULL;
+    }
+
+    this_rq->stats.steal_attempts++;
+
+    struct task_struct* p = NULL;
+    struct list_head* pos;
+    spin_lock(&busiest->lock);
+    for (int level = SCHED_NR_PRIO - 1; level >= 0 && !p; level--) {
+        if (!(busiest->bitmap & (1ull << level))) {
+            continue;
+        }
+        list_for_each(pos, &busiest->queue[level])
+        {
+            struct task_struct* t = list_entry(pos, struct task_struct, run_list);
+            if (!__atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE)) {
+                p = t;
+                break;
+            }
+        }
+    }
+    if (p) {
+        dequeue_task(busiest, p);
+    }
+    spin_unlock(&busiest->lock);
+
+    if (p) {
+        this_rq->stats.migrations++;
+    } else {
+        this_rq->stats.steal_failures++;
+    }
+    return p;
+}
+
+/**
+ * @brief Scheduler tick of a busy core.
+ *
+ * Stops itself once the core has nothing left to run, _schedule() starts it
+ * again when the core picks a task.
+ */
+static enum hrtimer_restart sched_tick(struct hrtimer* timer)
+{
+    struct rq* rq = timer->data;
+
+    if (rq->curr == rq->idle && !rq->nr_running) {
+        rq->tick_running = 0;
+        return HRTIMER_NORESTART;
+    }
+
+    timer_tick();
+
+    /* idle cores that could take over waiting tasks */
+    if (rq->nr_running) {
+        unsigned long idle = smp_online_mask() & sched_cpu_mask & ~sched_busy_mask();
+        if (idle) {
+            smp_send_ipi(idle, IPI_RESCHEDULE);
+        }
+    }
+
+    hrtimer_forward(timer, SCHED_TICK_NS);
+    return HRTIMER_RESTART;
+}
+
+/**
+ * @brief Makes the boot code of the primary core its idle task.
+ *
+ * Sets up the run queues of all cores. Must be called before anything uses
+ * current.
+ */
+void sched_init(void)
+{
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct rq* rq = &runqueues[cpu];
+
+        rq->nr_running = 0;
+        rq->bitmap = 0;
+        for (int level = 0; level < SCHED_NR_PRIO; level++) {
+            list_init(&rq->queue[level]);
+        }
+        rq->idle = &idle_task[cpu];
+        rq->curr = &idle_task[cpu];
+        hrtimer_setup(&rq->tick, sched_tick, rq);
+    }
+
+    idle_task[0].cpu = 0;
+    set_current(&idle_task[0]);
+}
+
+/**
+ * @brief Makes the boot code of a secondary core its idle task.
+ *
+ * @param cpu Number of the calling core.
+ */
+void sched_init_secondary(unsigned long cpu)
+{
+    idle_task[cpu].cpu = cpu;
+    set_current(&idle_task[cpu]);
+}
+
+/**
+ * @brief Restricts which cores run tasks.
+ *
+ * Cores outside of the mask only run their idle task and leave their queued
+ * tasks to be stolen. Used to measure how throughput scales with the number
+ * of cores.
+ *
+ * @param mask Bitmask of cores allowed to run tasks.
+ */
+void sched_set_cpu_mask(unsigned long mask)
+{
+    sched_cpu_mask = mask | 1;
+}
+
+/**
+ * @brief Reports the scheduler counters of a core.
+ *
+ * @param cpu The core to report.
+ * @param stats Filled with the counters.
+ */
+void sched_get_stats(unsigned int cpu, struct sched_stats* stats)
+{
+    *stats = runqueues[cpu].stats;
+    stats->nr_running = __atomic_load_n(&runqueues[cpu].nr_running, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Makes a newly created task visible to the scheduler.
+ *
+ * The task is queued on the least loaded core that may run tasks.
+ *
+ * @param p The new task.
+ */
+void wake_up_new_task(struct task_struct* p)
+{
+    unsigned long allowed = sched_cpu_mask & smp_online_mask();
+    unsigned int target = 0;
+    unsigned long min = ~0ul;
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        unsigned long nr = __atomic_load_n(&runqueues[cpu].nr_running, __ATOMIC_RELAXED);
+        if ((allowed & (1ul << cpu)) && nr < min) {
+            min = nr;
+            target = cpu;
+        }
+    }
+
+    struct rq* rq = &runqueues[target];
+    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    p->cpu = target;
+    enqueue_task(rq, p);
+    trace_event(TRACE_SCHED_WAKEUP, p->pid, target, 0);
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    /* wake the target if it sleeps in cpu_idle() */
+    if (target != smp_processor_id() && rq->curr == rq->idle) {
+        smp_send_ipi(1ul << target, IPI_RESCHEDULE);
+    }
+}
+
+/**
+ * @brief Makes a blocked task runnable again.
+ *
+ * Safe to call from interrupt context and before the task has finished
+ * blocking: on_rq stays set while the task runs, so a task that is still on
+ * its core is put back by _schedule() instead of being queued twice. Only
+ * sleeping tasks are woken, a late wakeup leaves zombies and stopped tasks
+ * alone.
+ *
+ * @param p The task to wake.
+ */
+void wake_up_process(struct task_struct* p)
+{
+    struct rq* rq;
+    unsigned long flags = local_irq_save();
+
+    /* p->cpu only changes while p is queued, which it is not while blocked */
+    while (1) {
+        rq = &runqueues[__atomic_load_n(&p->cpu, __ATOMIC_RELAXED)];
+        spin_lock(&rq->lock);
+        if (rq == &runqueues[p->cpu]) {
+            break;
+        }
+        spin_unlock(&rq->lock);
+    }
+
+    int kick = 0;
+    if (p->state == TASK_INTERRUPTIBLE || p->state == TASK_UNINTERRUPTIBLE) {
+        p->state = TASK_RUNNING;
+        /* a task that is still on its core gets put back by _schedule() */
+        if (!p->on_rq) {
+            enqueue_task(rq, p);
+            kick = rq->curr == rq->idle;
+        }
+        trace_event(TRACE_SCHED_WAKEUP, p->pid, rq - runqueues, 0);
+    }
+    spin_unlock(&rq->lock);
+
+    if (kick && rq != &runqueues[smp_processor_id()]) {
+        smp_send_ipi(1ul << (rq - runqueues), IPI_RESCHEDULE);
+    }
+    local_irq_restore(flags);
+}
+
+/**
+ * @brief Returns non-zero if p is the idle task of a core.
+ */
+int is_idle_task(struct task_struct* p)
+{
+    return p >= idle_task && p < idle_task + NR_CPUS;
+}
+
+/**
+ * @brief Returns a bitmask of the cores that run a task or have tasks waiting.
+ *
+ * Only these cores need the scheduler tick.
+ */
+unsigned long sched_busy_mask(void)
+{
+    unsigned long mask = 0;
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct rq* rq = &runqueues[cpu];
+        if (rq->curr != rq->idle || __atomic_load_n(&rq->nr_running, __ATOMIC_RELAXED)) {
+            mask |= 1ul << cpu;
+        }
+    }
+    return mask;
+}
+
+/**
+ * @brief Returns non-zero if any run queue has a task waiting.
+ */
+int sched_has_waiting(void)
+{
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (__atomic_load_n(&runqueues[cpu].nr_running, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs ready tasks, then sleeps in WFI until the next interrupt.
+ *
+ * While the zeroed page pool of the core is not full a page is zeroed
+ * instead of sleeping. The check for work and WFI happen with interrupts
+ * masked, a wakeup that arrives in between keeps WFI from sleeping. Time
+ * spent in WFI is counted as idle residency.
+ */
+void cpu_idle_enter(void)
+{
+    struct rq* rq = &runqueues[smp_processor_id()];
+
+    schedule();
+
+    if (mem_refill_zeroed()) {
+        return;
+    }
+
+    unsigned long flags = local_irq_save();
+    /* cores outside of sched_cpu_mask cannot take the waiting tasks */
+    if (!(sched_cpu_mask & (1ul << smp_processor_id())) || !sched_has_waiting()) {
+        uint64_t start = read_cntvct();
+        cpu_wfi();
+        rq->stats.idle_ticks += read_cntvct() - start;
+        rq->stats.wakeups++;
+    }
+    local_irq_restore(flags);
+}
+
+/**
+ * @brief Idle loop of a core.
+ *
+ * Runs any task that is ready and otherwise sleeps until an interrupt.
+ */
+void cpu_idle(void)
+{
+    while (1) {
+        cpu_idle_enter();
+    }
+}
 
 /**
  * @brief Disables preemption.
@@ -50,37 +456,64 @@ void preempt_enable()
  * It is called internally by the scheduler to determine which task should be executed next.
  *
  * @note This function should not be called directly. It is intended for internal use by the scheduler.
+ *
+ * @param preempt Non-zero if current is preempted, it then stays runnable
+ *                even if it was about to block.
  */
-void _schedule()
+void _schedule(int preempt)
 {
     preempt_disable();
-    int next, c;
-    struct task_struct* p;
+    unsigned int cpu = smp_processor_id();
+    struct rq* rq = &runqueues[cpu];
+    struct task_struct* prev = current;
+    struct task_struct* next = NULL;
 
-    while (1) {
-        c = -1;
-        next = 0;
-
-        /* find the task with the highest priority */
-        for (int i = 0; i < TASK_COUNT; i++) {
-            p = task[i];
-            if (p && p->state == TASK_RUNNING && p->counter > c) {
-                c = p->counter;
-                next = i;
-            }
-        }
-        if (c) {
-            break;
-        }
-        /* increment task counters, can never be larger than 2 * prio */
-        for (int i = 0; i < TASK_COUNT; i++) {
-            p = task[i];
-            if (p) {
-                p->counter = (p->counter >> 1) + p->prio;
-            }
+    unsigned long flags = local_irq_save();
+#ifdef CONFIG_BENCH
+    uint64_t start = read_cntvct();
+#endif
+    spin_lock(&rq->lock);
+    /* put prev back at the end of its level with a fresh time slice */
+    if (prev != rq->idle && (prev->state == TASK_RUNNING || preempt)) {
+        if (prev->counter <= 0) {
+            prev->counter = prev->prio;
         }
+        enqueue_task(rq, prev);
+    } else if (prev != rq->idle) {
+        /* blocked or exited, wake_up_process() has to queue it again */
+        prev->on_rq = 0;
+    }
+    if (sched_cpu_mask & (1ul << cpu)) {
+        next = pick_next_task(rq);
     }
-    switch_to(task[next]);
+    spin_unlock(&rq->lock);
+
+    if (!next && (sched_cpu_mask & (1ul << cpu))) {
+        next = steal_task(rq);
+    }
+    if (!next) {
+        next = rq->idle;
+    }
+    next->on_cpu = 1;
+    next->cpu = cpu;
+
+    rq->stats.picks++;
+#ifdef CONFIG_BENCH
+    rq->stats.pick_ticks += read_cntvct() - start;
+#endif
+    if (next != prev) {
+        rq->stats.switches++;
+        trace_event(TRACE_SCHED_SWITCH, prev->pid, next->pid, prev->state);
+    }
+    rq->curr = next;
+    rq->need_resched = 0;
+    if (next != rq->idle && !rq->tick_running) {
+        rq->tick_running = 1;
+        hrtimer_start(&rq->tick, read_cntvct() + ns_to_ticks(SCHED_TICK_NS));
+    }
+    local_irq_restore(flags);
+
+    switch_to(next);
     preempt_enable();
 }
 
@@ -94,7 +527,27 @@ void _schedule()
 void schedule()
 {
     current->counter = 0;
-    _schedule();
+    _schedule(0);
+}
+
+/**
+ * @brief Releases the task a core just switched away from.
+ *
+ * Runs on the stack of the new task, after cpu_switch_to() has saved the
+ * registers of prev, so other cores may pick prev from now on. A prev that
+ * exited is reaped here since nothing runs on its stack anymore.
+ *
+ * @param prev The task that was switched away from.
+ */
+static void finish_task_switch(struct task_struct* prev)
+{
+    perf_stop(&perf_switch, &runqueues[smp_processor_id()].switch_start);
+
+    if (prev->state == TASK_ZOMBIE) {
+        release_task(prev);
+        return;
+    }
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
 }
 
 /**
@@ -103,9 +556,12 @@ void schedule()
  * This function is called at the end of the scheduling process to perform any
  * necessary cleanup or finalization steps for the current task. It ensures
  * that the task is properly set up to continue execution.
+ *
+ * @param prev The task that was switched away from.
  */
-void schedule_tail()
+void schedule_tail(struct task_struct* prev)
 {
+    finish_task_switch(prev);
     preempt_enable();
 }
 
@@ -127,16 +583,26 @@ void switch_to(struct task_struct* next)
     }
 
     struct task_struct* prev = current;
-    current = next;
-    cpu_switch_to(prev, next);
+    /* no FP/SIMD trap may load the registers of prev after they were saved */
+    unsigned long flags = local_irq_save();
+    fpsimd_thread_switch(prev);
+    set_current(next);
+    local_irq_restore(flags);
+    perf_start(&runqueues[smp_processor_id()].switch_start);
+    /* TTBR0 carries the ASID, the TLB entries of prev stay valid */
+    if (prev->mm != next->mm) {
+        switch_mm(next->mm);
+    }
+    prev = cpu_switch_to(prev, next);
+    finish_task_switch(prev);
 }
 
 /**
  * @brief Handles the timer tick event.
  *
  * This function is called on each timer tick to perform necessary
- * scheduling operations. It is responsible for updating the system
- * timer and managing task scheduling.
+ * scheduling operations. Runs in interrupt context, so it only marks the
+ * core for rescheduling once the time slice is used up.
  */
 void timer_tick(void)
 {
@@ -146,8 +612,49 @@ void timer_tick(void)
     }
 
     current->counter = 0;
+    runqueues[smp_processor_id()].need_resched = 1;
+}
+
+/**
+ * @brief Preempts the current task on the way out of an interrupt.
+ *
+ * Called with interrupts disabled after the interrupt has been completed at
+ * the GIC, so other interrupts can be taken by the next task.
+ */
+void preempt_schedule_irq(void)
+{
+    struct rq* rq = &runqueues[smp_processor_id()];
+
+    if (!rq->need_resched || current->preempt_count > 0) {
+        return;
+    }
+    rq->need_resched = 0;
 
     enable_irqs();
-    _schedule();
+    _schedule(1);
     disable_irqs();
 }
+
+/**
+ * @brief Returns non-zero if the current task is to be preempted.
+ *
+ * Checked with interrupts disabled before returning from a system call, a
+ * zero lets it take the short way back to EL0.
+ */
+int sched_need_resched(void)
+{
+    return runqueues[smp_processor_id()].need_resched && !current->preempt_count;
+}
+
+/**
+ * @brief Reschedules until the current task may return to EL0.
+ *
+ * Called with interrupts disabled, the tick may end the time slice again
+ * while other tasks ran.
+ */
+void exit_to_user_mode(void)
+{
+    while (sched_need_resched()) {
+        preempt_schedule_irq();
+    }
+}
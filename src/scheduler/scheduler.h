@@ -5,6 +5,13 @@
 
 #ifndef __ASSEMBLER__
 
+#include "lib/list.h"
+#ifdef __aarch64__
+#include "fpsimd/fpsimd.h"
+#endif
+
+struct mm_struct;
+
 /* thread */
 #define THREAD_SIZE 4096
 
@@ -15,11 +22,11 @@
 #define TASK_INTERRUPTIBLE 3
 #define TASK_UNINTERRUPTIBLE 4
 
-/* max task count */
-#define TASK_COUNT 128
+/* number of priority levels of a run queue, higher levels run first */
+#define SCHED_NR_PRIO 64
 
-#define FIRST_TASK task[0]
-#define LAST_TASK task[TASK_COUNT - 1]
+/* period of the scheduler tick of a busy core, a time slice is prio ticks */
+#define SCHED_TICK_NS 200000000ull
 
 /**
  * @brief cpu context structure
@@ -51,23 +58,82 @@ struct task_struct {
     long counter; /* how long the task has been running -1 per tick */
     long prio; /* task priority copied over to counter. regulate cpu time */
     long preempt_count; /* 0 = preemptable, <0 = not preemptable */
+    unsigned long stack; /* base of the THREAD_SIZE kernel stack */
+    long on_cpu; /* 1 while a core is running the task or switching away from it */
+    long on_rq; /* 1 while the task is runnable, queued or running */
+    long cpu; /* core the task last ran on */
+    struct list_head run_list; /* node in the run queue while waiting to run */
+    long pid; /* 0 for the idle tasks */
+    long exit_code; /* set by do_exit() */
+    struct mm_struct* mm; /* address space, init_mm for kernel threads */
+#ifdef __aarch64__
+    long fpsimd_used; /* the task has executed FP/SIMD instructions */
+    long fpsimd_cpu; /* core that last loaded fpsimd, -1 if none */
+    struct fpsimd_state fpsimd; /* FP/SIMD registers while not live in a core */
+#endif
+};
+
+/**
+ * @brief Scheduler counters of a single core.
+ */
+struct sched_stats {
+    unsigned long nr_running; /* tasks waiting in the run queue */
+    unsigned long switches; /* context switches */
+    unsigned long picks; /* scheduling decisions */
+    unsigned long pick_ticks; /* CNTVCT ticks spent deciding, CONFIG_BENCH only */
+    unsigned long steal_attempts; /* times the core ran dry and looked for work */
+    unsigned long steal_failures; /* attempts that found nothing to take */
+    unsigned long migrations; /* tasks taken from other cores */
+    unsigned long idle_ticks; /* CNTVCT ticks spent in WFI */
+    unsigned long wakeups; /* times the core left WFI */
 };
 
+#ifdef __aarch64__
+/* every core keeps its current task in TPIDR_EL1 */
+static inline struct task_struct* get_current(void)
+{
+    struct task_struct* task;
+    asm volatile("mrs %[task], tpidr_el1"
+        : [task] "=r"(task));
+    return task;
+}
+
+static inline void set_current(struct task_struct* task)
+{
+    asm volatile("msr tpidr_el1, %[task]"
+        :
+        : [task] "r"(task)
+        : "memory");
+}
+
+#define current get_current()
+#endif
+
+void sched_init(void);
+void sched_init_secondary(unsigned long cpu);
+void sched_set_cpu_mask(unsigned long mask);
+void sched_get_stats(unsigned int cpu, struct sched_stats* stats);
+void wake_up_new_task(struct task_struct* p);
+void wake_up_process(struct task_struct* p);
+int is_idle_task(struct task_struct* p);
+void preempt_schedule_irq(void);
+int sched_need_resched(void);
+void exit_to_user_mode(void);
+unsigned long sched_busy_mask(void);
+int sched_has_waiting(void);
+void cpu_idle_enter(void);
+void cpu_idle(void);
 void preempt_disable();
 void preempt_enable();
 void schedule();
 void timer_tick();
 void switch_to(struct task_struct* next);
 #ifndef __ASSEMBLER__
-void schedule_tail();
+void schedule_tail(struct task_struct* prev);
 #endif
 
-extern struct task_struct* current;
-extern struct task_struct* task[TASK_COUNT];
-extern int task_count;
-
-/* asm */
-extern void cpu_switch_to(struct task_struct* prev, struct task_struct* next);
+/* asm, when prev is resumed it returns the task the core switched away from */
+extern struct task_struct* cpu_switch_to(struct task_struct* prev, struct task_struct* next);
 
 #endif
 #endif
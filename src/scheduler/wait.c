@@ -0,0 +1,85 @@
+/**
+ * @file wait.c
+ * @brief Wait queues.
+ *
+ * A task that has to wait for an event queues itself, sets its state and
+ * checks the condition before it calls schedule():
+ *
+ *     init_wait_entry(&wait);
+ *     while (1) {
+ *         prepare_to_wait(&wq, &wait, TASK_INTERRUPTIBLE);
+ *         if (condition)
+ *             break;
+ *         schedule();
+ *     }
+ *     finish_wait(&wq, &wait);
+ *
+ * The side that makes the condition true calls wake_up() afterwards. A
+ * wakeup between the check and schedule() sets the task running again, so
+ * schedule() returns right away and the event is not lost.
+ */
+#include "scheduler/scheduler.h"
+#include "scheduler/wait.h"
+
+void init_waitqueue_head(struct wait_queue_head* wq)
+{
+    wq->lock = (spinlock_t)SPINLOCK_INIT;
+    list_init(&wq->head);
+}
+
+/**
+ * @brief Prepares an entry of the current task, once before the wait loop.
+ */
+void init_wait_entry(struct wait_queue_entry* entry)
+{
+    entry->task = current;
+    list_init(&entry->list);
+}
+
+/**
+ * @brief Queues the current task on wq if it is not yet and sets its state.
+ *
+ * @param wq The wait queue.
+ * @param entry Entry of the current task.
+ * @param state TASK_INTERRUPTIBLE or TASK_UNINTERRUPTIBLE.
+ */
+void prepare_to_wait(struct wait_queue_head* wq, struct wait_queue_entry* entry, long state)
+{
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    if (list_empty(&entry->list)) {
+        list_add_tail(&entry->list, &wq->head);
+    }
+    current->state = state;
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/**
+ * @brief Sets the current task running again and takes it off wq.
+ */
+void finish_wait(struct wait_queue_head* wq, struct wait_queue_entry* entry)
+{
+    current->state = TASK_RUNNING;
+
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    if (!list_empty(&entry->list)) {
+        list_del(&entry->list);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/**
+ * @brief Wakes every task waiting on wq, may be called from interrupts.
+ *
+ * The tasks stay queued until they call finish_wait().
+ */
+void wake_up(struct wait_queue_head* wq)
+{
+    struct list_head* pos;
+
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    list_for_each(pos, &wq->head)
+    {
+        wake_up_process(list_entry(pos, struct wait_queue_entry, list)->task);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
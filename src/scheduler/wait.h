@@ -0,0 +1,33 @@
+#ifndef _WAIT_H
+#define _WAIT_H
+
+#include "lib/list.h"
+#include "sync/spinlock.h"
+
+struct task_struct;
+
+/**
+ * @brief A task waiting on a wait queue, usually on the stack of that task.
+ */
+struct wait_queue_entry {
+    struct task_struct* task;
+    struct list_head list;
+};
+
+/**
+ * @brief Tasks waiting for the same event.
+ */
+struct wait_queue_head {
+    spinlock_t lock;
+    struct list_head head;
+};
+
+#define WAIT_QUEUE_HEAD_INIT(name) { SPINLOCK_INIT, LIST_HEAD_INIT((name).head) }
+
+void init_waitqueue_head(struct wait_queue_head* wq);
+void init_wait_entry(struct wait_queue_entry* entry);
+void prepare_to_wait(struct wait_queue_head* wq, struct wait_queue_entry* entry, long state);
+void finish_wait(struct wait_queue_head* wq, struct wait_queue_entry* entry);
+void wake_up(struct wait_queue_head* wq);
+
+#endif
@@ -0,0 +1,125 @@
+/**
+ * @file syscall.c
+ * @brief System calls of tasks running in EL0.
+ *
+ * el0_svc in entry.S indexes sys_call_table with the number in x8 and
+ * calls the handler with the registers of the task as arguments, with
+ * interrupts enabled. User pointers are checked against the areas of the
+ * address space with access_ok() and then used directly, the task's tables
+ * are still live, so pages that are not backed yet fault in as usual.
+ */
+#include <stdint.h>
+
+#include "lib/string.h"
+#include "mem/mm.h"
+#include "printk.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "syscall/syscall.h"
+#include "time/hrtimer.h"
+
+/* bytes of a write passed to printk() at once */
+#define SYS_WRITE_CHUNK 128
+
+#define STDOUT_FILENO 1
+#define STDERR_FILENO 2
+
+/* the arguments are passed in registers, handlers ignore the ones they do not take */
+#define __SYSCALL(nr, fn) [nr] = (syscall_fn_t)(void (*)(void))(fn)
+
+const syscall_fn_t sys_call_table[NR_SYSCALLS] = {
+    __SYSCALL(SYS_WRITE, sys_write),
+    __SYSCALL(SYS_EXIT, sys_exit),
+    __SYSCALL(SYS_YIELD, sys_yield),
+    __SYSCALL(SYS_SLEEP, sys_sleep),
+    __SYSCALL(SYS_MMAP, sys_mmap),
+    __SYSCALL(SYS_GETPID, sys_getpid),
+};
+
+/**
+ * @brief Writes len bytes from buf to the console.
+ *
+ * There are no files, stdout and stderr both go to the kernel log.
+ *
+ * @return The number of bytes written, SYSCALL_ERROR for another fd or a
+ *         buffer the task may not read.
+ */
+long sys_write(unsigned long fd, unsigned long buf, unsigned long len)
+{
+    char chunk[SYS_WRITE_CHUNK + 1];
+
+    if ((fd != STDOUT_FILENO && fd != STDERR_FILENO) || !access_ok(current->mm, buf, len, VM_READ)) {
+        return SYSCALL_ERROR;
+    }
+
+    for (unsigned long done = 0; done < len;) {
+        unsigned long n = len - done < SYS_WRITE_CHUNK ? len - done : SYS_WRITE_CHUNK;
+
+        memcpy(chunk, (const void*)(buf + done), n);
+        chunk[n] = '\0';
+        printk("%s", chunk);
+        done += n;
+    }
+    return len;
+}
+
+/**
+ * @brief Ends the calling task, does not return.
+ */
+long sys_exit(long code)
+{
+    do_exit(code);
+    return 0;
+}
+
+/**
+ * @brief Gives up the rest of the time slice.
+ */
+long sys_yield(void)
+{
+    schedule();
+    return 0;
+}
+
+/**
+ * @brief Blocks the calling task for at least ns nanoseconds.
+ */
+long sys_sleep(unsigned long ns)
+{
+    sleep_ns(ns);
+    return 0;
+}
+
+/**
+ * @brief Reserves len bytes of zeroed memory, see do_mmap().
+ *
+ * @param addr Page aligned address, or 0 to let the kernel choose one.
+ * @param prot PROT_READ and PROT_WRITE.
+ *
+ * @return The address of the range, SYSCALL_ERROR if it cannot be reserved.
+ */
+long sys_mmap(unsigned long addr, unsigned long len, unsigned long prot)
+{
+    unsigned long flags = 0;
+
+    if (prot & ~(unsigned long)(PROT_READ | PROT_WRITE)) {
+        return SYSCALL_ERROR;
+    }
+    if (prot & PROT_READ) {
+        flags |= VM_READ;
+    }
+    if (prot & PROT_WRITE) {
+        flags |= VM_WRITE;
+    }
+
+    addr = do_mmap(current->mm, addr, len, flags);
+    return addr ? (long)addr : SYSCALL_ERROR;
+}
+
+/**
+ * @brief Returns the pid of the calling task.
+ */
+long sys_getpid(void)
+{
+    return current->pid;
+}
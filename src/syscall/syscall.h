@@ -0,0 +1,37 @@
+#ifndef _SYSCALL_H
+#define _SYSCALL_H
+
+/*
+ * System call numbers, passed in x8 to svc #0. The arguments go in x0-x5
+ * and the result comes back in x0, x1-x18 are not preserved.
+ */
+#define SYS_WRITE 0
+#define SYS_EXIT 1
+#define SYS_YIELD 2
+#define SYS_SLEEP 3
+#define SYS_MMAP 4
+#define SYS_GETPID 5
+#define NR_SYSCALLS 6
+
+/* returned for unknown numbers and invalid arguments */
+#define SYSCALL_ERROR -1
+
+/* prot of SYS_MMAP */
+#define PROT_READ (1 << 0)
+#define PROT_WRITE (1 << 1)
+
+#ifndef __ASSEMBLER__
+
+typedef long (*syscall_fn_t)(unsigned long, unsigned long, unsigned long, unsigned long, unsigned long, unsigned long);
+
+extern const syscall_fn_t sys_call_table[NR_SYSCALLS];
+
+long sys_write(unsigned long fd, unsigned long buf, unsigned long len);
+long sys_exit(long code);
+long sys_yield(void);
+long sys_sleep(unsigned long ns);
+long sys_mmap(unsigned long addr, unsigned long len, unsigned long prot);
+long sys_getpid(void);
+
+#endif
+#endif
@@ -0,0 +1,382 @@
+/**
+ * @file hrtimer.c
+ * @brief High resolution timers on the per-core generic timer.
+ *
+ * Every core has its own timer base: a binary min-heap of pending timers
+ * ordered by expiry, protected by a per-core lock. Adding and cancelling a
+ * timer is O(log n), the earliest timer is always at the root and its expiry
+ * is what the core's generic timer is programmed with. Expired timers run in
+ * the timer interrupt of the core they were added on.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "irq/irq.h"
+#include "mem/cache.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "sync/spinlock.h"
+#include "time/hrtimer.h"
+#include "timer/arch_timer.h"
+
+struct hrtimer_base {
+    spinlock_t lock;
+    unsigned long count;
+    struct hrtimer* running; /* timer whose callback is running right now */
+    struct hrtimer_stats stats;
+    struct hrtimer* heap[HRTIMER_MAX];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct hrtimer_base hrtimer_bases[NR_CPUS];
+static uint64_t counter_frequency;
+
+/**
+ * @brief Reads the counter frequency, must be called once before any timer is used.
+ */
+void hrtimer_init(void)
+{
+    counter_frequency = read_cntfrq();
+}
+
+uint64_t ns_to_ticks(uint64_t ns)
+{
+    return ns / NSEC_PER_SEC * counter_frequency + ns % NSEC_PER_SEC * counter_frequency / NSEC_PER_SEC;
+}
+
+uint64_t ticks_to_ns(uint64_t ticks)
+{
+    return ticks / counter_frequency * NSEC_PER_SEC + ticks % counter_frequency * NSEC_PER_SEC / counter_frequency;
+}
+
+/**
+ * @brief Returns the time since the counter started in nanoseconds.
+ */
+uint64_t ktime_get_ns(void)
+{
+    return ticks_to_ns(read_cntvct());
+}
+
+static void heap_set(struct hrtimer_base* base, unsigned long i, struct hrtimer* timer)
+{
+    base->heap[i] = timer;
+    timer->index = i;
+}
+
+static void heap_sift_up(struct hrtimer_base* base, unsigned long i)
+{
+    struct hrtimer* timer = base->heap[i];
+
+    while (i) {
+        unsigned long parent = (i - 1) / 2;
+        if (base->heap[parent]->expires <= timer->expires) {
+            break;
+        }
+        heap_set(base, i, base->heap[parent]);
+        i = parent;
+    }
+    heap_set(base, i, timer);
+}
+
+static void heap_sift_down(struct hrtimer_base* base, unsigned long i)
+{
+    struct hrtimer* timer = base->heap[i];
+
+    while (1) {
+        unsigned long child = 2 * i + 1;
+        if (child >= base->count) {
+            break;
+        }
+        if (child + 1 < base->count && base->heap[child + 1]->expires < base->heap[child]->expires) {
+            child++;
+        }
+        if (timer->expires <= base->heap[child]->expires) {
+            break;
+        }
+        heap_set(base, i, base->heap[child]);
+        i = child;
+    }
+    heap_set(base, i, timer);
+}
+
+/**
+ * @brief Removes a timer from a heap, base->lock must be held.
+ */
+static void heap_remove(struct hrtimer_base* base, struct hrtimer* timer)
+{
+    unsigned long i = timer->index;
+    struct hrtimer* last = base->heap[--base->count];
+
+    timer->cpu = -1;
+    if (last == timer) {
+        return;
+    }
+    heap_set(base, i, last);
+    if (i && base->heap[(i - 1) / 2]->expires > last->expires) {
+        heap_sift_up(base, i);
+    } else {
+        heap_sift_down(base, i);
+    }
+}
+
+/**
+ * @brief Programs the generic timer of this core for its earliest timer, base->lock must be held.
+ */
+static void hrtimer_reprogram(struct hrtimer_base* base)
+{
+    if (base->count) {
+        arch_timer_set_next(base->heap[0]->expires);
+    } else {
+        arch_timer_stop();
+    }
+}
+
+/**
+ * @brief Locks the base a timer is queued on.
+ *
+ * @return The base, or NULL with nothing locked if the timer is not queued.
+ */
+static struct hrtimer_base* lock_timer_base(struct hrtimer* timer, unsigned long* flags)
+{
+    while (1) {
+        long cpu = __atomic_load_n(&timer->cpu, __ATOMIC_ACQUIRE);
+        if (cpu < 0) {
+            return 0;
+        }
+        struct hrtimer_base* base = &hrtimer_bases[cpu];
+        *flags = spin_lock_irqsave(&base->lock);
+        if (timer->cpu == cpu) {
+            return base;
+        }
+        spin_unlock_irqrestore(&base->lock, *flags);
+    }
+}
+
+/**
+ * @brief Prepares a timer, must be called before it is used the first time.
+ *
+ * @param timer The timer.
+ * @param function Called in interrupt context when the timer expires.
+ * @param data Passed along in timer->data.
+ */
+void hrtimer_setup(struct hrtimer* timer, enum hrtimer_restart (*function)(struct hrtimer*), void* data)
+{
+    timer->expires = 0;
+    timer->function = function;
+    timer->data = data;
+    timer->cpu = -1;
+    timer->index = 0;
+}
+
+/**
+ * @brief Returns non-zero if a timer is queued.
+ */
+int hrtimer_pending(struct hrtimer* timer)
+{
+    return __atomic_load_n(&timer->cpu, __ATOMIC_RELAXED) >= 0;
+}
+
+/**
+ * @brief Queues a timer on the calling core for an absolute time.
+ *
+ * A timer that is already queued is moved. To rearm a timer from its own
+ * callback, use hrtimer_forward() and return HRTIMER_RESTART instead.
+ *
+ * @param timer The timer.
+ * @param expires CNTVCT_EL0 value to expire at.
+ * @return 0 on success, -1 if the base of this core is full.
+ */
+int hrtimer_start(struct hrtimer* timer, uint64_t expires)
+{
+    timer_cancel(timer);
+
+    unsigned long flags = local_irq_save();
+    struct hrtimer_base* base = &hrtimer_bases[smp_processor_id()];
+    spin_lock(&base->lock);
+
+    if (base->count >= HRTIMER_MAX) {
+        spin_unlock(&base->lock);
+        local_irq_restore(flags);
+        return -1;
+    }
+
+    timer->expires = expires;
+    timer->cpu = smp_processor_id();
+    base->heap[base->count] = timer;
+    timer->index = base->count++;
+    heap_sift_up(base, timer->index);
+    if (base->heap[0] == timer) {
+        hrtimer_reprogram(base);
+    }
+
+    spin_unlock(&base->lock);
+    local_irq_restore(flags);
+    return 0;
+}
+
+/**
+ * @brief Queues a timer on the calling core to expire after a delay.
+ *
+ * @param timer The timer.
+ * @param delay_ns Delay in nanoseconds.
+ * @return 0 on success, -1 if the base of this core is full.
+ */
+int timer_add(struct hrtimer* timer, uint64_t delay_ns)
+{
+    return hrtimer_start(timer, read_cntvct() + ns_to_ticks(delay_ns));
+}
+
+/**
+ * @brief Removes a timer from its base.
+ *
+ * Waits for the callback to finish if it is running on another core, so the
+ * timer may be freed afterwards. Must not be called from the callback of the
+ * timer itself.
+ *
+ * @param timer The timer.
+ * @return 1 if the timer was pending, 0 otherwise.
+ */
+int timer_cancel(struct hrtimer* timer)
+{
+    unsigned long flags;
+    int ret = 0;
+
+    struct hrtimer_base* base = lock_timer_base(timer, &flags);
+    if (base) {
+        int was_first = base->heap[0] == timer;
+        heap_remove(base, timer);
+        base->stats.pending = base->count;
+        /* another core's timer cannot be reprogrammed, it takes one spurious interrupt */
+        if (was_first && base == &hrtimer_bases[smp_processor_id()]) {
+            hrtimer_reprogram(base);
+        }
+        spin_unlock_irqrestore(&base->lock, flags);
+        ret = 1;
+    }
+
+    /* callbacks run with interrupts disabled, only other cores can be in one */
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        if (cpu == smp_processor_id()) {
+            continue;
+        }
+        while (__atomic_load_n(&hrtimer_bases[cpu].running, __ATOMIC_ACQUIRE) == timer) { }
+    }
+    return ret;
+}
+
+/**
+ * @brief Moves the expiry of a timer forward by a period.
+ *
+ * Meant for callbacks returning HRTIMER_RESTART. Periods that were missed
+ * are skipped, the timer never expires in the past.
+ *
+ * @param timer The timer.
+ * @param period_ns Period in nanoseconds.
+ */
+void hrtimer_forward(struct hrtimer* timer, uint64_t period_ns)
+{
+    uint64_t period = ns_to_ticks(period_ns);
+    uint64_t now = read_cntvct();
+
+    if (!period) {
+        period = 1;
+    }
+    timer->expires += period;
+    if (timer->expires <= now) {
+        timer->expires += ((now - timer->expires) / period + 1) * period;
+    }
+}
+
+/**
+ * @brief Runs the expired timers of the calling core.
+ *
+ * Called from the generic timer interrupt. Callbacks run with interrupts
+ * disabled.
+ */
+void hrtimer_interrupt(void)
+{
+    unsigned long flags = local_irq_save();
+    struct hrtimer_base* base = &hrtimer_bases[smp_processor_id()];
+    uint64_t start = read_cntvct();
+
+    spin_lock(&base->lock);
+    base->stats.interrupts++;
+    while (base->count && base->heap[0]->expires <= read_cntvct()) {
+        struct hrtimer* timer = base->heap[0];
+        heap_remove(base, timer);
+        __atomic_store_n(&base->running, timer, __ATOMIC_RELAXED);
+        spin_unlock(&base->lock);
+
+        enum hrtimer_restart restart = timer->function(timer);
+
+        spin_lock(&base->lock);
+        if (restart == HRTIMER_RESTART && timer->cpu < 0 && base->count < HRTIMER_MAX) {
+            timer->cpu = smp_processor_id();
+            base->heap[base->count] = timer;
+            timer->index = base->count++;
+            heap_sift_up(base, timer->index);
+        }
+        __atomic_store_n(&base->running, 0, __ATOMIC_RELEASE);
+        base->stats.expired++;
+    }
+    base->stats.pending = base->count;
+    hrtimer_reprogram(base);
+    base->stats.expire_ticks += read_cntvct() - start;
+    spin_unlock(&base->lock);
+    local_irq_restore(flags);
+}
+
+/**
+ * @brief Reports the timer counters of a core.
+ *
+ * @param cpu The core to report.
+ * @param stats Filled with the counters.
+ */
+void hrtimer_get_stats(unsigned int cpu, struct hrtimer_stats* stats)
+{
+    *stats = hrtimer_bases[cpu].stats;
+}
+
+static enum hrtimer_restart sleep_wakeup(struct hrtimer* timer)
+{
+    wake_up_process(timer->data);
+    return HRTIMER_NORESTART;
+}
+
+static enum hrtimer_restart sleep_idle_wakeup(struct hrtimer* timer)
+{
+    *(volatile int*)timer->data = 1;
+    return HRTIMER_NORESTART;
+}
+
+/**
+ * @brief Blocks the current task for at least ns nanoseconds.
+ *
+ * The idle task of a core cannot block, it waits in the idle loop instead.
+ *
+ * @param ns Time to sleep in nanoseconds.
+ */
+void sleep_ns(uint64_t ns)
+{
+    struct hrtimer timer;
+
+    if (is_idle_task(current)) {
+        volatile int expired = 0;
+        hrtimer_setup(&timer, sleep_idle_wakeup, (void*)&expired);
+        if (timer_add(&timer, ns)) {
+            return;
+        }
+        while (!expired) {
+            cpu_idle_enter();
+        }
+        return;
+    }
+
+    hrtimer_setup(&timer, sleep_wakeup, current);
+    current->state = TASK_INTERRUPTIBLE;
+    if (timer_add(&timer, ns)) {
+        current->state = TASK_RUNNING;
+        return;
+    }
+    schedule();
+    timer_cancel(&timer);
+}
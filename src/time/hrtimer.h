@@ -0,0 +1,52 @@
+#ifndef _HRTIMER_H
+#define _HRTIMER_H
+
+#include <stdint.h>
+
+/* pending timers per core */
+#define HRTIMER_MAX 4096
+
+#define NSEC_PER_SEC 1000000000ull
+#define NSEC_PER_USEC 1000ull
+#define NSEC_PER_MSEC 1000000ull
+
+enum hrtimer_restart {
+    HRTIMER_NORESTART,
+    HRTIMER_RESTART, /* the callback moved expires forward, queue it again */
+};
+
+/**
+ * @brief A one-shot timer, run in interrupt context on the core it was added on.
+ */
+struct hrtimer {
+    uint64_t expires; /* CNTVCT_EL0 value */
+    enum hrtimer_restart (*function)(struct hrtimer* timer);
+    void* data;
+    long cpu; /* core whose base holds the timer, -1 if not queued */
+    long index; /* position in the heap of that base */
+};
+
+struct hrtimer_stats {
+    unsigned long pending;
+    unsigned long interrupts;
+    unsigned long expired;
+    unsigned long expire_ticks; /* CNTVCT ticks spent running expired timers */
+};
+
+void hrtimer_init(void);
+void hrtimer_setup(struct hrtimer* timer, enum hrtimer_restart (*function)(struct hrtimer*), void* data);
+int hrtimer_start(struct hrtimer* timer, uint64_t expires);
+int timer_add(struct hrtimer* timer, uint64_t delay_ns);
+int timer_cancel(struct hrtimer* timer);
+void hrtimer_forward(struct hrtimer* timer, uint64_t period_ns);
+int hrtimer_pending(struct hrtimer* timer);
+void hrtimer_interrupt(void);
+void hrtimer_get_stats(unsigned int cpu, struct hrtimer_stats* stats);
+
+void sleep_ns(uint64_t ns);
+
+uint64_t ktime_get_ns(void);
+uint64_t ns_to_ticks(uint64_t ns);
+uint64_t ticks_to_ns(uint64_t ticks);
+
+#endif
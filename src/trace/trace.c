@@ -0,0 +1,118 @@
+/**
+ * @file trace.c
+ * @brief Binary trace buffers for scheduler and interrupt events.
+ *
+ * Tracepoints write fixed-size records into a ring of the calling core,
+ * overwriting the oldest record when it is full, so the buffers always hold
+ * the most recent TRACE_ENTRIES events of every core. Without CONFIG_TRACE
+ * the tracepoints compile to nothing, with it they cost one load and branch
+ * while tracing is stopped.
+ *
+ * trace_dump() prints the buffers as hex lines that scripts/trace2perfetto.py
+ * turns into Chrome/Perfetto trace JSON.
+ */
+#include <stdint.h>
+
+#include "arm/counter.h"
+#include "irq/irq.h"
+#include "mem/cache.h"
+#include "smp/smp.h"
+#include "trace/trace.h"
+
+struct trace_buf {
+    unsigned long head; /* records written, the next one goes to head % TRACE_ENTRIES */
+    struct trace_entry entries[TRACE_ENTRIES];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct trace_buf trace_bufs[NR_CPUS];
+
+volatile int trace_enabled;
+
+#ifdef CONFIG_TRACE
+/**
+ * @brief Records an event in the buffer of the calling core.
+ *
+ * Use trace_event(), which skips the call while tracing is stopped.
+ */
+void __trace_event(unsigned int event, uint32_t arg0, uint64_t arg1, uint64_t arg2)
+{
+    unsigned long flags = local_irq_save();
+    unsigned int cpu = smp_processor_id();
+    struct trace_buf* buf = &trace_bufs[cpu];
+    struct trace_entry* entry = &buf->entries[buf->head++ % TRACE_ENTRIES];
+
+    entry->ts = read_cntvct();
+    entry->event = event;
+    entry->cpu = cpu;
+    entry->arg0 = arg0;
+    entry->arg1 = arg1;
+    entry->arg2 = arg2;
+    local_irq_restore(flags);
+}
+#endif
+
+/**
+ * @brief Clears the buffers and starts recording.
+ */
+void trace_start(void)
+{
+    trace_enabled = 0;
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        trace_bufs[cpu].head = 0;
+    }
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Stops recording, the buffers keep their contents.
+ */
+void trace_stop(void)
+{
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+}
+
+static void trace_put_hex(void (*putc)(unsigned char c), const uint8_t* bytes, unsigned int n)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (unsigned int i = 0; i < n; i++) {
+        putc(digits[bytes[i] >> 4]);
+        putc(digits[bytes[i] & 0xf]);
+    }
+}
+
+static void trace_put_string(void (*putc)(unsigned char c), const char* s)
+{
+    while (*s) {
+        putc(*s++);
+    }
+}
+
+/**
+ * @brief Prints the buffers of all cores, tracing must be stopped.
+ *
+ * The output is a "TRACE_FREQ <hex>" line with the counter frequency and a
+ * "TRACE <hex>" line per record holding the raw little-endian struct
+ * trace_entry, oldest record of every core first.
+ *
+ * @param putc Where to print, usually uart_putc.
+ */
+void trace_dump(void (*putc)(unsigned char c))
+{
+    uint64_t frq = read_cntfrq();
+
+    trace_put_string(putc, "TRACE_FREQ ");
+    trace_put_hex(putc, (const uint8_t*)&frq, sizeof(frq));
+    putc('\n');
+
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct trace_buf* buf = &trace_bufs[cpu];
+        unsigned long start = buf->head > TRACE_ENTRIES ? buf->head - TRACE_ENTRIES : 0;
+
+        for (unsigned long i = start; i < buf->head; i++) {
+            trace_put_string(putc, "TRACE ");
+            trace_put_hex(putc, (const uint8_t*)&buf->entries[i % TRACE_ENTRIES], sizeof(struct trace_entry));
+            putc('\n');
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+/* records kept per core, a power of two */
+#define TRACE_ENTRIES 2048
+
+enum trace_event_id {
+    TRACE_SCHED_SWITCH = 1, /* arg0 prev pid, arg1 next pid, arg2 prev state */
+    TRACE_SCHED_WAKEUP = 2, /* arg0 pid, arg1 target core */
+    TRACE_IRQ_ENTRY = 3, /* arg0 interrupt id */
+    TRACE_IRQ_EXIT = 4, /* arg0 interrupt id */
+    TRACE_TASK_NEW = 5, /* arg0 pid, arg1 parent pid */
+    TRACE_TASK_EXIT = 6, /* arg0 pid, arg1 exit code */
+};
+
+/**
+ * @brief A trace record, 32 bytes, dumped as is for the host decoder.
+ */
+struct trace_entry {
+    uint64_t ts; /* CNTVCT_EL0 */
+    uint16_t event;
+    uint16_t cpu;
+    uint32_t arg0;
+    uint64_t arg1;
+    uint64_t arg2;
+};
+
+#ifdef CONFIG_TRACE
+extern volatile int trace_enabled;
+
+void __trace_event(unsigned int event, uint32_t arg0, uint64_t arg1, uint64_t arg2);
+
+/* a single load and branch while tracing is stopped */
+#define trace_event(event, arg0, arg1, arg2)                          \
+    do {                                                              \
+        if (__builtin_expect(trace_enabled, 0)) {                     \
+            __trace_event((event), (arg0), (arg1), (arg2));           \
+        }                                                             \
+    } while (0)
+#else
+#define trace_event(event, arg0, arg1, arg2) \
+    do {                                     \
+        (void)(arg0);                        \
+        (void)(arg1);                        \
+        (void)(arg2);                        \
+    } while (0)
+#endif
+
+void trace_start(void);
+void trace_stop(void);
+void trace_dump(void (*putc)(unsigned char c));
+
+#endif
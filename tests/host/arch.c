@@ -0,0 +1,233 @@
+/**
+ * @file arch.c
+ * @brief Stub arch layer the host build links mem.c and scheduler.c against.
+ *
+ * Interrupt masking and spinlocks only keep track of their state, so that
+ * the fuzzers catch a lock taken twice, one that is never released or an
+ * interrupt state that is not restored. cpu_switch_to() does not switch
+ * stacks, it returns at once as if next had been switched to and switched
+ * back right away, which is all that the run queue logic can observe.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arm/counter.h"
+#include "host/arch.h"
+#include "irq/irq.h"
+#include "mem/mem.h"
+#include "mem/mm.h"
+#include "scheduler/fork.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+#include "sync/spinlock.h"
+#include "time/hrtimer.h"
+
+unsigned int host_cpu;
+struct task_struct* host_current[NR_CPUS];
+uint64_t host_cntvct;
+
+struct mm_struct init_mm;
+
+/* interrupts are masked on the core, 1 while booting like on the target */
+static int irqs_masked[NR_CPUS] = { [0 ... NR_CPUS - 1] = 1 };
+/* spinlocks held by each core */
+static int locks_held[NR_CPUS];
+
+static struct host_arch_stats host_stats;
+
+static void host_fail(const char* what)
+{
+    fprintf(stderr, "host arch: %s on cpu %u\n", what, host_cpu);
+    abort();
+}
+
+/**
+ * @brief Maps the physical memory the page allocator hands out at its own address.
+ *
+ * Backed lazily, only the pages that are written to take host memory.
+ */
+static void host_map_memory(void)
+{
+    void* base = mmap((void*)LOW_MEMORY, PAGING_MEMORY, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if (base != (void*)LOW_MEMORY) {
+        perror("host arch: mapping the physical memory");
+        exit(1);
+    }
+}
+
+/**
+ * @brief Sets up the memory, must be called before mem_init().
+ */
+void host_arch_init(void)
+{
+    host_map_memory();
+}
+
+/**
+ * @brief Continues as the given core.
+ *
+ * The core that is left must not hold any locks or have interrupts masked
+ * by a local_irq_save() that is still open.
+ */
+void host_set_cpu(unsigned int cpu)
+{
+    if (locks_held[host_cpu]) {
+        host_fail("switching cores with a spinlock held");
+    }
+    host_cpu = cpu;
+}
+
+/**
+ * @brief Fails unless the current core is back at its starting state.
+ *
+ * Called by the fuzzers between operations, where nothing may be held.
+ */
+void host_check_idle(void)
+{
+    if (locks_held[host_cpu]) {
+        host_fail("spinlock held after an operation");
+    }
+}
+
+void host_arch_get_stats(struct host_arch_stats* stats)
+{
+    *stats = host_stats;
+}
+
+void enable_irqs(void)
+{
+    irqs_masked[host_cpu] = 0;
+}
+
+void disable_irqs(void)
+{
+    irqs_masked[host_cpu] = 1;
+}
+
+unsigned long local_irq_save(void)
+{
+    unsigned long flags = irqs_masked[host_cpu];
+
+    host_stats.irq_saves++;
+    irqs_masked[host_cpu] = 1;
+    return flags;
+}
+
+void local_irq_restore(unsigned long flags)
+{
+    if (!irqs_masked[host_cpu]) {
+        host_fail("local_irq_restore() with interrupts enabled");
+    }
+    irqs_masked[host_cpu] = flags;
+}
+
+void spin_lock(spinlock_t* lock)
+{
+    if (lock->locked) {
+        host_fail("spinlock taken twice");
+    }
+    lock->locked = 1;
+    locks_held[host_cpu]++;
+}
+
+void spin_unlock(spinlock_t* lock)
+{
+    if (!lock->locked || !locks_held[host_cpu]) {
+        host_fail("spinlock released that is not held");
+    }
+    lock->locked = 0;
+    locks_held[host_cpu]--;
+}
+
+int spin_trylock(spinlock_t* lock)
+{
+    if (lock->locked) {
+        return 0;
+    }
+    spin_lock(lock);
+    return 1;
+}
+
+unsigned long spin_lock_irqsave(spinlock_t* lock)
+{
+    unsigned long flags = local_irq_save();
+
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t* lock, unsigned long flags)
+{
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
+
+void clear_page(void* page)
+{
+    memset(page, 0, PAGE_SIZE);
+}
+
+struct task_struct* cpu_switch_to(struct task_struct* prev, struct task_struct* next)
+{
+    (void)next;
+    if (locks_held[host_cpu]) {
+        host_fail("context switch with a spinlock held");
+    }
+    host_stats.switches++;
+    return prev;
+}
+
+void fpsimd_thread_switch(struct task_struct* prev)
+{
+    (void)prev;
+}
+
+void switch_mm(struct mm_struct* mm)
+{
+    (void)mm;
+}
+
+void release_task(struct task_struct* p)
+{
+    (void)p;
+}
+
+unsigned long smp_online_mask(void)
+{
+    return (1ul << NR_CPUS) - 1;
+}
+
+void smp_send_ipi(unsigned long cpu_mask, unsigned int ipi)
+{
+    (void)cpu_mask;
+    (void)ipi;
+    host_stats.ipis++;
+}
+
+/* the fuzzers call timer_tick() themselves */
+void hrtimer_setup(struct hrtimer* timer, enum hrtimer_restart (*function)(struct hrtimer*), void* data)
+{
+    timer->function = function;
+    timer->data = data;
+    timer->cpu = -1;
+}
+
+int hrtimer_start(struct hrtimer* timer, uint64_t expires)
+{
+    timer->expires = expires;
+    return 0;
+}
+
+void hrtimer_forward(struct hrtimer* timer, uint64_t period_ns)
+{
+    timer->expires += period_ns;
+}
+
+uint64_t ns_to_ticks(uint64_t ns)
+{
+    return ns * 54 / 1000;
+}
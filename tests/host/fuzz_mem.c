@@ -0,0 +1,196 @@
+/**
+ * @file fuzz_mem.c
+ * @brief Random alloc/free sequences against the page allocator.
+ *
+ * Every operation runs on a random core, so the per-CPU caches and zeroed
+ * pools fill and drain against each other. Blocks of every order are taken
+ * with alloc_pages(), get_free_page() and get_zeroed_page() and given back
+ * in random order. Each block handed out is checked for alignment, range
+ * and overlap with the blocks still held, pages from get_zeroed_page() for
+ * content. Every FUZZ_MEM_CHECK_EVERY operations mem_check() walks the
+ * buddy bitmaps and the free page count has to add up.
+ *
+ * Usage: fuzz_mem [seed] [operations]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "host/arch.h"
+#include "mem/mem.h"
+#include "smp/smp.h"
+
+#define FUZZ_MEM_MAX_HELD 4096
+#define FUZZ_MEM_CHECK_EVERY 4096
+#define FUZZ_MEM_SCRIBBLE 0xdeadbeefdeadbeefull
+
+struct fuzz_block {
+    unsigned long p;
+    unsigned int order;
+};
+
+static struct fuzz_block held[FUZZ_MEM_MAX_HELD];
+static unsigned long nr_held;
+static unsigned long held_pages;
+/* bit n is set while the fuzzer holds page n */
+static uint64_t owned[PAGING_PAGES / 64 + 1];
+
+static uint64_t fuzz_seed;
+static unsigned long fuzz_op;
+
+static uint32_t fuzz_random(void)
+{
+    fuzz_seed ^= fuzz_seed << 13;
+    fuzz_seed ^= fuzz_seed >> 7;
+    fuzz_seed ^= fuzz_seed << 17;
+    return fuzz_seed >> 32;
+}
+
+static void fuzz_fail(const char* what, unsigned long p)
+{
+    fprintf(stderr, "fuzz_mem: %s, page %lx, operation %lu, cpu %u\n", what, p, fuzz_op, host_cpu);
+    exit(1);
+}
+
+static unsigned long fuzz_free_pages(void)
+{
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    return stats.free_pages + stats.cached_pages;
+}
+
+/**
+ * @brief Takes ownership of a block that was handed out.
+ */
+static void fuzz_take(unsigned long p, unsigned int order)
+{
+    unsigned long first = (p - LOW_MEMORY) >> PAGE_SHIFT;
+
+    if (p < LOW_MEMORY || p + ((unsigned long)PAGE_SIZE << order) > HIGH_MEMORY) {
+        fuzz_fail("block out of range", p);
+    }
+    if (first & ((1ul << order) - 1)) {
+        fuzz_fail("block not aligned to its order", p);
+    }
+    for (unsigned long page = first; page < first + (1ul << order); page++) {
+        if (owned[page / 64] & (1ull << (page % 64))) {
+            fuzz_fail("page handed out twice", LOW_MEMORY + (page << PAGE_SHIFT));
+        }
+        owned[page / 64] |= 1ull << (page % 64);
+    }
+
+    held[nr_held++] = (struct fuzz_block) { p, order };
+    held_pages += 1ul << order;
+}
+
+/**
+ * @brief Gives back held[i].
+ */
+static void fuzz_release(unsigned long i)
+{
+    struct fuzz_block block = held[i];
+    unsigned long first = (block.p - LOW_MEMORY) >> PAGE_SHIFT;
+
+    for (unsigned long page = first; page < first + (1ul << block.order); page++) {
+        owned[page / 64] &= ~(1ull << (page % 64));
+    }
+    held[i] = held[--nr_held];
+    held_pages -= 1ul << block.order;
+
+    /* a page that comes back dirty must not end up in a zeroed pool */
+    *(volatile uint64_t*)block.p = FUZZ_MEM_SCRIBBLE;
+    if (block.order == 0 && fuzz_random() & 1) {
+        free_page(block.p);
+    } else {
+        free_pages(block.p, block.order);
+    }
+}
+
+static void fuzz_get_zeroed(void)
+{
+    unsigned long p = get_zeroed_page();
+
+    if (!p) {
+        return;
+    }
+    for (unsigned long w = 0; w < PAGE_SIZE / sizeof(uint64_t); w++) {
+        if (((const uint64_t*)p)[w]) {
+            fuzz_fail("get_zeroed_page() returned a dirty page", p);
+        }
+    }
+    fuzz_take(p, 0);
+}
+
+static void fuzz_alloc(void)
+{
+    /* mostly small orders, like the kernel asks for */
+    unsigned int order = __builtin_ctz(fuzz_random() | (1u << (MAX_ORDER - 1)));
+    unsigned long p = alloc_pages(order);
+
+    if (p) {
+        fuzz_take(p, order);
+    }
+}
+
+static void fuzz_check(unsigned long expected_free)
+{
+    unsigned long errors = mem_check();
+
+    if (errors) {
+        fprintf(stderr, "fuzz_mem: mem_check() found %lu errors\n", errors);
+        fuzz_fail("allocator state broken", 0);
+    }
+    if (fuzz_free_pages() + held_pages != expected_free) {
+        fprintf(stderr, "fuzz_mem: %lu free and %lu held pages, expected %lu\n", fuzz_free_pages(), held_pages, expected_free);
+        fuzz_fail("pages lost", 0);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    fuzz_seed = argc > 1 ? strtoull(argv[1], NULL, 0) : 1;
+    unsigned long ops = argc > 2 ? strtoul(argv[2], NULL, 0) : 10000000;
+    fuzz_seed = fuzz_seed ? fuzz_seed : 1;
+
+    host_arch_init();
+    mem_init();
+    unsigned long expected_free = fuzz_free_pages();
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (fuzz_op = 0; fuzz_op < ops; fuzz_op++) {
+        host_set_cpu(fuzz_random() % NR_CPUS);
+
+        unsigned int r = fuzz_random() % 16;
+        if (nr_held == FUZZ_MEM_MAX_HELD || (r >= 9 && nr_held)) {
+            fuzz_release(fuzz_random() % nr_held);
+        } else if (r < 3) {
+            fuzz_alloc();
+        } else if (r < 6) {
+            unsigned long p = get_free_page();
+            if (p) {
+                fuzz_take(p, 0);
+            }
+        } else if (r < 8) {
+            fuzz_get_zeroed();
+        } else {
+            mem_refill_zeroed();
+        }
+        host_check_idle();
+
+        if (fuzz_op % FUZZ_MEM_CHECK_EVERY == 0) {
+            fuzz_check(expected_free);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    while (nr_held) {
+        fuzz_release(nr_held - 1);
+    }
+    fuzz_check(expected_free);
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("fuzz_mem: %lu operations, %.0f per second, seed %s\n", ops, ops / secs, argc > 1 ? argv[1] : "1");
+    return 0;
+}
@@ -0,0 +1,293 @@
+/**
+ * @file fuzz_sched.c
+ * @brief Randomized scheduler runs checked for run queue invariants and fairness.
+ *
+ * Ticks are delivered by calling timer_tick() and preempt_schedule_irq()
+ * like the tick interrupt does, a core running its idle task calls
+ * schedule() like cpu_idle_enter(). Tasks are plain task_structs, blocking
+ * means setting the state and calling schedule() like sleep_ns().
+ *
+ * The fairness phases run CPU-bound tasks of the same priority, first all on
+ * core 0 and then spread over all cores. Round robin within a level means
+ * no task waits more than (tasks - 1) * prio ticks of its core and, on a
+ * single core, run times differ by at most one time slice.
+ *
+ * The random phase spawns tasks of mixed priorities on random cores, blocks,
+ * wakes, yields and ticks them. After every operation each task has to be
+ * running on exactly one core, queued, or blocked and nowhere, the queue
+ * lengths have to add up and no lock may be left held.
+ *
+ * Usage: fuzz_sched [seed] [operations]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host/arch.h"
+#include "irq/irq.h"
+#include "mem/mm.h"
+#include "scheduler/scheduler.h"
+#include "smp/smp.h"
+
+#define FUZZ_SCHED_MAX_TASKS 256
+#define FUZZ_SCHED_FAIR_TASKS 12
+#define FUZZ_SCHED_FAIR_PRIO 3
+#define FUZZ_SCHED_FAIR_TICKS 100000
+
+static struct task_struct tasks[FUZZ_SCHED_MAX_TASKS];
+static unsigned long nr_tasks;
+/* fuzzer's view of each task */
+static unsigned long runtime[FUZZ_SCHED_MAX_TASKS];
+static unsigned long waiting[FUZZ_SCHED_MAX_TASKS];
+static int blocked[FUZZ_SCHED_MAX_TASKS];
+
+static uint64_t fuzz_seed;
+static unsigned long fuzz_op;
+
+static uint32_t fuzz_random(void)
+{
+    fuzz_seed ^= fuzz_seed << 13;
+    fuzz_seed ^= fuzz_seed >> 7;
+    fuzz_seed ^= fuzz_seed << 17;
+    return fuzz_seed >> 32;
+}
+
+static void fuzz_fail(const char* what, struct task_struct* p)
+{
+    fprintf(stderr, "fuzz_sched: %s, pid %ld, operation %lu, cpu %u\n", what, p ? p->pid : -1, fuzz_op, host_cpu);
+    exit(1);
+}
+
+static struct task_struct* fuzz_spawn(long prio)
+{
+    struct task_struct* p = &tasks[nr_tasks];
+
+    memset(p, 0, sizeof(*p));
+    p->pid = ++nr_tasks;
+    p->prio = prio;
+    p->counter = prio;
+    p->state = TASK_RUNNING;
+    /* like copy_task(), schedule_tail() drops it once the task runs */
+    p->preempt_count = 1;
+    p->mm = &init_mm;
+    wake_up_new_task(p);
+    return p;
+}
+
+/**
+ * @brief Delivers a scheduler tick to the current core, returns the task it ran.
+ */
+static struct task_struct* fuzz_tick(void)
+{
+    struct task_struct* p = current;
+
+    if (is_idle_task(p)) {
+        schedule();
+        return NULL;
+    }
+
+    runtime[p - tasks]++;
+    disable_irqs();
+    timer_tick();
+    preempt_schedule_irq();
+    enable_irqs();
+    return p;
+}
+
+static void fuzz_block(void)
+{
+    struct task_struct* p = current;
+
+    if (is_idle_task(p)) {
+        return;
+    }
+    blocked[p - tasks] = 1;
+    p->state = TASK_INTERRUPTIBLE;
+    schedule();
+}
+
+static void fuzz_wake(struct task_struct* p)
+{
+    blocked[p - tasks] = 0;
+    wake_up_process(p);
+}
+
+/**
+ * @brief Checks where every task is against the run queues.
+ */
+static void fuzz_check(void)
+{
+    struct task_struct* running[NR_CPUS];
+    unsigned long queued = 0;
+    unsigned long nr_running = 0;
+    unsigned int cpu = host_cpu;
+
+    for (unsigned int c = 0; c < NR_CPUS; c++) {
+        struct sched_stats stats;
+
+        host_set_cpu(c);
+        host_check_idle();
+        running[c] = current;
+        sched_get_stats(c, &stats);
+        nr_running += stats.nr_running;
+
+        struct task_struct* p = running[c];
+        if (is_idle_task(p)) {
+            continue;
+        }
+        if (p->state != TASK_RUNNING || !p->on_rq || !p->on_cpu || p->cpu != c) {
+            fuzz_fail("running task in the wrong state", p);
+        }
+        if (p->preempt_count) {
+            fuzz_fail("running task with preemption disabled", p);
+        }
+        for (unsigned int other = 0; other < c; other++) {
+            if (running[other] == p) {
+                fuzz_fail("task running on two cores", p);
+            }
+        }
+    }
+    host_set_cpu(cpu);
+
+    for (unsigned long i = 0; i < nr_tasks; i++) {
+        struct task_struct* p = &tasks[i];
+        int on_core = 0;
+
+        for (unsigned int c = 0; c < NR_CPUS; c++) {
+            on_core |= running[c] == p;
+        }
+        if (blocked[i]) {
+            if (p->state == TASK_RUNNING || p->on_rq || p->on_cpu || on_core) {
+                fuzz_fail("blocked task is runnable", p);
+            }
+        } else if (!on_core) {
+            if (p->state != TASK_RUNNING || !p->on_rq || p->on_cpu || p->preempt_count != 1) {
+                fuzz_fail("waiting task in the wrong state", p);
+            }
+            queued++;
+        }
+    }
+    if (queued != nr_running) {
+        fprintf(stderr, "fuzz_sched: %lu tasks waiting, run queues hold %lu\n", queued, nr_running);
+        fuzz_fail("run queue lengths do not add up", NULL);
+    }
+}
+
+/**
+ * @brief Runs a fairness phase, n tasks ticked round robin on the cores in mask.
+ */
+static void fuzz_fair(unsigned long n, unsigned long mask)
+{
+    unsigned long first = nr_tasks;
+    unsigned long bound = (n - 1) * FUZZ_SCHED_FAIR_PRIO;
+    unsigned long min = ~0ul, max = 0;
+
+    sched_set_cpu_mask(mask);
+    for (unsigned long i = 0; i < n; i++) {
+        fuzz_spawn(FUZZ_SCHED_FAIR_PRIO);
+    }
+
+    for (fuzz_op = 0; fuzz_op < FUZZ_SCHED_FAIR_TICKS; fuzz_op++) {
+        unsigned int cpu = fuzz_op % NR_CPUS;
+        if (!(mask & (1ul << cpu))) {
+            continue;
+        }
+        host_set_cpu(cpu);
+        struct task_struct* ran = fuzz_tick();
+
+        for (unsigned long i = first; i < nr_tasks; i++) {
+            struct task_struct* p = &tasks[i];
+            if (p == ran || p->on_cpu) {
+                waiting[i] = 0;
+            } else if (p->cpu == cpu && ++waiting[i] > bound) {
+                fuzz_fail("task starved", p);
+            }
+        }
+        fuzz_check();
+    }
+
+    for (unsigned long i = first; i < nr_tasks; i++) {
+        min = runtime[i] < min ? runtime[i] : min;
+        max = runtime[i] > max ? runtime[i] : max;
+    }
+    if (mask == 1 && max - min > FUZZ_SCHED_FAIR_PRIO) {
+        fprintf(stderr, "fuzz_sched: run times between %lu and %lu ticks\n", min, max);
+        fuzz_fail("unfair share on a single core", NULL);
+    }
+    printf("fuzz_sched: %lu tasks on cores %lx, run times %lu..%lu ticks\n", n, mask, min, max);
+
+    /* block them all, core 0 picks up and blocks whatever is still queued */
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        host_set_cpu(cpu);
+        while (!is_idle_task(current)) {
+            fuzz_block();
+        }
+    }
+    fuzz_check();
+    sched_set_cpu_mask(~0ul);
+}
+
+/**
+ * @brief Random operations on random cores, checked after each one.
+ */
+static void fuzz_random_ops(unsigned long ops)
+{
+    for (fuzz_op = 0; fuzz_op < ops; fuzz_op++) {
+        host_set_cpu(fuzz_random() % NR_CPUS);
+
+        unsigned int r = fuzz_random() % 16;
+        if (r < 1 && nr_tasks < FUZZ_SCHED_MAX_TASKS) {
+            fuzz_spawn(fuzz_random() % 8);
+        } else if (r < 9) {
+            fuzz_tick();
+        } else if (r < 11) {
+            fuzz_block();
+        } else if (r < 14) {
+            struct task_struct* p = &tasks[fuzz_random() % nr_tasks];
+            /* waking a task that is not blocked must do nothing */
+            if (blocked[p - tasks] || r == 13) {
+                fuzz_wake(p);
+            }
+        } else if (!is_idle_task(current)) {
+            schedule();
+        }
+        fuzz_check();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    fuzz_seed = argc > 1 ? strtoull(argv[1], NULL, 0) : 1;
+    unsigned long ops = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+    fuzz_seed = fuzz_seed ? fuzz_seed : 1;
+
+    host_arch_init();
+    sched_init();
+    for (unsigned int cpu = 0; cpu < NR_CPUS; cpu++) {
+        host_set_cpu(cpu);
+        if (cpu) {
+            sched_init_secondary(cpu);
+        }
+        enable_irqs();
+    }
+    host_set_cpu(0);
+
+    fuzz_fair(FUZZ_SCHED_FAIR_TASKS, 1);
+    fuzz_fair(FUZZ_SCHED_FAIR_TASKS, smp_online_mask());
+
+    /* the random phase brings its own tasks */
+    unsigned long parked = nr_tasks;
+    memset(runtime, 0, sizeof(runtime));
+    fuzz_spawn(1);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fuzz_random_ops(ops);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("fuzz_sched: %lu operations on %lu tasks, %.0f per second, seed %s\n", ops, nr_tasks - parked, ops / secs, argc > 1 ? argv[1] : "1");
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef HOST_COUNTER_H
+#define HOST_COUNTER_H
+
+/* a counter that only moves when it is read, at a nominal 54MHz */
+#define read_cntvct arch_read_cntvct
+#define read_cntfrq arch_read_cntfrq
+#include_next "arm/counter.h"
+#undef read_cntvct
+#undef read_cntfrq
+
+extern uint64_t host_cntvct;
+
+static inline uint64_t read_cntvct(void)
+{
+    return host_cntvct++;
+}
+
+static inline uint64_t read_cntfrq(void)
+{
+    return 54000000;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef HOST_ARCH_H
+#define HOST_ARCH_H
+
+/*
+ * Arch layer of the host build, in place of TPIDR_EL1 and cpu_switch_to().
+ * Included ahead of every file, see xmake.lua, the kernel headers do not
+ * know about it.
+ *
+ * The fuzzers run single threaded and play all cores in turn: host_cpu is
+ * the core that is executing, set it with host_set_cpu() before calling into
+ * the kernel code for that core.
+ */
+
+struct task_struct;
+
+/* only there so task_struct has the same shape, nothing is switched */
+struct cpu_context {
+    unsigned long x19;
+    unsigned long x20;
+    unsigned long x21;
+    unsigned long x22;
+    unsigned long x23;
+    unsigned long x24;
+    unsigned long x25;
+    unsigned long x26;
+    unsigned long x27;
+    unsigned long x28;
+    unsigned long fp;
+    unsigned long sp;
+    unsigned long pc;
+};
+
+extern unsigned int host_cpu;
+extern struct task_struct* host_current[];
+
+static inline struct task_struct* get_current(void)
+{
+    return host_current[host_cpu];
+}
+
+static inline void set_current(struct task_struct* task)
+{
+    host_current[host_cpu] = task;
+}
+
+#define current get_current()
+
+void host_set_cpu(unsigned int cpu);
+void host_arch_init(void);
+void host_check_idle(void);
+
+/* context switch, interrupt and IPI counters of the stub arch layer */
+struct host_arch_stats {
+    unsigned long switches;
+    unsigned long ipis;
+    unsigned long irq_saves;
+};
+
+void host_arch_get_stats(struct host_arch_stats* stats);
+
+void fpsimd_thread_switch(struct task_struct* prev);
+
+#endif
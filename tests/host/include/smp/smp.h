@@ -0,0 +1,23 @@
+#ifndef HOST_SMP_H
+#define HOST_SMP_H
+
+/* the core number comes from host_cpu instead of MPIDR_EL1 */
+#define smp_processor_id arch_smp_processor_id
+#define cpu_wfi arch_cpu_wfi
+#include_next "smp/smp.h"
+#undef smp_processor_id
+#undef cpu_wfi
+
+extern unsigned int host_cpu;
+
+static inline unsigned int smp_processor_id(void)
+{
+    return host_cpu;
+}
+
+/* nothing can wake the core, the fuzzers never let it sleep */
+static inline void cpu_wfi(void)
+{
+}
+
+#endif
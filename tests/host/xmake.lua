@@ -0,0 +1,29 @@
+-- The page allocator and the scheduler built for the build machine, against
+-- the stub arch layer in arch.c, so their logic can be fuzzed natively.
+-- Run with `xmake run fuzz_mem [seed] [operations]`, same for fuzz_sched.
+local function host_fuzzer(name)
+    target(name)
+        set_kind("binary")
+        set_default(false)
+        set_plat(os.host())
+        set_arch(os.arch())
+        set_toolchains("gcc")
+
+        add_files(name .. ".c",
+        "arch.c",
+        "../../arch/aarch64/mem/mem.c",
+        "../../src/scheduler/scheduler.c")
+
+        -- include comes first, its headers shadow the arch headers that use asm
+        add_includedirs("include",
+        "../../src",
+        "../../arch/aarch64")
+        -- cpu_context and current, which scheduler.h only has for aarch64
+        add_forceincludes("host/arch.h")
+
+        add_cflags("-Wall", "-Wextra")
+    target_end()
+end
+
+host_fuzzer("fuzz_mem")
+host_fuzzer("fuzz_sched")
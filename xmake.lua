@@ -17,17 +17,42 @@ rule("mode.debug")
         target:add("cflags", "-O0")
     end)
 
--- define the kernel target
-target("kernel8.elf")
+option("bench")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Run the boot-time benchmarks")
+    add_defines("CONFIG_BENCH")
+option_end()
+
+option("trace")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Compile in the scheduler and interrupt tracepoints")
+    add_defines("CONFIG_TRACE")
+option_end()
+
+option("perf")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Compile in the PMU perf region markers")
+    add_defines("CONFIG_PERF")
+option_end()
+
+-- sources and flags shared by the kernel images
+local function kernel_common()
     set_kind("binary")
 
-    add_files("src/**/*.c",
-    "src/**/*.S",
+    -- the FP/SIMD registers are switched lazily and may hold the live state
+    -- of the interrupted task, so C code must not use them
+    add_files("src/**/*.c|bench/bench_fpsimd.c",
     "arch/aarch64/**/*.c",
+    "arch/aarch64/*.c",
+    "external/printk/*.c", {cflags = "-mgeneral-regs-only"})
+    -- fills the registers from asm to check they survive task switches
+    add_files("src/bench/bench_fpsimd.c")
+    add_files("src/**/*.S",
     "arch/aarch64/**/*.S",
-    "arch/aarch64/*.S",
-    "arch/aarch64/*.c")
-    add_files("external/printk/*.c")
+    "arch/aarch64/*.S")
     add_files("linker8.ld")
 
     add_includedirs("src",
@@ -36,6 +61,20 @@ target("kernel8.elf")
 
     add_cflags("-ffreestanding", {force = true})
     add_cflags("-Wall", "-Wextra")
+end
+
+-- define the kernel target
+target("kernel8.elf")
+    kernel_common()
+    add_options("bench", "trace", "perf")
+
+-- the benchmarks only, exits QEMU when done, see scripts/kbench.py
+target("kbench")
+    kernel_common()
+    set_filename("kbench.elf")
+    set_default(false)
+    add_options("trace", "perf")
+    add_defines("CONFIG_BENCH", "CONFIG_KBENCH", "CONFIG_SEMIHOSTING")
 
 target("u-boot")
     set_kind("phony")
@@ -48,3 +87,5 @@ target("u-boot")
     on_clean(function (target)
         os.exec("make -C external/u-boot clean")
     end)
+
+includes("tests/host")